@@ -0,0 +1,502 @@
+// Compile-throughput benchmark
+//
+// Generates synthetic programs of increasing size, each stressing one part of the compiler,
+// compiles them with "--stats-json" and reports wall time, time of each phase and memory usage.
+// Only the standard library is used, so the benchmark itself can be built on any platform:
+//
+//   g++ -std=c++17 -O2 Benchmark/Benchmark.cpp -o benchmark
+//   ./benchmark --compiler "wine c-like-to-x86.exe" --sizes 100,1000,5000
+//
+// The compiler is started as external process, on Linux it can be run through Wine.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Max. number of statements in one generated function, larger functions
+/// would exceed 8-bit stack offsets used by the compiler
+/// </summary>
+static const uint32_t ChunkSize = 8;
+
+enum struct BenchmarkShape {
+    Functions,      // Many small functions called from entry point
+    Nesting,        // Deeply nested expression
+    Switch,         // One switch statement with many cases
+    Temporaries,    // Many expressions that need temporary variables
+    Strings,        // Long table of unique string literals
+    Includes,       // Many included files
+
+    Count
+};
+
+struct BenchmarkResult {
+    BenchmarkShape shape;
+    uint32_t size;
+    uint64_t source_bytes;
+
+    int exit_code;
+    double wall_ms;
+
+    std::map<std::string, double> phases;   // Time of each phase in ms
+    uint64_t peak_working_set;
+    uint64_t code_size;
+};
+
+static const char* ShapeToString(BenchmarkShape shape)
+{
+    switch (shape) {
+        case BenchmarkShape::Functions: return "functions";
+        case BenchmarkShape::Nesting: return "nesting";
+        case BenchmarkShape::Switch: return "switch";
+        case BenchmarkShape::Temporaries: return "temporaries";
+        case BenchmarkShape::Strings: return "strings";
+        case BenchmarkShape::Includes: return "includes";
+
+        default: return "-";
+    }
+}
+
+/// <summary>
+/// Split statements into functions with limited size, entry point calls all of them
+/// </summary>
+static void WriteChunkedProgram(std::ostream& out, const std::vector<std::string>& statements, const char* prologue)
+{
+    uint32_t chunk_count = 0;
+    for (size_t i = 0; i < statements.size(); i += ChunkSize) {
+        out << "void chunk" << chunk_count << "() {\n";
+        out << prologue;
+
+        size_t end = std::min(statements.size(), i + ChunkSize);
+        for (size_t j = i; j < end; j++) {
+            out << "    " << statements[j] << "\n";
+        }
+
+        out << "    return;\n}\n\n";
+        chunk_count++;
+    }
+
+    out << "uint8 Main() {\n";
+    for (uint32_t i = 0; i < chunk_count; i++) {
+        out << "    chunk" << i << "();\n";
+    }
+    out << "    return 0;\n}\n";
+}
+
+static void GenerateFunctions(std::ostream& out, uint32_t size)
+{
+    out << "static uint32 sum;\n\n";
+
+    for (uint32_t i = 0; i < size; i++) {
+        out << "uint32 f" << i << "(uint32 a, uint32 b) {\n";
+        out << "    if (a > b) {\n";
+        out << "        return a - b + " << i << ";\n";
+        out << "    }\n";
+        out << "    return b - a + " << (i % 97) << ";\n";
+        out << "}\n\n";
+    }
+
+    std::vector<std::string> statements;
+    for (uint32_t i = 0; i < size; i++) {
+        statements.push_back("sum = f" + std::to_string(i) + "(sum, " + std::to_string(i) + ");");
+    }
+
+    WriteChunkedProgram(out, statements, "");
+}
+
+static void GenerateNesting(std::ostream& out, uint32_t size)
+{
+    static const char* operators[] = { " + ", " * ", " - ", " / ", " % ", " << ", " >> " };
+
+    std::string expression = "x";
+    for (uint32_t i = 0; i < size; i++) {
+        expression = "(" + expression + operators[i % 7] + std::to_string(i % 7 + 1) + ")";
+    }
+
+    out << "uint8 Main() {\n";
+    out << "    uint32 x = 1;\n";
+    out << "    x = " << expression << ";\n";
+    out << "    PrintUint32(x);\n";
+    out << "    return 0;\n}\n";
+}
+
+static void GenerateSwitch(std::ostream& out, uint32_t size)
+{
+    out << "uint8 Main() {\n";
+    out << "    uint32 x = ReadUint32();\n";
+    out << "    uint32 y = 0;\n";
+    out << "    switch (x) {\n";
+
+    for (uint32_t i = 0; i < size; i++) {
+        out << "    case " << i << ": y = x + " << (i * 3 + 1) << "; break;\n";
+    }
+
+    out << "    default: y = 0;\n";
+    out << "    }\n";
+    out << "    PrintUint32(y);\n";
+    out << "    return 0;\n}\n";
+}
+
+static void GenerateTemporaries(std::ostream& out, uint32_t size)
+{
+    out << "static uint32 a, b, c, d;\n\n";
+
+    std::vector<std::string> statements;
+    for (uint32_t i = 0; i < size; i++) {
+        statements.push_back("a = (b * " + std::to_string(i % 13 + 1) + " + c * d) - (d / " +
+            std::to_string(i % 7 + 1) + " + (a << 1));");
+    }
+
+    WriteChunkedProgram(out, statements, "");
+}
+
+static void GenerateStrings(std::ostream& out, uint32_t size)
+{
+    std::vector<std::string> statements;
+    for (uint32_t i = 0; i < size; i++) {
+        statements.push_back("PrintString(\"String literal number " + std::to_string(i) + " with \\\"escapes\\\"\\r\\n\");");
+    }
+
+    WriteChunkedProgram(out, statements, "");
+}
+
+static bool GenerateIncludes(std::ostream& out, uint32_t size, const std::filesystem::path& directory)
+{
+    for (uint32_t i = 0; i < size; i++) {
+        std::string name = "include" + std::to_string(i) + ".h";
+
+        std::ofstream header(directory / name, std::ios::binary);
+        if (!header) {
+            return false;
+        }
+
+        header << "uint32 g" << i << "(uint32 a) {\n";
+        header << "    return a * 3 + " << i << ";\n";
+        header << "}\n";
+
+        out << "#include \"" << name << "\"\n";
+    }
+
+    out << "\nstatic uint32 sum;\n\n";
+
+    std::vector<std::string> statements;
+    for (uint32_t i = 0; i < size; i++) {
+        statements.push_back("sum = g" + std::to_string(i) + "(sum);");
+    }
+
+    WriteChunkedProgram(out, statements, "");
+    return true;
+}
+
+static bool GenerateSource(BenchmarkShape shape, uint32_t size, const std::filesystem::path& directory,
+    std::filesystem::path& filename)
+{
+    std::filesystem::create_directories(directory);
+
+    filename = directory / (std::string(ShapeToString(shape)) + ".c");
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+
+    switch (shape) {
+        case BenchmarkShape::Functions: GenerateFunctions(out, size); break;
+        case BenchmarkShape::Nesting: GenerateNesting(out, size); break;
+        case BenchmarkShape::Switch: GenerateSwitch(out, size); break;
+        case BenchmarkShape::Temporaries: GenerateTemporaries(out, size); break;
+        case BenchmarkShape::Strings: GenerateStrings(out, size); break;
+        case BenchmarkShape::Includes: return GenerateIncludes(out, size, directory);
+
+        default: return false;
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Find number that follows specified key in JSON text, starting at given position
+/// </summary>
+static bool FindJsonNumber(const std::string& json, const char* key, size_t& position, double& value)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t found = json.find(pattern, position);
+    if (found == std::string::npos) {
+        return false;
+    }
+
+    position = found + pattern.size();
+    value = strtod(json.c_str() + position, nullptr);
+    return true;
+}
+
+/// <summary>
+/// Read statistics written by the compiler, only keys used by the benchmark are parsed
+/// </summary>
+static bool ReadStats(const std::filesystem::path& filename, BenchmarkResult& result)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string json = buffer.str();
+
+    size_t position = 0;
+    while (true) {
+        size_t name_start = json.find("\"name\": \"", position);
+        size_t functions = json.find("\"functions\"");
+        if (name_start == std::string::npos || name_start > functions) {
+            break;
+        }
+
+        name_start += 9;
+        size_t name_end = json.find('"', name_start);
+        std::string name = json.substr(name_start, name_end - name_start);
+
+        position = name_end;
+        double time_ms;
+        if (!FindJsonNumber(json, "time_ms", position, time_ms)) {
+            return false;
+        }
+
+        result.phases[name] = time_ms;
+    }
+
+    double value;
+    position = 0;
+    if (FindJsonNumber(json, "peak_working_set", position, value)) {
+        result.peak_working_set = (uint64_t)value;
+    }
+    position = 0;
+    if (FindJsonNumber(json, "code_size", position, value)) {
+        result.code_size = (uint64_t)value;
+    }
+
+    return true;
+}
+
+static BenchmarkResult RunBenchmark(const std::string& compiler, BenchmarkShape shape, uint32_t size,
+    uint32_t runs, const std::filesystem::path& output_directory)
+{
+    BenchmarkResult result { };
+    result.shape = shape;
+    result.size = size;
+    result.exit_code = -1;
+
+    std::filesystem::path directory = output_directory / (std::string(ShapeToString(shape)) + "_" + std::to_string(size));
+    std::filesystem::path source;
+    if (!GenerateSource(shape, size, directory, source)) {
+        std::cerr << "Cannot generate source code in \"" << directory.string() << "\"\r\n";
+        return result;
+    }
+
+    result.source_bytes = std::filesystem::file_size(source);
+
+    std::filesystem::path executable = directory / "output.exe";
+    std::filesystem::path stats = directory / "stats.json";
+
+    std::string command = compiler + " --stats-json \"" + stats.string() + "\" \"" + source.string() +
+        "\" \"" + executable.string() + "\"";
+#if defined(_WIN32)
+    command = "\"" + command + " > NUL 2>&1\"";
+#else
+    command += " > /dev/null 2>&1";
+#endif
+
+    // The fastest run is reported, so the results are not affected by cold caches
+    for (uint32_t i = 0; i < runs; i++) {
+        std::filesystem::remove(stats);
+
+        auto start = std::chrono::steady_clock::now();
+        int exit_code = system(command.c_str());
+        auto end = std::chrono::steady_clock::now();
+
+        double wall_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+        BenchmarkResult current = result;
+        current.exit_code = exit_code;
+        current.wall_ms = wall_ms;
+        if (exit_code == 0 && !ReadStats(stats, current)) {
+            current.exit_code = -1;
+        }
+
+        if (i == 0 || (current.exit_code == 0 && current.wall_ms < result.wall_ms)) {
+            result = current;
+        }
+
+        if (exit_code != 0) {
+            // Failed compilation is not repeated
+            break;
+        }
+    }
+
+    return result;
+}
+
+static std::vector<uint32_t> ParseSizes(const char* value)
+{
+    std::vector<uint32_t> sizes;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        uint32_t size = (uint32_t)strtoul(item.c_str(), nullptr, 10);
+        if (size > 0) {
+            sizes.push_back(size);
+        }
+    }
+    return sizes;
+}
+
+static std::vector<BenchmarkShape> ParseShapes(const char* value)
+{
+    std::vector<BenchmarkShape> shapes;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        for (uint32_t i = 0; i < (uint32_t)BenchmarkShape::Count; i++) {
+            if (item == ShapeToString((BenchmarkShape)i)) {
+                shapes.push_back((BenchmarkShape)i);
+                break;
+            }
+        }
+    }
+    return shapes;
+}
+
+static const char* PhaseColumns[] = {
+    "Parsing",
+    "Postprocessing",
+    "Emitting instructions",
+    "Emitting shared functions",
+    "Emitting static data",
+    "Finalizing executable"
+};
+
+static void WriteResults(std::ostream& out, const std::vector<BenchmarkResult>& results, char separator, bool align)
+{
+    auto column = [&](const std::string& value, int width) {
+        if (align) {
+            out.width(width);
+        }
+        out << value << separator;
+    };
+
+    column("shape", 12);
+    column("size", 8);
+    column("source_bytes", 13);
+    column("exit_code", 10);
+    column("wall_ms", 10);
+    for (auto phase : PhaseColumns) {
+        std::string name = phase;
+        std::replace(name.begin(), name.end(), ' ', '_');
+        column(name, align ? 10 : 0);
+    }
+    column("peak_kb", 10);
+    out << "code_bytes\n";
+
+    for (auto& result : results) {
+        char buffer[32];
+
+        column(ShapeToString(result.shape), 12);
+        column(std::to_string(result.size), 8);
+        column(std::to_string(result.source_bytes), 13);
+        column(std::to_string(result.exit_code), 10);
+
+        snprintf(buffer, sizeof(buffer), "%.3f", result.wall_ms);
+        column(buffer, 10);
+
+        for (auto phase : PhaseColumns) {
+            auto it = result.phases.find(phase);
+            if (it != result.phases.end()) {
+                snprintf(buffer, sizeof(buffer), "%.3f", it->second);
+            } else {
+                snprintf(buffer, sizeof(buffer), "-");
+            }
+            column(buffer, 10);
+        }
+
+        column(std::to_string(result.peak_working_set / 1024), 10);
+        out << result.code_size << "\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+#if defined(_WIN32)
+    std::string compiler = "c-like-to-x86.exe";
+#else
+    std::string compiler = "wine c-like-to-x86.exe";
+#endif
+    std::vector<uint32_t> sizes = { 10, 100, 1000, 5000 };
+    std::vector<BenchmarkShape> shapes;
+    uint32_t runs = 3;
+    std::filesystem::path output_directory = "benchmark";
+    const char* csv_filename = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--compiler") == 0 && i + 1 < argc) {
+            compiler = argv[++i];
+        } else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            sizes = ParseSizes(argv[++i]);
+        } else if (strcmp(argv[i], "--shapes") == 0 && i + 1 < argc) {
+            shapes = ParseShapes(argv[++i]);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_directory = argv[++i];
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_filename = argv[++i];
+        } else {
+            std::cerr << "Usage: benchmark [--compiler <command>] [--sizes <n,n,...>] [--shapes <name,name,...>]\r\n"
+                         "                 [--runs <n>] [--output <directory>] [--csv <file>]\r\n"
+                         "Shapes: functions, nesting, switch, temporaries, strings, includes\r\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (shapes.empty()) {
+        for (uint32_t i = 0; i < (uint32_t)BenchmarkShape::Count; i++) {
+            shapes.push_back((BenchmarkShape)i);
+        }
+    }
+
+    std::vector<BenchmarkResult> results;
+    for (auto shape : shapes) {
+        for (auto size : sizes) {
+            std::cerr << "Compiling \"" << ShapeToString(shape) << "\" with size " << size << "...\r\n";
+
+            results.push_back(RunBenchmark(compiler, shape, size, runs, output_directory));
+        }
+    }
+
+    WriteResults(std::cout, results, ' ', true);
+
+    if (csv_filename) {
+        std::ofstream csv(csv_filename, std::ios::binary);
+        if (!csv) {
+            std::cerr << "Cannot create \"" << csv_filename << "\"\r\n";
+            return EXIT_FAILURE;
+        }
+
+        WriteResults(csv, results, ',', false);
+    }
+
+    bool success = std::all_of(results.begin(), results.end(), [](const BenchmarkResult& result) {
+        return result.exit_code == 0;
+    });
+
+    return (success ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,95 @@
+#include "CycleTable.h"
+
+// Values are taken from Intel 386 DX and i486 programmer's reference manuals,
+// variable counts (e.g. multiplication) are replaced by their typical value
+static const CycleTable i386_table = {
+    2,      // mov_reg_reg
+    4,      // mov_reg_mem
+    2,      // mov_mem_reg
+    2,      // mov_reg_imm
+    2,      // mov_mem_imm
+    2,      // mov_sreg
+    3,      // movzx_reg
+    6,      // movzx_mem
+    2,      // lea
+
+    2,      // alu_reg_reg
+    6,      // alu_reg_mem
+    7,      // alu_mem_reg
+    2,      // alu_reg_imm
+    7,      // alu_mem_imm
+    2,      // incdec_reg
+    6,      // incdec_mem
+    3,      // shift_reg
+    7,      // shift_mem
+
+    14,     // mul8
+    22,     // mul16
+    38,     // mul32
+    14,     // div8
+    22,     // div16
+    38,     // div32
+
+    2,      // push
+    4,      // pop
+    9,      // call
+    12,     // ret
+    9,      // jump
+    9,      // branch_taken
+    3,      // branch_not_taken
+
+    5,      // string
+    37,     // interrupt
+    0,      // prefix
+    3       // other
+};
+
+static const CycleTable i486_table = {
+    1,      // mov_reg_reg
+    1,      // mov_reg_mem
+    1,      // mov_mem_reg
+    1,      // mov_reg_imm
+    1,      // mov_mem_imm
+    3,      // mov_sreg
+    3,      // movzx_reg
+    3,      // movzx_mem
+    1,      // lea
+
+    1,      // alu_reg_reg
+    2,      // alu_reg_mem
+    3,      // alu_mem_reg
+    1,      // alu_reg_imm
+    3,      // alu_mem_imm
+    1,      // incdec_reg
+    3,      // incdec_mem
+    2,      // shift_reg
+    4,      // shift_mem
+
+    13,     // mul8
+    26,     // mul16
+    42,     // mul32
+    16,     // div8
+    24,     // div16
+    40,     // div32
+
+    1,      // push
+    4,      // pop
+    3,      // call
+    5,      // ret
+    3,      // jump
+    3,      // branch_taken
+    1,      // branch_not_taken
+
+    5,      // string
+    30,     // interrupt
+    1,      // prefix
+    2       // other
+};
+
+const CycleTable& CycleTable::Get(CpuModel model)
+{
+    switch (model) {
+        case CpuModel::i486: return i486_table;
+        default: return i386_table;
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+enum struct CpuModel {
+    i386,
+    i486
+};
+
+/// <summary>
+/// Estimated clock counts of instruction classes, memory operands are expected to hit the cache
+/// and taken branches include the average cost of refilling the prefetch queue
+/// </summary>
+struct CycleTable {
+    uint32_t mov_reg_reg;
+    uint32_t mov_reg_mem;       // Load
+    uint32_t mov_mem_reg;       // Store
+    uint32_t mov_reg_imm;
+    uint32_t mov_mem_imm;
+    uint32_t mov_sreg;
+    uint32_t movzx_reg;
+    uint32_t movzx_mem;
+    uint32_t lea;
+
+    uint32_t alu_reg_reg;
+    uint32_t alu_reg_mem;
+    uint32_t alu_mem_reg;       // Read-modify-write
+    uint32_t alu_reg_imm;
+    uint32_t alu_mem_imm;
+    uint32_t incdec_reg;
+    uint32_t incdec_mem;
+    uint32_t shift_reg;
+    uint32_t shift_mem;
+
+    uint32_t mul8;
+    uint32_t mul16;
+    uint32_t mul32;
+    uint32_t div8;
+    uint32_t div16;
+    uint32_t div32;
+
+    uint32_t push;
+    uint32_t pop;
+    uint32_t call;
+    uint32_t ret;
+    uint32_t jump;
+    uint32_t branch_taken;
+    uint32_t branch_not_taken;
+
+    uint32_t string;
+    uint32_t interrupt;
+    uint32_t prefix;
+    uint32_t other;
+
+    /// <summary>
+    /// Get cost table of specified CPU model
+    /// </summary>
+    /// <param name="model">CPU model</param>
+    /// <returns>Cost table</returns>
+    static const CycleTable& Get(CpuModel model);
+};
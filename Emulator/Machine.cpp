@@ -0,0 +1,1641 @@
+#include "Machine.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+// Program is loaded low, so pointers returned by "#Alloc" stay in 16-bit segment range
+constexpr uint16_t PspSegment = 0x0100;
+constexpr uint16_t TopSegment = 0xA000;     // 640 kB of conventional memory
+constexpr uint32_t MemorySize = 0x100000;
+constexpr uint32_t AddressMask = 0xFFFFF;   // A20 line is disabled
+
+constexpr uint32_t FlagCarry = 0x0001;
+constexpr uint32_t FlagParity = 0x0004;
+constexpr uint32_t FlagAdjust = 0x0010;
+constexpr uint32_t FlagZero = 0x0040;
+constexpr uint32_t FlagSign = 0x0080;
+constexpr uint32_t FlagInterrupt = 0x0200;
+constexpr uint32_t FlagDirection = 0x0400;
+constexpr uint32_t FlagOverflow = 0x0800;
+
+constexpr uint32_t FlagsArithmetic = FlagCarry | FlagParity | FlagAdjust | FlagZero | FlagSign | FlagOverflow;
+
+#pragma pack(push, 1)
+struct MzHeader {
+    uint8_t signature[2];
+    uint16_t last_block_size;
+    uint16_t block_count;
+    uint16_t reloc_count;
+    uint16_t header_paragraphs;
+    uint16_t min_extra_paragraphs;
+    uint16_t max_extra_paragraphs;
+    uint16_t ss;
+    uint16_t sp;
+    uint16_t checksum;
+    uint16_t ip;
+    uint16_t cs;
+    uint16_t reloc_table_offset;
+    uint16_t overlay_count;
+};
+#pragma pack(pop)
+
+static inline uint32_t SizeMask(uint32_t size)
+{
+    return (size == 4 ? 0xFFFFFFFF : ((1u << (size * 8)) - 1));
+}
+
+static inline uint32_t SignBit(uint32_t size)
+{
+    return (1u << (size * 8 - 1));
+}
+
+static inline int64_t SignExtend(uint32_t value, uint32_t size)
+{
+    switch (size) {
+        case 1: return (int8_t)value;
+        case 2: return (int16_t)value;
+        default: return (int32_t)value;
+    }
+}
+
+Machine::Machine(CpuModel model)
+    : memory(MemorySize),
+      cycle_table(CycleTable::Get(model))
+{
+    memset(registers, 0, sizeof(registers));
+    memset(segments, 0, sizeof(segments));
+    ip = 0;
+    flags = 0x0002;
+}
+
+Machine::~Machine()
+{
+    for (auto& file : files) {
+        fclose(file.second);
+    }
+}
+
+bool Machine::Load(const std::vector<uint8_t>& image, const std::string& command_tail)
+{
+    if (image.size() < sizeof(MzHeader)) {
+        error = "File is too small to be an executable";
+        return false;
+    }
+
+    const MzHeader* header = (const MzHeader*)image.data();
+    if (!((header->signature[0] == 'M' && header->signature[1] == 'Z') ||
+          (header->signature[0] == 'Z' && header->signature[1] == 'M'))) {
+        error = "File is not MZ executable";
+        return false;
+    }
+
+    if (header->block_count == 0) {
+        error = "Executable has no load module";
+        return false;
+    }
+
+    // Compute size of load module the same way as DOS loader
+    uint32_t header_size = (uint32_t)header->header_paragraphs << 4;
+    uint32_t file_size = (uint32_t)header->block_count * 512;
+    if (header->last_block_size > 0) {
+        file_size -= 512 - header->last_block_size;
+    }
+
+    if (file_size < header_size || file_size > image.size()) {
+        error = "Executable is truncated";
+        return false;
+    }
+
+    uint32_t load_size = file_size - header_size;
+    uint32_t load_paragraphs = (load_size + 16 - 1) >> 4;
+
+    // Program gets as much memory as it asked for, but at least the minimum
+    uint32_t available = TopSegment - PspSegment;
+    uint32_t needed = 0x10 + load_paragraphs + header->min_extra_paragraphs;
+    uint32_t wanted = 0x10 + load_paragraphs + header->max_extra_paragraphs;
+    if (needed > available) {
+        error = "Not enough memory to load executable";
+        return false;
+    }
+
+    uint16_t block_size = (uint16_t)(wanted < available ? wanted : available);
+    memory_blocks[PspSegment] = block_size;
+
+    uint16_t load_segment = PspSegment + 0x10;
+    memcpy(&memory[(uint32_t)load_segment << 4], image.data() + header_size, load_size);
+
+    // Apply segment relocations
+    for (uint32_t i = 0; i < header->reloc_count; i++) {
+        uint32_t entry = header->reloc_table_offset + i * 4;
+        if (entry + 4 > image.size()) {
+            error = "Relocation table is truncated";
+            return false;
+        }
+
+        uint16_t offset = *(const uint16_t*)(image.data() + entry);
+        uint16_t segment = *(const uint16_t*)(image.data() + entry + 2);
+        uint32_t address = ((uint32_t)(uint16_t)(load_segment + segment) << 4) + offset;
+        Write16(address, Read16(address) + load_segment);
+    }
+
+    // Create Program Segment Prefix
+    uint32_t psp = (uint32_t)PspSegment << 4;
+    memory[psp + 0x00] = 0xCD;  // int 20h
+    memory[psp + 0x01] = 0x20;
+    Write16(psp + 0x02, PspSegment + block_size);
+
+    uint32_t tail_length = (uint32_t)command_tail.size();
+    if (tail_length > 126) {
+        tail_length = 126;
+    }
+    memory[psp + 0x80] = (uint8_t)tail_length;
+    memcpy(&memory[psp + 0x81], command_tail.data(), tail_length);
+    memory[psp + 0x81 + tail_length] = '\r';
+
+    // Initial state of registers is defined by header
+    segments[(uint32_t)SegmentRegister::Cs] = load_segment + header->cs;
+    segments[(uint32_t)SegmentRegister::Ss] = load_segment + header->ss;
+    segments[(uint32_t)SegmentRegister::Ds] = PspSegment;
+    segments[(uint32_t)SegmentRegister::Es] = PspSegment;
+    ip = header->ip;
+    registers[(uint32_t)Register::Sp] = header->sp;
+    flags = 0x0002 | FlagInterrupt;
+
+    state = MachineState::Running;
+    return true;
+}
+
+MachineState Machine::Run(uint64_t max_instructions)
+{
+    while (state == MachineState::Running) {
+        if (max_instructions > 0 && instruction_count >= max_instructions) {
+            state = MachineState::InstructionLimit;
+            break;
+        }
+
+        Step();
+    }
+
+    return state;
+}
+
+void Machine::SetInput(FILE* input)
+{
+    this->input = input;
+}
+
+void Machine::SetOutput(FILE* output)
+{
+    this->output = output;
+}
+
+void Machine::Step()
+{
+    instruction_ip = ip;
+    segment_override = SegmentRegister::None;
+    repeat_prefix = 0;
+
+    uint32_t size = 2;
+    uint8_t opcode;
+
+    // Decode prefixes
+    bool is_prefix = true;
+    while (is_prefix) {
+        opcode = Fetch8();
+
+        switch (opcode) {
+            case 0x26: segment_override = SegmentRegister::Es; break;
+            case 0x2E: segment_override = SegmentRegister::Cs; break;
+            case 0x36: segment_override = SegmentRegister::Ss; break;
+            case 0x3E: segment_override = SegmentRegister::Ds; break;
+            case 0x64: segment_override = SegmentRegister::Fs; break;
+            case 0x65: segment_override = SegmentRegister::Gs; break;
+            case 0x66: size = 4; break;
+            case 0xF0: break;
+            case 0xF2:
+            case 0xF3: repeat_prefix = opcode; break;
+
+            case 0x67:
+                Fault("Address-size prefix is not supported");
+                return;
+
+            default: is_prefix = false; break;
+        }
+
+        if (is_prefix) {
+            Charge(cycle_table.prefix);
+        }
+    }
+
+    instruction_count++;
+
+    // Arithmetic and logical instructions with regular encoding
+    if (opcode < 0x40 && (opcode & 0x07) < 0x06) {
+        uint32_t operation = (opcode >> 3);
+        uint32_t operand_size = ((opcode & 0x01) ? size : 1);
+
+        switch (opcode & 0x07) {
+            case 0x00:
+            case 0x01: {
+                uint8_t modrm = Fetch8();
+                Operand dst = DecodeModRm(modrm);
+                uint32_t src_index = (modrm >> 3) & 0x07;
+                uint32_t result = Alu(operation, ReadOperand(dst, operand_size), GetRegister(src_index, operand_size), operand_size);
+                if (operation != 7) {
+                    WriteOperand(dst, result, operand_size);
+                    Charge(dst.is_register ? cycle_table.alu_reg_reg : cycle_table.alu_mem_reg);
+                } else {
+                    Charge(dst.is_register ? cycle_table.alu_reg_reg : cycle_table.alu_reg_mem);
+                }
+                break;
+            }
+            case 0x02:
+            case 0x03: {
+                uint8_t modrm = Fetch8();
+                Operand src = DecodeModRm(modrm);
+                uint32_t dst_index = (modrm >> 3) & 0x07;
+                uint32_t result = Alu(operation, GetRegister(dst_index, operand_size), ReadOperand(src, operand_size), operand_size);
+                if (operation != 7) {
+                    SetRegister(dst_index, result, operand_size);
+                }
+                Charge(src.is_register ? cycle_table.alu_reg_reg : cycle_table.alu_reg_mem);
+                break;
+            }
+            case 0x04:
+            case 0x05: {
+                uint32_t value = FetchImmediate(operand_size);
+                uint32_t result = Alu(operation, GetRegister(0, operand_size), value, operand_size);
+                if (operation != 7) {
+                    SetRegister(0, result, operand_size);
+                }
+                Charge(cycle_table.alu_reg_imm);
+                break;
+            }
+        }
+        return;
+    }
+
+    switch (opcode) {
+        // Segment registers
+        case 0x06: Push(segments[(uint32_t)SegmentRegister::Es], size); Charge(cycle_table.push); break;
+        case 0x0E: Push(segments[(uint32_t)SegmentRegister::Cs], size); Charge(cycle_table.push); break;
+        case 0x16: Push(segments[(uint32_t)SegmentRegister::Ss], size); Charge(cycle_table.push); break;
+        case 0x1E: Push(segments[(uint32_t)SegmentRegister::Ds], size); Charge(cycle_table.push); break;
+        case 0x07: segments[(uint32_t)SegmentRegister::Es] = (uint16_t)Pop(size); Charge(cycle_table.pop + cycle_table.mov_sreg); break;
+        case 0x17: segments[(uint32_t)SegmentRegister::Ss] = (uint16_t)Pop(size); Charge(cycle_table.pop + cycle_table.mov_sreg); break;
+        case 0x1F: segments[(uint32_t)SegmentRegister::Ds] = (uint16_t)Pop(size); Charge(cycle_table.pop + cycle_table.mov_sreg); break;
+
+        case 0x0F: ExecuteExtended(size); break;
+
+        // inc/dec/push/pop r16/32
+        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
+        case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F: {
+            uint32_t index = (opcode & 0x07);
+            SetRegister(index, IncDec(opcode >= 0x48, GetRegister(index, size), size), size);
+            Charge(cycle_table.incdec_reg);
+            break;
+        }
+        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
+            Push(GetRegister(opcode & 0x07, size), size);
+            Charge(cycle_table.push);
+            break;
+        case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+            SetRegister(opcode & 0x07, Pop(size), size);
+            Charge(cycle_table.pop);
+            break;
+
+        case 0x60: { // pusha
+            uint32_t sp = GetRegister((uint32_t)Register::Sp, size);
+            for (uint32_t i = 0; i < 8; i++) {
+                Push(i == (uint32_t)Register::Sp ? sp : GetRegister(i, size), size);
+            }
+            Charge(cycle_table.push * 8);
+            break;
+        }
+        case 0x61: { // popa
+            for (uint32_t i = 8; i > 0; i--) {
+                uint32_t value = Pop(size);
+                if (i - 1 != (uint32_t)Register::Sp) {
+                    SetRegister(i - 1, value, size);
+                }
+            }
+            Charge(cycle_table.pop * 8);
+            break;
+        }
+
+        case 0x68: Push(FetchImmediate(size), size); Charge(cycle_table.push); break;
+        case 0x6A: Push((uint32_t)(int8_t)Fetch8(), size); Charge(cycle_table.push); break;
+
+        case 0x69:
+        case 0x6B: { // imul r, rm, imm
+            uint8_t modrm = Fetch8();
+            Operand src = DecodeModRm(modrm);
+            int64_t a = SignExtend(ReadOperand(src, size), size);
+            int64_t b = (opcode == 0x6B ? (int8_t)Fetch8() : SignExtend(FetchImmediate(size), size));
+            int64_t result = a * b;
+            SetRegister((modrm >> 3) & 0x07, (uint32_t)result, size);
+
+            flags &= ~(FlagCarry | FlagOverflow);
+            if (result != SignExtend((uint32_t)result, size)) {
+                flags |= (FlagCarry | FlagOverflow);
+            }
+            Charge(size == 4 ? cycle_table.mul32 : cycle_table.mul16);
+            break;
+        }
+
+        // jcc rel8
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+        case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F: {
+            int8_t offset = (int8_t)Fetch8();
+            if (CheckCondition(opcode & 0x0F)) {
+                ip = (uint16_t)(ip + offset);
+                Charge(cycle_table.branch_taken);
+            } else {
+                Charge(cycle_table.branch_not_taken);
+            }
+            break;
+        }
+
+        case 0x80:
+        case 0x81:
+        case 0x82:
+        case 0x83: ExecuteGroup1(opcode, size); break;
+
+        case 0x84:
+        case 0x85: { // test rm, r
+            uint32_t operand_size = ((opcode & 0x01) ? size : 1);
+            uint8_t modrm = Fetch8();
+            Operand dst = DecodeModRm(modrm);
+            Alu(4, ReadOperand(dst, operand_size), GetRegister((modrm >> 3) & 0x07, operand_size), operand_size);
+            Charge(dst.is_register ? cycle_table.alu_reg_reg : cycle_table.alu_reg_mem);
+            break;
+        }
+        case 0x86:
+        case 0x87: { // xchg rm, r
+            uint32_t operand_size = ((opcode & 0x01) ? size : 1);
+            uint8_t modrm = Fetch8();
+            Operand dst = DecodeModRm(modrm);
+            uint32_t index = (modrm >> 3) & 0x07;
+            uint32_t value = ReadOperand(dst, operand_size);
+            WriteOperand(dst, GetRegister(index, operand_size), operand_size);
+            SetRegister(index, value, operand_size);
+            Charge(dst.is_register ? cycle_table.alu_reg_reg : cycle_table.alu_mem_reg);
+            break;
+        }
+
+        // mov
+        case 0x88:
+        case 0x89: {
+            uint32_t operand_size = ((opcode & 0x01) ? size : 1);
+            uint8_t modrm = Fetch8();
+            Operand dst = DecodeModRm(modrm);
+            WriteOperand(dst, GetRegister((modrm >> 3) & 0x07, operand_size), operand_size);
+            Charge(dst.is_register ? cycle_table.mov_reg_reg : cycle_table.mov_mem_reg);
+            break;
+        }
+        case 0x8A:
+        case 0x8B: {
+            uint32_t operand_size = ((opcode & 0x01) ? size : 1);
+            uint8_t modrm = Fetch8();
+            Operand src = DecodeModRm(modrm);
+            SetRegister((modrm >> 3) & 0x07, ReadOperand(src, operand_size), operand_size);
+            Charge(src.is_register ? cycle_table.mov_reg_reg : cycle_table.mov_reg_mem);
+            break;
+        }
+        case 0x8C: { // mov rm16, sreg
+            uint8_t modrm = Fetch8();
+            Operand dst = DecodeModRm(modrm);
+            uint32_t index = (modrm >> 3) & 0x07;
+            if (index >= 6) {
+                Fault("Invalid segment register");
+                return;
+            }
+            WriteOperand(dst, segments[index], dst.is_register ? size : 2);
+            Charge(cycle_table.mov_sreg);
+            break;
+        }
+        case 0x8D: { // lea
+            uint8_t modrm = Fetch8();
+            Operand src = DecodeModRm(modrm);
+            if (src.is_register) {
+                Fault("Invalid operand of lea instruction");
+                return;
+            }
+            // Only offset part of the address is needed
+            SetRegister((modrm >> 3) & 0x07, src.index, size);
+            Charge(cycle_table.lea);
+            break;
+        }
+        case 0x8E: { // mov sreg, rm16
+            uint8_t modrm = Fetch8();
+            Operand src = DecodeModRm(modrm);
+            uint32_t index = (modrm >> 3) & 0x07;
+            if (index >= 6 || index == (uint32_t)SegmentRegister::Cs) {
+                Fault("Invalid segment register");
+                return;
+            }
+            segments[index] = (uint16_t)ReadOperand(src, 2);
+            Charge(cycle_table.mov_sreg);
+            break;
+        }
+        case 0x8F: { // pop rm
+            Operand dst = DecodeModRm(Fetch8());
+            WriteOperand(dst, Pop(size), size);
+            Charge(cycle_table.pop);
+            break;
+        }
+
+        case 0x90: Charge(cycle_table.other); break;
+        case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97: {
+            uint32_t index = (opcode & 0x07);
+            uint32_t value = GetRegister(index, size);
+            SetRegister(index, GetRegister(0, size), size);
+            SetRegister(0, value, size);
+            Charge(cycle_table.alu_reg_reg);
+            break;
+        }
+
+        case 0x98: // cbw/cwde
+            SetRegister(0, (uint32_t)SignExtend(GetRegister(0, size / 2), size / 2), size);
+            Charge(cycle_table.other);
+            break;
+        case 0x99: // cwd/cdq
+            SetRegister((uint32_t)Register::Dx, (GetRegister(0, size) & SignBit(size)) ? 0xFFFFFFFF : 0, size);
+            Charge(cycle_table.other);
+            break;
+
+        case 0x9C: Push(flags, size); Charge(cycle_table.push); break;
+        case 0x9D: flags = (Pop(size) & 0x0FD5) | 0x0002; Charge(cycle_table.pop); break;
+
+        // mov al/ax, moffs
+        case 0xA0:
+        case 0xA1:
+        case 0xA2:
+        case 0xA3: {
+            uint32_t operand_size = ((opcode & 0x01) ? size : 1);
+            uint32_t address = Linear(segment_override != SegmentRegister::None ? segment_override : SegmentRegister::Ds, Fetch16());
+            if (opcode < 0xA2) {
+                SetRegister(0, Read(address, operand_size), operand_size);
+                Charge(cycle_table.mov_reg_mem);
+            } else {
+                Write(address, GetRegister(0, operand_size), operand_size);
+                Charge(cycle_table.mov_mem_reg);
+            }
+            break;
+        }
+
+        case 0xA4: case 0xA5: case 0xA6: case 0xA7:
+        case 0xAA: case 0xAB: case 0xAC: case 0xAD: case 0xAE: case 0xAF:
+            ExecuteString(opcode, (opcode & 0x01) ? size : 1);
+            break;
+
+        case 0xA8:
+        case 0xA9: { // test al/ax, imm
+            uint32_t operand_size = ((opcode & 0x01) ? size : 1);
+            Alu(4, GetRegister(0, operand_size), FetchImmediate(operand_size), operand_size);
+            Charge(cycle_table.alu_reg_imm);
+            break;
+        }
+
+        case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: case 0xB7:
+            SetRegister(opcode & 0x07, Fetch8(), 1);
+            Charge(cycle_table.mov_reg_imm);
+            break;
+        case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+            SetRegister(opcode & 0x07, FetchImmediate(size), size);
+            Charge(cycle_table.mov_reg_imm);
+            break;
+
+        case 0xC0:
+        case 0xC1:
+        case 0xD0:
+        case 0xD1:
+        case 0xD2:
+        case 0xD3: ExecuteGroup2(opcode, (opcode & 0x01) ? size : 1); break;
+
+        case 0xC2:
+        case 0xC3: { // retn
+            uint16_t release = (opcode == 0xC2 ? Fetch16() : 0);
+            ip = (uint16_t)Pop(size);
+            SetRegister((uint32_t)Register::Sp, GetRegister((uint32_t)Register::Sp, 2) + release, 2);
+            Charge(cycle_table.ret);
+            break;
+        }
+        case 0xCA:
+        case 0xCB: { // retf
+            uint16_t release = (opcode == 0xCA ? Fetch16() : 0);
+            ip = (uint16_t)Pop(size);
+            segments[(uint32_t)SegmentRegister::Cs] = (uint16_t)Pop(size);
+            SetRegister((uint32_t)Register::Sp, GetRegister((uint32_t)Register::Sp, 2) + release, 2);
+            Charge(cycle_table.ret * 2);
+            break;
+        }
+
+        case 0xC6:
+        case 0xC7: { // mov rm, imm
+            uint32_t operand_size = ((opcode & 0x01) ? size : 1);
+            Operand dst = DecodeModRm(Fetch8());
+            WriteOperand(dst, FetchImmediate(operand_size), operand_size);
+            Charge(dst.is_register ? cycle_table.mov_reg_imm : cycle_table.mov_mem_imm);
+            break;
+        }
+
+        case 0xC9: { // leave
+            SetRegister((uint32_t)Register::Sp, GetRegister((uint32_t)Register::Bp, 2), 2);
+            SetRegister((uint32_t)Register::Bp, Pop(size), size);
+            Charge(cycle_table.pop + cycle_table.mov_reg_reg);
+            break;
+        }
+
+        case 0xCC: Interrupt(0x03); break;
+        case 0xCD: Interrupt(Fetch8()); break;
+
+        case 0xE2: { // loop
+            int8_t offset = (int8_t)Fetch8();
+            uint32_t count = GetRegister((uint32_t)Register::Cx, 2) - 1;
+            SetRegister((uint32_t)Register::Cx, count, 2);
+            if ((count & 0xFFFF) != 0) {
+                ip = (uint16_t)(ip + offset);
+                Charge(cycle_table.branch_taken);
+            } else {
+                Charge(cycle_table.branch_not_taken);
+            }
+            break;
+        }
+        case 0xE3: { // jcxz
+            int8_t offset = (int8_t)Fetch8();
+            if (GetRegister((uint32_t)Register::Cx, 2) == 0) {
+                ip = (uint16_t)(ip + offset);
+                Charge(cycle_table.branch_taken);
+            } else {
+                Charge(cycle_table.branch_not_taken);
+            }
+            break;
+        }
+
+        case 0xE8: { // call rel
+            uint32_t offset = FetchImmediate(size);
+            Push(ip, size);
+            ip = (uint16_t)(ip + offset);
+            Charge(cycle_table.call);
+            break;
+        }
+        case 0xE9: { // jmp rel
+            uint32_t offset = FetchImmediate(size);
+            ip = (uint16_t)(ip + offset);
+            Charge(cycle_table.jump);
+            break;
+        }
+        case 0xEA: { // jmp far
+            uint16_t offset = Fetch16();
+            uint16_t segment = Fetch16();
+            ip = offset;
+            segments[(uint32_t)SegmentRegister::Cs] = segment;
+            Charge(cycle_table.jump * 2);
+            break;
+        }
+        case 0xEB: { // jmp rel8
+            int8_t offset = (int8_t)Fetch8();
+            ip = (uint16_t)(ip + offset);
+            Charge(cycle_table.jump);
+            break;
+        }
+
+        case 0xF4:
+            Fault("Processor halted");
+            break;
+
+        case 0xF5: flags ^= FlagCarry; Charge(cycle_table.other); break;
+        case 0xF8: flags &= ~FlagCarry; Charge(cycle_table.other); break;
+        case 0xF9: flags |= FlagCarry; Charge(cycle_table.other); break;
+        case 0xFA: flags &= ~FlagInterrupt; Charge(cycle_table.other); break;
+        case 0xFB: flags |= FlagInterrupt; Charge(cycle_table.other); break;
+        case 0xFC: flags &= ~FlagDirection; Charge(cycle_table.other); break;
+        case 0xFD: flags |= FlagDirection; Charge(cycle_table.other); break;
+
+        case 0xF6: ExecuteGroup3(1); break;
+        case 0xF7: ExecuteGroup3(size); break;
+
+        case 0xFE: { // inc/dec rm8
+            uint8_t modrm = Fetch8();
+            uint32_t operation = (modrm >> 3) & 0x07;
+            if (operation > 1) {
+                Fault("Invalid instruction 0xFE /%d", operation);
+                return;
+            }
+            Operand dst = DecodeModRm(modrm);
+            WriteOperand(dst, IncDec(operation == 1, ReadOperand(dst, 1), 1), 1);
+            Charge(dst.is_register ? cycle_table.incdec_reg : cycle_table.incdec_mem);
+            break;
+        }
+        case 0xFF: ExecuteGroup5(size); break;
+
+        default:
+            Fault("Unsupported instruction 0x%02X", opcode);
+            break;
+    }
+}
+
+void Machine::Fault(const char* format, ...)
+{
+    char message[256];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    char location[32];
+    snprintf(location, sizeof(location), " at %04X:%04X", segments[(uint32_t)SegmentRegister::Cs], instruction_ip);
+
+    error = message;
+    error += location;
+    state = MachineState::Faulted;
+}
+
+uint8_t Machine::Read8(uint32_t address)
+{
+    return memory[address & AddressMask];
+}
+
+uint16_t Machine::Read16(uint32_t address)
+{
+    return (uint16_t)(Read8(address) | (Read8(address + 1) << 8));
+}
+
+uint32_t Machine::Read32(uint32_t address)
+{
+    return (uint32_t)Read16(address) | ((uint32_t)Read16(address + 2) << 16);
+}
+
+uint32_t Machine::Read(uint32_t address, uint32_t size)
+{
+    switch (size) {
+        case 1: return Read8(address);
+        case 2: return Read16(address);
+        default: return Read32(address);
+    }
+}
+
+void Machine::Write8(uint32_t address, uint8_t value)
+{
+    memory[address & AddressMask] = value;
+}
+
+void Machine::Write16(uint32_t address, uint16_t value)
+{
+    Write8(address, (uint8_t)value);
+    Write8(address + 1, (uint8_t)(value >> 8));
+}
+
+void Machine::Write32(uint32_t address, uint32_t value)
+{
+    Write16(address, (uint16_t)value);
+    Write16(address + 2, (uint16_t)(value >> 16));
+}
+
+void Machine::Write(uint32_t address, uint32_t value, uint32_t size)
+{
+    switch (size) {
+        case 1: Write8(address, (uint8_t)value); break;
+        case 2: Write16(address, (uint16_t)value); break;
+        default: Write32(address, value); break;
+    }
+}
+
+uint32_t Machine::Linear(SegmentRegister segment, uint16_t offset)
+{
+    if (segment == SegmentRegister::None) {
+        return offset;
+    }
+
+    return (((uint32_t)segments[(uint32_t)segment] << 4) + offset) & AddressMask;
+}
+
+uint8_t Machine::Fetch8()
+{
+    uint8_t value = Read8(Linear(SegmentRegister::Cs, ip));
+    ip++;
+    return value;
+}
+
+uint16_t Machine::Fetch16()
+{
+    uint16_t value = Fetch8();
+    value |= (uint16_t)(Fetch8() << 8);
+    return value;
+}
+
+uint32_t Machine::Fetch32()
+{
+    uint32_t value = Fetch16();
+    value |= ((uint32_t)Fetch16() << 16);
+    return value;
+}
+
+uint32_t Machine::FetchImmediate(uint32_t size)
+{
+    switch (size) {
+        case 1: return Fetch8();
+        case 2: return Fetch16();
+        default: return Fetch32();
+    }
+}
+
+uint32_t Machine::GetRegister(uint32_t index, uint32_t size)
+{
+    switch (size) {
+        case 1:
+            // AL, CL, DL, BL, AH, CH, DH, BH
+            return (index < 4 ? (registers[index] & 0xFF) : ((registers[index - 4] >> 8) & 0xFF));
+        case 2: return (registers[index] & 0xFFFF);
+        default: return registers[index];
+    }
+}
+
+void Machine::SetRegister(uint32_t index, uint32_t value, uint32_t size)
+{
+    switch (size) {
+        case 1:
+            if (index < 4) {
+                registers[index] = (registers[index] & ~0xFFu) | (value & 0xFF);
+            } else {
+                registers[index - 4] = (registers[index - 4] & ~0xFF00u) | ((value & 0xFF) << 8);
+            }
+            break;
+        case 2: registers[index] = (registers[index] & 0xFFFF0000u) | (value & 0xFFFF); break;
+        default: registers[index] = value; break;
+    }
+}
+
+Operand Machine::DecodeModRm(uint8_t modrm)
+{
+    uint32_t mod = (modrm >> 6);
+    uint32_t rm = (modrm & 0x07);
+
+    if (mod == 3) {
+        return { true, rm, 0 };
+    }
+
+    uint16_t offset;
+    SegmentRegister segment = SegmentRegister::Ds;
+
+    switch (rm) {
+        case 0: offset = (uint16_t)(registers[(uint32_t)Register::Bx] + registers[(uint32_t)Register::Si]); break;
+        case 1: offset = (uint16_t)(registers[(uint32_t)Register::Bx] + registers[(uint32_t)Register::Di]); break;
+        case 2: offset = (uint16_t)(registers[(uint32_t)Register::Bp] + registers[(uint32_t)Register::Si]); segment = SegmentRegister::Ss; break;
+        case 3: offset = (uint16_t)(registers[(uint32_t)Register::Bp] + registers[(uint32_t)Register::Di]); segment = SegmentRegister::Ss; break;
+        case 4: offset = (uint16_t)registers[(uint32_t)Register::Si]; break;
+        case 5: offset = (uint16_t)registers[(uint32_t)Register::Di]; break;
+        case 6:
+            if (mod == 0) {
+                offset = 0;
+            } else {
+                offset = (uint16_t)registers[(uint32_t)Register::Bp];
+                segment = SegmentRegister::Ss;
+            }
+            break;
+        default: offset = (uint16_t)registers[(uint32_t)Register::Bx]; break;
+    }
+
+    switch (mod) {
+        case 0:
+            if (rm == 6) {
+                offset = Fetch16();
+            }
+            break;
+        case 1: offset = (uint16_t)(offset + (int8_t)Fetch8()); break;
+        case 2: offset = (uint16_t)(offset + Fetch16()); break;
+    }
+
+    if (segment_override != SegmentRegister::None) {
+        segment = segment_override;
+    }
+
+    // Offset is kept in index field for "lea" instruction
+    return { false, offset, Linear(segment, offset) };
+}
+
+uint32_t Machine::ReadOperand(const Operand& operand, uint32_t size)
+{
+    if (operand.is_register) {
+        return GetRegister(operand.index, size);
+    }
+
+    return Read(operand.address, size);
+}
+
+void Machine::WriteOperand(const Operand& operand, uint32_t value, uint32_t size)
+{
+    if (operand.is_register) {
+        SetRegister(operand.index, value, size);
+    } else {
+        Write(operand.address, value, size);
+    }
+}
+
+void Machine::Push(uint32_t value, uint32_t size)
+{
+    uint16_t sp = (uint16_t)(registers[(uint32_t)Register::Sp] - size);
+    SetRegister((uint32_t)Register::Sp, sp, 2);
+    Write(Linear(SegmentRegister::Ss, sp), value, size);
+}
+
+uint32_t Machine::Pop(uint32_t size)
+{
+    uint16_t sp = (uint16_t)registers[(uint32_t)Register::Sp];
+    uint32_t value = Read(Linear(SegmentRegister::Ss, sp), size);
+    SetRegister((uint32_t)Register::Sp, sp + size, 2);
+    return value;
+}
+
+uint32_t Machine::Alu(uint32_t operation, uint32_t a, uint32_t b, uint32_t size)
+{
+    uint32_t mask = SizeMask(size);
+    uint32_t sign = SignBit(size);
+    uint32_t carry = (flags & FlagCarry);
+    uint32_t result;
+
+    a &= mask;
+    b &= mask;
+    flags &= ~FlagsArithmetic;
+
+    switch (operation) {
+        case 0:   // add
+        case 2: { // adc
+            uint64_t c = (operation == 2 ? carry : 0);
+            uint64_t value = (uint64_t)a + b + c;
+            result = (uint32_t)value & mask;
+            if (value > mask) {
+                flags |= FlagCarry;
+            }
+            if ((a ^ result) & (b ^ result) & sign) {
+                flags |= FlagOverflow;
+            }
+            if ((a ^ b ^ result) & 0x10) {
+                flags |= FlagAdjust;
+            }
+            break;
+        }
+
+        case 3:   // sbb
+        case 5:   // sub
+        case 7: { // cmp
+            uint64_t c = (operation == 3 ? carry : 0);
+            result = (uint32_t)(a - b - c) & mask;
+            if ((uint64_t)a < (uint64_t)b + c) {
+                flags |= FlagCarry;
+            }
+            if ((a ^ b) & (a ^ result) & sign) {
+                flags |= FlagOverflow;
+            }
+            if ((a ^ b ^ result) & 0x10) {
+                flags |= FlagAdjust;
+            }
+            break;
+        }
+
+        case 1: result = (a | b); break;
+        case 4: result = (a & b); break;
+        default: result = (a ^ b); break;
+    }
+
+    SetResultFlags(result, size);
+    return result;
+}
+
+uint32_t Machine::Shift(uint32_t operation, uint32_t value, uint32_t count, uint32_t size)
+{
+    uint32_t bits = size * 8;
+    uint32_t mask = SizeMask(size);
+    uint32_t sign = SignBit(size);
+
+    count &= 0x1F;
+    value &= mask;
+
+    if (count == 0) {
+        return value;
+    }
+
+    uint32_t result;
+    bool carry;
+
+    switch (operation) {
+        case 0:   // rol
+        case 1: { // ror
+            uint32_t n = count % bits;
+            if (operation == 0) {
+                result = (n ? ((value << n) | (value >> (bits - n))) & mask : value);
+                carry = (result & 1) != 0;
+            } else {
+                result = (n ? ((value >> n) | (value << (bits - n))) & mask : value);
+                carry = (result & sign) != 0;
+            }
+
+            flags &= ~(FlagCarry | FlagOverflow);
+            if (carry) {
+                flags |= FlagCarry;
+            }
+            if (((result & sign) != 0) != (operation == 0 ? carry : ((result << 1) & sign) != 0)) {
+                flags |= FlagOverflow;
+            }
+            return result;
+        }
+
+        case 2:   // rcl
+        case 3: { // rcr
+            result = value;
+            carry = (flags & FlagCarry) != 0;
+            for (uint32_t i = 0; i < count; i++) {
+                if (operation == 2) {
+                    bool out = (result & sign) != 0;
+                    result = ((result << 1) | (carry ? 1 : 0)) & mask;
+                    carry = out;
+                } else {
+                    bool out = (result & 1) != 0;
+                    result = (result >> 1) | (carry ? sign : 0);
+                    carry = out;
+                }
+            }
+
+            flags &= ~(FlagCarry | FlagOverflow);
+            if (carry) {
+                flags |= FlagCarry;
+            }
+            if (((result & sign) != 0) != (operation == 2 ? carry : ((result << 1) & sign) != 0)) {
+                flags |= FlagOverflow;
+            }
+            return result;
+        }
+
+        case 4:   // shl
+        case 6: { // sal
+            carry = (count <= bits ? ((value >> (bits - count)) & 1) != 0 : false);
+            result = (count < bits ? (value << count) & mask : 0);
+
+            flags &= ~FlagsArithmetic;
+            if (carry) {
+                flags |= FlagCarry;
+            }
+            if (((result & sign) != 0) != carry) {
+                flags |= FlagOverflow;
+            }
+            break;
+        }
+
+        case 5: { // shr
+            carry = (count <= bits ? ((value >> (count - 1)) & 1) != 0 : false);
+            result = (count < bits ? (value >> count) : 0);
+
+            flags &= ~FlagsArithmetic;
+            if (carry) {
+                flags |= FlagCarry;
+            }
+            if (value & sign) {
+                flags |= FlagOverflow;
+            }
+            break;
+        }
+
+        default: { // sar
+            int64_t signed_value = SignExtend(value, size);
+            uint32_t n = (count < bits ? count : bits);
+            carry = ((signed_value >> (n - 1)) & 1) != 0;
+            result = (uint32_t)(signed_value >> (n < bits ? n : bits - 1)) & mask;
+
+            flags &= ~FlagsArithmetic;
+            if (carry) {
+                flags |= FlagCarry;
+            }
+            break;
+        }
+    }
+
+    SetResultFlags(result, size);
+    return result;
+}
+
+uint32_t Machine::IncDec(bool is_decrement, uint32_t value, uint32_t size)
+{
+    // Carry flag is not affected by inc/dec instructions
+    uint32_t carry = (flags & FlagCarry);
+    uint32_t result = Alu(is_decrement ? 5 : 0, value, 1, size);
+    flags = (flags & ~FlagCarry) | carry;
+    return result;
+}
+
+void Machine::SetResultFlags(uint32_t result, uint32_t size)
+{
+    if (result == 0) {
+        flags |= FlagZero;
+    }
+    if (result & SignBit(size)) {
+        flags |= FlagSign;
+    }
+
+    uint8_t parity = (uint8_t)result;
+    parity ^= (parity >> 4);
+    parity ^= (parity >> 2);
+    parity ^= (parity >> 1);
+    if (!(parity & 1)) {
+        flags |= FlagParity;
+    }
+}
+
+bool Machine::MulDiv(uint32_t operation, const Operand& operand, uint32_t size)
+{
+    uint32_t mask = SizeMask(size);
+    uint32_t bits = size * 8;
+    uint32_t src = ReadOperand(operand, size);
+
+    // Accumulator is AX for 8-bit operations, DX:AX or EDX:EAX otherwise
+    uint64_t acc;
+    if (size == 1) {
+        acc = GetRegister((uint32_t)Register::Ax, 2);
+    } else {
+        acc = ((uint64_t)GetRegister((uint32_t)Register::Dx, size) << bits) | GetRegister((uint32_t)Register::Ax, size);
+    }
+
+    uint64_t low, high;
+
+    switch (operation) {
+        case 4: { // mul
+            uint64_t result = (uint64_t)(acc & mask) * src;
+            low = result & mask;
+            high = (result >> bits) & mask;
+
+            flags &= ~(FlagCarry | FlagOverflow);
+            if (high != 0) {
+                flags |= (FlagCarry | FlagOverflow);
+            }
+            break;
+        }
+
+        case 5: { // imul
+            int64_t result = SignExtend((uint32_t)acc, size) * SignExtend(src, size);
+            low = (uint64_t)result & mask;
+            high = ((uint64_t)result >> bits) & mask;
+
+            flags &= ~(FlagCarry | FlagOverflow);
+            if (result != SignExtend((uint32_t)low, size)) {
+                flags |= (FlagCarry | FlagOverflow);
+            }
+            break;
+        }
+
+        case 6: { // div
+            if (src == 0) {
+                Fault("Divide by zero");
+                return false;
+            }
+
+            uint64_t quotient = acc / src;
+            if (quotient > mask) {
+                Fault("Divide overflow");
+                return false;
+            }
+
+            low = quotient;
+            high = acc % src;
+            break;
+        }
+
+        default: { // idiv
+            int64_t divisor = SignExtend(src, size);
+            if (divisor == 0) {
+                Fault("Divide by zero");
+                return false;
+            }
+
+            int64_t dividend;
+            switch (size) {
+                case 1: dividend = (int16_t)acc; break;
+                case 2: dividend = (int32_t)acc; break;
+                default: dividend = (int64_t)acc; break;
+            }
+
+            if (dividend == INT64_MIN && divisor == -1) {
+                Fault("Divide overflow");
+                return false;
+            }
+
+            int64_t quotient = dividend / divisor;
+            if (quotient > (int64_t)(mask >> 1) || quotient < -(int64_t)(mask >> 1) - 1) {
+                Fault("Divide overflow");
+                return false;
+            }
+
+            low = (uint64_t)quotient & mask;
+            high = (uint64_t)(dividend % divisor) & mask;
+            break;
+        }
+    }
+
+    if (size == 1) {
+        SetRegister((uint32_t)Register::Ax, (uint32_t)(low | (high << 8)), 2);
+    } else {
+        SetRegister((uint32_t)Register::Ax, (uint32_t)low, size);
+        SetRegister((uint32_t)Register::Dx, (uint32_t)high, size);
+    }
+
+    return true;
+}
+
+bool Machine::CheckCondition(uint32_t condition)
+{
+    bool cf = (flags & FlagCarry) != 0;
+    bool zf = (flags & FlagZero) != 0;
+    bool sf = (flags & FlagSign) != 0;
+    bool of = (flags & FlagOverflow) != 0;
+    bool pf = (flags & FlagParity) != 0;
+
+    bool result;
+    switch (condition >> 1) {
+        case 0: result = of; break;              // jo
+        case 1: result = cf; break;              // jb
+        case 2: result = zf; break;              // jz
+        case 3: result = (cf || zf); break;      // jbe
+        case 4: result = sf; break;              // js
+        case 5: result = pf; break;              // jp
+        case 6: result = (sf != of); break;      // jl
+        default: result = (zf || sf != of); break; // jle
+    }
+
+    // Odd conditions are negated
+    return ((condition & 1) ? !result : result);
+}
+
+void Machine::ExecuteGroup1(uint8_t opcode, uint32_t size)
+{
+    uint32_t operand_size = (opcode == 0x80 || opcode == 0x82 ? 1 : size);
+
+    uint8_t modrm = Fetch8();
+    uint32_t operation = (modrm >> 3) & 0x07;
+    Operand dst = DecodeModRm(modrm);
+
+    uint32_t value;
+    if (opcode == 0x83) {
+        value = (uint32_t)(int8_t)Fetch8();
+    } else {
+        value = FetchImmediate(operand_size);
+    }
+
+    uint32_t result = Alu(operation, ReadOperand(dst, operand_size), value, operand_size);
+    if (operation != 7) {
+        WriteOperand(dst, result, operand_size);
+        Charge(dst.is_register ? cycle_table.alu_reg_imm : cycle_table.alu_mem_imm);
+    } else {
+        Charge(dst.is_register ? cycle_table.alu_reg_imm : cycle_table.alu_reg_mem);
+    }
+}
+
+void Machine::ExecuteGroup2(uint8_t opcode, uint32_t size)
+{
+    uint8_t modrm = Fetch8();
+    uint32_t operation = (modrm >> 3) & 0x07;
+    Operand dst = DecodeModRm(modrm);
+
+    uint32_t count;
+    switch (opcode) {
+        case 0xC0:
+        case 0xC1: count = Fetch8(); break;
+        case 0xD2:
+        case 0xD3: count = GetRegister((uint32_t)Register::Cx, 1); break;
+        default: count = 1; break;
+    }
+
+    WriteOperand(dst, Shift(operation, ReadOperand(dst, size), count, size), size);
+    Charge(dst.is_register ? cycle_table.shift_reg : cycle_table.shift_mem);
+}
+
+void Machine::ExecuteGroup3(uint32_t size)
+{
+    uint8_t modrm = Fetch8();
+    uint32_t operation = (modrm >> 3) & 0x07;
+    Operand dst = DecodeModRm(modrm);
+
+    switch (operation) {
+        case 0:
+        case 1: { // test rm, imm
+            Alu(4, ReadOperand(dst, size), FetchImmediate(size), size);
+            Charge(dst.is_register ? cycle_table.alu_reg_imm : cycle_table.alu_reg_mem);
+            break;
+        }
+        case 2: { // not
+            WriteOperand(dst, ~ReadOperand(dst, size), size);
+            Charge(dst.is_register ? cycle_table.alu_reg_reg : cycle_table.alu_mem_reg);
+            break;
+        }
+        case 3: { // neg
+            uint32_t value = ReadOperand(dst, size);
+            WriteOperand(dst, Alu(5, 0, value, size), size);
+            Charge(dst.is_register ? cycle_table.alu_reg_reg : cycle_table.alu_mem_reg);
+            break;
+        }
+        default: { // mul, imul, div, idiv
+            if (!MulDiv(operation, dst, size)) {
+                return;
+            }
+
+            bool is_div = (operation >= 6);
+            switch (size) {
+                case 1: Charge(is_div ? cycle_table.div8 : cycle_table.mul8); break;
+                case 2: Charge(is_div ? cycle_table.div16 : cycle_table.mul16); break;
+                default: Charge(is_div ? cycle_table.div32 : cycle_table.mul32); break;
+            }
+            break;
+        }
+    }
+}
+
+void Machine::ExecuteGroup5(uint32_t size)
+{
+    uint8_t modrm = Fetch8();
+    uint32_t operation = (modrm >> 3) & 0x07;
+    Operand dst = DecodeModRm(modrm);
+
+    switch (operation) {
+        case 0:
+        case 1: // inc, dec
+            WriteOperand(dst, IncDec(operation == 1, ReadOperand(dst, size), size), size);
+            Charge(dst.is_register ? cycle_table.incdec_reg : cycle_table.incdec_mem);
+            break;
+        case 2: { // call rm
+            uint32_t target = ReadOperand(dst, size);
+            Push(ip, size);
+            ip = (uint16_t)target;
+            Charge(cycle_table.call);
+            break;
+        }
+        case 4: // jmp rm
+            ip = (uint16_t)ReadOperand(dst, size);
+            Charge(cycle_table.jump);
+            break;
+        case 6: // push rm
+            Push(ReadOperand(dst, size), size);
+            Charge(dst.is_register ? cycle_table.push : cycle_table.push + cycle_table.mov_reg_mem);
+            break;
+
+        default:
+            Fault("Unsupported instruction 0xFF /%d", operation);
+            break;
+    }
+}
+
+void Machine::ExecuteExtended(uint32_t size)
+{
+    uint8_t opcode = Fetch8();
+
+    // jcc rel16/32
+    if (opcode >= 0x80 && opcode <= 0x8F) {
+        uint32_t offset = FetchImmediate(size);
+        if (CheckCondition(opcode & 0x0F)) {
+            ip = (uint16_t)(ip + offset);
+            Charge(cycle_table.branch_taken);
+        } else {
+            Charge(cycle_table.branch_not_taken);
+        }
+        return;
+    }
+
+    // setcc rm8
+    if (opcode >= 0x90 && opcode <= 0x9F) {
+        Operand dst = DecodeModRm(Fetch8());
+        WriteOperand(dst, CheckCondition(opcode & 0x0F) ? 1 : 0, 1);
+        Charge(dst.is_register ? cycle_table.alu_reg_reg : cycle_table.mov_mem_reg);
+        return;
+    }
+
+    switch (opcode) {
+        case 0xAF: { // imul r, rm
+            uint8_t modrm = Fetch8();
+            Operand src = DecodeModRm(modrm);
+            uint32_t index = (modrm >> 3) & 0x07;
+            int64_t result = SignExtend(GetRegister(index, size), size) * SignExtend(ReadOperand(src, size), size);
+            SetRegister(index, (uint32_t)result, size);
+
+            flags &= ~(FlagCarry | FlagOverflow);
+            if (result != SignExtend((uint32_t)result, size)) {
+                flags |= (FlagCarry | FlagOverflow);
+            }
+            Charge(size == 4 ? cycle_table.mul32 : cycle_table.mul16);
+            break;
+        }
+
+        case 0xB6:
+        case 0xB7:
+        case 0xBE:
+        case 0xBF: { // movzx, movsx
+            uint32_t src_size = ((opcode & 0x01) ? 2 : 1);
+            uint8_t modrm = Fetch8();
+            Operand src = DecodeModRm(modrm);
+            uint32_t value = ReadOperand(src, src_size);
+            if (opcode >= 0xBE) {
+                value = (uint32_t)SignExtend(value, src_size);
+            }
+            SetRegister((modrm >> 3) & 0x07, value, size);
+            Charge(src.is_register ? cycle_table.movzx_reg : cycle_table.movzx_mem);
+            break;
+        }
+
+        default:
+            Fault("Unsupported instruction 0x0F 0x%02X", opcode);
+            break;
+    }
+}
+
+void Machine::ExecuteString(uint8_t opcode, uint32_t size)
+{
+    SegmentRegister src_segment = (segment_override != SegmentRegister::None ? segment_override : SegmentRegister::Ds);
+    int32_t step = ((flags & FlagDirection) ? -(int32_t)size : (int32_t)size);
+
+    for (;;) {
+        if (repeat_prefix && GetRegister((uint32_t)Register::Cx, 2) == 0) {
+            break;
+        }
+
+        uint16_t si = (uint16_t)registers[(uint32_t)Register::Si];
+        uint16_t di = (uint16_t)registers[(uint32_t)Register::Di];
+        bool is_compare = false;
+
+        switch (opcode & ~0x01) {
+            case 0xA4: // movs
+                Write(Linear(SegmentRegister::Es, di), Read(Linear(src_segment, si), size), size);
+                SetRegister((uint32_t)Register::Si, si + step, 2);
+                SetRegister((uint32_t)Register::Di, di + step, 2);
+                break;
+            case 0xA6: // cmps
+                Alu(7, Read(Linear(src_segment, si), size), Read(Linear(SegmentRegister::Es, di), size), size);
+                SetRegister((uint32_t)Register::Si, si + step, 2);
+                SetRegister((uint32_t)Register::Di, di + step, 2);
+                is_compare = true;
+                break;
+            case 0xAA: // stos
+                Write(Linear(SegmentRegister::Es, di), GetRegister(0, size), size);
+                SetRegister((uint32_t)Register::Di, di + step, 2);
+                break;
+            case 0xAC: // lods
+                SetRegister(0, Read(Linear(src_segment, si), size), size);
+                SetRegister((uint32_t)Register::Si, si + step, 2);
+                break;
+            default: // scas
+                Alu(7, GetRegister(0, size), Read(Linear(SegmentRegister::Es, di), size), size);
+                SetRegister((uint32_t)Register::Di, di + step, 2);
+                is_compare = true;
+                break;
+        }
+
+        Charge(cycle_table.string);
+
+        if (!repeat_prefix) {
+            break;
+        }
+
+        SetRegister((uint32_t)Register::Cx, GetRegister((uint32_t)Register::Cx, 2) - 1, 2);
+
+        // repe/repne terminates also on flag condition
+        if (is_compare) {
+            bool zf = (flags & FlagZero) != 0;
+            if ((repeat_prefix == 0xF3 && !zf) || (repeat_prefix == 0xF2 && zf)) {
+                break;
+            }
+        }
+    }
+}
+
+void Machine::Interrupt(uint8_t number)
+{
+    Charge(cycle_table.interrupt);
+
+    // Services are implemented natively, so no interrupt frame is created
+    switch (number) {
+        case 0x20: // Program Terminate
+            exit_code = 0;
+            state = MachineState::Exited;
+            break;
+        case 0x21: DosFunction(); break;
+
+        default:
+            Fault("Unsupported interrupt 0x%02X", number);
+            break;
+    }
+}
+
+void Machine::DosFunction()
+{
+    uint8_t function = (uint8_t)GetRegister(4 /*AH*/, 1);
+
+    switch (function) {
+        case 0x02: { // Character Output
+            fputc((int)GetRegister((uint32_t)Register::Dx, 1), output);
+            break;
+        }
+
+        case 0x09: { // Print String
+            uint16_t offset = (uint16_t)GetRegister((uint32_t)Register::Dx, 2);
+            for (uint32_t i = 0; i < 0x10000; i++) {
+                uint8_t c = Read8(Linear(SegmentRegister::Ds, (uint16_t)(offset + i)));
+                if (c == '$') {
+                    break;
+                }
+                fputc(c, output);
+            }
+            break;
+        }
+
+        case 0x0A: { // Buffered Keyboard Input
+            // Input is not echoed, terminal already does it if needed
+            fflush(output);
+
+            uint16_t offset = (uint16_t)GetRegister((uint32_t)Register::Dx, 2);
+            uint32_t buffer = Linear(SegmentRegister::Ds, offset);
+            uint8_t max_length = Read8(buffer);
+            if (max_length == 0) {
+                break;
+            }
+
+            // Last byte is always reserved for carriage return
+            uint8_t length = 0;
+            for (;;) {
+                int c = fgetc(input);
+                if (c == EOF || c == '\n') {
+                    break;
+                }
+                if (c == '\r') {
+                    continue;
+                }
+                if (length < max_length - 1) {
+                    Write8(Linear(SegmentRegister::Ds, (uint16_t)(offset + 2 + length)), (uint8_t)c);
+                    length++;
+                }
+            }
+
+            Write8(Linear(SegmentRegister::Ds, (uint16_t)(offset + 1)), length);
+            Write8(Linear(SegmentRegister::Ds, (uint16_t)(offset + 2 + length)), '\r');
+            break;
+        }
+
+        case 0x3C: DosCreateFile(); break;
+        case 0x3E: DosCloseFile(); break;
+        case 0x40: DosWriteFile(); break;
+        case 0x48: DosAllocate(); break;
+        case 0x49: DosRelease(); break;
+
+        case 0x4C: { // Terminate with Return Code
+            exit_code = (int32_t)GetRegister((uint32_t)Register::Ax, 1);
+            state = MachineState::Exited;
+            break;
+        }
+
+        default:
+            Fault("Unsupported DOS function 0x%02X", function);
+            break;
+    }
+}
+
+void Machine::DosAllocate()
+{
+    uint32_t requested = GetRegister((uint32_t)Register::Bx, 2);
+
+    // Find first free space that is large enough, blocks are sorted by segment
+    uint32_t candidate = PspSegment;
+    uint32_t largest = 0;
+    bool found = false;
+    for (auto& block : memory_blocks) {
+        if (block.first > candidate) {
+            uint32_t free_space = block.first - candidate;
+            if (free_space >= requested) {
+                found = true;
+                break;
+            }
+            if (largest < free_space) {
+                largest = free_space;
+            }
+        }
+
+        uint32_t block_end = (uint32_t)block.first + block.second;
+        if (candidate < block_end) {
+            candidate = block_end;
+        }
+    }
+
+    if (!found && candidate < TopSegment) {
+        uint32_t free_space = TopSegment - candidate;
+        if (free_space >= requested) {
+            found = true;
+        } else if (largest < free_space) {
+            largest = free_space;
+        }
+    }
+
+    if (!found) {
+        SetRegister((uint32_t)Register::Ax, 0x0008 /*Insufficient memory*/, 2);
+        SetRegister((uint32_t)Register::Bx, largest, 2);
+        flags |= FlagCarry;
+        return;
+    }
+
+    memory_blocks[(uint16_t)candidate] = (uint16_t)requested;
+
+    SetRegister((uint32_t)Register::Ax, candidate, 2);
+    flags &= ~FlagCarry;
+}
+
+void Machine::DosRelease()
+{
+    uint16_t segment = segments[(uint32_t)SegmentRegister::Es];
+
+    auto it = memory_blocks.find(segment);
+    if (it == memory_blocks.end()) {
+        SetRegister((uint32_t)Register::Ax, 0x0009 /*Invalid memory block address*/, 2);
+        flags |= FlagCarry;
+        return;
+    }
+
+    memory_blocks.erase(it);
+    flags &= ~FlagCarry;
+}
+
+void Machine::DosCreateFile()
+{
+    uint16_t offset = (uint16_t)GetRegister((uint32_t)Register::Dx, 2);
+
+    // Filename is ASCIIZ string, it's created relative to working directory of the emulator
+    std::string filename;
+    for (uint32_t i = 0; i < 128; i++) {
+        uint8_t c = Read8(Linear(SegmentRegister::Ds, (uint16_t)(offset + i)));
+        if (c == '\0') {
+            break;
+        }
+        filename += (char)c;
+    }
+
+    uint16_t handle = 5;
+    while (files.find(handle) != files.end()) {
+        handle++;
+    }
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        SetRegister((uint32_t)Register::Ax, 0x0003 /*Path not found*/, 2);
+        flags |= FlagCarry;
+        return;
+    }
+
+    files[handle] = file;
+
+    SetRegister((uint32_t)Register::Ax, handle, 2);
+    flags &= ~FlagCarry;
+}
+
+void Machine::DosWriteFile()
+{
+    uint16_t handle = (uint16_t)GetRegister((uint32_t)Register::Bx, 2);
+    uint16_t count = (uint16_t)GetRegister((uint32_t)Register::Cx, 2);
+    uint16_t offset = (uint16_t)GetRegister((uint32_t)Register::Dx, 2);
+
+    FILE* file;
+    switch (handle) {
+        case 1: file = output; break;
+        case 2: file = stderr; break;
+
+        default: {
+            auto it = files.find(handle);
+            if (it == files.end()) {
+                SetRegister((uint32_t)Register::Ax, 0x0006 /*Invalid handle*/, 2);
+                flags |= FlagCarry;
+                return;
+            }
+            file = it->second;
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        fputc(Read8(Linear(SegmentRegister::Ds, (uint16_t)(offset + i))), file);
+    }
+
+    SetRegister((uint32_t)Register::Ax, count, 2);
+    flags &= ~FlagCarry;
+}
+
+void Machine::DosCloseFile()
+{
+    uint16_t handle = (uint16_t)GetRegister((uint32_t)Register::Bx, 2);
+
+    auto it = files.find(handle);
+    if (it == files.end()) {
+        SetRegister((uint32_t)Register::Ax, 0x0006 /*Invalid handle*/, 2);
+        flags |= FlagCarry;
+        return;
+    }
+
+    fclose(it->second);
+    files.erase(it);
+    flags &= ~FlagCarry;
+}
+
+void Machine::Charge(uint32_t cycles)
+{
+    cycle_count += cycles;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "CycleTable.h"
+
+enum struct MachineState {
+    Running,
+    Exited,
+    Faulted,
+    InstructionLimit
+};
+
+enum struct Register : uint32_t {
+    Ax, Cx, Dx, Bx, Sp, Bp, Si, Di
+};
+
+enum struct SegmentRegister : uint32_t {
+    Es, Cs, Ss, Ds, Fs, Gs,
+
+    None
+};
+
+/// <summary>
+/// Effective address or register selected by ModR/M byte
+/// </summary>
+struct Operand {
+    bool is_register;
+    uint32_t index;             // Register index
+    uint32_t address;           // Linear address of memory operand
+};
+
+/// <summary>
+/// Real-mode i386 machine with minimal DOS services, it executes MZ executables
+/// produced by the compiler and counts retired instructions and estimated clock cycles.
+/// Only instructions and services that emitted programs can use are implemented,
+/// anything else stops the machine with fault.
+/// </summary>
+class Machine
+{
+public:
+    Machine(CpuModel model);
+    ~Machine();
+
+    /// <summary>
+    /// Load MZ executable into memory and prepare Program Segment Prefix
+    /// </summary>
+    /// <param name="image">Content of executable file</param>
+    /// <param name="command_tail">Command line passed to the program</param>
+    /// <returns>True if the executable was loaded successfully</returns>
+    bool Load(const std::vector<uint8_t>& image, const std::string& command_tail);
+
+    /// <summary>
+    /// Execute loaded program until it exits, faults or reaches instruction limit
+    /// </summary>
+    /// <param name="max_instructions">Maximum number of instructions to execute, zero for no limit</param>
+    /// <returns>Final state of the machine</returns>
+    MachineState Run(uint64_t max_instructions);
+
+    void SetInput(FILE* input);
+    void SetOutput(FILE* output);
+
+    uint64_t GetInstructionCount() const { return instruction_count; }
+    uint64_t GetCycleCount() const { return cycle_count; }
+    int32_t GetExitCode() const { return exit_code; }
+    const std::string& GetError() const { return error; }
+
+private:
+    void Step();
+    void Fault(const char* format, ...);
+
+    // Memory access
+    uint8_t Read8(uint32_t address);
+    uint16_t Read16(uint32_t address);
+    uint32_t Read32(uint32_t address);
+    uint32_t Read(uint32_t address, uint32_t size);
+    void Write8(uint32_t address, uint8_t value);
+    void Write16(uint32_t address, uint16_t value);
+    void Write32(uint32_t address, uint32_t value);
+    void Write(uint32_t address, uint32_t value, uint32_t size);
+
+    uint32_t Linear(SegmentRegister segment, uint16_t offset);
+
+    // Instruction stream
+    uint8_t Fetch8();
+    uint16_t Fetch16();
+    uint32_t Fetch32();
+    uint32_t FetchImmediate(uint32_t size);
+
+    // Registers
+    uint32_t GetRegister(uint32_t index, uint32_t size);
+    void SetRegister(uint32_t index, uint32_t value, uint32_t size);
+
+    Operand DecodeModRm(uint8_t modrm);
+    uint32_t ReadOperand(const Operand& operand, uint32_t size);
+    void WriteOperand(const Operand& operand, uint32_t value, uint32_t size);
+
+    void Push(uint32_t value, uint32_t size);
+    uint32_t Pop(uint32_t size);
+
+    // Arithmetic
+    uint32_t Alu(uint32_t operation, uint32_t a, uint32_t b, uint32_t size);
+    uint32_t Shift(uint32_t operation, uint32_t value, uint32_t count, uint32_t size);
+    uint32_t IncDec(bool is_decrement, uint32_t value, uint32_t size);
+    void SetResultFlags(uint32_t result, uint32_t size);
+    bool MulDiv(uint32_t operation, const Operand& operand, uint32_t size);
+    bool CheckCondition(uint32_t condition);
+
+    void ExecuteGroup1(uint8_t opcode, uint32_t size);
+    void ExecuteGroup2(uint8_t opcode, uint32_t size);
+    void ExecuteGroup3(uint32_t size);
+    void ExecuteGroup5(uint32_t size);
+    void ExecuteExtended(uint32_t size);
+    void ExecuteString(uint8_t opcode, uint32_t size);
+
+    // DOS services
+    void Interrupt(uint8_t number);
+    void DosFunction();
+    void DosAllocate();
+    void DosRelease();
+    void DosCreateFile();
+    void DosWriteFile();
+    void DosCloseFile();
+
+    void Charge(uint32_t cycles);
+
+    std::vector<uint8_t> memory;
+
+    uint32_t registers[8];
+    uint16_t segments[6];
+    uint16_t ip;
+    uint32_t flags;
+
+    // State of currently decoded instruction
+    SegmentRegister segment_override;
+    uint32_t repeat_prefix;
+    uint16_t instruction_ip;
+
+    // Memory blocks allocated through DOS, segment to paragraph count
+    std::map<uint16_t, uint16_t> memory_blocks;
+
+    // Files opened through DOS, standard handles are not included
+    std::map<uint16_t, FILE*> files;
+
+    const CycleTable& cycle_table;
+    uint64_t instruction_count = 0;
+    uint64_t cycle_count = 0;
+
+    MachineState state = MachineState::Running;
+    int32_t exit_code = 0;
+    std::string error;
+
+    FILE* input = stdin;
+    FILE* output = stdout;
+};
@@ -0,0 +1,136 @@
+// Real-mode i386 emulator for compiled programs
+//
+// Loads MZ executable produced by the compiler, runs it with minimal DOS services
+// and reports number of retired instructions and estimated clock cycles.
+// Only the standard library is used, so the emulator can run on any platform:
+//
+//   g++ -std=c++17 -O2 Emulator/*.cpp -o emulator
+//   ./emulator --cpu 486 program.exe arg1 arg2 < input.txt
+//
+// Output of the program goes to standard output, the report goes to standard error.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Machine.h"
+
+static void ShowUsage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [options] <program.exe> [arguments...]\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --cpu <386|486>              CPU model used to estimate clock cycles (default: 386)\n");
+    fprintf(stderr, "  --max-instructions <count>   Stop the program after specified number of instructions\n");
+    fprintf(stderr, "  --input <file>               Read standard input of the program from file\n");
+}
+
+static const char* StateToString(MachineState state)
+{
+    switch (state) {
+        case MachineState::Running: return "running";
+        case MachineState::Exited: return "exited";
+        case MachineState::Faulted: return "faulted";
+        case MachineState::InstructionLimit: return "instruction limit reached";
+
+        default: return "-";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    CpuModel model = CpuModel::i386;
+    uint64_t max_instructions = 0;
+    const char* input_filename = nullptr;
+    const char* program_filename = nullptr;
+    std::string command_tail;
+
+    for (int i = 1; i < argc; i++) {
+        if (program_filename) {
+            // DOS command tail starts with separator
+            command_tail += ' ';
+            command_tail += argv[i];
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "386") == 0) {
+                model = CpuModel::i386;
+            } else if (strcmp(argv[i], "486") == 0) {
+                model = CpuModel::i486;
+            } else {
+                fprintf(stderr, "Unknown CPU model \"%s\"\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--max-instructions") == 0 && i + 1 < argc) {
+            max_instructions = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_filename = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
+            ShowUsage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            program_filename = argv[i];
+        }
+    }
+
+    if (!program_filename) {
+        ShowUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream file(program_filename, std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "Cannot open file \"%s\"\n", program_filename);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint8_t> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    FILE* input = stdin;
+    if (input_filename) {
+        input = fopen(input_filename, "rb");
+        if (!input) {
+            fprintf(stderr, "Cannot open file \"%s\"\n", input_filename);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Machine machine(model);
+    machine.SetInput(input);
+    machine.SetOutput(stdout);
+
+    if (!machine.Load(image, command_tail)) {
+        fprintf(stderr, "%s\n", machine.GetError().c_str());
+        return EXIT_FAILURE;
+    }
+
+    MachineState state = machine.Run(max_instructions);
+
+    fflush(stdout);
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Program %s", StateToString(state));
+    if (state == MachineState::Exited) {
+        fprintf(stderr, " with code %d", machine.GetExitCode());
+    } else if (state == MachineState::Faulted) {
+        fprintf(stderr, ": %s", machine.GetError().c_str());
+    }
+    fprintf(stderr, "\n");
+
+    fprintf(stderr, "Instructions retired: %llu\n", (unsigned long long)machine.GetInstructionCount());
+    fprintf(stderr, "Estimated cycles (%s): %llu\n", (model == CpuModel::i486 ? "i486" : "i386"),
+        (unsigned long long)machine.GetCycleCount());
+
+    // Exit code of the program is forwarded, so the emulator can be used in scripts
+    return (state == MachineState::Exited ? machine.GetExitCode() : 255);
+}
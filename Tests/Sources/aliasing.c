@@ -0,0 +1,36 @@
+static uint32 g;
+static uint32<4> table;
+
+uint32 ReadG(uint32 unused) {
+    return g + unused;
+}
+
+uint8 Main() {
+    uint32* r = &g;
+    g = 4;
+    r[0] = 9;
+    PrintUint32(g);
+    PrintNewLine();
+
+    g = g + 1;
+    PrintUint32(r[0]);
+    PrintNewLine();
+
+    r[0] = 20;
+    PrintUint32(ReadG(0));
+    PrintNewLine();
+
+    uint32 local = 3;
+    uint32* p = &local;
+    local = local + 4;
+    p[0] = p[0] + 10;
+    PrintUint32(local);
+    PrintNewLine();
+
+    uint32* t = table;
+    table[1] = 5;
+    t[1] = t[1] * 2;
+    PrintUint32(table[1]);
+    PrintNewLine();
+    return 0;
+}
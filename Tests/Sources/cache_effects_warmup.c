@@ -0,0 +1,24 @@
+static uint32 total;
+
+uint32 Touch(uint32 n) {
+    return n + 1;
+}
+
+uint32 Accumulate(uint32 n) {
+    uint32 i = 0;
+    while (i < n) {
+        total = total + i;
+        Touch(i);
+        i = i + 1;
+    }
+    return total;
+}
+
+uint8 Main() {
+    total = 0;
+    PrintUint32(Accumulate(5));
+    PrintNewLine();
+    PrintUint32(total);
+    PrintNewLine();
+    return 0;
+}
@@ -0,0 +1,53 @@
+uint32 Increment(uint32 x) {
+    return x + 1;
+}
+
+uint32 Constant() {
+    return 42;
+}
+
+uint32 Third(uint32 a, uint32 b, uint32 c) {
+    return c;
+}
+
+uint32 Sum4(uint32 a, uint32 b, uint32 c, uint32 d) {
+    return a + b + c + d;
+}
+
+uint32 Busy(uint32 a, uint32 b, uint32 c, uint32 d) {
+    uint32 x = a + b;
+    uint32 y = c + d;
+    uint32 z = x + c;
+    uint32 w = y + a;
+    return x + y + z + w + c + d;
+}
+
+uint16 Weighted(uint16 a, uint16 b, uint16 c) {
+    uint16 result = c;
+    result = result - b;
+    result = result + a;
+    return result;
+}
+
+uint32 Outer(uint32 n) {
+    uint32 x = Increment(n);
+    return Sum4(x, Third(1, 2, n), Constant(), 1000);
+}
+
+uint8 Main() {
+    PrintUint32(Increment(9));
+    PrintNewLine();
+    PrintUint32(Constant());
+    PrintNewLine();
+    PrintUint32(Third(7, 8, 9));
+    PrintNewLine();
+    PrintUint32(Sum4(1, 20, 300, 4000));
+    PrintNewLine();
+    PrintUint32(Busy(1, 2, 3, 4));
+    PrintNewLine();
+    PrintUint32(Weighted(5, 10, 100));
+    PrintNewLine();
+    PrintUint32(Outer(5));
+    PrintNewLine();
+    return 0;
+}
@@ -0,0 +1,23 @@
+uint32 Twice(uint32 x);
+uint32 NextId();
+
+static uint32 counter;
+
+uint8 Main() {
+    uint32 i = 0;
+    counter = 20;
+    while (i < 3) {
+        PrintUint32(Twice(counter));
+        PrintNewLine();
+        counter = counter + 1;
+        i = i + 1;
+    }
+    PrintUint32(NextId());
+    PrintNewLine();
+    PrintUint32(NextId());
+    PrintNewLine();
+    PrintString("Static variables are separate: ");
+    PrintUint32(counter);
+    PrintNewLine();
+    return 0;
+}
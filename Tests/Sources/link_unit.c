@@ -0,0 +1,10 @@
+static uint32 counter;
+
+uint32 Twice(uint32 x) {
+    return x + x;
+}
+
+uint32 NextId() {
+    counter = counter + 100;
+    return counter;
+}
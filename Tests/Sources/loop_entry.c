@@ -0,0 +1,48 @@
+static uint32 total;
+
+uint32 CountDown(uint32 n) {
+    while (n > 3) {
+        n = n - 1;
+    }
+    return n;
+}
+
+uint32 StepUp(uint32 n, uint32 step) {
+    do {
+        n = n + step;
+    } while (n < 100);
+    return n;
+}
+
+uint32 SumTo(uint32 n) {
+    while (n > 0) {
+        total = total + n;
+        n = n - 1;
+    }
+    return total;
+}
+
+uint32 Restart(uint32 n) {
+again:
+    n = n + 7;
+    if (n < 50) {
+        goto again;
+    }
+    return n;
+}
+
+uint8 Main() {
+    PrintUint32(CountDown(10));
+    PrintNewLine();
+    PrintUint32(CountDown(2));
+    PrintNewLine();
+    PrintUint32(StepUp(1, 9));
+    PrintNewLine();
+    PrintUint32(StepUp(150, 1));
+    PrintNewLine();
+    PrintUint32(SumTo(10));
+    PrintNewLine();
+    PrintUint32(Restart(0));
+    PrintNewLine();
+    return 0;
+}
@@ -0,0 +1,96 @@
+uint32 Twice(uint32 x) {
+    return x + x;
+}
+
+uint32 Square(uint32 x) {
+    return x * x;
+}
+
+uint32 Multiply(uint32 a, uint32 b) {
+    return a * b;
+}
+
+uint32 Divide(uint32 a, uint32 b) {
+    return a / b;
+}
+
+uint32 Remainder(uint32 a, uint32 b) {
+    return a % b;
+}
+
+uint32 Shift(uint32 a, uint32 b) {
+    return a << b;
+}
+
+uint32 Difference(uint32 a, uint32 b) {
+    return b - a;
+}
+
+uint32 Sum3(uint32 a, uint32 b, uint32 c) {
+    return a + b + c;
+}
+
+uint32 Mix5(uint32 a, uint32 b, uint32 c, uint32 d, uint32 e) {
+    return a - b + c - d + e;
+}
+
+uint16 Narrow(uint8 a, uint16 b) {
+    uint16 result = a;
+    result = result + b;
+    return result;
+}
+
+uint32 Factorial(uint32 n);
+uint32 Fibonacci(uint32 n);
+uint32 Gcd(uint32 a, uint32 b);
+
+uint32 Factorial(uint32 n) {
+    if (n < 2) {
+        return 1;
+    }
+    return n * Factorial(n - 1);
+}
+
+uint32 Fibonacci(uint32 n) {
+    if (n < 2) {
+        return n;
+    }
+    return Fibonacci(n - 1) + Fibonacci(n - 2);
+}
+
+uint32 Gcd(uint32 a, uint32 b) {
+    if (b == 0) {
+        return a;
+    }
+    return Gcd(b, a % b);
+}
+
+uint8 Main() {
+    PrintUint32(Twice(4));
+    PrintNewLine();
+    PrintUint32(Square(12));
+    PrintNewLine();
+    PrintUint32(Multiply(6, 7));
+    PrintNewLine();
+    PrintUint32(Divide(100, 7));
+    PrintNewLine();
+    PrintUint32(Remainder(100, 7));
+    PrintNewLine();
+    PrintUint32(Shift(3, 4));
+    PrintNewLine();
+    PrintUint32(Difference(3, 10));
+    PrintNewLine();
+    PrintUint32(Sum3(1, 20, 300));
+    PrintNewLine();
+    PrintUint32(Mix5(50, 4, 30, 2, 1));
+    PrintNewLine();
+    PrintUint32(Narrow(200, 1000));
+    PrintNewLine();
+    PrintUint32(Factorial(10));
+    PrintNewLine();
+    PrintUint32(Fibonacci(15));
+    PrintNewLine();
+    PrintUint32(Gcd(1071, 462));
+    PrintNewLine();
+    return 0;
+}
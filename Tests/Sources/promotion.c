@@ -0,0 +1,146 @@
+static uint32 g;
+static uint32 h;
+static uint16 w;
+static uint8 b;
+static uint32 total;
+
+void Bump() {
+    g = g + 100;
+}
+
+uint32 Read() {
+    return g + 1;
+}
+
+uint32 Other(uint32 n) {
+    h = h + n;
+    return h;
+}
+
+uint32 Acc(uint32 n) {
+    uint32 i = 0;
+    while (i < n) {
+        g = g + i;
+        if (g > 1000) {
+            return i;
+        }
+        i = i + 1;
+    }
+    return 0;
+}
+
+uint32 Sum(uint32 n) {
+    uint32 i = 0;
+    while (i < n) {
+        g = g + i;
+        i = i + 1;
+        if (i == 3) {
+            Bump();
+        }
+        if (i == 5) {
+            h = Read();
+        }
+        Other(1);
+    }
+    return g;
+}
+
+uint32 Nested(uint32 n) {
+    uint32 i = 0;
+    while (i < n) {
+        uint16 j = 0;
+        while (j < n) {
+            w = w + j;
+            b = b + 1;
+            j = j + 1;
+        }
+        PrintUint32(w);
+        PrintNewLine();
+        i = i + 1;
+    }
+    return w + b;
+}
+
+uint32 ReadOnly(uint32 n) {
+    uint32 s = 0;
+    uint32 i = 0;
+    while (i < n) {
+        s = s + g;
+        s = s + g;
+        i = i + 1;
+    }
+    return s;
+}
+
+uint32 Loop2(uint32 n) {
+    while (n > 0) {
+        g = g + 2;
+        n = n - 1;
+    }
+    return n;
+}
+
+uint32 Pressure(uint32 n) {
+    uint32 a = 1;
+    uint32 b = 2;
+    uint32 c = 3;
+    uint32 d = 4;
+    uint32 i = 0;
+    total = 0;
+    while (i < n) {
+        a = a + i;
+        b = b + a;
+        c = c + (b / 3);
+        d = d + (c << 1);
+        total = total + a + b + c + d;
+        i = i + 1;
+        if (i == 2) {
+            PrintUint32(total);
+            PrintNewLine();
+        }
+    }
+    return a + b + c + d;
+}
+
+uint8 Main() {
+    uint32 i = 0;
+    g = 1;
+    h = 0;
+    Acc(10);
+    PrintUint32(g);
+    PrintNewLine();
+    Acc(100);
+    PrintUint32(g);
+    PrintNewLine();
+    g = 0;
+    PrintUint32(Sum(8));
+    PrintNewLine();
+    PrintUint32(g);
+    PrintNewLine();
+    PrintUint32(h);
+    PrintNewLine();
+    PrintUint32(Nested(3));
+    PrintNewLine();
+    g = 7;
+    PrintUint32(ReadOnly(4));
+    PrintNewLine();
+    Loop2(5);
+    PrintUint32(g);
+    PrintNewLine();
+    PrintUint32(Read());
+    PrintNewLine();
+    while (i < 5) {
+        h = h + g;
+        g = g + 1;
+        i = i + 1;
+    }
+    PrintUint32(h);
+    PrintNewLine();
+    PrintUint32(g);
+    PrintNewLine();
+    PrintUint32(Pressure(6));
+    PrintNewLine();
+    PrintUint32(total);
+    PrintNewLine();
+    return 0;
+}
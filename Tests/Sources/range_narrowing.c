@@ -0,0 +1,45 @@
+uint32 Scale(uint32 n) {
+    uint32 acc = 0;
+    uint32 i = 0;
+    while (i < 3) {
+        acc = n * acc;
+        i = i + 1;
+    }
+    return acc;
+}
+
+uint8 Main() {
+    uint32 zero = 0;
+    uint32 big = 100000;
+    uint32 small = 200;
+    uint32 other = 300;
+    uint32 r;
+
+    r = zero * 100000;
+    PrintUint32(r);
+    PrintNewLine();
+
+    r = zero * big;
+    PrintUint32(r);
+    PrintNewLine();
+
+    r = big * zero;
+    PrintUint32(r);
+    PrintNewLine();
+
+    PrintUint32(Scale(131072));
+    PrintNewLine();
+
+    r = small * other;
+    PrintUint32(r);
+    PrintNewLine();
+
+    r = small + other;
+    PrintUint32(r);
+    PrintNewLine();
+
+    r = big * 3;
+    PrintUint32(r);
+    PrintNewLine();
+    return 0;
+}
@@ -0,0 +1,54 @@
+static uint32 counter;
+static uint32 limit;
+
+uint32 ReadCounter(uint32 offset) {
+    return counter + offset;
+}
+
+uint32 Bump(uint32 by) {
+    counter = counter + by;
+    return counter;
+}
+
+uint32 Poke(uint32* target, uint32 value) {
+    target[0] = value;
+    return value;
+}
+
+uint8 Main() {
+    uint32 i;
+    uint32 sum = 0;
+
+    counter = 0;
+    for (i = 0; i < 5; ++i) {
+        counter = counter + 3;
+        sum = sum + ReadCounter(i);
+    }
+    PrintUint32(counter);
+    PrintNewLine();
+    PrintUint32(sum);
+    PrintNewLine();
+
+    counter = counter + 1;
+    i = Bump(4);
+    counter = counter + 1;
+    PrintUint32(i);
+    PrintNewLine();
+    PrintUint32(counter);
+    PrintNewLine();
+
+    uint32* p = &limit;
+    limit = 3;
+    limit = limit + 1;
+    Poke(p, 77);
+    PrintUint32(limit);
+    PrintNewLine();
+
+    uint32 local = 1;
+    uint32* q = &local;
+    local = local + 1;
+    Poke(q, 8);
+    PrintUint32(local);
+    PrintNewLine();
+    return 0;
+}
@@ -44,7 +44,7 @@ namespace Tests
             string sourcePath = (string)TestContext.DataRow["Source"];
             string expectedOutputPath = (string)TestContext.DataRow["Output"];
 
-            string args, inputPath;
+            string args, inputPath, build, warmupPath;
             int expectedExitCode;
             try {
                 args = (string)TestContext.DataRow["Args"];         // Optimal
@@ -52,6 +52,18 @@ namespace Tests
                 args = null;
             }
 
+            try {
+                build = (string)TestContext.DataRow["Build"];       // Optimal
+            } catch {
+                build = null;
+            }
+
+            try {
+                warmupPath = (string)TestContext.DataRow["Warmup"]; // Optimal
+            } catch {
+                warmupPath = null;
+            }
+
             try {
                 inputPath = (string)TestContext.DataRow["Input"];   // Optimal
             } catch {
@@ -73,7 +85,13 @@ namespace Tests
             string expectedOutput = File.ReadAllText(Path.Combine("Outputs", expectedOutputPath));
 
             // Compile source code
-            Compile(Path.Combine("Sources", sourcePath), targetPath);
+            if (build == "Objects") {
+                CompileObjects(sourcePath.Split(';'), targetPath);
+            } else if (build == "Cache") {
+                CompileWithCache(sourcePath, warmupPath, targetPath);
+            } else {
+                Compile(Path.Combine("Sources", sourcePath), targetPath);
+            }
 
             // Run compiled program
             string output, error;
@@ -101,11 +119,86 @@ namespace Tests
         }
 
         private void Compile(string sourcePath, string targetPath)
+        {
+            RunCompiler(Quote(sourcePath) + " " + Quote(targetPath));
+        }
+
+        private void CompileObjects(string[] sourcePaths, string targetPath)
+        {
+            // Each source is compiled to separate object file, then all of them are linked together
+            string objectPaths = "";
+            for (int i = 0; i < sourcePaths.Length; i++) {
+                string objectPath = "_tmp" + i + ".obj";
+                RunCompiler("--compile-only " + Quote(Path.Combine("Sources", sourcePaths[i])) + " " + Quote(objectPath));
+
+                objectPaths += " " + Quote(objectPath);
+            }
+
+            RunCompiler("--link " + Quote(targetPath) + objectPaths);
+
+            for (int i = 0; i < sourcePaths.Length; i++) {
+                try {
+                    File.Delete("_tmp" + i + ".obj");
+                } catch {
+                    // Nothing to do...
+                }
+            }
+        }
+
+        private void CompileWithCache(string sourcePath, string warmupPath, string targetPath)
+        {
+            const string functionCachePath = "_cache_functions";
+            const string outputCachePath = "_cache_outputs";
+            const string cachedTargetPath = "_tmp_cached.exe";
+
+            DeleteDirectory(functionCachePath);
+            DeleteDirectory(outputCachePath);
+
+            // Reference build without any cache
+            Compile(Path.Combine("Sources", sourcePath), targetPath);
+            byte[] expected = File.ReadAllBytes(targetPath);
+
+            string cacheArgs = "--function-cache " + Quote(functionCachePath) + " --output-cache " + Quote(outputCachePath) + " ";
+
+            // Warm-up source differs only in some functions, so the rest is reused from function cache
+            if (!string.IsNullOrEmpty(warmupPath)) {
+                RunCompiler(cacheArgs + Quote(Path.Combine("Sources", warmupPath)) + " " + Quote(cachedTargetPath));
+            }
+
+            // The first build fills the output cache, the second one is served from it
+            for (int i = 0; i < 2; i++) {
+                RunCompiler(cacheArgs + Quote(Path.Combine("Sources", sourcePath)) + " " + Quote(cachedTargetPath));
+
+                CollectionAssert.AreEqual(expected, File.ReadAllBytes(cachedTargetPath), "Cached build differs from clean build (pass " + (i + 1) + ").");
+            }
+
+            try {
+                File.Delete(cachedTargetPath);
+            } catch {
+                // Nothing to do...
+            }
+
+            DeleteDirectory(functionCachePath);
+            DeleteDirectory(outputCachePath);
+        }
+
+        private static void DeleteDirectory(string path)
+        {
+            try {
+                if (Directory.Exists(path)) {
+                    Directory.Delete(path, true);
+                }
+            } catch {
+                // Nothing to do...
+            }
+        }
+
+        private void RunCompiler(string arguments)
         {
             Process p = new Process {
                 StartInfo = new ProcessStartInfo {
                     FileName = "c-like-to-x86.exe",
-                    Arguments = "\"" + sourcePath.Replace("\"", "\\\"") + "\" \"" + targetPath.Replace("\"", "\\\"") + "\"",
+                    Arguments = arguments,
                     CreateNoWindow = true,
                     WindowStyle = ProcessWindowStyle.Hidden,
                     RedirectStandardInput = true,
@@ -132,6 +225,11 @@ namespace Tests
             Assert.AreEqual(0, p.ExitCode, "Compilation failed.");
         }
 
+        private static string Quote(string path)
+        {
+            return "\"" + path.Replace("\"", "\\\"") + "\"";
+        }
+
         private int CreateDosProcess(string target, string args, string stdin, out string stdout, out string stderr)
         {
             Process p = new Process {
@@ -0,0 +1,284 @@
+#include "CompileServer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+// Windows-specific includes
+#include "targetver.h"
+#include <windows.h>
+#include <shlwapi.h>
+
+#pragma comment(lib, "shlwapi")
+
+#include "Log.h"
+
+/// <summary>
+/// Max. size of one block in request, larger requests are refused
+/// </summary>
+static const uint32_t MaxBlockSize = 64 * 1024 * 1024;
+
+static bool ReadExact(HANDLE handle, void* data, uint32_t size)
+{
+    uint8_t* ptr = (uint8_t*)data;
+    while (size > 0) {
+        DWORD read;
+        if (!ReadFile(handle, ptr, size, &read, nullptr) || read == 0) {
+            return false;
+        }
+
+        ptr += read;
+        size -= read;
+    }
+
+    return true;
+}
+
+static bool WriteExact(HANDLE handle, const void* data, uint32_t size)
+{
+    const uint8_t* ptr = (const uint8_t*)data;
+    while (size > 0) {
+        DWORD written;
+        if (!WriteFile(handle, ptr, size, &written, nullptr) || written == 0) {
+            return false;
+        }
+
+        ptr += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+static bool ReadBlock(HANDLE handle, std::vector<uint8_t>& block)
+{
+    uint32_t size;
+    if (!ReadExact(handle, &size, sizeof(size)) || size > MaxBlockSize) {
+        return false;
+    }
+
+    block.resize(size);
+    return (size == 0 || ReadExact(handle, block.data(), size));
+}
+
+static bool WriteBlock(HANDLE handle, const void* data, uint32_t size)
+{
+    return WriteExact(handle, &size, sizeof(size)) && (size == 0 || WriteExact(handle, data, size));
+}
+
+CompileServer::CompileServer(Compiler* compiler)
+    : compiler(compiler)
+{
+}
+
+CompileServer::~CompileServer()
+{
+}
+
+int CompileServer::Run(const wchar_t* pipe_name)
+{
+    if (!pipe_name) {
+        // Stdout is used for responses, so log lines written outside of requests must go elsewhere,
+        // the buffered sink could flush them between two responses otherwise
+        Log::SetErrorOutput();
+
+        ServeConnection(GetStdHandle(STD_INPUT_HANDLE), GetStdHandle(STD_OUTPUT_HANDLE));
+        return EXIT_SUCCESS;
+    }
+
+    Log::Write(LogType::Info, "Compile server is waiting for requests...");
+    Log::PushIndent();
+
+    while (true) {
+        HANDLE pipe = CreateNamedPipe(pipe_name, PIPE_ACCESS_DUPLEX,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 64 * 1024, 64 * 1024, 0, nullptr);
+
+        if (pipe == INVALID_HANDLE_VALUE) {
+            Log::Write(LogType::Error, "Cannot create pipe for compile server");
+            return EXIT_FAILURE;
+        }
+
+        bool running = true;
+        if (ConnectNamedPipe(pipe, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED) {
+            running = ServeConnection(pipe, pipe);
+
+            FlushFileBuffers(pipe);
+            DisconnectNamedPipe(pipe);
+        }
+
+        CloseHandle(pipe);
+
+        if (!running) {
+            break;
+        }
+    }
+
+    Log::PopIndent();
+    Log::Write(LogType::Info, "Compile server was stopped");
+
+    return EXIT_SUCCESS;
+}
+
+bool CompileServer::ServeConnection(void* input_handle, void* output_handle)
+{
+    while (true) {
+        CompileServerCommand command;
+        if (!ReadExact(input_handle, &command, sizeof(command))) {
+            // Connection was closed
+            return true;
+        }
+
+        if (command == CompileServerCommand::Shutdown) {
+            return false;
+        }
+
+        CompileServerOptions options;
+        if (command != CompileServerCommand::Compile || !ReadBlock(input_handle, path) ||
+            !ReadExact(input_handle, &options, sizeof(options)) || !ReadBlock(input_handle, source) ||
+            options.target > (uint8_t)TargetPlatform::Linux || options.log_level > (uint8_t)LogType::Error) {
+            // Malformed request, drop the connection
+            return true;
+        }
+
+        // Set working directory, so include files are resolved relative to the source file
+        if (path.size() >= sizeof(wchar_t)) {
+            std::wstring directory((const wchar_t*)path.data(), path.size() / sizeof(wchar_t));
+            directory.push_back(L'\0');
+
+            if (PathRemoveFileSpec(&directory[0])) {
+                SetCurrentDirectory(directory.c_str());
+            }
+        }
+
+        diagnostics.clear();
+
+        // Source code is scanned in place, so it must be terminated by two zero bytes
+        uint32_t source_size = (uint32_t)source.size();
+        source.push_back(0);
+        source.push_back(0);
+
+        // Log level of the client is used only for this request
+        LogType min_type = Log::min_type;
+        Log::SetMinType((LogType)options.log_level);
+
+        Log::SetOutput(&diagnostics);
+        uint32_t exit_code = compiler->CompileBuffer((char*)source.data(), source_size,
+            (TargetPlatform)options.target, options.show_stats != 0, output);
+        Log::SetOutput(nullptr);
+
+        Log::SetMinType(min_type);
+
+        if (!WriteExact(output_handle, &exit_code, sizeof(exit_code)) ||
+            !WriteBlock(output_handle, output.data(), (uint32_t)output.size()) ||
+            !WriteBlock(output_handle, diagnostics.data(), (uint32_t)diagnostics.size())) {
+            return true;
+        }
+    }
+}
+
+int CompileServer::RunClient(const wchar_t* pipe_name, const CompileServerOptions& options, int argc, wchar_t* argv[])
+{
+    if (argc < 2) {
+        Log::Write(LogType::Error, "You must specify at least output filename!");
+        return EXIT_FAILURE;
+    }
+
+    FILE* input;
+    wchar_t* output_filename;
+    wchar_t input_path[MAX_PATH] { };
+
+    // Open input file
+    if (argc >= 3) {
+        errno_t err = _wfopen_s(&input, argv[1], L"rb");
+        if (err) {
+            char error[200];
+            strerror_s(error, err);
+            Log::Write(LogType::Error, "Error while opening input file: %s", error);
+            return EXIT_FAILURE;
+        }
+
+        // Server can run in different working directory
+        GetFullPathName(argv[1], MAX_PATH, input_path, nullptr);
+
+        output_filename = argv[2];
+    } else {
+        input = stdin;
+
+        output_filename = argv[1];
+    }
+
+    // Open output files
+    FILE* outputExe;
+    errno_t err = _wfopen_s(&outputExe, output_filename, L"wb");
+    if (err) {
+        char error[200];
+        strerror_s(error, err);
+        Log::Write(LogType::Error, "Error while creating output file: %s", error);
+        if (input != stdin) {
+            fclose(input);
+        }
+        return EXIT_FAILURE;
+    }
+
+    // Whole source code is sent in one request
+    std::vector<uint8_t> source;
+    {
+        uint8_t chunk[4096];
+        size_t read;
+        while ((read = fread(chunk, 1, sizeof(chunk), input)) > 0) {
+            source.insert(source.end(), chunk, chunk + read);
+        }
+    }
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    HANDLE pipe;
+    while (true) {
+        pipe = CreateFile(pipe_name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            break;
+        }
+
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipe(pipe_name, 10000)) {
+            Log::Write(LogType::Error, "Cannot connect to compile server");
+            fclose(outputExe);
+            return EXIT_FAILURE;
+        }
+    }
+
+    CompileServerCommand command = CompileServerCommand::Compile;
+    uint32_t exit_code = EXIT_FAILURE;
+    std::vector<uint8_t> output;
+    std::vector<uint8_t> diagnostics;
+
+    bool success = WriteExact(pipe, &command, sizeof(command)) &&
+        WriteBlock(pipe, input_path, (uint32_t)(wcslen(input_path) * sizeof(wchar_t))) &&
+        WriteExact(pipe, &options, sizeof(options)) &&
+        WriteBlock(pipe, source.data(), (uint32_t)source.size()) &&
+        ReadExact(pipe, &exit_code, sizeof(exit_code)) &&
+        ReadBlock(pipe, output) &&
+        ReadBlock(pipe, diagnostics);
+
+    CloseHandle(pipe);
+
+    if (!success) {
+        Log::Write(LogType::Error, "Communication with compile server failed");
+        fclose(outputExe);
+        return EXIT_FAILURE;
+    }
+
+    // Diagnostics are already formatted by the server
+    Log::Flush();
+    std::cout.write((const char*)diagnostics.data(), diagnostics.size());
+
+    if (output.size() > 0 && !fwrite(output.data(), output.size(), 1, outputExe)) {
+        Log::Write(LogType::Error, "Emitting of executable file failed.");
+        exit_code = EXIT_FAILURE;
+    }
+
+    fclose(outputExe);
+
+    return exit_code;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Compiler.h"
+
+/// <summary>
+/// Default name of the pipe that is used by compile server and its client
+/// </summary>
+#define CompileServerPipeName L"\\\\.\\pipe\\c-like-to-x86"
+
+enum struct CompileServerCommand : uint32_t {
+    Shutdown,
+    Compile
+};
+
+/// <summary>
+/// Options sent with each compile request, the server applies them only to that request.
+/// Options that are not listed here are refused by the client, the server would ignore them.
+/// </summary>
+struct CompileServerOptions {
+    uint8_t target;         // TargetPlatform
+    uint8_t log_level;      // LogType, the lowest type of returned diagnostics
+    uint8_t show_stats;
+    uint8_t reserved;
+};
+
+/// <summary>
+/// Long-running server that compiles source code from in-memory buffers,
+/// so process start-up and declaration of shared functions are done only once.
+///
+/// Request:  [uint32 command] [uint32 size, UTF-16 source path] [CompileServerOptions] [uint32 size, source code]
+/// Response: [uint32 exit code] [uint32 size, executable] [uint32 size, diagnostics]
+/// </summary>
+class CompileServer
+{
+public:
+    CompileServer(Compiler* compiler);
+    ~CompileServer();
+
+    /// <summary>
+    /// Serve compile requests until shutdown is requested
+    /// </summary>
+    /// <param name="pipe_name">Name of the pipe; or nullptr to use stdin/stdout</param>
+    /// <returns>Exit code</returns>
+    int Run(const wchar_t* pipe_name);
+
+    /// <summary>
+    /// Send compile request to running server, input and output filenames are the same as for standalone compiler
+    /// </summary>
+    /// <param name="pipe_name">Name of the pipe the server is listening on</param>
+    /// <param name="options">Options of the request</param>
+    /// <param name="argc">Argument count</param>
+    /// <param name="argv">Arguments</param>
+    /// <returns>Exit code</returns>
+    static int RunClient(const wchar_t* pipe_name, const CompileServerOptions& options, int argc, wchar_t* argv[]);
+
+private:
+    /// <summary>
+    /// Process all requests from one connection
+    /// </summary>
+    /// <param name="input_handle">Input handle</param>
+    /// <param name="output_handle">Output handle</param>
+    /// <returns>False if shutdown was requested</returns>
+    bool ServeConnection(void* input_handle, void* output_handle);
+
+    Compiler* compiler;
+
+    // These buffers are reused between requests
+    std::vector<uint8_t> path;
+    std::vector<uint8_t> source;
+    std::vector<uint8_t> output;
+    std::string diagnostics;
+};
@@ -0,0 +1,336 @@
+#include "CompileStats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+// Windows-specific includes
+#include "targetver.h"
+#include <windows.h>
+#include <psapi.h>
+
+#pragma comment(lib, "psapi")
+
+#include "Log.h"
+
+static std::atomic<uint64_t> allocation_count;
+
+// Allocations are counted for all phases, it's only one relaxed increment
+void* operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept
+{
+    free(ptr);
+}
+
+static uint64_t GetTimestamp()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)counter.QuadPart;
+}
+
+static void GetMemoryUsage(int64_t& private_bytes, uint64_t& peak_working_set)
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        private_bytes = 0;
+        peak_working_set = 0;
+        return;
+    }
+
+    private_bytes = (int64_t)counters.PagefileUsage;
+    peak_working_set = (uint64_t)counters.PeakWorkingSetSize;
+}
+
+CompileStats::CompileStats()
+{
+    Reset();
+}
+
+CompileStats::~CompileStats()
+{
+}
+
+void CompileStats::Reset()
+{
+    memset(phases, 0, sizeof(phases));
+    functions.clear();
+
+    current_phase = CompilePhase::Count;
+    current_function = -1;
+
+    instructions = 0;
+    symbols = 0;
+    spills = 0;
+    reloads = 0;
+    fixups = 0;
+    code_size = 0;
+    static_size = 0;
+    peak_working_set = 0;
+}
+
+void CompileStats::BeginPhase(CompilePhase phase)
+{
+    EndPhase();
+
+    current_phase = phase;
+
+    uint64_t peak;
+    GetMemoryUsage(phase_start_private_bytes, peak);
+    phase_start_allocations = allocation_count.load(std::memory_order_relaxed);
+    phase_start_time = GetTimestamp();
+}
+
+void CompileStats::EndPhase()
+{
+    if (current_phase == CompilePhase::Count) {
+        return;
+    }
+
+    uint64_t time = GetTimestamp();
+
+    int64_t private_bytes;
+    uint64_t peak;
+    GetMemoryUsage(private_bytes, peak);
+
+    // The same phase can be measured more than once (e.g. interactive mode)
+    CompilePhaseStats& stats = phases[(uint32_t)current_phase];
+    stats.time += (time - phase_start_time);
+    stats.allocations += (allocation_count.load(std::memory_order_relaxed) - phase_start_allocations);
+    stats.private_bytes += (private_bytes - phase_start_private_bytes);
+    stats.is_used = true;
+
+    if (peak_working_set < peak) {
+        peak_working_set = peak;
+    }
+
+    current_phase = CompilePhase::Count;
+}
+
+void CompileStats::BeginFunction(const char* name, uint32_t ip_dst)
+{
+    functions.push_back({ name, 0, 0, 0, 0, 0 });
+
+    current_function = (int32_t)(functions.size() - 1);
+    function_start_ip = ip_dst;
+}
+
+void CompileStats::EndFunction(uint32_t ip_dst)
+{
+    CompileFunctionStats* function = GetCurrentFunction();
+    if (!function) {
+        return;
+    }
+
+    function->emitted_bytes = (ip_dst - function_start_ip);
+
+    current_function = -1;
+}
+
+void CompileStats::AddInstruction()
+{
+    CompileFunctionStats* function = GetCurrentFunction();
+    if (function) {
+        function->instructions++;
+    }
+}
+
+void CompileStats::AddSpill()
+{
+    spills++;
+
+    CompileFunctionStats* function = GetCurrentFunction();
+    if (function) {
+        function->spills++;
+    }
+}
+
+void CompileStats::AddReload()
+{
+    reloads++;
+
+    CompileFunctionStats* function = GetCurrentFunction();
+    if (function) {
+        function->reloads++;
+    }
+}
+
+void CompileStats::AddFixup()
+{
+    fixups++;
+
+    CompileFunctionStats* function = GetCurrentFunction();
+    if (function) {
+        function->fixups++;
+    }
+}
+
+void CompileStats::SetProgramSize(uint32_t instructions, uint32_t symbols)
+{
+    this->instructions = instructions;
+    this->symbols = symbols;
+}
+
+void CompileStats::SetEmittedSize(uint32_t code_size, uint32_t static_size)
+{
+    this->code_size = code_size;
+    this->static_size = static_size;
+}
+
+void CompileStats::WriteReport()
+{
+    // Report was explicitly requested, so it's written even if informational messages are filtered out
+    LogType min_type = Log::min_type;
+    Log::SetMinType(LogType::Info);
+
+    Log::Write(LogType::Info, "Compilation statistics:");
+    Log::PushIndent();
+
+    Log::Write(LogType::Info, "%-26s %12s %12s %12s", "Phase", "Time [ms]", "Allocations", "Memory [kB]");
+
+    uint64_t total_time = 0;
+    uint64_t total_allocations = 0;
+    for (uint32_t i = 0; i < (uint32_t)CompilePhase::Count; i++) {
+        CompilePhaseStats& stats = phases[i];
+        if (!stats.is_used) {
+            continue;
+        }
+
+        Log::Write(LogType::Info, "%-26s %12.3f %12llu %+12lld", PhaseToString((CompilePhase)i),
+            TicksToMilliseconds(stats.time), stats.allocations, stats.private_bytes / 1024);
+
+        total_time += stats.time;
+        total_allocations += stats.allocations;
+    }
+
+    Log::Write(LogType::Info, "%-26s %12.3f %12llu", "Total", TicksToMilliseconds(total_time), total_allocations);
+    Log::Write(LogType::Info, "");
+
+    Log::Write(LogType::Info, "Peak working set: %llu kB", peak_working_set / 1024);
+    Log::Write(LogType::Info, "Intermediate instructions: %d, symbols: %d", instructions, symbols);
+    Log::Write(LogType::Info, "Spills: %d, reloads: %d, fixups: %d", spills, reloads, fixups);
+    Log::Write(LogType::Info, "Emitted %d bytes of code, %d bytes of static data", code_size, static_size);
+
+    if (!functions.empty()) {
+        Log::Write(LogType::Info, "");
+        Log::Write(LogType::Info, "%-24s %12s %8s %8s %8s %8s", "Function", "Instructions", "Bytes", "Spills", "Reloads", "Fixups");
+
+        for (auto& function : functions) {
+            Log::Write(LogType::Info, "%-24s %12d %8d %8d %8d %8d", function.name, function.instructions,
+                function.emitted_bytes, function.spills, function.reloads, function.fixups);
+        }
+    }
+
+    Log::PopIndent();
+
+    Log::SetMinType(min_type);
+}
+
+bool CompileStats::SaveJson(const wchar_t* filename)
+{
+    FILE* file;
+    if (_wfopen_s(&file, filename, L"wb")) {
+        Log::Write(LogType::Warning, "Statistics cannot be saved to file");
+        return false;
+    }
+
+    std::string json = ToJson();
+    bool success = (fwrite(json.data(), 1, json.size(), file) == json.size());
+
+    fclose(file);
+
+    return success;
+}
+
+std::string CompileStats::ToJson()
+{
+    std::string json = "{\n  \"phases\": [";
+
+    bool is_first = true;
+    for (uint32_t i = 0; i < (uint32_t)CompilePhase::Count; i++) {
+        CompilePhaseStats& stats = phases[i];
+        if (!stats.is_used) {
+            continue;
+        }
+
+        json += (is_first ? "\n" : ",\n");
+        json += tinyformat::format("    { \"name\": \"%s\", \"time_ms\": %.3f, \"allocations\": %llu, \"private_bytes\": %lld }",
+            PhaseToString((CompilePhase)i), TicksToMilliseconds(stats.time), stats.allocations, stats.private_bytes);
+        is_first = false;
+    }
+
+    json += "\n  ],\n";
+    json += tinyformat::format("  \"peak_working_set\": %llu,\n", peak_working_set);
+    json += tinyformat::format("  \"instructions\": %d,\n", instructions);
+    json += tinyformat::format("  \"symbols\": %d,\n", symbols);
+    json += tinyformat::format("  \"spills\": %d,\n", spills);
+    json += tinyformat::format("  \"reloads\": %d,\n", reloads);
+    json += tinyformat::format("  \"fixups\": %d,\n", fixups);
+    json += tinyformat::format("  \"code_size\": %d,\n", code_size);
+    json += tinyformat::format("  \"static_size\": %d,\n", static_size);
+    json += "  \"functions\": [";
+
+    is_first = true;
+    for (auto& function : functions) {
+        // Function names are identifiers, so they don't need to be escaped
+        json += (is_first ? "\n" : ",\n");
+        json += tinyformat::format("    { \"name\": \"%s\", \"instructions\": %d, \"emitted_bytes\": %d, \"spills\": %d, \"reloads\": %d, \"fixups\": %d }",
+            function.name, function.instructions, function.emitted_bytes, function.spills, function.reloads, function.fixups);
+        is_first = false;
+    }
+
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+CompileFunctionStats* CompileStats::GetCurrentFunction()
+{
+    if (current_function < 0) {
+        return nullptr;
+    }
+
+    return &functions[current_function];
+}
+
+const char* CompileStats::PhaseToString(CompilePhase phase)
+{
+    switch (phase) {
+        case CompilePhase::Parse: return "Parsing";
+        case CompilePhase::Postprocess: return "Postprocessing";
+        case CompilePhase::EmitInstructions: return "Emitting instructions";
+        case CompilePhase::EmitSharedFunctions: return "Emitting shared functions";
+        case CompilePhase::EmitStaticData: return "Emitting static data";
+        case CompilePhase::Link: return "Linking";
+        case CompilePhase::FixMzHeader: return "Finalizing executable";
+
+        default: return "-";
+    }
+}
+
+double CompileStats::TicksToMilliseconds(uint64_t ticks)
+{
+    static uint64_t frequency = 0;
+    if (!frequency) {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        frequency = (uint64_t)value.QuadPart;
+    }
+
+    return (double)ticks * 1000.0 / (double)frequency;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum struct CompilePhase : uint32_t {
+    Parse,
+    Postprocess,
+    EmitInstructions,
+    EmitSharedFunctions,
+    EmitStaticData,
+    Link,
+    FixMzHeader,
+
+    Count
+};
+
+struct CompilePhaseStats {
+    uint64_t time;              // In performance counter ticks
+    uint64_t allocations;       // Allocations made through operator new
+    int64_t private_bytes;      // Growth of private memory of the process
+
+    bool is_used;
+};
+
+struct CompileFunctionStats {
+    std::string name;
+
+    uint32_t instructions;      // Intermediate instructions
+    uint32_t emitted_bytes;
+    uint32_t spills;
+    uint32_t reloads;
+    uint32_t fixups;
+};
+
+/// <summary>
+/// Timing and counters of one compilation, split into phases and functions.
+/// All counters are plain increments and phases are sampled only at their boundaries,
+/// so the statistics are collected always, they are only reported on demand.
+/// </summary>
+class CompileStats
+{
+public:
+    CompileStats();
+    ~CompileStats();
+
+    /// <summary>
+    /// Clear all statistics, it's called at the beginning of every compilation
+    /// </summary>
+    void Reset();
+
+    /// <summary>
+    /// Start measuring specified phase, the previous phase is ended if needed
+    /// </summary>
+    /// <param name="phase">Phase</param>
+    void BeginPhase(CompilePhase phase);
+    void EndPhase();
+
+    /// <summary>
+    /// Start collecting counters of specified function
+    /// </summary>
+    /// <param name="name">Name of the function</param>
+    /// <param name="ip_dst">Current offset in output buffer</param>
+    void BeginFunction(const char* name, uint32_t ip_dst);
+    void EndFunction(uint32_t ip_dst);
+
+    void AddInstruction();
+    void AddSpill();
+    void AddReload();
+    void AddFixup();
+
+    void SetProgramSize(uint32_t instructions, uint32_t symbols);
+    void SetEmittedSize(uint32_t code_size, uint32_t static_size);
+
+    /// <summary>
+    /// Write all statistics as table to log
+    /// </summary>
+    void WriteReport();
+
+    /// <summary>
+    /// Write all statistics to file as JSON document
+    /// </summary>
+    /// <param name="filename">Path to file</param>
+    /// <returns>True if the file was written successfully</returns>
+    bool SaveJson(const wchar_t* filename);
+
+    std::string ToJson();
+
+private:
+    CompileFunctionStats* GetCurrentFunction();
+
+    static const char* PhaseToString(CompilePhase phase);
+    static double TicksToMilliseconds(uint64_t ticks);
+
+    CompilePhaseStats phases[(uint32_t)CompilePhase::Count];
+    std::vector<CompileFunctionStats> functions;
+
+    CompilePhase current_phase = CompilePhase::Count;
+    uint64_t phase_start_time = 0;
+    uint64_t phase_start_allocations = 0;
+    int64_t phase_start_private_bytes = 0;
+
+    int32_t current_function = -1;
+    uint32_t function_start_ip = 0;
+
+    uint32_t instructions = 0;
+    uint32_t symbols = 0;
+    uint32_t spills = 0;
+    uint32_t reloads = 0;
+    uint32_t fixups = 0;
+    uint32_t code_size = 0;
+    uint32_t static_size = 0;
+    uint64_t peak_working_set = 0;
+};
@@ -1,5 +1,6 @@
 #include "DosExeEmitter.h"
 
+#include <algorithm>
 #include <iostream>
 #include <list>
 #include <memory>
@@ -10,11 +11,20 @@
 #include "Log.h"
 #include "Compiler.h"
 #include "CompilerException.h"
+#include "ObjectFile.h"
 #include "SuppressRegister.h"
 
 // This emitter is using i386 architecture
 using namespace i386;
 
+char DosExeEmitter::ProfileCountersName[] = "#ProfileCounters";
+char DosExeEmitter::ProfileDumpName[] = "#ProfileDump";
+
+/// <summary>
+/// Max. number of profile counters, the whole table must be written by one DOS call
+/// </summary>
+static const uint32_t MaxProfileCounters = 0x4000;
+
 DosExeEmitter::DosExeEmitter(Compiler* compiler)
     : compiler(compiler)
 {
@@ -22,18 +32,11 @@ DosExeEmitter::DosExeEmitter(Compiler* compiler)
 
 DosExeEmitter::~DosExeEmitter()
 {
-    std::unordered_set<char*>::iterator it = strings.begin();
-
-    while (it != strings.end()) {
-        free(*it);
-
-        ++it;
-    }
-
-    strings.clear();
+    // Strings are owned by the compiler (or they point directly to source code),
+    // they are released at the end of the compilation
 }
 
-void DosExeEmitter::EmitMzHeader()
+void DosExeEmitter::EmitHeader()
 {
     int32_t header_size = sizeof(MzHeader);
 
@@ -65,7 +68,6 @@ void DosExeEmitter::EmitInstructions(InstructionEntry* instruction_stream)
 
     // Find IPs that are targets for "goto" statements,
     // at these places, compiler must unload all veriables from registers
-    std::unordered_set<uint32_t> discontinuous_ips;
     {
         InstructionEntry* current = instruction_stream;
         while (current) {
@@ -79,7 +81,8 @@ void DosExeEmitter::EmitInstructions(InstructionEntry* instruction_stream)
         }
     }
 
-    std::stack<InstructionEntry*> call_parameters;
+    instrument_profile = (compiler->GetProfileDataName() != nullptr);
+    profile = compiler->GetProfile();
 
     current_instruction = instruction_stream;
 
@@ -89,12 +92,52 @@ void DosExeEmitter::EmitInstructions(InstructionEntry* instruction_stream)
         ip_src++;
     }
 
-    while (current_instruction) {
+    EmitInstructionRange(symbol_table, INT32_MAX);
+
+    EmitFunctionEpilogue();
+
+    // Functions that were never executed according to the profile are placed
+    // after all other functions, so the hot code is more compact
+    if (!cold_functions.empty()) {
+        int32_t ip_stream_end = ip_src;
+
+        emitting_cold_functions = true;
+
+        std::list<DosDeferredFunction>::iterator it = cold_functions.begin();
+
+        while (it != cold_functions.end()) {
+            current_instruction = it->instruction;
+            ip_src = it->ip_src;
+
+            EmitInstructionRange(symbol_table, it->ip_end);
+
+            // Close the function at the end of the stream, so the mapping
+            // of the following (already emitted) function is not changed
+            current_instruction = nullptr;
+            ip_src = ip_stream_end;
+
+            EmitFunctionEpilogue();
+
+            ++it;
+        }
+    }
+
+    Log::PopIndent();
+    Log::PopIndent();
+}
+
+void DosExeEmitter::EmitInstructionRange(SymbolTableEntry* symbol_table, int32_t ip_end)
+{
+    std::stack<InstructionEntry*> call_parameters;
+
+    while (current_instruction && ip_src < ip_end) {
 
         // Unload all registers before "goto" statement target, so we can
         // jump to it without any issues
         if (discontinuous_ips.find(ip_src) != discontinuous_ips.end()) {
             SaveAndUnloadAllRegisters(SaveReason::Before);
+
+            is_block_entry = true;
         }
 
         // Used for abstract instruction to real instruction pointer conversion
@@ -110,6 +153,15 @@ void DosExeEmitter::EmitInstructions(InstructionEntry* instruction_stream)
 
         BackpatchAddresses();
 
+        // Count executions of basic block, it's placed after the prologue of function
+        if (is_block_entry) {
+            if (instrument_profile && parent) {
+                EmitProfileCounter(ProfileCounterType::Block, nullptr);
+            }
+
+            is_block_entry = false;
+        }
+
         was_return = false;
 
         switch (current_instruction->type) {
@@ -125,14 +177,16 @@ void DosExeEmitter::EmitInstructions(InstructionEntry* instruction_stream)
             default: ThrowOnUnreachableCode();
         }
 
+        compiler->GetStats()->AddInstruction();
+
+        // Fall-through path of conditional jump starts new basic block
+        if (current_instruction->type == InstructionType::If) {
+            is_block_entry = true;
+        }
+
         current_instruction = current_instruction->next;
         ip_src++;
     }
-
-    EmitFunctionEpilogue();
-
-    Log::PopIndent();
-    Log::PopIndent();
 }
 
 void DosExeEmitter::EmitSharedFunctions()
@@ -140,37 +194,19 @@ void DosExeEmitter::EmitSharedFunctions()
     Log::Write(LogType::Info, "Emitting shared functions...");
     Log::PushIndent();
 
-    SymbolTableEntry* symbol_table = compiler->GetSymbols();
-
     // This buffer is used for (almost) all I/O operations
     const int32_t io_buffer_size = 0x20; // 32 bytes
 
-    bool io_buffer_needed = false;
     uint16_t io_buffer_address = 0;
 
     // Check, if I/O buffer for read/print operations is needed
-    {
-        SymbolTableEntry* current = symbol_table;
-
-        while (current) {
-            if (current->type.base == BaseSymbolType::SharedFunction && current->ref_count > 0) {
-                // Process only referenced shared functions
-                if (strcmp(current->name, "PrintUint32") == 0  ||
-                    strcmp(current->name, "PrintNewLine") == 0 ||
-                    strcmp(current->name, "ReadUint32") == 0) {
-
-                    io_buffer_needed = true;
-                    break;
-                }
-            }
-
-            current = current->next;
-        }
-    }
+    bool io_buffer_needed = (IsSharedFunctionReferenced("PrintUint32")  ||
+                             IsSharedFunctionReferenced("PrintNewLine") ||
+                             IsSharedFunctionReferenced("ReadUint32"));
 
     // Buffer is needed, allocate space for it
     if (io_buffer_needed) {
-        io_buffer_address = ip_dst + 0x0100 /*Program Segment Prefix*/;
+        io_buffer_address = ip_dst + code_base;
 
         // ToDo: This could be allocated only on runtime
         uint8_t* buffer = AllocateBufferForInstruction(io_buffer_size);
@@ -379,162 +415,7 @@ void DosExeEmitter::EmitSharedFunctions()
         AsmProcLeaveNoArgs(0);
     });
 
-    EmitSharedFunction("GetCommandLine", [&]() {
-        //   mov si, (0x81 - 1)
-        LoadConstantToRegister(0x81 - 1, CpuRegister::SI, 2);
-
-        uint32_t loop1 = ip_dst;
-
-        // Go forward and find first non-whitespace character
-        //   inc si
-        uint8_t* l3 = AllocateBufferForInstruction(1);
-        l3[0] = ToOpR(0x40, CpuRegister::SI);   // inc r16
-
-        //   cmp [si], ' '
-        uint8_t* l4 = AllocateBufferForInstruction(2 + 1);
-        l4[0] = 0x80;   // cmp rm8, imm8
-        l4[1] = ToXrm(0, 7, 4);
-        l4[2] = ' ';
-
-        //   jz [loop1]
-        uint8_t* l5 = AllocateBufferForInstruction(1 + 1);
-        l5[0] = 0x74;   // jz rel8
-        l5[1] = (int8_t)(loop1 - ip_dst);
-
-        // Save starting address to AX
-        AsmMov(CpuRegister::AX, CpuRegister::SI, 2);
-
-        AsmDec(CpuRegister::SI, 2);
-
-        uint32_t loop2 = ip_dst;
-
-        // Go forward and find CR
-        AsmInc(CpuRegister::SI, 2);
-
-        //   cmp [si], '\r'
-        uint8_t* l9 = AllocateBufferForInstruction(2 + 1);
-        l9[0] = 0x80;   // cmp rm8, imm8
-        l9[1] = ToXrm(0, 7, 4);
-        l9[2] = '\r';
-
-        //   jnz [loop2]
-        uint8_t* l10 = AllocateBufferForInstruction(1 + 1);
-        l10[0] = 0x75;   // jnz rel8
-        l10[1] = (int8_t)(loop2 - ip_dst);
-
-        uint32_t loop3 = ip_dst;
-
-        // Go backward and find first non-whitespace character
-        AsmDec(CpuRegister::SI, 2);
-
-        //   cmp [si], ' '
-        uint8_t* l12 = AllocateBufferForInstruction(2 + 1);
-        l12[0] = 0x80;   // cmp rm8, imm8
-        l12[1] = ToXrm(0, 7, 4);
-        l12[2] = ' ';
-
-        //   jz [loop3]
-        uint8_t* l13 = AllocateBufferForInstruction(1 + 1);
-        l13[0] = 0x74;   // jz rel8
-        l13[1] = (int8_t)(loop3 - ip_dst);
-
-        AsmInc(CpuRegister::SI, 2);
-
-        //   mov [si], '\0'
-        uint8_t* l15 = AllocateBufferForInstruction(2 + 1);
-        l15[0] = 0xC6;   // mov rm8, imm8
-        l15[1] = ToXrm(0, 0, 4);
-        l15[2] = 0x00;   // '\0'
-
-        AsmProcLeaveNoArgs(0);
-    });
-
-    EmitSharedFunction("#StringsEqual", [&]() {
-        AsmProcEnter();
-
-        //   mov si, ss:[bp + 6]
-        uint8_t* l2 = AllocateBufferForInstruction(3);
-        l2[0] = 0x8B;   // mov r16, rm16
-        l2[1] = ToXrm(1, CpuRegister::SI, 6);
-        l2[2] = (int8_t)6;
-
-        //   mov di, ss:[bp + 8]
-        uint8_t* l3 = AllocateBufferForInstruction(3);
-        l3[0] = 0x8B;   // mov r16, rm16
-        l3[1] = ToXrm(1, CpuRegister::DI, 6);
-        l3[2] = (int8_t)8;
-
-        //   cmp si, di
-        uint8_t* l4 = AllocateBufferForInstruction(2);
-        l4[0] = 0x39;   // cmp rm16, r16
-        l4[1] = ToXrm(3, CpuRegister::DI, CpuRegister::SI);
-
-        //   jz [equal]
-        uint8_t* l5 = AllocateBufferForInstruction(1 + 1);
-        l5[0] = 0x74;   // jz rel8
-
-        uint32_t l5_ip = ip_dst;
-        uint32_t l5_offset = (l5 + 1) - buffer;
-
-        AsmDec(CpuRegister::DI, 2);
-
-        uint8_t loop = ip_dst;
-
-        AsmInc(CpuRegister::DI, 2);
-
-        //   lodsb
-        uint8_t* l8 = AllocateBufferForInstruction(1);
-        l8[0] = 0xAC;
-
-        //   cmp [di], al
-        uint8_t* l9 = AllocateBufferForInstruction(2);
-        l9[0] = 0x38;   // cmp rm8, r8
-        l9[1] = ToXrm(0, CpuRegister::AL, 5);
-
-        //   jnz [not_equal]
-        uint8_t* l10 = AllocateBufferForInstruction(1 + 1);
-        l10[0] = 0x75;  // jnz rel8
-        
-        uint32_t l10_ip = ip_dst;
-        uint32_t l10_offset = (l10 + 1) - buffer;
-
-        //   cmp al, 0
-        uint8_t* l11 = AllocateBufferForInstruction(2 + 1);
-        l11[0] = 0x80;  // cmp rm8, imm8
-        l11[1] = ToXrm(3, 7, CpuRegister::AL);
-        l11[2] = 0;
-
-        //   jnz [loop]
-        uint8_t* l12 = AllocateBufferForInstruction(1 + 1);
-        l12[0] = 0x75;  // jnz rel8
-        l12[1] = (int8_t)(loop - ip_dst);
-
-        // They are equal
-        uint32_t equal = ip_dst;
-        *(buffer + l5_offset) = (int8_t)(equal - l5_ip);
-
-        LoadConstantToRegister(1, CpuRegister::AL, 1);
-
-        //   jmp [end]
-        uint8_t* l14 = AllocateBufferForInstruction(1 + 1);
-        l14[0] = 0xEB;  // jmp rel8
-
-        uint32_t l14_ip = ip_dst;
-        uint32_t l14_offset = (l14 + 1) - buffer;
-
-        // They are not equal
-        // Backpatch "not_equal" jump, offset is known now
-        uint32_t not_equal = ip_dst;
-        *(buffer + l10_offset) = (int8_t)(not_equal - l10_ip);
-
-        ZeroRegister(CpuRegister::AL, 1);
-
-        // Backpatch "end" jump, offset is known now
-        uint32_t end = ip_dst;
-        *(buffer + l14_offset) = (int8_t)(end - l14_ip);
-
-        AsmProcLeave(4);
-    });
+    EmitCommonSharedFunctions();
 
     // ToDo: Release allocated block on failure
     // ToDo: Check (ptr + bytes) is fully accessible; if it's not, release and return null
@@ -649,7 +530,7 @@ void DosExeEmitter::EmitSharedFunctions()
         uint32_t ret_ptr = ip_dst;
         *(buffer + l17_offset) = (int8_t)(ret_ptr - l17_ip);
 
-        AsmProcLeave(2);
+        AsmProcLeave(4);
     });
 
     EmitSharedFunction("release", [&]() {
@@ -658,7 +539,7 @@ void DosExeEmitter::EmitSharedFunctions()
         //   mov ax, ss:[bp + 6]
         uint8_t* l2 = AllocateBufferForInstruction(3);
         l2[0] = 0x8B;   // mov r16, rm16
-        l2[1] = ToXrm(1, CpuRegister::BX, 6);
+        l2[1] = ToXrm(1, CpuRegister::AX, 6);
         l2[2] = (int8_t)6;
 
         // Convert pointer to segment
@@ -682,6 +563,10 @@ void DosExeEmitter::EmitSharedFunctions()
         AsmProcLeave(2);
     });
 
+    if (instrument_profile) {
+        EmitProfileDump();
+    }
+
     Log::PopIndent();
 }
 
@@ -704,128 +589,481 @@ void DosExeEmitter::EmitStaticData()
     }
 
     // Pre-allocate virtual space for all static variables
-    {
-        std::unordered_set<DosVariableDescriptor>::iterator it = variables.begin();
-
-        while (it != variables.end()) {
-            if (!it->symbol->parent) {
-                int32_t size;
-                if (it->symbol->size > 0) {
-                    SymbolType resolved_type = it->symbol->type;
-                    resolved_type.pointer--;
-                    size = it->symbol->size * compiler->GetSymbolTypeSize(resolved_type);
-                } else {
-                    size = compiler->GetSymbolTypeSize(it->symbol->type);
-                }
+    for (uint32_t i = 0; i < static_count; i++) {
+        SymbolTableEntry* symbol = variables[i].symbol;
+
+        int32_t size;
+        if (symbol->size > 0) {
+            SymbolType resolved_type = symbol->type;
+            resolved_type.pointer--;
+            size = symbol->size * compiler->GetSymbolTypeSize(resolved_type);
+        } else {
+            size = compiler->GetSymbolTypeSize(symbol->type);
+        }
 
-                BackpatchLabels({ it->symbol->name, ip_dst + static_size }, DosBackpatchTarget::Static);
+        BackpatchLabels({ symbol->name, ip_dst + static_size }, DosBackpatchTarget::Static);
 
-                static_size += size;
-            }
+        static_size += size;
+    }
+
+    for (const DosLinkedStatic& linked : linked_statics) {
+        BackpatchLabels({ linked.name, ip_dst + static_size }, DosBackpatchTarget::Static);
+
+        static_size += linked.size;
+    }
+
+    // Pre-allocate virtual space for profile counters
+    if (instrument_profile) {
+        uint32_t counter_count = compiler->GetProfileMap()->GetCounterCount();
+
+        BackpatchLabels({ ProfileCountersName, ip_dst + static_size }, DosBackpatchTarget::Static);
+
+        StoreOffset(buffer + profile_clear_offset, (int32_t)(counter_count * 2));
+
+        static_size += counter_count * sizeof(uint32_t);
+    }
+}
+
+void DosExeEmitter::ResolveRelocations()
+{
+    MoveRelocations();
+
+    Log::Write(LogType::Verbose, "Resolving %d relocations to %d functions...",
+        (int32_t)relocations.size(), (int32_t)function_symbols.size());
+
+    std::list<DosBackpatchInstruction>::iterator it = relocations.begin();
 
+    while (it != relocations.end()) {
+        std::unordered_map<std::string, int32_t>* symbols = FindLinkSymbols(it->target);
+        std::unordered_map<std::string, int32_t>::iterator symbol = symbols->find(it->value);
+        if (symbol != symbols->end()) {
+            ApplyBackpatch(*it, symbol->second);
+
+            compiler->GetStats()->AddFixup();
+
+            it = relocations.erase(it);
+        } else {
             ++it;
         }
     }
+
+    // Unresolved entries are reported when the executable is saved
+    backpatch.splice(backpatch.end(), relocations);
 }
 
-void DosExeEmitter::FixMzHeader(InstructionEntry* instruction_stream, uint32_t stack_size)
+void DosExeEmitter::CreateObject(ObjectUnit& unit)
 {
-    MzHeader* header = (MzHeader*)buffer;
-
-    Log::Write(LogType::Info, "Finalizing executable file...");
+    Log::Write(LogType::Info, "Creating object unit...");
     Log::PushIndent();
 
-    Log::Write(LogType::Verbose, "Program size: %d bytes", ip_dst);
-    Log::Write(LogType::Verbose, "Static size: %d bytes", static_size);
+    MoveRelocations();
 
-    // Compute image size
-    header->block_count = (ip_dst / 512);
-    header->last_block_size = (ip_dst % 512);
-    if (header->last_block_size > 0) {
-        header->block_count++;
-    }
+    // Code starts after the header
+    uint32_t code_offset = buffer_offset - ip_dst;
 
-    // Create stack
-    header->ss = ((ip_dst + static_size + 16 - 1) >> 4);
+    unit.code.assign(buffer + code_offset, buffer + buffer_offset);
 
-    if (stack_size >= 0x20 /*32B*/ && stack_size <= 0x8000 /*32kB*/) {
-        header->sp = stack_size;
-    } else {
-        header->sp = 0x2000; // 8kB is default stack size
+    unit.functions.clear();
+    for (const DosFunctionRange& range : function_ranges) {
+        unit.functions.push_back({ range.name, (uint32_t)range.begin, (uint32_t)range.end,
+            (uint32_t)range.entry_ip, range.is_entry_point });
     }
 
-    Log::Write(LogType::Verbose, "Stack size: %d bytes", header->sp);
-    Log::Write(LogType::Verbose, "Stack segment: 0x%04x", header->ss);
+    unit.relocations.clear();
+    for (const DosBackpatchInstruction& b : relocations) {
+        unit.relocations.push_back({ b.type, b.target, b.backpatch_offset - code_offset, (int32_t)b.backpatch_ip, b.value });
+    }
 
-    // Compute additional memory needed
-    header->min_extra_paragraphs = ((static_size + header->sp + 16 - 1) >> 4) + 1;
-    header->max_extra_paragraphs = header->min_extra_paragraphs;
+    std::sort(unit.relocations.begin(), unit.relocations.end(), [](const ObjectRelocation& a, const ObjectRelocation& b) {
+        return a.offset < b.offset;
+    });
 
-    // Adjust SP for flat memory model
-    header->sp += (header->ss << 4);
-    header->sp += 0x0100; // Program Segment Prefix
-    header->ss = 0;
+    unit.statics.clear();
+    for (uint32_t i = 0; i < static_count; i++) {
+        SymbolTableEntry* symbol = variables[i].symbol;
 
-    // Adjust start IP
-    if (instruction_stream && instruction_stream->type == InstructionType::Goto) {
-        header->ip = ip_src_to_dst[instruction_stream->goto_statement.ip];
+        int32_t size;
+        if (symbol->size > 0) {
+            SymbolType resolved_type = symbol->type;
+            resolved_type.pointer--;
+            size = symbol->size * compiler->GetSymbolTypeSize(resolved_type);
+        } else {
+            size = compiler->GetSymbolTypeSize(symbol->type);
+        }
+
+        unit.statics.push_back({ symbol->name, (uint32_t)size });
     }
 
-    Log::Write(LogType::Verbose, "Entry point: 0x%04x", header->ip);
+    Log::Write(LogType::Verbose, "Object unit contains %d functions with %d relocations",
+        (int32_t)unit.functions.size(), (int32_t)unit.relocations.size());
+
+    compiler->GetStats()->SetEmittedSize(ip_dst, 0);
+
+    relocations.clear();
 
     Log::PopIndent();
 }
 
-void DosExeEmitter::Save(FILE* stream)
+void DosExeEmitter::LinkObjects(std::vector<ObjectUnit>& units)
 {
-    if (buffer) {
-        if (buffer_offset > 0) {
-            CheckBackpatchListIsEmpty(DosBackpatchTarget::Function);
-            CheckBackpatchListIsEmpty(DosBackpatchTarget::String);
-            CheckBackpatchListIsEmpty(DosBackpatchTarget::Static);
+    Log::Write(LogType::Info, "Linking object units...");
+    Log::PushIndent();
 
-            if (!fwrite(buffer, buffer_offset, 1, stream)) {
-                Log::Write(LogType::Error, "Emitting of executable file failed.");
-            }
-        }
+    // Relocations of each function, they are sorted in the same order as functions
+    std::vector<std::vector<std::pair<size_t, size_t>>> function_relocations(units.size());
+    std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> definitions;
+    std::stack<std::pair<uint32_t, uint32_t>> pending;
+
+    for (uint32_t u = 0; u < units.size(); u++) {
+        ObjectUnit& unit = units[u];
+
+        size_t r = 0;
+        for (uint32_t f = 0; f < unit.functions.size(); f++) {
+            ObjectFunction& function = unit.functions[f];
+
+            while (r < unit.relocations.size() && unit.relocations[r].offset < function.begin) {
+                r++;
+            }
+            size_t first = r;
+            while (r < unit.relocations.size() && unit.relocations[r].offset < function.end) {
+                r++;
+            }
+            function_relocations[u].push_back({ first, r });
+
+            if (!definitions.emplace(function.name, std::make_pair(u, f)).second) {
+                std::string message = "Duplicate function definition for \"";
+                message += function.name;
+                message += "\"";
+                throw CompilerException(CompilerExceptionSource::Declaration, message);
+            }
+
+            if (function.is_entry_point) {
+                pending.push({ u, f });
+            }
+        }
+    }
+
+    if (pending.size() != 1) {
+        throw CompilerException(CompilerExceptionSource::Declaration,
+            pending.empty() ? "Entry point not found" : "Duplicate entry point");
+    }
+
+    // Only functions reachable from the entry point are placed to the executable
+    std::vector<std::vector<bool>> is_used(units.size());
+    for (uint32_t u = 0; u < units.size(); u++) {
+        is_used[u].resize(units[u].functions.size());
+    }
+
+    do {
+        std::pair<uint32_t, uint32_t> current = pending.top();
+        pending.pop();
+
+        if (is_used[current.first][current.second]) {
+            continue;
+        }
+
+        is_used[current.first][current.second] = true;
+
+        ObjectUnit& unit = units[current.first];
+        std::pair<size_t, size_t> range = function_relocations[current.first][current.second];
+        for (size_t r = range.first; r < range.second; r++) {
+            ObjectRelocation& relocation = unit.relocations[r];
+            if (relocation.target != DosBackpatchTarget::Function) {
+                continue;
+            }
+
+            auto definition = definitions.find(relocation.name);
+            if (definition != definitions.end()) {
+                pending.push(definition->second);
+                continue;
+            }
+
+            // Shared functions are emitted only once for all units
+            SymbolTableEntry* symbol = compiler->FindSymbolByName(relocation.name.c_str());
+            if (symbol && symbol->type.base == BaseSymbolType::SharedFunction) {
+                symbol->ref_count++;
+            }
+        }
+    } while (!pending.empty());
+
+    // Copy all used functions, unresolved references are reported when the executable is saved
+    std::unordered_set<std::string> string_names;
+
+    for (uint32_t u = 0; u < units.size(); u++) {
+        ObjectUnit& unit = units[u];
+
+        std::unordered_map<std::string, char*> static_names;
+        for (ObjectStatic& variable : unit.statics) {
+            linked_names.push_back(variable.name + "@" + std::to_string(u));
+            char* name = &linked_names.back()[0];
+
+            static_names[variable.name] = name;
+            linked_statics.push_back({ name, (int32_t)variable.size });
+        }
+
+        for (uint32_t f = 0; f < unit.functions.size(); f++) {
+            ObjectFunction& function = unit.functions[f];
+
+            if (!is_used[u][f]) {
+                Log::Write(LogType::Info, "Function \"%s\" was optimized out", function.name.c_str());
+                continue;
+            }
+
+            int32_t delta = ip_dst - (int32_t)function.begin;
+
+            uint32_t size = function.end - function.begin;
+            uint8_t* dst = AllocateBufferForInstruction(size);
+            memcpy(dst, unit.code.data() + function.begin, size);
+
+            int32_t entry_ip = (int32_t)function.entry + delta;
+            function_symbols.emplace(function.name, entry_ip);
+
+            if (function.is_entry_point) {
+                linked_entry_ip = entry_ip;
+            }
+
+            std::pair<size_t, size_t> range = function_relocations[u][f];
+            for (size_t r = range.first; r < range.second; r++) {
+                ObjectRelocation& relocation = unit.relocations[r];
+
+                DosBackpatchInstruction b { };
+                b.type = relocation.type;
+                b.target = relocation.target;
+                b.backpatch_offset = (uint32_t)((int32_t)relocation.offset + delta + (buffer_offset - ip_dst));
+                b.backpatch_ip = (uint32_t)(relocation.ip + delta);
+                b.value = &relocation.name[0];
+
+                if (b.target == DosBackpatchTarget::Static) {
+                    auto name = static_names.find(relocation.name);
+                    if (name != static_names.end()) {
+                        b.value = name->second;
+                    }
+                } else if (b.target == DosBackpatchTarget::String) {
+                    // Equal strings of all units share the same copy
+                    if (string_names.insert(relocation.name).second) {
+                        strings.insert(b.value);
+                    }
+                }
+
+                relocations.push_back(b);
+            }
+        }
+    }
+
+    Log::PopIndent();
+}
+
+uint32_t DosExeEmitter::GetEntryIp(InstructionEntry* instruction_stream)
+{
+    if (linked_entry_ip >= 0) {
+        return (uint32_t)linked_entry_ip;
+    }
+
+    if (instruction_stream && instruction_stream->type == InstructionType::Goto) {
+        return ip_src_to_dst[instruction_stream->goto_statement.ip];
+    }
+
+    return 0;
+}
+
+void DosExeEmitter::FixHeader(InstructionEntry* instruction_stream, uint32_t stack_size)
+{
+    MzHeader* header = (MzHeader*)buffer;
+
+    Log::Write(LogType::Info, "Finalizing executable file...");
+    Log::PushIndent();
+
+    Log::Write(LogType::Verbose, "Program size: %d bytes", ip_dst);
+    Log::Write(LogType::Verbose, "Static size: %d bytes", static_size);
+
+    compiler->GetStats()->SetEmittedSize(ip_dst, static_size);
+
+    // Compute image size, it includes the header, otherwise loader would truncate the end of the program
+    header->block_count = (buffer_offset / 512);
+    header->last_block_size = (buffer_offset % 512);
+    if (header->last_block_size > 0) {
+        header->block_count++;
+    }
+
+    // Create stack
+    header->ss = ((ip_dst + static_size + 16 - 1) >> 4);
+
+    if (stack_size >= 0x20 /*32B*/ && stack_size <= 0x8000 /*32kB*/) {
+        header->sp = stack_size;
+    } else {
+        header->sp = 0x2000; // 8kB is default stack size
+    }
+
+    Log::Write(LogType::Verbose, "Stack size: %d bytes", header->sp);
+    Log::Write(LogType::Verbose, "Stack segment: 0x%04x", header->ss);
+
+    // Compute additional memory needed
+    header->min_extra_paragraphs = ((static_size + header->sp + 16 - 1) >> 4) + 1;
+    header->max_extra_paragraphs = header->min_extra_paragraphs;
+
+    // Adjust SP for flat memory model
+    header->sp += (header->ss << 4);
+    header->sp += 0x0100; // Program Segment Prefix
+    header->ss = 0;
+
+    // Adjust start IP
+    header->ip = GetEntryIp(instruction_stream);
+
+    Log::Write(LogType::Verbose, "Entry point: 0x%04x", header->ip);
+
+    Log::PopIndent();
+}
+
+void DosExeEmitter::Save(FILE* stream)
+{
+    if (buffer) {
+        if (buffer_offset > 0) {
+            CheckBackpatchListIsEmpty(DosBackpatchTarget::Function);
+            CheckBackpatchListIsEmpty(DosBackpatchTarget::String);
+            CheckBackpatchListIsEmpty(DosBackpatchTarget::Static);
+
+            if (!fwrite(buffer, buffer_offset, 1, stream)) {
+                Log::Write(LogType::Error, "Emitting of executable file failed.");
+            }
+        }
+
+        free(buffer);
+        buffer = nullptr;
+    }
+}
+
+void DosExeEmitter::Save(std::vector<uint8_t>& output)
+{
+    output.clear();
+
+    if (buffer) {
+        if (buffer_offset > 0) {
+            CheckBackpatchListIsEmpty(DosBackpatchTarget::Function);
+            CheckBackpatchListIsEmpty(DosBackpatchTarget::String);
+            CheckBackpatchListIsEmpty(DosBackpatchTarget::Static);
+
+            output.insert(output.end(), buffer, buffer + buffer_offset);
+        }
 
         free(buffer);
         buffer = nullptr;
     }
 }
 
+void DosExeEmitter::ReserveOutput(uint32_t size)
+{
+    if (size > 0) {
+        ReserveBuffer(size);
+    }
+}
+
 void DosExeEmitter::CreateVariableList(SymbolTableEntry* symbol_table)
 {
+    // Add all variables to the list, so they
+    // can be referenced by the compiler
+    std::vector<SymbolTableEntry*> locals;
+    std::unordered_map<std::string, uint32_t> local_count;
+
+    variables.clear();
+    static_index.clear();
+    function_variables.clear();
+
     SymbolTableEntry* current = symbol_table;
 
     while (current) {
         if (TypeIsValid(current->type)) {
-            // Add all variables to the list, so they
-            // can be referenced by the compiler
-            DosVariableDescriptor variable { };
-            variable.symbol = current;
-            variable.reg = CpuRegister::None;
-            variables.push_back(variable);
+            if (current->parent) {
+                locals.push_back(current);
+                local_count[current->parent]++;
+            } else {
+                DosVariableDescriptor variable { };
+                variable.symbol = current;
+                variable.reg = CpuRegister::None;
+                static_index.emplace(current->name, (uint32_t)variables.size());
+                variables.push_back(variable);
+            }
         }
 
         current = current->next;
     }
+
+    static_count = (uint32_t)variables.size();
+
+    // Reserve contiguous range for each function, variables keep their order from the symbol table
+    uint32_t end = static_count;
+    for (const std::pair<const std::string, uint32_t>& function : local_count) {
+        function_variables[function.first] = { end, end };
+        end += function.second;
+    }
+
+    variables.resize(end);
+
+    for (SymbolTableEntry* symbol : locals) {
+        DosVariableRange& range = function_variables[symbol->parent];
+
+        DosVariableDescriptor& variable = variables[range.end++];
+        variable.symbol = symbol;
+        variable.reg = CpuRegister::None;
+    }
 }
 
-CpuRegister DosExeEmitter::GetUnusedRegister()
+void DosExeEmitter::BindParentVariables(SymbolTableEntry* function)
 {
-    // First four 32-bit registers are generally usable
-    DosVariableDescriptor* register_used[4] { };
+    std::unordered_map<std::string, DosVariableRange>::iterator it = function_variables.find(function->name);
+    if (it != function_variables.end()) {
+        parent_variables = it->second;
+    } else {
+        parent_variables = { static_count, static_count };
+    }
 
-    std::list<DosVariableDescriptor>::iterator it = variables.begin();
+    parent_points_to = compiler->GetPointsTo()->Find(function->name);
 
-    while (it != variables.end()) {
-        if (it->reg != CpuRegister::None && (!it->symbol->parent || (it->symbol->parent && strcmp(it->symbol->parent, parent->name) == 0))) {
-            register_used[(int32_t)it->reg] = &(*it);
+    promoted_static = nullptr;
+    is_promoted_static_written = false;
+
+    parent_index.clear();
+    for (uint32_t i = parent_variables.begin; i < parent_variables.end; i++) {
+        parent_index.emplace(variables[i].symbol->name, i);
+
+        // Variable can be read through pointer anywhere in the function, so its stores must be kept
+        if (compiler->GetPointsTo()->IsAddressTaken(parent_points_to, variables[i].symbol)) {
+            variables[i].force_save = true;
         }
+    }
 
-        ++it;
+    // Registers are not preserved across functions, static variables were written back on return
+    for (uint32_t i = 0; i < static_count; i++) {
+        variables[i].reg = CpuRegister::None;
+        variables[i].is_dirty = false;
+    }
+
+    for (DosVariableDescriptor*& owner : register_owner) {
+        owner = nullptr;
+    }
+}
+
+void DosExeEmitter::SetVariableRegister(DosVariableDescriptor* var, CpuRegister reg)
+{
+    if (var->reg != CpuRegister::None && register_owner[(int32_t)var->reg] == var) {
+        register_owner[(int32_t)var->reg] = nullptr;
+    }
+
+    var->reg = reg;
+
+    if (reg != CpuRegister::None) {
+        DosVariableDescriptor*& owner = register_owner[(int32_t)reg];
+        if (owner && owner != var) {
+            // Register was overwritten, previous value is not valid anymore
+            owner->reg = CpuRegister::None;
+        }
+        owner = var;
     }
+}
+
+CpuRegister DosExeEmitter::GetUnusedRegister()
+{
+    // First four 32-bit registers are generally usable
+    DosVariableDescriptor** register_used = register_owner;
 
     DosVariableDescriptor* last_used = nullptr;
 
@@ -837,14 +1075,29 @@ CpuRegister DosExeEmitter::GetUnusedRegister()
 
         if (!register_used[i]) {
             // Register is empty (it was not used yet in this scope)
+            if ((CpuRegister)i == CpuRegister::BX) {
+                parent_uses_bx = true;
+            }
             return (CpuRegister)i;
         }
 
-        if (!last_used || last_used->last_used > register_used[i]->last_used) {
+        if (register_used[i] == promoted_static && (CpuRegister)i == CpuRegister::BX) {
+            // Promoted static variable is unloaded only if there is no other choice
+            continue;
+        }
+
+        // Variables with less executed references are unloaded first (if profile is used),
+        // then the least recently used one
+        if (!last_used || last_used->weight > register_used[i]->weight ||
+            (last_used->weight == register_used[i]->weight && last_used->last_used > register_used[i]->last_used)) {
             last_used = register_used[i];
         }
     }
 
+    if (!last_used) {
+        last_used = register_used[(int32_t)CpuRegister::BX];
+    }
+
     CpuRegister reg = last_used->reg;
 
     // Register was used, save it back to the stack and discard it
@@ -852,7 +1105,7 @@ CpuRegister DosExeEmitter::GetUnusedRegister()
         SaveVariable(last_used, SaveReason::Inside);
     }
 
-    last_used->reg = CpuRegister::None;
+    SetVariableRegister(last_used, CpuRegister::None);
     last_used->is_dirty = false;
 
     return reg;
@@ -861,17 +1114,7 @@ CpuRegister DosExeEmitter::GetUnusedRegister()
 CpuRegister DosExeEmitter::TryGetUnusedRegister()
 {
     // First four 32-bit registers are generally usable
-    DosVariableDescriptor* register_used[4] { };
-
-    std::list<DosVariableDescriptor>::iterator it = variables.begin();
-
-    while (it != variables.end()) {
-        if (it->reg != CpuRegister::None && (!it->symbol->parent || (it->symbol->parent && strcmp(it->symbol->parent, parent->name) == 0))) {
-            register_used[(int32_t)it->reg] = &(*it);
-        }
-
-        ++it;
-    }
+    DosVariableDescriptor** register_used = register_owner;
 
     for (int32_t i = 0; i < 4; i++) {
         if (suppressed_registers.find((CpuRegister)i) != suppressed_registers.end()) {
@@ -881,6 +1124,9 @@ CpuRegister DosExeEmitter::TryGetUnusedRegister()
 
         if (!register_used[i]) {
             // Register is empty (it was not used yet in this scope)
+            if ((CpuRegister)i == CpuRegister::BX) {
+                parent_uses_bx = true;
+            }
             return (CpuRegister)i;
         }
     }
@@ -891,34 +1137,30 @@ CpuRegister DosExeEmitter::TryGetUnusedRegister()
 
 DosVariableDescriptor* DosExeEmitter::FindVariableByName(char* name)
 {
-    // Search in function-local variables
-    {
-        std::list<DosVariableDescriptor>::iterator it = variables.begin();
+    DosVariableDescriptor* var = TryFindVariableByName(name);
+    if (!var) {
+        // Variable cannot be found
+        ThrowOnUnreachableCode();
+    }
 
-        while (it != variables.end()) {
-            if (it->symbol->parent && strcmp(it->symbol->parent, parent->name) == 0 && strcmp(it->symbol->name, name) == 0) {
-                return &(*it);
-            }
+    return var;
+}
 
-            ++it;
-        }
+DosVariableDescriptor* DosExeEmitter::TryFindVariableByName(const char* name)
+{
+    // Search in function-local variables
+    std::unordered_map<std::string, uint32_t>::iterator it = parent_index.find(name);
+    if (it != parent_index.end()) {
+        return &variables[it->second];
     }
 
     // Search in static (global) variables
-    {
-        std::list<DosVariableDescriptor>::iterator it = variables.begin();
-
-        while (it != variables.end()) {
-            if (!it->symbol->parent && strcmp(it->symbol->name, name) == 0) {
-                return &(*it);
-            }
-
-            ++it;
-        }
+    it = static_index.find(name);
+    if (it != static_index.end()) {
+        return &variables[it->second];
     }
 
-    // Variable cannot be found
-    ThrowOnUnreachableCode();
+    return nullptr;
 }
 
 InstructionEntry* DosExeEmitter::FindNextVariableReference(DosVariableDescriptor* var, SaveReason reason)
@@ -1080,74 +1322,27 @@ void DosExeEmitter::SaveVariable(DosVariableDescriptor* var, SaveReason reason)
 #endif
             return;
         }
+    }
 
-        switch (var_size) {
-            case 1: {
-                // Register to stack copy (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0x88;   // mov rm8, r8
-                a[1] = ToXrm(1, var->reg, 6);
-
-                BackpatchLocal(a + 2, var);
-                break;
-            }
-            case 2: {
-                // Register to stack copy (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0x89;   // mov rm16/32, r16/32
-                a[1] = ToXrm(1, var->reg, 6);
-
-                BackpatchLocal(a + 2, var);
-                break;
-            }
-            case 4: {
-                // Register to stack copy (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x89;   // mov rm16/32, r16/32
-                a[2] = ToXrm(1, var->reg, 6);
-
-                BackpatchLocal(a + 3, var);
-                break;
-            }
-
-            default: ThrowOnUnreachableCode();
+    // Register to stack/static copy
+    switch (var_size) {
+        case 1: {
+            // mov rm8, r8
+            EmitVariableAccess(1, { 0x88 }, var->reg, var);
+            break;
         }
-    } else {
-        switch (var_size) {
-            case 1: {
-                // Register to static copy
-                uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                a[0] = 0x88;   // mov rm8, r8
-                a[1] = ToXrm(0, var->reg, 6);
-
-                BackpatchStatic(a + 2, var);
-                break;
-            }
-            case 2: {
-                // Register to static copy
-                uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                a[0] = 0x89;   // mov rm16/32, r16/32
-                a[1] = ToXrm(0, var->reg, 6);
-
-                BackpatchStatic(a + 2, var);
-                break;
-            }
-            case 4: {
-                // Register to static copy
-                uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x89;   // mov rm16/32, r16/32
-                a[2] = ToXrm(0, var->reg, 6);
-
-                BackpatchStatic(a + 3, var);
-                break;
-            }
-
-            default: ThrowOnUnreachableCode();
+        case 2:
+        case 4: {
+            // mov rm16/32, r16/32
+            EmitVariableAccess(var_size, { 0x89 }, var->reg, var);
+            break;
         }
+
+        default: ThrowOnUnreachableCode();
     }
 
+    compiler->GetStats()->AddSpill();
+
     var->is_dirty = false;
 }
 
@@ -1158,25 +1353,30 @@ void DosExeEmitter::SaveIndexedVariable(DosVariableDescriptor* var, InstructionO
         ThrowOnUnreachableCode();
     }
 
+    if (var->symbol->size == 0) {
+        // Memory must be up-to-date, if the pointer can reach a variable that is held in register
+        SaveAliasedVariables(var);
+    }
+
     SymbolType resolved_type = var->symbol->type;
     resolved_type.pointer--;
     int32_t resolved_size = compiler->GetSymbolTypeSize(resolved_type);
 
     switch (index.exp_type) {
         case ExpressionType::Constant: {
-            int32_t value = atoi(index.value) * resolved_size;
-            LoadConstantToRegister(value, CpuRegister::DI, 2);
+            int32_t value = (int32_t)index.imm * resolved_size;
+            LoadConstantToRegister(value, CpuRegister::DI, default_size);
             break;
         }
         case ExpressionType::Variable: {
             DosVariableDescriptor* index_desc = FindVariableByName(index.value);
-            CopyVariableToRegister(index_desc, CpuRegister::DI, 2);
+            CopyVariableToRegister(index_desc, CpuRegister::DI, default_size);
 
             // Multiply by size
             uint8_t shift = compiler->SizeToShift(resolved_size);
             if (shift > 0) {
                 uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0xC1;    // shl rm16, imm8
+                a[0] = 0xC1;    // shl rm16/32, imm8
                 a[1] = ToXrm(3, 4, CpuRegister::DI);
                 a[2] = shift;
             }
@@ -1191,129 +1391,87 @@ void DosExeEmitter::SaveIndexedVariable(DosVariableDescriptor* var, InstructionO
         if (var->reg != CpuRegister::None) {
             // Pointer is already loaded in register
             uint8_t* a = AllocateBufferForInstruction(2);
-            a[0] = 0x03;    // add r16, rm16
+            a[0] = 0x03;    // add r16/32, rm16/32
             a[1] = ToXrm(3, CpuRegister::DI, var->reg);
-        } else if (!var->symbol->parent) {
-            // Pointer is in static (16-bit range)
-            uint8_t* a = AllocateBufferForInstruction(2 + 2);
-            a[0] = 0x03;   // add r16, rm16
-            a[1] = ToXrm(0, CpuRegister::DI, 6);
-
-            BackpatchStatic(a + 2, var);
         } else {
-            // Pointer is in stack (8-bit range)
-            uint8_t* a = AllocateBufferForInstruction(2 + 1);
-            a[0] = 0x03;   // add r16, rm16
-            a[1] = ToXrm(1, CpuRegister::DI, 6);
-
-            BackpatchLocal(a + 2, var);
+            // Pointer is in static or stack
+            //   add r16/32, rm16/32
+            EmitVariableAccess(default_size, { 0x03 }, CpuRegister::DI, var);
         }
     }
 
     switch (resolved_size) {
         case 1: {
-            if (var->symbol->size == 0) {
-                // Register to pointer (16-bit)
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x88;   // mov rm8, r8
-                a[1] = ToXrm(0, reg_dst, 5);
-            } else if (!var->symbol->parent) {
-                // Register to static (16-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                a[0] = 0x88;   // mov rm8, r8
-                a[1] = ToXrm(2, reg_dst, 5);
-
-                BackpatchStatic(a + 2, var);
-            } else {
-                // Register to stack (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0x88;   // mov rm8, r8
-                a[1] = ToXrm(1, reg_dst, 3);
-
-                BackpatchLocal(a + 2, var);
-            }
-            break;
-        }
-        case 2: {
-            if (var->symbol->size == 0) {
-                // Register to pointer (16-bit)
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x89;   // mov rm16, r16
-                a[1] = ToXrm(0, reg_dst, 5);
-            } else if (!var->symbol->parent) {
-                // Register to static (16-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                a[0] = 0x89;   // mov rm16, r16
-                a[1] = ToXrm(2, reg_dst, 5);
-
-                BackpatchStatic(a + 2, var);
-            } else {
-                // Register to stack (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0x89;   // mov rm16, r16
-                a[1] = ToXrm(1, reg_dst, 3);
-
-                BackpatchLocal(a + 2, var);
-            }
+            // mov rm8, r8
+            EmitIndexedVariableAccess(1, { 0x88 }, reg_dst, var, CpuRegister::DI);
             break;
         }
+        case 2:
         case 4: {
-            if (var->symbol->size == 0) {
-                // Register to pointer (16-bit)
-                uint8_t* a = AllocateBufferForInstruction(3);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x89;   // mov rm32, r32
-                a[2] = ToXrm(0, reg_dst, 5);
-            } else if (!var->symbol->parent) {
-                // Register to static (16-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x89;   // mov rm32, r32
-                a[2] = ToXrm(2, reg_dst, 5);
-
-                BackpatchStatic(a + 3, var);
-            } else {
-                // Register to stack (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x89;   // mov rm32, r32
-                a[2] = ToXrm(1, reg_dst, 3);
-
-                BackpatchLocal(a + 3, var);
-            }
+            // mov rm16/32, r16/32
+            EmitIndexedVariableAccess(resolved_size, { 0x89 }, reg_dst, var, CpuRegister::DI);
             break;
         }
 
         default: ThrowOnUnreachableCode();
     }
+
+    if (var->symbol->size == 0) {
+        // Arrays cannot overlap with variables, only pointers can
+        UnloadAliasedVariables(var);
+    }
 }
 
-void DosExeEmitter::SaveAndUnloadRegister(CpuRegister reg, SaveReason reason)
+void DosExeEmitter::SaveAliasedVariables(DosVariableDescriptor* pointer)
 {
-    std::list<DosVariableDescriptor>::iterator it = variables.begin();
+    PointsToMap* points_to = compiler->GetPointsTo();
 
-    while (it != variables.end()) {
-        if (it->reg == reg && (!it->symbol->parent || (it->symbol->parent && strcmp(it->symbol->parent, parent->name) == 0))) {
-            SaveVariable(&(*it), reason);
-            it->reg = CpuRegister::None;
-            break;
+    for (DosVariableDescriptor* var : register_owner) {
+        if (var && var->is_dirty && points_to->MayAlias(parent_points_to, pointer->symbol, var->symbol)) {
+            SaveVariable(var, SaveReason::Force);
         }
+    }
+}
 
-        ++it;
+void DosExeEmitter::UnloadAliasedVariables(DosVariableDescriptor* pointer)
+{
+    PointsToMap* points_to = compiler->GetPointsTo();
+
+    for (DosVariableDescriptor* var : register_owner) {
+        if (var && points_to->MayAlias(parent_points_to, pointer->symbol, var->symbol)) {
+            SetVariableRegister(var, CpuRegister::None);
+        }
+    }
+}
+
+void DosExeEmitter::SaveAndUnloadRegister(CpuRegister reg, SaveReason reason)
+{
+    DosVariableDescriptor* var = register_owner[(int32_t)reg];
+    if (var) {
+        SaveVariable(var, reason);
+        SetVariableRegister(var, CpuRegister::None);
     }
 }
 
 void DosExeEmitter::SaveAndUnloadAllRegisters(SaveReason reason)
 {
-    std::list<DosVariableDescriptor>::iterator it = variables.begin();
+    // Promoted static variable stays in EBX register across block boundaries, the code after the last return is not reachable
+    bool keep_promoted = (promoted_static && reason == SaveReason::Before && !(was_return && ip_src > parent_end_ip));
 
-    while (it != variables.end()) {
-        if (it->reg != CpuRegister::None && (!it->symbol->parent || (it->symbol->parent && strcmp(it->symbol->parent, parent->name) == 0))) {
-            SaveVariable(&(*it), reason);
-            it->reg = CpuRegister::None;
+    for (DosVariableDescriptor* var : register_owner) {
+        if (var && !(keep_promoted && var == promoted_static)) {
+            SaveVariable(var, reason);
+            SetVariableRegister(var, CpuRegister::None);
         }
+    }
 
-        ++it;
+    if (keep_promoted) {
+        RestorePromotedStatic();
+
+        // Value from any incoming path can differ from memory, so it's written back on return
+        if (is_promoted_static_written) {
+            promoted_static->is_dirty = true;
+        }
     }
 }
 
@@ -1323,21 +1481,15 @@ void DosExeEmitter::MarkRegisterAsDiscarded(CpuRegister reg)
         return;
     }
 
-    std::list<DosVariableDescriptor>::iterator it = variables.begin();
-
-    while (it != variables.end()) {
-        if (it->reg == reg && (!it->symbol->parent || (it->symbol->parent && strcmp(it->symbol->parent, parent->name) == 0))) {
-            if (it->is_dirty) {
-                // This should not happen, register owned by variable is discarded,
-                // but variable was not written back to stack yet
-                ThrowOnUnreachableCode();
-            }
-
-            it->reg = CpuRegister::None;
-            break;
+    DosVariableDescriptor* var = register_owner[(int32_t)reg];
+    if (var) {
+        if (var->is_dirty) {
+            // This should not happen, register owned by variable is discarded,
+            // but variable was not written back to stack yet
+            ThrowOnUnreachableCode();
         }
 
-        ++it;
+        SetVariableRegister(var, CpuRegister::None);
     }
 }
 
@@ -1345,122 +1497,153 @@ void DosExeEmitter::PushVariableToStack(DosVariableDescriptor* var, int32_t para
 {
     int32_t var_size = compiler->GetSymbolTypeSize(var->symbol->type);
 
-    if (var_size < param_size) {
-        // Variable expansion is needed
-        CpuRegister reg = LoadVariableUnreferenced(var, param_size);
+    // Parameters are always pushed with at least default operand size
+    int32_t push_size = (param_size < default_size ? default_size : param_size);
 
-        switch (param_size) {
-            case 2: {
-                // Push register to parameter stack
-                uint8_t* a = AllocateBufferForInstruction(1);
-                a[0] = ToOpR(0x50, reg);    // push r16
-                break;
-            }
-            case 4: {
-                // Push register to parameter stack
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x66;                // Operand size prefix
-                a[1] = ToOpR(0x50, reg);    // push r32
-                break;
-            }
+    if (var_size == default_size && push_size > default_size) {
+        // High part is pushed as zero immediate first, so no register is needed for expansion
+        uint8_t* a = AllocateBufferForInstruction(1 + 1);
+        a[0] = 0x6A;    // push imm8
+        a[1] = 0x00;
 
-            default: ThrowOnUnreachableCode();
+        if (var->reg != CpuRegister::None) {
+            a = AllocateBufferForInstruction(1);
+            a[0] = ToOpR(0x50, var->reg);   // push r16
+        } else {
+            //   push rm16
+            EmitVariableAccess(var_size, { 0xFF }, 6, var);
         }
     } else if (var->reg != CpuRegister::None) {
         // Variable is already in register
-        switch (param_size) {
-            case 1: {
-                // Zero high part of register and push it to parameter stack
-                uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0x32;                    // xor r8, rm8
-                a[1] = ToXrm(3, (uint8_t)var->reg + 4, (uint8_t)var->reg + 4);
-                a[2] = ToOpR(0x50, var->reg);   // push r16
-                break;
-            }
-            case 2: {
-                // Push register to parameter stack
-                uint8_t* a = AllocateBufferForInstruction(1);
-                a[0] = ToOpR(0x50, var->reg);   // push r16
-                break;
-            }
-            case 4: {
-                // Push register to parameter stack
+        if (var_size < push_size) {
+            // Zero high part of register, value of the variable is preserved
+            if (var_size == 1 && push_size == 2) {
                 uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x66;                    // Operand size prefix
-                a[1] = ToOpR(0x50, var->reg);   // push r32
-                break;
+                a[0] = 0x32;    // xor r8, rm8
+                a[1] = ToXrm(3, (uint8_t)var->reg + 4, (uint8_t)var->reg + 4);
+            } else {
+                uint8_t* a = AllocateBufferWithPrefix(push_size, 3);
+                a[0] = 0x0F;
+                a[1] = (var_size == 1 ? 0xB6 : 0xB7);   // movzx r16/32, rm8/16 (i386+)
+                a[2] = ToXrm(3, var->reg, var->reg);
             }
-
-            default: ThrowOnUnreachableCode();
         }
+
+        // Push register to parameter stack
+        uint8_t* a = AllocateBufferWithPrefix(push_size, 1);
+        a[0] = ToOpR(0x50, var->reg);   // push r16/32
+    } else if (var_size < push_size) {
+        // Variable expansion is needed
+        CpuRegister reg = LoadVariableUnreferenced(var, push_size);
+
+        // Push register to parameter stack
+        uint8_t* a = AllocateBufferWithPrefix(push_size, 1);
+        a[0] = ToOpR(0x50, reg);        // push r16/32
     } else {
         // Variable is in memory
-        switch (param_size) {
-            case 1: {
-                CpuRegister reg_temp = GetUnusedRegister();
+        //   push rm16/32
+        EmitVariableAccess(push_size, { 0xFF }, 6, var);
+    }
+}
+
+void DosExeEmitter::LoadParameterToRegister(InstructionEntry* push, SymbolTableEntry* param_decl, CpuRegister reg)
+{
+    int32_t param_size = compiler->GetSymbolTypeSize(param_decl->type);
 
-                if (!var->symbol->parent) {
-                    // Static push using register (16-bit range)
-                    uint8_t* a1 = AllocateBufferForInstruction(3 + 2);
-                    a1[0] = 0x0F;
-                    a1[1] = 0xB6;   // movzx r16, rm8 (i386+)
-                    a1[2] = ToXrm(0, reg_temp, 6);
+    switch (push->push_statement.symbol->exp_type) {
+        case ExpressionType::Constant: {
+            SaveAndUnloadRegister(reg, SaveReason::Inside);
+
+            switch (param_decl->type.base) {
+                case BaseSymbolType::Bool:
+                case BaseSymbolType::Uint8:
+                case BaseSymbolType::Uint16:
+                case BaseSymbolType::Uint32: {
+                    int32_t value = (int32_t)push->push_statement.imm;
+                    LoadConstantToRegister(value, reg, param_size);
+                    break;
+                }
 
-                    BackpatchStatic(a1 + 3, var);
-                } else {
-                    // Stack push using register (8-bit range)
-                    uint8_t* a1 = AllocateBufferForInstruction(3 + 1);
-                    a1[0] = 0x0F;
-                    a1[1] = 0xB6;   // movzx r16, rm8 (i386+)
-                    a1[2] = ToXrm(1, reg_temp, 6);
+                case BaseSymbolType::String: {
+                    uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+                    a[0] = ToOpR(0xB8, reg);    // mov r16/32, imm16/32
 
-                    BackpatchLocal(a1 + 3, var);
+                    // Create backpatch info for string
+                    BackpatchString(a + 1, push->push_statement.symbol->name);
+                    break;
                 }
 
-                uint8_t* a2 = AllocateBufferForInstruction(1);
-                a2[0] = ToOpR(0x50, reg_temp);  // push r16
-                break;
+                default: ThrowOnUnreachableCode();
             }
-            case 2: {
-                if (!var->symbol->parent) {
-                    // Static push (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                    a[0] = 0xFF;                // push rm16
-                    a[1] = ToXrm(0, 6, 6);
+            break;
+        }
 
-                    BackpatchStatic(a + 2, var);
-                } else {
-                    // Stack push (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                    a[0] = 0xFF;                // push rm16
-                    a[1] = ToXrm(1, 6, 6);
+        case ExpressionType::Variable: {
+            DosVariableDescriptor* var = FindVariableByName(push->push_statement.symbol->name);
+
+            if (var->symbol->size > 0) {
+                // Arrays are passed as pointer
+                SaveAndUnloadRegister(reg, SaveReason::Inside);
+
+                if (var->symbol->parent) { // Local (stack)
+                    //   lea r16/32, m
+                    EmitVariableAccess(default_size, { 0x8D }, reg, var);
+                } else { // Static
+                    uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+                    a[0] = ToOpR(0xB8, reg);    // mov r16/32, imm16/32
 
-                    BackpatchLocal(a + 2, var);
+                    BackpatchStatic(a + 1, var);
                 }
-                break;
+            } else {
+                CopyVariableToRegister(var, reg, param_size);
             }
-            case 4: {
-                if (!var->symbol->parent) {
-                    // Static push (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                    a[0] = 0x66;                // Operand size prefix
-                    a[1] = 0xFF;                // push rm32
-                    a[2] = ToXrm(0, 6, 6);
-
-                    BackpatchStatic(a + 3, var);
-                } else {
-                    // Stack push (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                    a[0] = 0x66;                // Operand size prefix
-                    a[1] = 0xFF;                // push rm32
-                    a[2] = ToXrm(1, 6, 6);
+            break;
+        }
 
-                    BackpatchLocal(a + 3, var);
-                }
-                break;
+        default: ThrowOnUnreachableCode();
+    }
+}
+
+CpuRegister DosExeEmitter::GetParameterRegister(SymbolTableEntry* function, int32_t parameter)
+{
+    if (function->type.base == BaseSymbolType::SharedFunction || parameter > RegisterParameterCount) {
+        // Shared functions and remaining parameters use stack
+        return CpuRegister::None;
+    }
+
+    return (parameter == 1 ? CpuRegister::CX : CpuRegister::DX);
+}
+
+void DosExeEmitter::SaveAndUnloadCallerSavedRegisters(SymbolTableEntry* function)
+{
+    SideEffectMap* side_effects = compiler->GetSideEffects();
+    const FunctionSideEffects* effects = side_effects->Find(function->name);
+
+    for (DosVariableDescriptor* var : register_owner) {
+        if (var) {
+            bool can_read, can_write;
+            if (var->reg != CpuRegister::BX) {
+                // Caller-saved register is always lost
+                can_read = can_write = true;
+            } else if (!var->symbol->parent) {
+                // Static variable can be accessed directly or through pointer
+                can_read = side_effects->CanRead(effects, var->symbol->name);
+                can_write = side_effects->CanWrite(effects, var->symbol->name);
+            } else if (var->force_save) {
+                // Variable with reference can be accessed through pointer
+                can_read = (!effects || effects->reads_memory);
+                can_write = (!effects || effects->writes_memory);
+            } else {
+                can_read = can_write = false;
             }
 
-            default: ThrowOnUnreachableCode();
+            if (can_write) {
+                SaveVariable(var, SaveReason::Inside);
+                SetVariableRegister(var, CpuRegister::None);
+            } else if (can_read) {
+                // Callee needs the current value, but the register is still valid after the call
+                SaveVariable(var, SaveReason::Inside);
+            }
         }
     }
 }
@@ -1469,7 +1652,7 @@ CpuRegister DosExeEmitter::LoadVariableUnreferenced(DosVariableDescriptor* var,
 {
     if (var->symbol->size > 0) {
 
-        if (desired_size != 2) {
+        if (desired_size != default_size) {
             ThrowOnUnreachableCode();
         }
 
@@ -1482,6 +1665,9 @@ CpuRegister DosExeEmitter::LoadVariableUnreferenced(DosVariableDescriptor* var,
     if (var->reg == CpuRegister::None) {
         // Not loaded in any register yet
         reg_dst = GetUnusedRegister();
+    } else if (var == promoted_static && var->reg == CpuRegister::BX) {
+        // Register can be overwritten by the caller, so promoted static variable is copied instead
+        reg_dst = GetUnusedRegister();
     } else {
         reg_dst = var->reg;
 
@@ -1503,20 +1689,17 @@ CpuRegister DosExeEmitter::LoadVariablePointer(DosVariableDescriptor* var, bool
 {
     CpuRegister reg_dst = GetUnusedRegister();
 
-    // Hardcoded 16-bit pointer size
+    // Pointers have default address size
     if (!force_reference && var->symbol->size == 0) { // It's already pointer
-        return LoadVariableUnreferenced(var, 2);
+        return LoadVariableUnreferenced(var, default_size);
     }
     
     if (var->symbol->parent) { // Local (stack)
-        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-        a[0] = 0x8D;    // lea r16, m
-        a[1] = ToXrm(1, reg_dst, 6);
-
-        BackpatchLocal(a + 2, var);
+        //   lea r16/32, m
+        EmitVariableAccess(default_size, { 0x8D }, reg_dst, var);
     } else { // Static
-        uint8_t* a = AllocateBufferForInstruction(1 + 2);
-        a[0] = ToOpR(0xB8, reg_dst);    // mov r16, imm16
+        uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+        a[0] = ToOpR(0xB8, reg_dst);    // mov r16/32, imm16/32
 
         BackpatchStatic(a + 1, var);
     }
@@ -1530,25 +1713,30 @@ CpuRegister DosExeEmitter::LoadIndexedVariable(DosVariableDescriptor* var, Instr
         ThrowOnUnreachableCode();
     }
 
+    if (var->symbol->size == 0) {
+        // Variable that can be read through the pointer must be saved first
+        SaveAliasedVariables(var);
+    }
+
     SymbolType resolved_type = var->symbol->type;
     resolved_type.pointer--;
     int32_t resolved_size = compiler->GetSymbolTypeSize(resolved_type);
 
     switch (index.exp_type) {
         case ExpressionType::Constant: {
-            int32_t value = atoi(index.value) * resolved_size;
-            LoadConstantToRegister(value, CpuRegister::SI, 2);
+            int32_t value = (int32_t)index.imm * resolved_size;
+            LoadConstantToRegister(value, CpuRegister::SI, default_size);
             break;
         }
         case ExpressionType::Variable: {
             DosVariableDescriptor* index_desc = FindVariableByName(index.value);
-            CopyVariableToRegister(index_desc, CpuRegister::SI, 2);
+            CopyVariableToRegister(index_desc, CpuRegister::SI, default_size);
 
             // Multiply by size
             uint8_t shift = compiler->SizeToShift(resolved_size);
             if (shift > 0) {
                 uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0xC1;    // shl rm16, imm8
+                a[0] = 0xC1;    // shl rm16/32, imm8
                 a[1] = ToXrm(3, 4, CpuRegister::SI);
                 a[2] = shift;
             }
@@ -1562,22 +1750,12 @@ CpuRegister DosExeEmitter::LoadIndexedVariable(DosVariableDescriptor* var, Instr
         if (var->reg != CpuRegister::None) {
             // Pointer is already loaded in register
             uint8_t* a = AllocateBufferForInstruction(2);
-            a[0] = 0x03;    // add r16, rm16
+            a[0] = 0x03;    // add r16/32, rm16/32
             a[1] = ToXrm(3, CpuRegister::SI, var->reg);
-        } else if (!var->symbol->parent) {
-            // Pointer is in static (16-bit range)
-            uint8_t* a = AllocateBufferForInstruction(2 + 2);
-            a[0] = 0x03;   // add r16, rm16
-            a[1] = ToXrm(0, CpuRegister::SI, 6);
-
-            BackpatchStatic(a + 2, var);
         } else {
-            // Pointer is in stack (8-bit range)
-            uint8_t* a = AllocateBufferForInstruction(2 + 1);
-            a[0] = 0x03;   // add r16, rm16
-            a[1] = ToXrm(1, CpuRegister::SI, 6);
-
-            BackpatchLocal(a + 2, var);
+            // Pointer is in static or stack
+            //   add r16/32, rm16/32
+            EmitVariableAccess(default_size, { 0x03 }, CpuRegister::SI, var);
         }
     }
 
@@ -1586,153 +1764,30 @@ CpuRegister DosExeEmitter::LoadIndexedVariable(DosVariableDescriptor* var, Instr
     switch (resolved_size) {
         case 1: {
             if (desired_size == 4) {
-                if (var->symbol->size == 0) {
-                    // Pointer to register (16-bit)
-                    uint8_t* a = AllocateBufferForInstruction(4);
-                    a[0] = 0x66;    // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[3] = ToXrm(0, reg_dst, 4);
-                } else if (!var->symbol->parent) {
-                    // Static to register (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(4 + 2);
-                    a[0] = 0x66;    // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[3] = ToXrm(2, reg_dst, 4);
-
-                    BackpatchStatic(a + 4, var);
-                } else {
-                    // Stack to register (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(4 + 1);
-                    a[0] = 0x66;    // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[3] = ToXrm(1, reg_dst, 2);
-
-                    BackpatchLocal(a + 4, var);
-                }
+                // movzx r32, rm8 (i386+)
+                EmitIndexedVariableAccess(4, { 0x0F, 0xB6 }, reg_dst, var, CpuRegister::SI);
             } else if (desired_size == 2) {
-                if (var->symbol->size == 0) {
-                    // Pointer to register (16-bit)
-                    uint8_t* a = AllocateBufferForInstruction(3);
-                    a[0] = 0x0F;
-                    a[1] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[2] = ToXrm(0, reg_dst, 4);
-                } else if (!var->symbol->parent) {
-                    // Static to register (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                    a[0] = 0x0F;
-                    a[1] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[2] = ToXrm(2, reg_dst, 4);
-
-                    BackpatchStatic(a + 3, var);
-                } else {
-                    // Stack to register (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                    a[0] = 0x0F;
-                    a[1] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[2] = ToXrm(1, reg_dst, 2);
-
-                    BackpatchLocal(a + 3, var);
-                }
+                // movzx r16, rm8 (i386+)
+                EmitIndexedVariableAccess(2, { 0x0F, 0xB6 }, reg_dst, var, CpuRegister::SI);
             } else {
-                if (var->symbol->size == 0) {
-                    // Pointer to register (16-bit)
-                    uint8_t* a = AllocateBufferForInstruction(2);
-                    a[0] = 0x8A;   // mov r8, rm8
-                    a[1] = ToXrm(0, reg_dst, 4);
-                } else if (!var->symbol->parent) {
-                    // Static to register (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                    a[0] = 0x8A;   // mov r8, rm8
-                    a[1] = ToXrm(2, reg_dst, 4);
-
-                    BackpatchStatic(a + 2, var);
-                } else {
-                    // Stack to register (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                    a[0] = 0x8A;   // mov r8, rm8
-                    a[1] = ToXrm(1, reg_dst, 2);
-
-                    BackpatchLocal(a + 2, var);
-                }
+                // mov r8, rm8
+                EmitIndexedVariableAccess(1, { 0x8A }, reg_dst, var, CpuRegister::SI);
             }
             break;
         }
         case 2: {
             if (desired_size == 4) {
-                if (var->symbol->size == 0) {
-                    // Pointer to register (16-bit)
-                    uint8_t* a = AllocateBufferForInstruction(3);
-                    a[0] = 0x0F;
-                    a[1] = 0xB7;    // movzx r32, rm16 (i386+)
-                    a[2] = ToXrm(0, reg_dst, 4);
-                } else if (!var->symbol->parent) {
-                    // Static to register (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                    a[0] = 0x0F;
-                    a[1] = 0xB7;    // movzx r32, rm16 (i386+)
-                    a[2] = ToXrm(2, reg_dst, 4);
-
-                    BackpatchStatic(a + 3, var);
-                } else {
-                    // Stack to register (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                    a[0] = 0x0F;
-                    a[1] = 0xB7;    // movzx r32, rm16 (i386+)
-                    a[2] = ToXrm(1, reg_dst, 2);
-
-                    BackpatchLocal(a + 3, var);
-                }
+                // movzx r32, rm16 (i386+)
+                EmitIndexedVariableAccess(4, { 0x0F, 0xB7 }, reg_dst, var, CpuRegister::SI);
             } else {
-                if (var->symbol->size == 0) {
-                    // Pointer to register (16-bit)
-                    uint8_t* a = AllocateBufferForInstruction(2);
-                    a[0] = 0x8B;   // mov r16, rm16
-                    a[1] = ToXrm(0, reg_dst, 4);
-                } else if (!var->symbol->parent) {
-                    // Static to register (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                    a[0] = 0x8B;   // mov r16, rm16
-                    a[1] = ToXrm(2, reg_dst, 4);
-
-                    BackpatchStatic(a + 2, var);
-                } else {
-                    // Stack to register (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                    a[0] = 0x8B;   // mov r16, rm16
-                    a[1] = ToXrm(1, reg_dst, 2);
-
-                    BackpatchLocal(a + 2, var);
-                }
+                // mov r16, rm16
+                EmitIndexedVariableAccess(2, { 0x8B }, reg_dst, var, CpuRegister::SI);
             }
             break;
         }
         case 4: {
-            if (var->symbol->size == 0) {
-                // Pointer to register (16-bit)
-                uint8_t* a = AllocateBufferForInstruction(3);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x8B;   // mov r32, rm32
-                a[2] = ToXrm(0, reg_dst, 4);
-            } else if (!var->symbol->parent) {
-                // Static to register (16-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x8B;   // mov r32, rm32
-                a[2] = ToXrm(2, reg_dst, 4);
-
-                BackpatchStatic(a + 3, var);
-            } else {
-                // Stack to register copy (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x8B;   // mov r32, rm32
-                a[2] = ToXrm(1, reg_dst, 2);
-
-                BackpatchLocal(a + 3, var);
-            }
+            // mov r32, rm32
+            EmitIndexedVariableAccess(4, { 0x8B }, reg_dst, var, CpuRegister::SI);
             break;
         }
 
@@ -1754,7 +1809,7 @@ void DosExeEmitter::CopyVariableToRegister(DosVariableDescriptor* var, CpuRegist
         if (var->reg == reg_dst && var_size >= desired_size) {
             // Variable is already in desired register with desired size
             SaveVariable(var, SaveReason::Inside);
-            var->reg = CpuRegister::None;
+            SetVariableRegister(var, CpuRegister::None);
             return;
         }
 
@@ -1763,7 +1818,7 @@ void DosExeEmitter::CopyVariableToRegister(DosVariableDescriptor* var, CpuRegist
         if (var->reg == reg_dst) {
             // Variable is in desired register, remove ownership
             SaveVariable(var, SaveReason::Inside);
-            var->reg = CpuRegister::None;
+            SetVariableRegister(var, CpuRegister::None);
         } else {
             // Variable is in another register
             SaveAndUnloadRegister(reg_dst, SaveReason::Inside);
@@ -1772,16 +1827,10 @@ void DosExeEmitter::CopyVariableToRegister(DosVariableDescriptor* var, CpuRegist
         // Copy value to desired register
         switch (var_size) {
             case 1: {
-                if (desired_size == 4) {
-                    uint8_t* a = AllocateBufferForInstruction(4);
-                    a[0] = 0x66;    // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB6;    // movzx r32, rm8 (i386+)
-                    a[3] = ToXrm(3, reg_dst, reg_src);
-                } else if (desired_size == 2) {
-                    uint8_t* a = AllocateBufferForInstruction(3);
+                if (desired_size == 4 || desired_size == 2) {
+                    uint8_t* a = AllocateBufferWithPrefix(desired_size, 3);
                     a[0] = 0x0F;
-                    a[1] = 0xB6;    // movzx r16, rm8 (i386+)
+                    a[1] = 0xB6;    // movzx r16/32, rm8 (i386+)
                     a[2] = ToXrm(3, reg_dst, reg_src);
                 } else {
                     uint8_t* a = AllocateBufferForInstruction(2);
@@ -1792,23 +1841,17 @@ void DosExeEmitter::CopyVariableToRegister(DosVariableDescriptor* var, CpuRegist
             }
             case 2: {
                 if (desired_size == 4) {
-                    uint8_t* a = AllocateBufferForInstruction(4);
-                    a[0] = 0x66;    // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB7;    // movzx r32, rm16 (i386+)
-                    a[3] = ToXrm(3, reg_dst, reg_src);
+                    uint8_t* a = AllocateBufferWithPrefix(4, 3);
+                    a[0] = 0x0F;
+                    a[1] = 0xB7;    // movzx r32, rm16 (i386+)
+                    a[2] = ToXrm(3, reg_dst, reg_src);
                 } else {
-                    uint8_t* a = AllocateBufferForInstruction(2);
-                    a[0] = 0x8B;   // mov r16, rm16
-                    a[1] = ToXrm(3, reg_dst, reg_src);
+                    AsmMov(reg_dst, reg_src, 2);
                 }
                 break;
             }
             case 4: {
-                uint8_t* a = AllocateBufferForInstruction(3);
-                a[0] = 0x66;        // Operand size prefix
-                a[1] = 0x8B;        // mov r32, rm32
-                a[2] = ToXrm(3, reg_dst, reg_src);
+                AsmMov(reg_dst, reg_src, 4);
                 break;
             }
 
@@ -1819,123 +1862,33 @@ void DosExeEmitter::CopyVariableToRegister(DosVariableDescriptor* var, CpuRegist
 
     SaveAndUnloadRegister(reg_dst, SaveReason::Inside);
 
+    // Variable is loaded from memory
+    compiler->GetStats()->AddReload();
+
     switch (var_size) {
         case 1: {
-            if (desired_size == 4) {
-                if (!var->symbol->parent) {
-                    // Static to register copy (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(4 + 2);
-                    a[0] = 0x66;    // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[3] = ToXrm(0, reg_dst, 6);
-
-                    BackpatchStatic(a + 4, var);
-                } else {
-                    // Stack to register copy (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(4 + 1);
-                    a[0] = 0x66;    // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[3] = ToXrm(1, reg_dst, 6);
-
-                    BackpatchLocal(a + 4, var);
-                }
-            } else if (desired_size == 2) {
-                if (!var->symbol->parent) {
-                    // Static to register copy (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                    a[0] = 0x0F;
-                    a[1] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[2] = ToXrm(0, reg_dst, 6);
-
-                    BackpatchStatic(a + 3, var);
-                } else {
-                    // Stack to register copy (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                    a[0] = 0x0F;
-                    a[1] = 0xB6;    // movzx r16, rm8 (i386+)
-                    a[2] = ToXrm(1, reg_dst, 6);
-
-                    BackpatchLocal(a + 3, var);
-                }
+            if (desired_size == 4 || desired_size == 2) {
+                // movzx r16/32, rm8 (i386+)
+                EmitVariableAccess(desired_size, { 0x0F, 0xB6 }, reg_dst, var);
             } else {
-                if (!var->symbol->parent) {
-                    // Static to register copy (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                    a[0] = 0x8A;   // mov r8, rm8
-                    a[1] = ToXrm(0, reg_dst, 6);
-
-                    BackpatchStatic(a + 2, var);
-                } else {
-                    // Stack to register copy (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                    a[0] = 0x8A;   // mov r8, rm8
-                    a[1] = ToXrm(1, reg_dst, 6);
-
-                    BackpatchLocal(a + 2, var);
-                }
+                // mov r8, rm8
+                EmitVariableAccess(1, { 0x8A }, reg_dst, var);
             }
             break;
         }
         case 2: {
             if (desired_size == 4) {
-                if (!var->symbol->parent) {
-                    // Static to register copy (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(4 + 2);
-                    a[0] = 0x66;   // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB7;    // movzx r32, rm16 (i386+)
-                    a[3] = ToXrm(0, reg_dst, 6);
-
-                    BackpatchStatic(a + 4, var);
-                } else {
-                    // Stack to register copy (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(4 + 1);
-                    a[0] = 0x66;   // Operand size prefix
-                    a[1] = 0x0F;
-                    a[2] = 0xB7;    // movzx r32, rm16 (i386+)
-                    a[3] = ToXrm(1, reg_dst, 6);
-
-                    BackpatchLocal(a + 4, var);
-                }
+                // movzx r32, rm16 (i386+)
+                EmitVariableAccess(4, { 0x0F, 0xB7 }, reg_dst, var);
             } else {
-                if (!var->symbol->parent) {
-                    // Static to register copy (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                    a[0] = 0x8B;   // mov r16, rm16
-                    a[1] = ToXrm(0, reg_dst, 6);
-
-                    BackpatchStatic(a + 2, var);
-                } else {
-                    // Stack to register copy (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                    a[0] = 0x8B;   // mov r16, rm16
-                    a[1] = ToXrm(1, reg_dst, 6);
-
-                    BackpatchLocal(a + 2, var);
-                }
+                // mov r16, rm16
+                EmitVariableAccess(2, { 0x8B }, reg_dst, var);
             }
             break;
         }
         case 4: {
-            if (!var->symbol->parent) {
-                // Static to register copy (16-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x8B;   // mov r32, rm32
-                a[2] = ToXrm(0, reg_dst, 6);
-
-                BackpatchStatic(a + 3, var);
-            } else {
-                // Stack to register copy (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0x8B;   // mov r32, rm32
-                a[2] = ToXrm(1, reg_dst, 6);
-
-                BackpatchLocal(a + 3, var);
-            }
+            // mov r32, rm32
+            EmitVariableAccess(4, { 0x8B }, reg_dst, var);
             break;
         }
 
@@ -1943,6 +1896,39 @@ void DosExeEmitter::CopyVariableToRegister(DosVariableDescriptor* var, CpuRegist
     }
 }
 
+uint8_t* DosExeEmitter::EmitVariableAccess(int32_t operand_size, std::initializer_list<uint8_t> opcode, uint8_t r, DosVariableDescriptor* var, uint32_t imm_size)
+{
+    if (var->symbol->parent) { // Local (stack)
+        uint8_t* a = AllocateBufferForMemoryAccess(operand_size, opcode, r, CpuMemory::Stack, imm_size);
+        BackpatchLocal(a, var);
+        return a + 1;
+    } else { // Static
+        uint8_t* a = AllocateBufferForMemoryAccess(operand_size, opcode, r, CpuMemory::Absolute, imm_size);
+        BackpatchStatic(a, var);
+        return a + default_size;
+    }
+}
+
+void DosExeEmitter::EmitIndexedVariableAccess(int32_t operand_size, std::initializer_list<uint8_t> opcode, CpuRegister r, DosVariableDescriptor* var, CpuRegister index)
+{
+    if (index != CpuRegister::SI && index != CpuRegister::DI) {
+        ThrowOnUnreachableCode();
+    }
+
+    bool is_si = (index == CpuRegister::SI);
+
+    if (var->symbol->size == 0) {
+        // Pointer was already added to index register
+        AllocateBufferForMemoryAccess(operand_size, opcode, (uint8_t)r, is_si ? CpuMemory::Si : CpuMemory::Di);
+    } else if (var->symbol->parent) { // Local (stack)
+        uint8_t* a = AllocateBufferForMemoryAccess(operand_size, opcode, (uint8_t)r, is_si ? CpuMemory::StackSi : CpuMemory::StackDi);
+        BackpatchLocal(a, var);
+    } else { // Static
+        uint8_t* a = AllocateBufferForMemoryAccess(operand_size, opcode, (uint8_t)r, is_si ? CpuMemory::SiDisp : CpuMemory::DiDisp);
+        BackpatchStatic(a, var);
+    }
+}
+
 void DosExeEmitter::LoadConstantToRegister(int32_t value, CpuRegister reg)
 {
     MarkRegisterAsDiscarded(reg);
@@ -1952,14 +1938,13 @@ void DosExeEmitter::LoadConstantToRegister(int32_t value, CpuRegister reg)
         a[0] = ToOpR(0xB0, reg);    // mov r8, imm8
         *(uint8_t*)(a + 1) = (int8_t)value;
     } else if (value == (int16_t)value || value == (uint16_t)value) {
-        uint8_t* a = AllocateBufferForInstruction(1 + 2);
+        uint8_t* a = AllocateBufferWithPrefix(2, 1 + 2);
         a[0] = ToOpR(0xB8, reg);     // mov r16, imm16
         *(uint16_t*)(a + 1) = (int16_t)value;
     } else {
-        uint8_t* a = AllocateBufferForInstruction(2 + 4);
-        a[0] = 0x66;                // Operand size prefix
-        a[1] = ToOpR(0xB8, reg);    // mov r32, imm32
-        *(uint32_t*)(a + 2) = value;
+        uint8_t* a = AllocateBufferWithPrefix(4, 1 + 4);
+        a[0] = ToOpR(0xB8, reg);    // mov r32, imm32
+        *(uint32_t*)(a + 1) = value;
     }
 }
 
@@ -1981,17 +1966,16 @@ void DosExeEmitter::LoadConstantToRegister(int32_t value, CpuRegister reg, int32
             break;
         }
         case 2: {
-            uint8_t* a = AllocateBufferForInstruction(1 + 2);
+            uint8_t* a = AllocateBufferWithPrefix(2, 1 + 2);
             a[0] = ToOpR(0xB8, reg);    // mov r16, imm16
             *(uint16_t*)(a + 1) = (int16_t)value;
             break;
         }
         case 4:
         case 8: {
-            uint8_t* a = AllocateBufferForInstruction(2 + 4);
-            a[0] = 0x66;                // Operand size prefix
-            a[1] = ToOpR(0xB8, reg);    // mov r32, imm32
-            *(uint32_t*)(a + 2) = value;
+            uint8_t* a = AllocateBufferWithPrefix(4, 1 + 4);
+            a[0] = ToOpR(0xB8, reg);    // mov r32, imm32
+            *(uint32_t*)(a + 1) = value;
             break;
         }
 
@@ -2011,17 +1995,54 @@ void DosExeEmitter::ZeroRegister(CpuRegister reg, int32_t desired_size)
             break;
         }
         case 2: {
-            uint8_t* a = AllocateBufferForInstruction(2);
+            uint8_t* a = AllocateBufferWithPrefix(2, 2);
             a[0] = 0x33;   // xor r16, rm16
             a[1] = ToXrm(3, reg, reg);
             break;
         }
         case 4:
         case 8: {
-            uint8_t* a = AllocateBufferForInstruction(3);
-            a[0] = 0x66;   // Operand size prefix
-            a[1] = 0x33;   // xor r32, rm32
-            a[2] = ToXrm(3, reg, reg);
+            uint8_t* a = AllocateBufferWithPrefix(4, 2);
+            a[0] = 0x33;   // xor r32, rm32
+            a[1] = ToXrm(3, reg, reg);
+            break;
+        }
+
+        default: ThrowOnUnreachableCode();
+    }
+}
+
+void DosExeEmitter::EmitImmediateOperation(int32_t operand_size, uint8_t r, CpuRegister reg, int32_t value)
+{
+    switch (operand_size) {
+        case 1: {
+            uint8_t* a = AllocateBufferForInstruction(2 + 1);
+            a[0] = 0x80;    // op rm8, imm8
+            a[1] = ToXrm(3, r, reg);
+            *(int8_t*)(a + 2) = (int8_t)value;
+            break;
+        }
+        case 2:
+        case 4: {
+            if (operand_size == 2) {
+                value = (int16_t)value;
+            }
+
+            if (value == (int8_t)value) {
+                uint8_t* a = AllocateBufferWithPrefix(operand_size, 2 + 1);
+                a[0] = 0x83;    // op rm16/32, imm8 (sign-extended)
+                a[1] = ToXrm(3, r, reg);
+                *(int8_t*)(a + 2) = (int8_t)value;
+            } else {
+                uint8_t* a = AllocateBufferWithPrefix(operand_size, 2 + operand_size);
+                a[0] = 0x81;    // op rm16/32, imm16/32
+                a[1] = ToXrm(3, r, reg);
+                if (operand_size == 2) {
+                    *(int16_t*)(a + 2) = value;
+                } else {
+                    *(int32_t*)(a + 2) = value;
+                }
+            }
             break;
         }
 
@@ -2046,15 +2067,16 @@ void DosExeEmitter::BackpatchAddresses()
                     *(int8_t*)(buffer + it->backpatch_offset) = (int8_t)rel8;
                     break;
                 }
-                case DosBackpatchType::ToRel16: {
-                    int16_t rel16 = (int16_t)(ip_src_to_dst[ip_src] - it->backpatch_ip);
-                    *(int16_t*)(buffer + it->backpatch_offset) = rel16;
+                case DosBackpatchType::ToRel: {
+                    StoreOffset(buffer + it->backpatch_offset, (int32_t)(ip_src_to_dst[ip_src] - it->backpatch_ip));
                     break;
                 }
 
                 default: ThrowOnUnreachableCode();
             }
 
+            compiler->GetStats()->AddFixup();
+
             it = backpatch.erase(it);
         } else {
             ++it;
@@ -2064,39 +2086,20 @@ void DosExeEmitter::BackpatchAddresses()
 
 void DosExeEmitter::BackpatchLabels(const DosLabel& label, DosBackpatchTarget target)
 {
+    std::unordered_map<std::string, int32_t>* symbols = FindLinkSymbols(target);
+    if (symbols) {
+        // References to functions and data are resolved later by link stage
+        symbols->emplace(label.name, label.ip_dst);
+        return;
+    }
+
     std::list<DosBackpatchInstruction>::iterator it = backpatch.begin();
 
     while (it != backpatch.end()) {
         if (it->target == target && strcmp(it->value, label.name) == 0) {
-            switch (it->type) {
-                case DosBackpatchType::ToRel8: {
-                    int32_t rel8 = (int32_t)(label.ip_dst - it->backpatch_ip);
-                    if (rel8 < INT8_MIN || rel8 > INT8_MAX) {
-                        throw CompilerException(CompilerExceptionSource::Compilation,
-                            "Compiler cannot generate that high relative address");
-                    }
-
-                    *(int8_t*)(buffer + it->backpatch_offset) = (int8_t)rel8;
-                    break;
-                }
-                case DosBackpatchType::ToRel16: {
-                    int16_t rel16 = (int16_t)(label.ip_dst - it->backpatch_ip);
-                    *(int16_t*)(buffer + it->backpatch_offset) = rel16;
-                    break;
-                }
-                case DosBackpatchType::ToDsAbs16: {
-                    int16_t abs16 = (int16_t)label.ip_dst;
-                    abs16 += 0x0100; // Program Segment Prefix
-                    *(int16_t*)(buffer + it->backpatch_offset) = abs16;
-                    break;
-                }
-                case DosBackpatchType::ToStack8: {
-                    *(int8_t*)(buffer + it->backpatch_offset) = (int8_t)label.ip_dst;
-                    break;
-                }
+            ApplyBackpatch(*it, label.ip_dst);
 
-                default: ThrowOnUnreachableCode();
-            }
+            compiler->GetStats()->AddFixup();
 
             it = backpatch.erase(it);
         } else {
@@ -2105,21 +2108,80 @@ void DosExeEmitter::BackpatchLabels(const DosLabel& label, DosBackpatchTarget ta
     }
 }
 
-void DosExeEmitter::CheckBackpatchListIsEmpty(DosBackpatchTarget target)
+void DosExeEmitter::ApplyBackpatch(const DosBackpatchInstruction& b, int32_t ip_dst)
 {
-    std::list<DosBackpatchInstruction>::iterator it = backpatch.begin();
+    switch (b.type) {
+        case DosBackpatchType::ToRel8: {
+            int32_t rel8 = (int32_t)(ip_dst - b.backpatch_ip);
+            if (rel8 < INT8_MIN || rel8 > INT8_MAX) {
+                throw CompilerException(CompilerExceptionSource::Compilation,
+                    "Compiler cannot generate that high relative address");
+            }
 
-    while (it != backpatch.end()) {
-        if (it->target == target) {
-            if (target == DosBackpatchTarget::Function) {
-                std::string message = "Function \"";
-                message += it->value;
-                message += "\" could not be resolved";
-                throw CompilerException(CompilerExceptionSource::Statement, message);
-            } else if (target == DosBackpatchTarget::String) {
-                std::string message = "String \"";
-                message += it->value;
-                message += "\" could not be resolved";
+            *(int8_t*)(buffer + b.backpatch_offset) = (int8_t)rel8;
+            break;
+        }
+        case DosBackpatchType::ToRel: {
+            StoreOffset(buffer + b.backpatch_offset, (int32_t)(ip_dst - b.backpatch_ip));
+            break;
+        }
+        case DosBackpatchType::ToDsAbs: {
+            StoreOffset(buffer + b.backpatch_offset, (int32_t)(ip_dst + code_base));
+            break;
+        }
+        case DosBackpatchType::ToDsAbsAdd: {
+            int32_t stored = LoadOffset(buffer + b.backpatch_offset);
+            StoreOffset(buffer + b.backpatch_offset, stored + (int32_t)(ip_dst + code_base));
+            break;
+        }
+        case DosBackpatchType::ToStack8: {
+            *(int8_t*)(buffer + b.backpatch_offset) = (int8_t)ip_dst;
+            break;
+        }
+
+        default: ThrowOnUnreachableCode();
+    }
+}
+
+void DosExeEmitter::MoveRelocations()
+{
+    std::list<DosBackpatchInstruction>::iterator it = backpatch.begin();
+
+    while (it != backpatch.end()) {
+        if (FindLinkSymbols(it->target)) {
+            relocations.splice(relocations.end(), backpatch, it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::unordered_map<std::string, int32_t>* DosExeEmitter::FindLinkSymbols(DosBackpatchTarget target)
+{
+    switch (target) {
+        case DosBackpatchTarget::Function: return &function_symbols;
+        case DosBackpatchTarget::String: return &string_symbols;
+        case DosBackpatchTarget::Static: return &static_symbols;
+
+        default: return nullptr;
+    }
+}
+
+void DosExeEmitter::CheckBackpatchListIsEmpty(DosBackpatchTarget target)
+{
+    std::list<DosBackpatchInstruction>::iterator it = backpatch.begin();
+
+    while (it != backpatch.end()) {
+        if (it->target == target) {
+            if (target == DosBackpatchTarget::Function) {
+                std::string message = "Function \"";
+                message += it->value;
+                message += "\" could not be resolved";
+                throw CompilerException(CompilerExceptionSource::Statement, message);
+            } else if (target == DosBackpatchTarget::String) {
+                std::string message = "String \"";
+                message += it->value;
+                message += "\" could not be resolved";
                 throw CompilerException(CompilerExceptionSource::Statement, message);
             } else {
                 ThrowOnUnreachableCode();
@@ -2159,92 +2221,303 @@ Retry:
                 // Start of entry point
                 EmitFunctionEpilogue();
 
+                if (TryEmitCachedFunction(symbol, symbol_table)) {
+                    goto Retry;
+                }
+
                 EmitEntryPointPrologue(symbol);
 
                 RefreshParentEndIp(symbol_table);
 
+                ComputeValueRanges();
+
+                PromoteStaticVariable();
+
+                if (profile) {
+                    ComputeVariableWeights();
+                }
+
+                is_block_entry = true;
+
                 Log::PopIndent();
                 Log::Write(LogType::Info, "Compiling entry point...");
                 Log::PushIndent();
+
+                if (promoted_static) {
+                    Log::Write(LogType::Verbose, "Static variable \"%s\" is kept in register", promoted_static->symbol->name);
+                }
             } else if (symbol->type.base == BaseSymbolType::Function) {
                 // Start of standard function
                 EmitFunctionEpilogue();
 
-                if (symbol->ref_count == 0) {
-                    // Function is not referenced, it will be optimized out
+                bool is_cold = (symbol->ref_count != 0 && profile && !emitting_cold_functions &&
+                                profile->IsColdFunction(symbol->name));
+
+                if (symbol->ref_count == 0 || is_cold) {
+                    DosDeferredFunction deferred { current_instruction, ip_src, 0 };
+
                     Log::PopIndent();
-                    Log::Write(LogType::Info, "Function \"%s\" was optimized out", symbol->name);
+                    if (is_cold) {
+                        // Function was never executed, it will be emitted later
+                        Log::Write(LogType::Info, "Function \"%s\" was not executed in profile, it will be placed out of line", symbol->name);
+                    } else {
+                        // Function is not referenced, it will be optimized out
+                        Log::Write(LogType::Info, "Function \"%s\" was optimized out", symbol->name);
+                    }
                     Log::PushIndent();
 
                     // Find the beginning of the next function to skip unused lines
-                    current_instruction = current_instruction->next;
-                    ip_src++;
-
-                    while (current_instruction) {
-                        symbol = symbol_table;
-                        while (symbol) {
-                            if (symbol->ip == ip_src &&
-                                (symbol->type.base == BaseSymbolType::Function || symbol->type.base == BaseSymbolType::EntryPoint)) {
-                                goto CanContinue;
-                            }
+                    SkipToNextFunction(symbol_table);
 
-                            symbol = symbol->next;
-                        }
-
-                        current_instruction = current_instruction->next;
-                        ip_src++;
+                    if (is_cold) {
+                        deferred.ip_end = ip_src;
+                        cold_functions.push_back(deferred);
                     }
 
-                CanContinue:
                     // Adjust "ip_src_to_dst" mapping, because of unloaded registers
                     ip_src_to_dst[ip_src] = ip_dst;
 
                     goto Retry;
                 }
 
+                if (TryEmitCachedFunction(symbol, symbol_table)) {
+                    goto Retry;
+                }
+
                 EmitFunctionPrologue(symbol, symbol_table);
 
                 RefreshParentEndIp(symbol_table);
 
+                ComputeValueRanges();
+
+                PromoteStaticVariable();
+
+                if (discontinuous_ips.find(ip_src) != discontinuous_ips.end()) {
+                    // The first instruction is target of jump, so parameters
+                    // passed in registers must be unloaded after the prologue
+                    SaveAndUnloadAllRegisters(SaveReason::Before);
+
+                    ip_src_to_dst[ip_src] = ip_dst;
+                }
+
+                if (profile) {
+                    ComputeVariableWeights();
+                }
+
+                is_block_entry = true;
+
                 Log::PopIndent();
                 Log::Write(LogType::Info, "Compiling function \"%s\"...", parent->name);
                 Log::PushIndent();
-            } else if (symbol->type.base == BaseSymbolType::Label) {
-                // Label
 
-                // Unload all registers before label, so we can
-                // jump to it without any issues
-                SaveAndUnloadAllRegisters(SaveReason::Before);
+                if (promoted_static) {
+                    Log::Write(LogType::Verbose, "Static variable \"%s\" is kept in register", promoted_static->symbol->name);
+                }
+            }
+        }
 
-                // Adjust "ip_src_to_dst" mapping, because of unloaded registers
-                ip_src_to_dst[ip_src] = ip_dst;
+        symbol = symbol->next;
+    }
 
-                BackpatchLabels({ symbol->name, ip_dst }, DosBackpatchTarget::Label);
-            }
+    // Labels are declared before their function in the symbol table,
+    // so they are processed after the prologue of the function was emitted
+    symbol = symbol_table;
+
+    while (symbol) {
+        if (symbol->ip == ip_src && symbol->type.base == BaseSymbolType::Label) {
+            // Unload all registers before label, so we can
+            // jump to it without any issues
+            SaveAndUnloadAllRegisters(SaveReason::Before);
+
+            // Adjust "ip_src_to_dst" mapping, because of unloaded registers
+            ip_src_to_dst[ip_src] = ip_dst;
+
+            BackpatchLabels({ symbol->name, ip_dst }, DosBackpatchTarget::Label);
+
+            // Keep the label for "goto" statements that follow it
+            labels.push_back({ symbol->name, (int32_t)ip_dst });
+
+            is_block_entry = true;
         }
 
         symbol = symbol->next;
     }
 }
 
+void DosExeEmitter::SkipToNextFunction(SymbolTableEntry* symbol_table)
+{
+    current_instruction = current_instruction->next;
+    ip_src++;
+
+    while (current_instruction) {
+        SymbolTableEntry* symbol = symbol_table;
+        while (symbol) {
+            if (symbol->ip == ip_src &&
+                (symbol->type.base == BaseSymbolType::Function || symbol->type.base == BaseSymbolType::EntryPoint)) {
+                return;
+            }
+
+            symbol = symbol->next;
+        }
+
+        current_instruction = current_instruction->next;
+        ip_src++;
+    }
+}
+
+bool DosExeEmitter::TryEmitCachedFunction(SymbolTableEntry* function, SymbolTableEntry* symbol_table)
+{
+    parent_cache_key = 0;
+
+    FunctionCache* cache = compiler->GetFunctionCache();
+    if (!cache) {
+        return false;
+    }
+
+    uint64_t key = cache->ComputeKey(function, current_instruction, ip_src, discontinuous_ips);
+    const FunctionCacheEntry* entry = cache->Find(key);
+    if (!entry) {
+        // Function will be added to cache in epilogue
+        parent_cache_key = key;
+        return false;
+    }
+
+    // Jumps from the previous function to this one are resolved before the instructions are skipped
+    BackpatchAddresses();
+
+    compiler->GetStats()->BeginFunction(function->name, ip_dst);
+
+    int32_t begin = ip_dst;
+    uint8_t* dst = AllocateBufferForInstruction((uint32_t)entry->code.size());
+    memcpy(dst, entry->code.data(), entry->code.size());
+
+    uint32_t code_offset = (uint32_t)(dst - buffer);
+
+    int32_t entry_ip = begin + (int32_t)entry->entry;
+    bool is_entry_point = (function->type.base == BaseSymbolType::EntryPoint);
+    if (!is_entry_point) {
+        BackpatchLabels({ function->name, entry_ip }, DosBackpatchTarget::Function);
+    }
+
+    for (const FunctionCacheRelocation& relocation : entry->relocations) {
+        DosBackpatchInstruction b { };
+        b.type = (DosBackpatchType)relocation.type;
+        b.target = (DosBackpatchTarget)relocation.target;
+        b.backpatch_offset = code_offset + relocation.offset;
+        b.backpatch_ip = (uint32_t)(begin + relocation.ip);
+        b.value = compiler->InternString(relocation.name.c_str());
+
+        if (b.target == DosBackpatchTarget::String) {
+            strings.insert(b.value);
+        } else if (b.target == DosBackpatchTarget::Function) {
+            // Some shared functions are referenced only by emitted code (e.g. comparison of strings)
+            SymbolTableEntry* symbol = compiler->FindSymbolByName(b.value);
+            if (symbol && symbol->type.base == BaseSymbolType::SharedFunction) {
+                symbol->ref_count++;
+            }
+        }
+
+        relocations.push_back(b);
+    }
+
+    function_ranges.push_back({ function->name, begin, ip_dst, entry_ip, is_entry_point });
+
+    compiler->GetStats()->EndFunction(ip_dst);
+
+    Log::PopIndent();
+    if (is_entry_point) {
+        Log::Write(LogType::Info, "Entry point was reused from cache");
+    } else {
+        Log::Write(LogType::Info, "Function \"%s\" was reused from cache", function->name);
+    }
+    Log::PushIndent();
+
+    SkipToNextFunction(symbol_table);
+
+    // Adjust "ip_src_to_dst" mapping, because of skipped instructions
+    ip_src_to_dst[ip_src] = ip_dst;
+
+    return true;
+}
+
+void DosExeEmitter::AddFunctionToCache(int32_t entry_ip, size_t first_relocation)
+{
+    // Unresolved jumps target instructions outside of the function, so it can't be moved
+    for (const DosBackpatchInstruction& b : backpatch) {
+        if (b.target == DosBackpatchTarget::IP) {
+            return;
+        }
+    }
+
+    uint32_t code_offset = (buffer_offset - ip_dst) + parent_ip_dst;
+
+    FunctionCacheEntry entry { };
+    entry.key = parent_cache_key;
+    entry.code.assign(buffer + code_offset, buffer + buffer_offset);
+    entry.entry = (uint32_t)(entry_ip - (int32_t)parent_ip_dst);
+
+    std::list<DosBackpatchInstruction>::iterator it = std::prev(relocations.end(), relocations.size() - first_relocation);
+    while (it != relocations.end()) {
+        entry.relocations.push_back({ (uint8_t)it->type, (uint8_t)it->target, it->backpatch_offset - code_offset,
+            (int32_t)(it->backpatch_ip - parent_ip_dst), it->value });
+        ++it;
+    }
+
+    compiler->GetFunctionCache()->Add(entry);
+}
+
 void DosExeEmitter::EmitEntryPointPrologue(SymbolTableEntry* function)
 {
     parent = function;
+    BindParentVariables(function);
+    parent_ip_dst = ip_dst;
+
+    compiler->GetStats()->BeginFunction(function->name, ip_dst);
+
+    if (default_size == 2) {
+        // Prepare for startup, flat memory model has segments already set
+        AsmMov(CpuRegister::AX, CpuSegment::DS);
+        AsmMov(CpuSegment::SS, CpuRegister::AX);
+        AsmMov(CpuSegment::ES, CpuRegister::AX);
+    }
+
+    if (instrument_profile) {
+        // Static memory is not initialized by DOS, so profile counters must be cleared
+        //   mov di, [counters]
+        uint8_t* l1 = AllocateBufferForInstruction(1 + default_size);
+        l1[0] = ToOpR(0xB8, CpuRegister::DI);   // mov r16/32, imm16/32
+        backpatch.push_back({
+            DosBackpatchType::ToDsAbs, DosBackpatchTarget::Static,
+            (uint32_t)((l1 + 1) - buffer), 0, 0, ProfileCountersName
+        });
+
+        //   mov cx, [counter_count * 2]
+        uint8_t* l2 = AllocateBufferForInstruction(1 + default_size);
+        l2[0] = ToOpR(0xB8, CpuRegister::CX);   // mov r16/32, imm16/32
 
-    // Prepare for startup
-    AsmMov(CpuRegister::AX, CpuSegment::DS);
-    AsmMov(CpuSegment::SS, CpuRegister::AX);
-    AsmMov(CpuSegment::ES, CpuRegister::AX);
+        // Number of counters is known after all instructions are emitted
+        profile_clear_offset = (l2 + 1) - buffer;
+
+        ZeroRegister(CpuRegister::AX, 2);
+
+        //   cld
+        uint8_t* l3 = AllocateBufferForInstruction(1);
+        l3[0] = 0xFC;   // cld
+
+        //   rep stosw
+        uint8_t* l4 = AllocateBufferWithPrefix(2, 2);
+        l4[0] = 0xF3;   // rep
+        l4[1] = 0xAB;   // stosw
+    }
 
     // Create new call frame
-    uint8_t* l4 = AllocateBufferForInstruction(3);
-    l4[0] = 0x66;    // Operand size prefix
-    l4[1] = 0x8B;    // mov r32 (ebp), rm32 (esp)
-    l4[2] = ToXrm(3, CpuRegister::BP, CpuRegister::SP);
+    uint8_t* l4 = AllocateBufferWithPrefix(4, 2);
+    l4[0] = 0x8B;    // mov r32 (ebp), rm32 (esp)
+    l4[1] = ToXrm(3, CpuRegister::BP, CpuRegister::SP);
 
     // Allocate space for local variables
-    uint8_t* l5 = AllocateBufferForInstruction(2 + 2);
-    l5[0] = 0x81;    // sub rm32 (esp), imm32 <size>
+    uint8_t* l5 = AllocateBufferForInstruction(2 + default_size);
+    l5[0] = 0x81;    // sub rm16/32 (esp), imm16/32 <size>
     l5[1] = ToXrm(3, 5, CpuRegister::SP);
 
     parent_stack_offset = (l5 + 2) - buffer;
@@ -2256,40 +2529,45 @@ void DosExeEmitter::EmitEntryPointPrologue(SymbolTableEntry* function)
 void DosExeEmitter::EmitFunctionPrologue(SymbolTableEntry* function, SymbolTableEntry* symbol_table)
 {
     parent = function;
+    BindParentVariables(function);
+    parent_ip_dst = ip_dst;
 
-    // Create backpatch information
-    BackpatchLabels({ function->name, ip_dst }, DosBackpatchTarget::Function);
-
-    functions.push_back({ function->name, ip_dst });
-
-    // Create new call frame
-    AsmProcEnter();
+    compiler->GetStats()->BeginFunction(function->name, ip_dst);
 
-    // Allocate space for local variables in stack
-    int32_t stack_param_size = 0;
+    // EBX is callee-saved, unused instructions of prologue are removed in epilogue,
+    // so the entry point of the function is known after all instructions are emitted
+    parent_uses_bx = false;
+    parent_returns.clear();
 
-    std::list<DosVariableDescriptor>::iterator it = variables.begin();
+    uint8_t* push = AllocateBufferWithPrefix(4, 1);
+    push[0] = ToOpR(0x50, CpuRegister::BX);     // push ebx
 
-    while (it != variables.end()) {
-        if (it->symbol->parent && strcmp(it->symbol->parent, parent->name) == 0) {
-            if (it->symbol->parameter) { // Parameter
-                int32_t size = compiler->GetSymbolTypeSize(it->symbol->type);
-                if (size < 2) { // Min. push size is 2 bytes
-                    size = 2;
-                }
+    parent_frame_offset = buffer_offset;
 
-                // 4 bytes are used by ebp, 2 bytes are used for return address
-                it->location = stack_param_size + 6;
+    // Create new call frame
+    AsmProcEnter();
 
-                stack_param_size += size;
+    // Bind parameters passed in registers
+    for (uint32_t i = parent_variables.begin; i < parent_variables.end; i++) {
+        DosVariableDescriptor* var = &variables[i];
+
+        if (var->symbol->parameter) { // Parameter
+            CpuRegister reg = GetParameterRegister(function, var->symbol->parameter);
+            if (reg != CpuRegister::None) {
+                // Parameter is passed in register, it's saved to stack as local variable if needed
+                var->location = 0;
+                SetVariableRegister(var, reg);
+                var->is_dirty = true;
+                var->last_used = ip_src;
+            } else {
+                // Location depends on saved ebx, so it's resolved in epilogue
+                var->location = 0;
             }
         }
-
-        ++it;
     }
 
-    uint8_t* a = AllocateBufferForInstruction(2 + 2);
-    a[0] = 0x81;    // sub rm32 (esp), imm32 <size>
+    uint8_t* a = AllocateBufferForInstruction(2 + default_size);
+    a[0] = 0x81;    // sub rm16/32 (esp), imm16/32 <size>
     a[1] = ToXrm(3, 5, CpuRegister::SP);
 
     parent_stack_offset = (a + 2) - buffer;
@@ -2309,33 +2587,55 @@ void DosExeEmitter::EmitFunctionEpilogue()
     // Adjust stack for function-local variables
     int32_t stack_var_size = 0;
     int32_t stack_saved_size = 0;
-    std::list<DosVariableDescriptor>::iterator it = variables.begin();
-
-    while (it != variables.end()) {
-        if (it->symbol->parent && strcmp(it->symbol->parent, parent->name) == 0) {
-            if (!it->symbol->parameter) { // Local variable
-                int32_t size;
-                if (it->symbol->size > 0) {
-                    SymbolType resolved_type = it->symbol->type;
-                    resolved_type.pointer--;
-                    size = it->symbol->size * compiler->GetSymbolTypeSize(resolved_type);
-                } else {
-                    size = compiler->GetSymbolTypeSize(it->symbol->type);
-                }
+    int32_t stack_param_size = 0;
+    // Saved ebx (if not removed), ebp and return address are stored below parameters
+    int32_t stack_param_base = GetProcFrameSize() + (parent_uses_bx ? CalleeSavedSize : 0);
+
+    // Call frame is needed only if any variable is accessed in stack
+    bool uses_frame = false;
+    for (const DosBackpatchInstruction& b : backpatch) {
+        if (b.target == DosBackpatchTarget::Local) {
+            uses_frame = true;
+            break;
+        }
+    }
 
-                if (it->symbol->ref_count == 0) {
-                    stack_saved_size += size;
-                } else {
-                    stack_var_size += size;
+    for (uint32_t i = parent_variables.begin; i < parent_variables.end; i++) {
+        DosVariableDescriptor* var = &variables[i];
 
-                    it->location = -stack_var_size;
+        if (!var->symbol->parameter || GetParameterRegister(parent, var->symbol->parameter) != CpuRegister::None) {
+            // Local variable or parameter passed in register
+            int32_t size;
+            if (var->symbol->size > 0) {
+                SymbolType resolved_type = var->symbol->type;
+                resolved_type.pointer--;
+                size = var->symbol->size * compiler->GetSymbolTypeSize(resolved_type);
+            } else {
+                size = compiler->GetSymbolTypeSize(var->symbol->type);
+            }
 
-                    BackpatchLabels({ it->symbol->name, it->location }, DosBackpatchTarget::Local);
-                }
+            if (var->symbol->ref_count == 0) {
+                stack_saved_size += size;
+            } else {
+                stack_var_size += size;
+
+                var->location = -stack_var_size;
+
+                BackpatchLabels({ var->symbol->name, var->location }, DosBackpatchTarget::Local);
+            }
+        } else {
+            // Parameter passed in stack
+            int32_t size = compiler->GetSymbolTypeSize(var->symbol->type);
+            if (size < default_size) { // Min. push size is default operand size
+                size = default_size;
             }
-        }
 
-        ++it;
+            var->location = stack_param_base + stack_param_size;
+
+            stack_param_size += size;
+
+            BackpatchLabels({ var->symbol->name, var->location }, DosBackpatchTarget::Local);
+        }
     }
 
     if (!parent_stack_offset) {
@@ -2347,7 +2647,21 @@ void DosExeEmitter::EmitFunctionEpilogue()
             "Compiler cannot generate that high address offset");
     }
 
-    *(uint16_t*)(buffer + parent_stack_offset) = stack_var_size;
+    StoreOffset(buffer + parent_stack_offset, stack_var_size);
+
+    int32_t entry_ip = (int32_t)parent_ip_dst;
+
+    if (parent->type.base == BaseSymbolType::Function) {
+        uint32_t entry_offset = RemoveUnusedFrame(uses_frame, stack_var_size);
+        entry_ip = (int32_t)(entry_offset + (ip_dst - buffer_offset));
+
+        if (!uses_frame) {
+            Log::Write(LogType::Verbose, "Call frame was omitted");
+        }
+
+        // Create backpatch information
+        BackpatchLabels({ parent->name, entry_ip }, DosBackpatchTarget::Function);
+    }
 
     CheckBackpatchListIsEmpty(DosBackpatchTarget::Local);
 
@@ -2356,9 +2670,78 @@ void DosExeEmitter::EmitFunctionEpilogue()
     // Labels are function-local too, so they must be resolved at this point
     CheckBackpatchListIsEmpty(DosBackpatchTarget::Label);
 
+    // Remaining entries reference other functions or data, keep them aside, so they are not scanned again
+    size_t first_relocation = relocations.size();
+    MoveRelocations();
+
+    function_ranges.push_back({ parent->name, (int32_t)parent_ip_dst, ip_dst, entry_ip,
+        parent->type.base == BaseSymbolType::EntryPoint });
+
+    if (parent_cache_key) {
+        AddFunctionToCache(entry_ip, first_relocation);
+        parent_cache_key = 0;
+    }
+
+    compiler->GetStats()->EndFunction(ip_dst);
+
     parent = nullptr;
 }
 
+uint32_t DosExeEmitter::RemoveUnusedFrame(bool uses_frame, int32_t stack_var_size)
+{
+    uint32_t bx_size = (default_size == 4 ? 1 : 2);
+    uint32_t prologue_offset = parent_frame_offset - bx_size;
+    uint32_t sub_offset = parent_stack_offset - 2;
+    uint32_t body_offset = parent_stack_offset + default_size;
+
+    // Rebuild prologue directly before the body, removed instructions are skipped
+    uint8_t code[16];
+    uint32_t size = 0;
+
+    if (parent_uses_bx) {
+        memcpy(code + size, buffer + prologue_offset, bx_size);
+        size += bx_size;
+    }
+
+    if (uses_frame) {
+        memcpy(code + size, buffer + parent_frame_offset, sub_offset - parent_frame_offset);
+        size += sub_offset - parent_frame_offset;
+
+        if (stack_var_size > 0) {
+            code[size++] = 0x83;    // sub rm16/32 (esp), imm8 <size>
+            code[size++] = ToXrm(3, 5, CpuRegister::SP);
+            code[size++] = (uint8_t)stack_var_size;
+        }
+    }
+
+    uint32_t entry_offset = body_offset - size;
+    memset(buffer + prologue_offset, 0x90, entry_offset - prologue_offset);
+    memcpy(buffer + entry_offset, code, size);
+
+    // Rebuild all epilogues, "retn" follows the last needed instruction
+    for (const DosReturnSite& site : parent_returns) {
+        size = 0;
+
+        if (uses_frame) {
+            memcpy(code + size, buffer + site.offset, site.bx_offset - site.offset);
+            size += site.bx_offset - site.offset;
+        }
+
+        if (parent_uses_bx) {
+            memcpy(code + size, buffer + site.bx_offset, site.ret_offset - site.bx_offset);
+            size += site.ret_offset - site.bx_offset;
+        }
+
+        memcpy(code + size, buffer + site.ret_offset, site.end_offset - site.ret_offset);
+        size += site.end_offset - site.ret_offset;
+
+        memcpy(buffer + site.offset, code, size);
+        memset(buffer + site.offset + size, 0x90, site.end_offset - site.offset - size);
+    }
+
+    return entry_offset;
+}
+
 void DosExeEmitter::EmitAssign(InstructionEntry* i)
 {
     switch (i->assignment.type) {
@@ -2405,8 +2788,8 @@ void DosExeEmitter::EmitAssignNone(InstructionEntry* i)
                 // Load string address to register
                 reg_dst = GetUnusedRegister();
 
-                uint8_t* a = AllocateBufferForInstruction(1 + 2);
-                a[0] = ToOpR(0xB8, reg_dst);   // mov r16, imm16
+                uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+                a[0] = ToOpR(0xB8, reg_dst);   // mov r16/32, imm16/32
 
                 // Create backpatch info for string
                 BackpatchString(a + 1, i->assignment.op1.value);
@@ -2417,7 +2800,7 @@ void DosExeEmitter::EmitAssignNone(InstructionEntry* i)
                 // Load constant to register
                 reg_dst = GetUnusedRegister();
 
-                int32_t value = atoi(i->assignment.op1.value);
+                int32_t value = (int32_t)i->assignment.op1.imm;
 
                 int32_t dst_size = compiler->GetSymbolTypeSize(dst->symbol->type);
                 LoadConstantToRegister(value, reg_dst, dst_size);
@@ -2427,7 +2810,7 @@ void DosExeEmitter::EmitAssignNone(InstructionEntry* i)
                 // Array values are not cached
                 SaveIndexedVariable(dst, i->assignment.dst_index, reg_dst);
             } else {
-                dst->reg = reg_dst;
+                SetVariableRegister(dst, reg_dst);
                 dst->is_dirty = true;
             }
             dst->last_used = ip_src;
@@ -2449,14 +2832,14 @@ void DosExeEmitter::EmitAssignNone(InstructionEntry* i)
                     // Load string address to register
                     reg_dst = GetUnusedRegister();
 
-                    uint8_t* a = AllocateBufferForInstruction(1 + 2);
-                    a[0] = ToOpR(0xB8, reg_dst);    // mov r16, imm16
+                    uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+                    a[0] = ToOpR(0xB8, reg_dst);    // mov r16/32, imm16/32
 
                     // Create backpatch info for string
                     {
                     DosBackpatchInstruction b { };
                     b.target = DosBackpatchTarget::String;
-                    b.type = DosBackpatchType::ToDsAbs16;
+                    b.type = DosBackpatchType::ToDsAbs;
                     b.backpatch_offset = (a + 1) - buffer;
                     b.value = i->assignment.op1.value;
                     backpatch.push_back(b);
@@ -2484,7 +2867,7 @@ void DosExeEmitter::EmitAssignNone(InstructionEntry* i)
                 // Array values are not cached
                 SaveIndexedVariable(dst, i->assignment.dst_index, reg_dst);
             } else {
-                dst->reg = reg_dst;
+                SetVariableRegister(dst, reg_dst);
                 dst->is_dirty = true;
             }
             dst->last_used = ip_src;
@@ -2526,7 +2909,7 @@ void DosExeEmitter::EmitAssignNegation(InstructionEntry* i)
 
     switch (i->assignment.op1.exp_type) {
         case ExpressionType::Constant: {
-            int32_t value = atoi(i->assignment.op1.value);
+            int32_t value = (int32_t)i->assignment.op1.imm;
             LoadConstantToRegister(value, reg_dst, dst_size);
             break;
         }
@@ -2546,24 +2929,18 @@ void DosExeEmitter::EmitAssignNegation(InstructionEntry* i)
             a[1] = ToXrm(3, 3, reg_dst);
             break;
         }
-        case 2: {
-            uint8_t* a = AllocateBufferForInstruction(2);
-            a[0] = 0xF7;   // neg rm16
-            a[1] = ToXrm(3, 3, reg_dst);
-            break;
-        }
+        case 2:
         case 4: {
-            uint8_t* a = AllocateBufferForInstruction(3);
-            a[0] = 0x66;   // Operand size prefix
-            a[1] = 0xF7;   // neg rm32
-            a[2] = ToXrm(1, 3, reg_dst);
+            uint8_t* a = AllocateBufferWithPrefix(dst_size, 2);
+            a[0] = 0xF7;   // neg rm16/32
+            a[1] = ToXrm(3, 3, reg_dst);
             break;
         }
 
         default: ThrowOnUnreachableCode();
     }
 
-    dst->reg = reg_dst;
+    SetVariableRegister(dst, reg_dst);
     dst->is_dirty = true;
     dst->last_used = ip_src;
 }
@@ -2574,13 +2951,10 @@ void DosExeEmitter::EmitAssignAddSubtract(InstructionEntry* i)
 
     if (i->assignment.type == AssignType::Add && dst->symbol->type.base == BaseSymbolType::String) {
         if (i->assignment.op1.exp_type == ExpressionType::Constant && i->assignment.op2.exp_type == ExpressionType::Constant) {
-            size_t length1 = strlen(i->assignment.op1.value);
-            size_t length2 = strlen(i->assignment.op2.value);
+            std::string concat_value = i->assignment.op1.value;
+            concat_value += i->assignment.op2.value;
 
-            char* concat = new char[length1 + length2 + 1];
-            memcpy(concat, i->assignment.op1.value, length1);
-            memcpy(concat + length1, i->assignment.op2.value, length2);
-            concat[length1 + length2] = '\0';
+            char* concat = compiler->InternString(concat_value.c_str());
 
             strings.insert(concat);
 
@@ -2588,10 +2962,10 @@ void DosExeEmitter::EmitAssignAddSubtract(InstructionEntry* i)
             //dst->symbol->exp_type = ExpressionType::Constant;
 
             // Load string address to register
-            dst->reg = GetUnusedRegister();
+            SetVariableRegister(dst, GetUnusedRegister());
 
-            uint8_t* a = AllocateBufferForInstruction(1 + 2);
-            a[0] = ToOpR(0xB8, dst->reg);   // mov r16, imm16
+            uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+            a[0] = ToOpR(0xB8, dst->reg);   // mov r16/32, imm16/32
 
             // Create backpatch info for string
             BackpatchString(a + 1, concat);
@@ -2617,8 +2991,8 @@ void DosExeEmitter::EmitAssignAddSubtract(InstructionEntry* i)
 
     if (i->assignment.op1.exp_type == ExpressionType::Constant) {
         // Both operands are constants
-        int32_t value1 = atoi(i->assignment.op1.value);
-        int32_t value2 = atoi(i->assignment.op2.value);
+        int32_t value1 = (int32_t)i->assignment.op1.imm;
+        int32_t value2 = (int32_t)i->assignment.op2.imm;
 
         if (i->assignment.type == AssignType::Add) {
             value1 += value2;
@@ -2630,7 +3004,7 @@ void DosExeEmitter::EmitAssignAddSubtract(InstructionEntry* i)
 
         LoadConstantToRegister(value1, reg_dst, dst_size);
 
-        dst->reg = reg_dst;
+        SetVariableRegister(dst, reg_dst);
         dst->is_dirty = true;
         dst->last_used = ip_src;
         return;
@@ -2645,58 +3019,27 @@ void DosExeEmitter::EmitAssignAddSubtract(InstructionEntry* i)
         reg_dst = LoadVariableUnreferenced(op1, dst_size);
     }
 
+    // Addition can be done with default operand size, if the result is known to fit into it,
+    // subtraction can underflow, so it always uses the size of destination
+    int32_t op_size = dst_size;
+    if (i->assignment.type == AssignType::Add) {
+        op_size = GetNarrowOperandSize(dst_size, (uint64_t)GetOperandMaxValue(i->assignment.op1) + GetOperandMaxValue(i->assignment.op2));
+    }
+
     switch (i->assignment.op2.exp_type) {
         case ExpressionType::Constant: {
-            int32_t value = atoi(i->assignment.op2.value);
+            int32_t value = (int32_t)i->assignment.op2.imm;
             if (i->assignment.type == AssignType::Subtract) {
                 value = -value;
             }
-            
-            switch (dst_size) {
-                case 1: {
-                    uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                    a[0] = 0x80;        // add rm8, imm8
-                    a[1] = ToXrm(3, 0, reg_dst);
-                    *(int8_t*)(a + 2) = value;
-
-                    if (i->assignment.type == AssignType::Subtract && constant_swapped) {
-                        uint8_t* neg = AllocateBufferForInstruction(2);
-                        neg[0] = 0xF6;  // neg rm8
-                        neg[1] = ToXrm(3, 3, reg_dst);
-                    }
-                    break;
-                }
-                case 2: {
-                    uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                    a[0] = 0x81;        // add rm16, imm16
-                    a[1] = ToXrm(3, 0, reg_dst);
-                    *(int16_t*)(a + 2) = value;
-
-                    if (i->assignment.type == AssignType::Subtract && constant_swapped) {
-                        uint8_t* neg = AllocateBufferForInstruction(2);
-                        neg[0] = 0xF7;  // neg rm16
-                        neg[1] = ToXrm(3, 3, reg_dst);
-                    }
-                    break;
-                }
-                case 4: {
-                    uint8_t* a = AllocateBufferForInstruction(3 + 4);
-                    a[0] = 0x66;        // Operand size prefix
-                    a[1] = 0x81;        // add rm32, imm32
-                    a[2] = ToXrm(3, 0, reg_dst);
-                    *(int32_t*)(a + 3) = value;
-
-                    if (i->assignment.type == AssignType::Subtract && constant_swapped) {
-                        uint8_t* neg = AllocateBufferForInstruction(3);
-                        neg[0] = 0x66;  // Operand size prefix
-                        neg[1] = 0xF7;  // neg rm32
-                        neg[2] = ToXrm(3, 3, reg_dst);
-                    }
 
-                    break;
-                }
+            //   add rm8/16/32, imm8/16/32
+            EmitImmediateOperation(op_size, 0, reg_dst, value);
 
-                default: ThrowOnUnreachableCode();
+            if (i->assignment.type == AssignType::Subtract && constant_swapped) {
+                uint8_t* neg = AllocateBufferWithPrefix(op_size, 2);
+                neg[0] = (op_size == 1 ? 0xF6 : 0xF7);  // neg rm8/16/32
+                neg[1] = ToXrm(3, 3, reg_dst);
             }
             break;
         }
@@ -2704,84 +3047,47 @@ void DosExeEmitter::EmitAssignAddSubtract(InstructionEntry* i)
             DosVariableDescriptor* op2 = FindVariableByName(i->assignment.op2.value);
             int32_t op2_size = compiler->GetSymbolTypeSize(op2->symbol->type);
 
-            if (op2_size < dst_size) {
-                SuppressRegister _(this, reg_dst);
-                op2->reg = LoadVariableUnreferenced(op2, dst_size);
+            // The first operand may have been unloaded from its register without storing it,
+            // because its next reference is in this instruction, so the loaded copy is used instead
+            CpuRegister reg_src;
+            if (op2 == op1) {
+                reg_src = reg_dst;
+            } else {
+                if (op2_size < op_size) {
+                    SuppressRegister _(this, reg_dst);
+                    SetVariableRegister(op2, LoadVariableUnreferenced(op2, op_size));
+                }
+
+                reg_src = op2->reg;
             }
 
-            switch (dst_size) {
+            switch (op_size) {
                 case 1: {
                     uint8_t opcode = (i->assignment.type == AssignType::Add ? 0x02 : 0x2A);
-                    if (op2->reg != CpuRegister::None) {
+                    if (reg_src != CpuRegister::None) {
                         // Register to register copy
                         uint8_t* a = AllocateBufferForInstruction(2);
                         a[0] = opcode; // add/sub r8, rm8
-                        a[1] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = opcode; // add/sub r8, rm8
-                        a[1] = ToXrm(0, reg_dst, 6);
-
-                        BackpatchStatic(a + 2, op2);
+                        a[1] = ToXrm(3, reg_dst, reg_src);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = opcode; // add/sub r8, rm8
-                        a[1] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchLocal(a + 2, op2);
+                        // Static or stack to register copy
+                        //   add/sub r8, rm8
+                        EmitVariableAccess(1, { opcode }, reg_dst, op2);
                     }
                     break;
                 }
-                case 2: {
+                case 2:
+                case 4: {
                     uint8_t opcode = (i->assignment.type == AssignType::Add ? 0x03 : 0x2B);
-                    if (op2->reg != CpuRegister::None) {
+                    if (reg_src != CpuRegister::None) {
                         // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(2);
-                        a[0] = opcode; // add/sub r16, rm16
-                        a[1] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = opcode; // add/sub r16, rm16
-                        a[1] = ToXrm(0, reg_dst, 6);
-
-                        BackpatchStatic(a + 2, op2);
-                    } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = opcode; // add/sub r16, rm16
-                        a[1] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchLocal(a + 2, op2);
-                    }
-                    break;
-                }
-                case 4: {
-                    uint8_t opcode = (i->assignment.type == AssignType::Add ? 0x03 : 0x2B);
-                    if (op2->reg != CpuRegister::None) {
-                        // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(3);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = opcode; // add/sub r32, rm32
-                        a[2] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = opcode; // add/sub r32, rm32
-                        a[2] = ToXrm(0, reg_dst, 6);
-
-                        BackpatchStatic(a + 3, op2);
+                        uint8_t* a = AllocateBufferWithPrefix(op_size, 2);
+                        a[0] = opcode; // add/sub r16/32, rm16/32
+                        a[1] = ToXrm(3, reg_dst, reg_src);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = opcode; // add/sub r32, rm32
-                        a[2] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchLocal(a + 3, op2);
+                        // Static or stack to register copy
+                        //   add/sub r16/32, rm16/32
+                        EmitVariableAccess(op_size, { opcode }, reg_dst, op2);
                     }
                     break;
                 }
@@ -2794,7 +3100,7 @@ void DosExeEmitter::EmitAssignAddSubtract(InstructionEntry* i)
         default: ThrowOnUnreachableCode();
     }
 
-    dst->reg = reg_dst;
+    SetVariableRegister(dst, reg_dst);
     dst->is_dirty = true;
     dst->last_used = ip_src;
 }
@@ -2812,8 +3118,8 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
 
     if (i->assignment.op1.exp_type == ExpressionType::Constant) {
         // Both operands are constants - constant expression
-        int32_t value1 = atoi(i->assignment.op1.value);
-        int32_t value2 = atoi(i->assignment.op2.value);
+        int32_t value1 = (int32_t)i->assignment.op1.imm;
+        int32_t value2 = (int32_t)i->assignment.op2.imm;
 
         value1 *= value2;
 
@@ -2821,7 +3127,7 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
 
         LoadConstantToRegister(value1, reg_dst, dst_size);
 
-        dst->reg = reg_dst;
+        SetVariableRegister(dst, reg_dst);
         dst->is_dirty = true;
         dst->last_used = ip_src;
         return;
@@ -2829,34 +3135,35 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
 
     DosVariableDescriptor* op1 = FindVariableByName(i->assignment.op1.value);
 
+    // Operands are loaded with full size and narrow multiplication leaves the high part of the register
+    // untouched, so both operands and the product have to fit into default operand size to omit the prefix
+    uint64_t op1_max = GetOperandMaxValue(i->assignment.op1);
+    uint64_t op2_max = GetOperandMaxValue(i->assignment.op2);
+    int32_t mul_size = GetNarrowOperandSize(dst_size, std::max(op1_max * op2_max, std::max(op1_max, op2_max)));
+
     switch (i->assignment.op2.exp_type) {
         case ExpressionType::Constant: {
-            int32_t value = atoi(i->assignment.op2.value);
+            int32_t value = (int32_t)i->assignment.op2.imm;
+
+            if (op1->reg == CpuRegister::AX || (mul_size > 1 && op1->reg == CpuRegister::DX)) {
+                // Operand is read from memory after its register is overwritten by the constant or the product
+                SaveVariable(op1, SaveReason::Before);
+            }
 
             SaveAndUnloadRegister(CpuRegister::AX, SaveReason::Inside);
             LoadConstantToRegister(value, CpuRegister::AX, dst_size);
 
-            switch (dst_size) {
+            switch (mul_size) {
                 case 1: {
                     if (op1->reg != CpuRegister::None) {
                         // Register to register copy
                         uint8_t* a = AllocateBufferForInstruction(2);
                         a[0] = 0xF6;   // mul r8, rm8
                         a[1] = ToXrm(3, 4, op1->reg);
-                    } else if (!op1->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = 0xF6;   // mul r8, rm8
-                        a[1] = ToXrm(0, 4, 6);
-
-                        BackpatchStatic(a + 2, op1);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = 0xF6;   // mul r8, rm8
-                        a[1] = ToXrm(1, 4, 6);
-
-                        BackpatchLocal(a + 2, op1);
+                        // Static or stack to register copy
+                        //   mul r8, rm8
+                        EmitVariableAccess(1, { 0xF6 }, 4, op1);
                     }
                     break;
                 }
@@ -2866,23 +3173,13 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
 
                     if (op1->reg != CpuRegister::None) {
                         // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(2);
+                        uint8_t* a = AllocateBufferWithPrefix(2, 2);
                         a[0] = 0xF7;   // mul r16, rm16
                         a[1] = ToXrm(3, 4, op1->reg);
-                    } else if (!op1->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = 0xF7;   // mul r16, rm16
-                        a[1] = ToXrm(0, 4, 6);
-
-                        BackpatchStatic(a + 2, op1);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = 0xF7;   // mul r16, rm16
-                        a[1] = ToXrm(1, 4, 6);
-
-                        BackpatchLocal(a + 2, op1);
+                        // Static or stack to register copy
+                        //   mul r16, rm16
+                        EmitVariableAccess(2, { 0xF7 }, 4, op1);
                     }
                     break;
                 }
@@ -2892,26 +3189,13 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
 
                     if (op1->reg != CpuRegister::None) {
                         // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(3);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = 0xF7;   // mul r32, rm32
-                        a[2] = ToXrm(3, 4, op1->reg);
-                    } else if (!op1->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = 0xF7;   // mul r32, rm32
-                        a[2] = ToXrm(0, 4, 6);
-
-                        BackpatchStatic(a + 3, op1);
+                        uint8_t* a = AllocateBufferWithPrefix(4, 2);
+                        a[0] = 0xF7;   // mul r32, rm32
+                        a[1] = ToXrm(3, 4, op1->reg);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = 0xF7;   // mul r32, rm32
-                        a[2] = ToXrm(1, 4, 6);
-
-                        BackpatchLocal(a + 3, op1);
+                        // Static or stack to register copy
+                        //   mul r32, rm32
+                        EmitVariableAccess(4, { 0xF7 }, 4, op1);
                     }
                     break;
                 }
@@ -2929,38 +3213,35 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
                 std::swap(op1, op2);
             }
 
+            if ((op2 == op1 && op2->reg == CpuRegister::AX) || (mul_size > 1 && op2->reg == CpuRegister::DX)) {
+                // Second operand would be lost when AX is loaded or DX receives the high part of the product
+                SaveVariable(op2, SaveReason::Before);
+                SetVariableRegister(op2, CpuRegister::None);
+            }
+
             CopyVariableToRegister(op1, CpuRegister::AX, dst_size);
 
-            // One operand is already in AX
-            SuppressRegister _(this, CpuRegister::AX);
+            // One operand is already in AX and DX is overwritten by the product
+            SuppressRegister _1(this, CpuRegister::AX);
+            SuppressRegister _2(this, CpuRegister::DX);
 
             int32_t op2_size = compiler->GetSymbolTypeSize(op2->symbol->type);
-            if (op2_size < dst_size) {
+            if (op2_size < mul_size) {
                 // Required size is higher than provided, unreference and expand it
-                op2->reg = LoadVariableUnreferenced(op2, dst_size);
+                SetVariableRegister(op2, LoadVariableUnreferenced(op2, mul_size));
             }
 
-            switch (dst_size) {
+            switch (mul_size) {
                 case 1: {
                     if (op2->reg != CpuRegister::None) {
                         // Register to register copy
                         uint8_t* a = AllocateBufferForInstruction(2);
                         a[0] = 0xF6;   // mul r8, rm8
                         a[1] = ToXrm(3, 4, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = 0xF6;   // mul r8, rm8
-                        a[1] = ToXrm(0, 4, 6);
-
-                        BackpatchStatic(a + 2, op2);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = 0xF6;   // mul r8, rm8
-                        a[1] = ToXrm(1, 4, 6);
-
-                        BackpatchLocal(a + 2, op2);
+                        // Static or stack to register copy
+                        //   mul r8, rm8
+                        EmitVariableAccess(1, { 0xF6 }, 4, op2);
                     }
                     break;
                 }
@@ -2970,23 +3251,13 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
 
                     if (op2->reg != CpuRegister::None) {
                         // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(2);
+                        uint8_t* a = AllocateBufferWithPrefix(2, 2);
                         a[0] = 0xF7;   // mul r16, rm16
                         a[1] = ToXrm(3, 4, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = 0xF7;   // mul r16, rm16
-                        a[1] = ToXrm(0, 4, 6);
-
-                        BackpatchStatic(a + 2, op2);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = 0xF7;   // mul r16, rm16
-                        a[1] = ToXrm(1, 4, 6);
-
-                        BackpatchLocal(a + 2, op2);
+                        // Static or stack to register copy
+                        //   mul r16, rm16
+                        EmitVariableAccess(2, { 0xF7 }, 4, op2);
                     }
                     break;
                 }
@@ -2996,26 +3267,13 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
 
                     if (op2->reg != CpuRegister::None) {
                         // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(3);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = 0xF7;   // mul r32, rm32
-                        a[2] = ToXrm(3, 4, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = 0xF7;   // mul r32, rm32
-                        a[2] = ToXrm(0, 4, 6);
-
-                        BackpatchStatic(a + 3, op2);
+                        uint8_t* a = AllocateBufferWithPrefix(4, 2);
+                        a[0] = 0xF7;   // mul r32, rm32
+                        a[1] = ToXrm(3, 4, op2->reg);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = 0xF7;   // mul r32, rm32
-                        a[2] = ToXrm(1, 4, 6);
-
-                        BackpatchLocal(a + 3, op2);
+                        // Static or stack to register copy
+                        //   mul r32, rm32
+                        EmitVariableAccess(4, { 0xF7 }, 4, op2);
                     }
                     break;
                 }
@@ -3028,7 +3286,7 @@ void DosExeEmitter::EmitAssignMultiply(InstructionEntry* i)
         default: ThrowOnUnreachableCode();
     }
 
-    dst->reg = CpuRegister::AX;
+    SetVariableRegister(dst, CpuRegister::AX);
     dst->is_dirty = true;
     dst->last_used = ip_src;
 }
@@ -3039,9 +3297,18 @@ void DosExeEmitter::EmitAssignDivide(InstructionEntry* i)
 
     int32_t dst_size = compiler->GetSymbolTypeSize(dst->symbol->type);
 
+    if (i->assignment.op2.exp_type == ExpressionType::Variable) {
+        DosVariableDescriptor* op2 = FindVariableByName(i->assignment.op2.value);
+        if (op2->reg == CpuRegister::AX || op2->reg == CpuRegister::DX) {
+            // Divisor cannot stay in the registers used by the dividend, it's read from memory instead
+            SaveVariable(op2, SaveReason::Before);
+            SetVariableRegister(op2, CpuRegister::None);
+        }
+    }
+
     switch (i->assignment.op1.exp_type) {
         case ExpressionType::Constant: {
-            int32_t value = atoi(i->assignment.op1.value);
+            int32_t value = (int32_t)i->assignment.op1.imm;
 
             SaveAndUnloadRegister(CpuRegister::AX, SaveReason::Inside);
             // Load with higher size than destination to clear upper/high part
@@ -3069,7 +3336,7 @@ void DosExeEmitter::EmitAssignDivide(InstructionEntry* i)
     CpuRegister op2_reg;
     switch (i->assignment.op2.exp_type) {
         case ExpressionType::Constant: {
-            int32_t value = atoi(i->assignment.op2.value);
+            int32_t value = (int32_t)i->assignment.op2.imm;
 
             op2_reg = GetUnusedRegister();
             LoadConstantToRegister(value, op2_reg, dst_size);
@@ -3091,20 +3358,10 @@ void DosExeEmitter::EmitAssignDivide(InstructionEntry* i)
                 uint8_t* a = AllocateBufferForInstruction(2);
                 a[0] = 0xF6;   // div r8, rm8
                 a[1] = ToXrm(3, 6, op2_reg);
-            } else if (!op2->symbol->parent) {
-                // Static to register copy (16-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                a[0] = 0xF6;   // div r8, rm8
-                a[1] = ToXrm(0, 6, 6);
-
-                BackpatchStatic(a + 2, op2);
             } else {
-                // Stack to register copy (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0xF6;   // div r8, rm8
-                a[1] = ToXrm(1, 6, 6);
-
-                BackpatchLocal(a + 2, op2);
+                // Static or stack to register copy
+                //   div r8, rm8
+                EmitVariableAccess(1, { 0xF6 }, 6, op2);
             }
 
             if (i->assignment.type == AssignType::Remainder) {
@@ -3116,7 +3373,7 @@ void DosExeEmitter::EmitAssignDivide(InstructionEntry* i)
 
             ZeroRegister(CpuRegister::AH, 1);
 
-            dst->reg = CpuRegister::AX;
+            SetVariableRegister(dst, CpuRegister::AX);
             break;
         }
         case 2: {
@@ -3127,26 +3384,16 @@ void DosExeEmitter::EmitAssignDivide(InstructionEntry* i)
 
             if (op2_reg != CpuRegister::None) {
                 // Register to register copy
-                uint8_t* a = AllocateBufferForInstruction(2);
+                uint8_t* a = AllocateBufferWithPrefix(2, 2);
                 a[0] = 0xF7;   // div r16, rm16
                 a[1] = ToXrm(3, 6, op2_reg);
-            } else if (!op2->symbol->parent) {
-                // Static to register copy (16-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                a[0] = 0xF7;   // div r16, rm16
-                a[1] = ToXrm(0, 6, 6);
-
-                BackpatchStatic(a + 2, op2);
             } else {
-                // Stack to register copy (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                a[0] = 0xF7;   // div r16, rm16
-                a[1] = ToXrm(1, 6, 6);
-
-                BackpatchLocal(a + 2, op2);
+                // Static or stack to register copy
+                //   div r16, rm16
+                EmitVariableAccess(2, { 0xF7 }, 6, op2);
             }
 
-            dst->reg = (i->assignment.type == AssignType::Remainder ? CpuRegister::DX : CpuRegister::AX);
+            SetVariableRegister(dst, (i->assignment.type == AssignType::Remainder ? CpuRegister::DX : CpuRegister::AX));
             break;
         }
         case 4: {
@@ -3157,29 +3404,16 @@ void DosExeEmitter::EmitAssignDivide(InstructionEntry* i)
 
             if (op2_reg != CpuRegister::None) {
                 // Register to register copy
-                uint8_t* a = AllocateBufferForInstruction(3);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0xF7;   // div r32, rm32
-                a[2] = ToXrm(3, 6, op2_reg);
-            } else if (!op2->symbol->parent) {
-                // Static to register copy (16-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0xF7;   // div r32, rm32
-                a[2] = ToXrm(0, 6, 6);
-
-                BackpatchStatic(a + 3, op2);
+                uint8_t* a = AllocateBufferWithPrefix(4, 2);
+                a[0] = 0xF7;   // div r32, rm32
+                a[1] = ToXrm(3, 6, op2_reg);
             } else {
-                // Stack to register copy (8-bit range)
-                uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                a[0] = 0x66;   // Operand size prefix
-                a[1] = 0xF7;   // div r32, rm32
-                a[2] = ToXrm(1, 6, 6);
-
-                BackpatchLocal(a + 3, op2);
+                // Static or stack to register copy
+                //   div r32, rm32
+                EmitVariableAccess(4, { 0xF7 }, 6, op2);
             }
 
-            dst->reg = (i->assignment.type == AssignType::Remainder ? CpuRegister::DX : CpuRegister::AX);
+            SetVariableRegister(dst, (i->assignment.type == AssignType::Remainder ? CpuRegister::DX : CpuRegister::AX));
             break;
         }
 
@@ -3196,13 +3430,21 @@ void DosExeEmitter::EmitAssignShift(InstructionEntry* i)
 
     int32_t dst_size = compiler->GetSymbolTypeSize(dst->symbol->type);
 
+    if (i->assignment.op1.exp_type == ExpressionType::Variable) {
+        DosVariableDescriptor* op1 = FindVariableByName(i->assignment.op1.value);
+        if (op1->reg == CpuRegister::CX) {
+            // Shifted value is still needed after CL receives the shift count
+            SaveVariable(op1, SaveReason::Before);
+        }
+    }
+
     switch (i->assignment.op2.exp_type) {
         case ExpressionType::Constant: {
-            int32_t shift = atoi(i->assignment.op2.value);
+            int32_t shift = (int32_t)i->assignment.op2.imm;
 
             if (i->assignment.op1.exp_type == ExpressionType::Constant) {
                 // Shift constant with constant
-                int32_t value = atoi(i->assignment.op1.value);
+                int32_t value = (int32_t)i->assignment.op1.imm;
 
                 if (i->assignment.type == AssignType::ShiftLeft) {
                     value = value << shift;
@@ -3213,7 +3455,7 @@ void DosExeEmitter::EmitAssignShift(InstructionEntry* i)
                 CpuRegister reg_dst = GetUnusedRegister();
                 LoadConstantToRegister(value, reg_dst, dst_size);
 
-                dst->reg = reg_dst;
+                SetVariableRegister(dst, reg_dst);
                 dst->is_dirty = true;
                 dst->last_used = ip_src;
                 return;
@@ -3239,7 +3481,7 @@ void DosExeEmitter::EmitAssignShift(InstructionEntry* i)
     CpuRegister reg_dst;
     switch (i->assignment.op1.exp_type) {
         case ExpressionType::Constant: {
-            int32_t value = atoi(i->assignment.op1.value);
+            int32_t value = (int32_t)i->assignment.op1.imm;
 
             reg_dst = GetUnusedRegister();
             LoadConstantToRegister(value, reg_dst, dst_size);
@@ -3269,24 +3511,18 @@ void DosExeEmitter::EmitAssignShift(InstructionEntry* i)
             a[1] = ToXrm(3, type, reg_dst);
             break;
         }
-        case 2: {
-            uint8_t* a = AllocateBufferForInstruction(2);
-            a[0] = 0xD3;    // shl/shr rm16, cl
-            a[1] = ToXrm(3, type, reg_dst);
-            break;
-        }
+        case 2:
         case 4: {
-            uint8_t* a = AllocateBufferForInstruction(3);
-            a[0] = 0x66;    // Operand size prefix
-            a[1] = 0xD3;    // shl/shr rm32, cl
-            a[2] = ToXrm(3, type, reg_dst);
+            uint8_t* a = AllocateBufferWithPrefix(dst_size, 2);
+            a[0] = 0xD3;    // shl/shr rm16/32, cl
+            a[1] = ToXrm(3, type, reg_dst);
             break;
         }
 
         default: ThrowOnUnreachableCode();
     }
 
-    dst->reg = reg_dst;
+    SetVariableRegister(dst, reg_dst);
     dst->is_dirty = true;
     dst->last_used = ip_src;
 }
@@ -3327,8 +3563,8 @@ void DosExeEmitter::EmitGoto(InstructionEntry* i)
 
         goto_ptr = (a + 1);
     } else {
-        uint8_t* a = AllocateBufferForInstruction(1 + 2);
-        a[0] = 0xE9; // jmp rel16
+        uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+        a[0] = 0xE9; // jmp rel16/32
 
         goto_ptr = (a + 1);
     }
@@ -3345,12 +3581,12 @@ void DosExeEmitter::EmitGoto(InstructionEntry* i)
 
             *(uint8_t*)goto_ptr = rel;
         } else {
-            *(uint16_t*)goto_ptr = rel;
+            StoreOffset(goto_ptr, rel);
         }
     } else {
         // Create backpatch info, if the label was not defined yet
         DosBackpatchInstruction b { };
-        b.type = (goto_near ? DosBackpatchType::ToRel8 : DosBackpatchType::ToRel16);
+        b.type = (goto_near ? DosBackpatchType::ToRel8 : DosBackpatchType::ToRel);
         b.backpatch_offset = goto_ptr - buffer;
         b.backpatch_ip = ip_dst;
         b.target = DosBackpatchTarget::IP;
@@ -3397,8 +3633,8 @@ void DosExeEmitter::EmitGotoLabel(InstructionEntry* i)
 
         goto_ptr = (a + 1);
     } else {
-        uint8_t* a = AllocateBufferForInstruction(1 + 2);
-        a[0] = 0xE9; // jmp rel16
+        uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+        a[0] = 0xE9; // jmp rel16/32
 
         goto_ptr = (a + 1);
     }
@@ -3415,12 +3651,12 @@ void DosExeEmitter::EmitGotoLabel(InstructionEntry* i)
 
             *(uint8_t*)goto_ptr = rel;
         } else {
-            *(uint16_t*)goto_ptr = rel;
+            StoreOffset(goto_ptr, rel);
         }
     } else {
         // Create backpatch info, if the label was not defined yet
         DosBackpatchInstruction b { };
-        b.type = (goto_near ? DosBackpatchType::ToRel8 : DosBackpatchType::ToRel16);
+        b.type = (goto_near ? DosBackpatchType::ToRel8 : DosBackpatchType::ToRel);
         b.backpatch_offset = goto_ptr - buffer;
         b.backpatch_ip = ip_dst;
         b.target = DosBackpatchTarget::Label;
@@ -3456,6 +3692,17 @@ void DosExeEmitter::EmitIf(InstructionEntry* i)
         // Not emitted yet, use estimation
         int32_t rel = (int32_t)(i->if_statement.ip - ip_src) * NearJumpThreshold;
         goto_near = (rel > INT8_MIN && rel < INT8_MAX);
+
+        if (!goto_near && profile) {
+            // Distance of executed branch is known from instrumented program, both paths start with counter,
+            // so it's the upper bound (the same code was emitted there, including the counters)
+            const ProfileCounter* taken = profile->FindBlock(parent->name, i->if_statement.ip);
+            const ProfileCounter* not_taken = profile->FindBlock(parent->name, ip_src + 1);
+            if (taken && not_taken && (taken->count > 0 || not_taken->count > 0)) {
+                rel = taken->offset - not_taken->offset;
+                goto_near = (rel >= 0 && rel < INT8_MAX);
+            }
+        }
     }
 
     if (i->if_statement.op1.exp_type == ExpressionType::Constant) {
@@ -3503,12 +3750,12 @@ void DosExeEmitter::EmitIf(InstructionEntry* i)
 
             *(uint8_t*)goto_ptr = rel;
         } else {
-            *(uint16_t*)goto_ptr = rel;
+            StoreOffset(goto_ptr, rel);
         }
     } else {
         // Create backpatch info, if the line was not precessed yet
         DosBackpatchInstruction b { };
-        b.type = (goto_near ? DosBackpatchType::ToRel8 : DosBackpatchType::ToRel16);
+        b.type = (goto_near ? DosBackpatchType::ToRel8 : DosBackpatchType::ToRel);
         b.backpatch_offset = goto_ptr - buffer;
         b.backpatch_ip = ip_dst;
         b.target = DosBackpatchTarget::IP;
@@ -3523,8 +3770,8 @@ void DosExeEmitter::EmitIfOrAnd(InstructionEntry* i, uint8_t*& goto_ptr, bool& g
         case ExpressionType::Constant: {
             switch (i->if_statement.op1.exp_type) {
                 case ExpressionType::Constant: {
-                    int32_t value1 = atoi(i->if_statement.op1.value);
-                    int32_t value2 = atoi(i->if_statement.op2.value);
+                    int32_t value1 = (int32_t)i->if_statement.op1.imm;
+                    int32_t value2 = (int32_t)i->if_statement.op2.imm;
 
                     if (IfConstexpr(i->if_statement.type, value1, value2)) {
                         if (goto_near) {
@@ -3533,8 +3780,8 @@ void DosExeEmitter::EmitIfOrAnd(InstructionEntry* i, uint8_t*& goto_ptr, bool& g
 
                             goto_ptr = a + 1;
                         } else {
-                            uint8_t* a = AllocateBufferForInstruction(1 + 2);
-                            a[0] = 0xE9;   // jmp rel16
+                            uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+                            a[0] = 0xE9;   // jmp rel16/32
 
                             goto_ptr = a + 1;
                         }
@@ -3546,7 +3793,7 @@ void DosExeEmitter::EmitIfOrAnd(InstructionEntry* i, uint8_t*& goto_ptr, bool& g
 
                     int32_t op1_size = compiler->GetSymbolTypeSize(op1->symbol->type);
 
-                    int32_t value = atoi(i->if_statement.op2.value);
+                    int32_t value = (int32_t)i->if_statement.op2.imm;
 
                     CpuRegister reg_dst = LoadVariableUnreferenced(op1, op1_size);
 
@@ -3562,18 +3809,17 @@ void DosExeEmitter::EmitIfOrAnd(InstructionEntry* i, uint8_t*& goto_ptr, bool& g
                             break;
                         }
                         case 2: {
-                            uint8_t* a = AllocateBufferForInstruction(2 + 2);
+                            uint8_t* a = AllocateBufferWithPrefix(2, 2 + 2);
                             a[0] = 0x81;   // or/and rm16, imm16
                             a[1] = ToXrm(3, type, reg_dst);
                             *(uint16_t*)(a + 2) = (int16_t)value;
                             break;
                         }
                         case 4: {
-                            uint8_t* a = AllocateBufferForInstruction(3 + 4);
-                            a[0] = 0x66;   // Operand size prefix
-                            a[1] = 0x81;   // or/and rm32, imm32
-                            a[2] = ToXrm(3, type, reg_dst);
-                            *(uint32_t*)(a + 3) = (int32_t)value;
+                            uint8_t* a = AllocateBufferWithPrefix(4, 2 + 4);
+                            a[0] = 0x81;   // or/and rm32, imm32
+                            a[1] = ToXrm(3, type, reg_dst);
+                            *(uint32_t*)(a + 2) = (int32_t)value;
                             break;
                         }
 
@@ -3610,20 +3856,10 @@ void DosExeEmitter::EmitIfOrAnd(InstructionEntry* i, uint8_t*& goto_ptr, bool& g
                         uint8_t* a = AllocateBufferForInstruction(2);
                         a[0] = opcode; // or/and r8, rm8
                         a[1] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = opcode; // or/and r8, rm8
-                        a[1] = ToXrm(0, reg_dst, 6);
-
-                        BackpatchStatic(a + 2, op2);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = opcode; // or/and r8, rm8
-                        a[1] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchLocal(a + 2, op2);
+                        // Static or stack to register copy
+                        //   or/and r8, rm8
+                        EmitVariableAccess(1, { opcode }, reg_dst, op2);
                     }
                     break;
                 }
@@ -3631,23 +3867,13 @@ void DosExeEmitter::EmitIfOrAnd(InstructionEntry* i, uint8_t*& goto_ptr, bool& g
                     uint8_t opcode = (i->if_statement.type == CompareType::LogOr ? 0x0B : 0x23);
                     if (op2->reg != CpuRegister::None) {
                         // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(2);
+                        uint8_t* a = AllocateBufferWithPrefix(2, 2);
                         a[0] = opcode; // or/and r16, rm16
                         a[1] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = opcode; // or/and r16, rm16
-                        a[1] = ToXrm(0, reg_dst, 6);
-
-                        BackpatchStatic(a + 2, op2);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = opcode; // or/and r16, rm16
-                        a[1] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchLocal(a + 2, op2);
+                        // Static or stack to register copy
+                        //   or/and r16, rm16
+                        EmitVariableAccess(2, { opcode }, reg_dst, op2);
                     }
                     break;
                 }
@@ -3655,26 +3881,13 @@ void DosExeEmitter::EmitIfOrAnd(InstructionEntry* i, uint8_t*& goto_ptr, bool& g
                     uint8_t opcode = (i->if_statement.type == CompareType::LogOr ? 0x0B : 0x23);
                     if (op2->reg != CpuRegister::None) {
                         // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(3);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = opcode; // or/and r32, rm32
-                        a[2] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = opcode; // or/and r32, rm32
-                        a[2] = ToXrm(0, reg_dst, 6);
-
-                        BackpatchStatic(a + 3, op2);
+                        uint8_t* a = AllocateBufferWithPrefix(4, 2);
+                        a[0] = opcode; // or/and r32, rm32
+                        a[1] = ToXrm(3, reg_dst, op2->reg);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                        a[0] = 0x66;   // Operand size prefix
-                        a[1] = opcode; // or/and r32, rm32
-                        a[2] = ToXrm(1, reg_dst, 6);
-                        
-                        BackpatchLocal(a + 3, op2);
+                        // Static or stack to register copy
+                        //   or/and r32, rm32
+                        EmitVariableAccess(4, { opcode }, reg_dst, op2);
                     }
                     break;
                 }
@@ -3693,9 +3906,9 @@ void DosExeEmitter::EmitIfOrAnd(InstructionEntry* i, uint8_t*& goto_ptr, bool& g
 
         goto_ptr = a + 1;
     } else{
-        uint8_t* a = AllocateBufferForInstruction(2 + 2);
+        uint8_t* a = AllocateBufferForInstruction(2 + default_size);
         a[0] = 0x0F;
-        a[1] = 0x85; // jnz rel16 (i386+)
+        a[1] = 0x85; // jnz rel16/32 (i386+)
 
         goto_ptr = a + 2;
     }
@@ -3707,8 +3920,8 @@ void DosExeEmitter::EmitIfArithmetic(InstructionEntry* i, uint8_t*& goto_ptr, bo
         case ExpressionType::Constant: {
             switch (i->if_statement.op1.exp_type) {
                 case ExpressionType::Constant: {
-                    int32_t value1 = atoi(i->if_statement.op1.value);
-                    int32_t value2 = atoi(i->if_statement.op2.value);
+                    int32_t value1 = (int32_t)i->if_statement.op1.imm;
+                    int32_t value2 = (int32_t)i->if_statement.op2.imm;
 
                     if (IfConstexpr(i->if_statement.type, value1, value2)) {
                         if (goto_near) {
@@ -3717,8 +3930,8 @@ void DosExeEmitter::EmitIfArithmetic(InstructionEntry* i, uint8_t*& goto_ptr, bo
 
                             goto_ptr = a + 1;
                         } else {
-                            uint8_t* a = AllocateBufferForInstruction(1 + 2);
-                            a[0] = 0xE9;   // jmp rel16
+                            uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+                            a[0] = 0xE9;   // jmp rel16/32
 
                             goto_ptr = a + 1;
                         }
@@ -3729,37 +3942,19 @@ void DosExeEmitter::EmitIfArithmetic(InstructionEntry* i, uint8_t*& goto_ptr, bo
                     DosVariableDescriptor* op1 = FindVariableByName(i->if_statement.op1.value);
                     int32_t op1_size = compiler->GetSymbolTypeSize(op1->symbol->type);
 
-                    int32_t value = atoi(i->if_statement.op2.value);
+                    int32_t value = (int32_t)i->if_statement.op2.imm;
 
                     CpuRegister reg_dst = LoadVariableUnreferenced(op1, op1_size);
 
-                    // ToDo: This should be max(op1_size, op2_size)
-                    switch (op1_size) {
-                        case 1: {
-                            uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                            a[0] = 0x80;    // cmp rm8, imm8
-                            a[1] = ToXrm(3, 7, reg_dst);
-                            *(uint8_t*)(a + 2) = (int8_t)value;
-                            break;
-                        }
-                        case 2: {
-                            uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                            a[0] = 0x81;    // cmp rm16, imm16
-                            a[1] = ToXrm(3, 7, reg_dst);
-                            *(uint16_t*)(a + 2) = (int16_t)value;
-                            break;
-                        }
-                        case 4: {
-                            uint8_t* a = AllocateBufferForInstruction(3 + 4);
-                            a[0] = 0x66;    // Operand size prefix
-                            a[1] = 0x81;    // cmp rm32, imm32
-                            a[2] = ToXrm(3, 7, reg_dst);
-                            *(uint32_t*)(a + 3) = (int32_t)value;
-                            break;
-                        }
-
-                        default: ThrowOnUnreachableCode();
+                    // Compare is unsigned, so it can be done with default operand size, if both operands fit into it
+                    int32_t cmp_size = op1_size;
+                    if ((uint32_t)value <= GetMaxValueOfSize(default_size)) {
+                        cmp_size = GetNarrowOperandSize(op1_size, op1->max_value);
                     }
+
+                    // ToDo: This should be max(op1_size, op2_size)
+                    //   cmp rm8/16/32, imm8/16/32
+                    EmitImmediateOperation(cmp_size, 7, reg_dst, value);
                     break;
                 }
 
@@ -3784,77 +3979,38 @@ void DosExeEmitter::EmitIfArithmetic(InstructionEntry* i, uint8_t*& goto_ptr, bo
 
             CpuRegister reg_dst = LoadVariableUnreferenced(op1, op1_size);
 
+            // Compare is unsigned, so it can be done with default operand size, if both operands fit into it
+            int32_t cmp_size = op1_size;
+            if (compiler->GetSymbolTypeSize(op2->symbol->type) >= default_size) {
+                cmp_size = GetNarrowOperandSize(op1_size, std::max(op1->max_value, op2->max_value));
+            }
+
             // ToDo: This should be max(op1_size, op2_size)
-            switch (op1_size) {
+            switch (cmp_size) {
                 case 1: {
                     if (op2->reg != CpuRegister::None) {
                         // Register to register copy
                         uint8_t* a = AllocateBufferForInstruction(2);
-                        a[0] = 0x3A;    // cmp r8, rm8
-                        a[1] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = 0x3A;    // cmp r8, rm8
-                        a[1] = ToXrm(0, reg_dst, 6);
-
-                        BackpatchStatic(a + 2, op2);
-                    } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = 0x3A;    // cmp r8, rm8
-                        a[1] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchLocal(a + 2, op2);
-                    }
-                    break;
-                }
-                case 2: {
-                    if (op2->reg != CpuRegister::None) {
-                        // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(2);
-                        a[0] = 0x3B;    // cmp r16, rm16
+                        a[0] = 0x3A;   // cmp r8, rm8
                         a[1] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                        a[0] = 0x3B;    // cmp r16, rm16
-                        a[1] = ToXrm(0, reg_dst, 6);
-
-                        BackpatchStatic(a + 2, op2);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                        a[0] = 0x3B;    // cmp r16, rm16
-                        a[1] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchLocal(a + 2, op2);
+                        // Static or stack to register copy
+                        //   cmp r8, rm8
+                        EmitVariableAccess(1, { 0x3A }, reg_dst, op2);
                     }
                     break;
                 }
+                case 2:
                 case 4: {
                     if (op2->reg != CpuRegister::None) {
                         // Register to register copy
-                        uint8_t* a = AllocateBufferForInstruction(3);
-                        a[0] = 0x66;    // Operand size prefix
-                        a[1] = 0x3B;    // cmp r32, rm32
-                        a[2] = ToXrm(3, reg_dst, op2->reg);
-                    } else if (!op2->symbol->parent) {
-                        // Static to register copy (16-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 2);
-                        a[0] = 0x66;    // Operand size prefix
-                        a[1] = 0x3B;    // cmp r32, rm32
-                        a[2] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchStatic(a + 3, op1);
+                        uint8_t* a = AllocateBufferWithPrefix(cmp_size, 2);
+                        a[0] = 0x3B;   // cmp r16/32, rm16/32
+                        a[1] = ToXrm(3, reg_dst, op2->reg);
                     } else {
-                        // Stack to register copy (8-bit range)
-                        uint8_t* a = AllocateBufferForInstruction(3 + 1);
-                        a[0] = 0x66;    // Operand size prefix
-                        a[1] = 0x3B;    // cmp r32, rm32
-                        a[2] = ToXrm(1, reg_dst, 6);
-
-                        BackpatchLocal(a + 3, op2);
+                        // Static or stack to register copy
+                        //   cmp r16/32, rm16/32
+                        EmitVariableAccess(cmp_size, { 0x3B }, reg_dst, op2);
                     }
                     break;
                 }
@@ -3890,7 +4046,7 @@ void DosExeEmitter::EmitIfArithmetic(InstructionEntry* i, uint8_t*& goto_ptr, bo
 
         goto_ptr = (a + 1);
     } else {
-        uint8_t* a = AllocateBufferForInstruction(2 + 2);
+        uint8_t* a = AllocateBufferForInstruction(2 + default_size);
         a[0] = 0x0F;
         a[1] = opcode + 0x10; // (i386+)
 
@@ -3920,8 +4076,8 @@ void DosExeEmitter::EmitIfStrings(InstructionEntry* i, uint8_t*& goto_ptr, bool&
 
                 goto_ptr = a + 1;
             } else {
-                uint8_t* a = AllocateBufferForInstruction(1 + 2);
-                a[0] = 0xE9;   // jmp rel16
+                uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+                a[0] = 0xE9;   // jmp rel16/32
 
                 goto_ptr = a + 1;
             }
@@ -3932,8 +4088,8 @@ void DosExeEmitter::EmitIfStrings(InstructionEntry* i, uint8_t*& goto_ptr, bool&
     if (i->if_statement.op2.exp_type == ExpressionType::Constant) {
         strings.insert(i->if_statement.op2.value);
 
-        uint8_t* a = AllocateBufferForInstruction(1 + 2);
-        a[0] = 0x68;    // push imm16
+        uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+        a[0] = 0x68;    // push imm16/32
 
         // Create backpatch info for string
         BackpatchString(a + 1, i->if_statement.op2.value);
@@ -3958,13 +4114,13 @@ void DosExeEmitter::EmitIfStrings(InstructionEntry* i, uint8_t*& goto_ptr, bool&
 
     // Emit "call" instruction
     {
-        uint8_t* call = AllocateBufferForInstruction(1 + 2);
-        call[0] = 0xE8; // call rel16
+        uint8_t* call = AllocateBufferForInstruction(1 + default_size);
+        call[0] = 0xE8; // call rel16/32
 
         // Create backpatch info, because of shared function
         {
             DosBackpatchInstruction b { };
-            b.type = DosBackpatchType::ToRel16;
+            b.type = DosBackpatchType::ToRel;
             b.backpatch_offset = (call + 1) - buffer;
             b.backpatch_ip = ip_dst;
             b.target = DosBackpatchTarget::Function;
@@ -3993,7 +4149,7 @@ void DosExeEmitter::EmitIfStrings(InstructionEntry* i, uint8_t*& goto_ptr, bool&
 
         goto_ptr = (l2 + 1);
     } else {
-        uint8_t* l2 = AllocateBufferForInstruction(2 + 2);
+        uint8_t* l2 = AllocateBufferForInstruction(2 + default_size);
         l2[0] = 0x0F;
         l2[1] = opcode + 0x10; // (i386+)
 
@@ -4014,65 +4170,105 @@ void DosExeEmitter::EmitCall(InstructionEntry* i, SymbolTableEntry* symbol_table
         ThrowOnUnreachableCode();
     }
 
-    // Emit "push" instructions (evaluated right to left)
-    {
-        for (int32_t param = i->call_statement.target->parameter; param > 0; param--) {
-            InstructionEntry* push = call_parameters.top();
-            call_parameters.pop();
+    // Find declarations of all parameters
+    int32_t param_count = i->call_statement.target->parameter;
+    std::vector<InstructionEntry*> pushes(param_count);
+    std::vector<SymbolTableEntry*> param_decls(param_count);
 
-            SymbolTableEntry* param_decl = symbol_table;
-            while (param_decl) {
-                if (param_decl->parameter == param && param_decl->parent &&
-                    strcmp(param_decl->parent, i->call_statement.target->name) == 0) {
+    for (int32_t param = param_count; param > 0; param--) {
+        pushes[param - 1] = call_parameters.top();
+        call_parameters.pop();
 
-                    break;
-                }
+        SymbolTableEntry* param_decl = symbol_table;
+        while (param_decl) {
+            if (param_decl->parameter == param && param_decl->parent &&
+                strcmp(param_decl->parent, i->call_statement.target->name) == 0) {
 
-                param_decl = param_decl->next;
+                break;
             }
 
-            // Can't find parameter, this should not happen,
-            // because function parameters are generated by compiler
-            if (!param_decl) {
-                ThrowOnUnreachableCode();
+            param_decl = param_decl->next;
+        }
+
+        // Can't find parameter, this should not happen,
+        // because function parameters are generated by compiler
+        if (!param_decl) {
+            ThrowOnUnreachableCode();
+        }
+
+        param_decls[param - 1] = param_decl;
+    }
+
+    // Registers with values of parameters passed in registers can't be reused,
+    // while the remaining parameters are pushed to stack
+    std::vector<CpuRegister> suppressed;
+
+    for (int32_t param = 1; param <= param_count; param++) {
+        if (GetParameterRegister(i->call_statement.target, param) != CpuRegister::None &&
+            pushes[param - 1]->push_statement.symbol->exp_type == ExpressionType::Variable) {
+
+            DosVariableDescriptor* var = FindVariableByName(pushes[param - 1]->push_statement.symbol->name);
+            if (var->reg != CpuRegister::None && suppressed_registers.insert(var->reg).second) {
+                suppressed.push_back(var->reg);
+            }
+        }
+    }
+
+    // Emit "push" instructions (evaluated right to left)
+    {
+        for (int32_t param = param_count; param > 0; param--) {
+            if (GetParameterRegister(i->call_statement.target, param) != CpuRegister::None) {
+                continue;
             }
 
+            InstructionEntry* push = pushes[param - 1];
+            SymbolTableEntry* param_decl = param_decls[param - 1];
+
             switch (push->push_statement.symbol->exp_type) {
                 case ExpressionType::Constant: {
                     // Push constant directly to parameter stack
                     switch (param_decl->type.base) {
                         case BaseSymbolType::Bool:
                         case BaseSymbolType::Uint8: {
-                            uint8_t imm8 = atoi(push->push_statement.symbol->name);
+                            uint8_t imm8 = (uint8_t)push->push_statement.imm;
 
                             uint8_t* a = AllocateBufferForInstruction(1 + 1);
                             a[0] = 0x6A;    // push imm8
                             a[1] = imm8;
                             break;
                         }
-                        case BaseSymbolType::Uint16: {
-                            uint16_t imm16 = atoi(push->push_statement.symbol->name);
-
-                            uint8_t* a = AllocateBufferForInstruction(1 + 2);
-                            a[0] = 0x68;    // push imm16
-                            *(uint16_t*)(a + 1) = imm16;
-                            break;
-                        }
+                        case BaseSymbolType::Uint16:
                         case BaseSymbolType::Uint32: {
-                            uint32_t imm32 = atoi(push->push_statement.symbol->name);
+                            uint32_t imm = (uint32_t)push->push_statement.imm;
+
+                            // Parameters are always pushed with at least default operand size
+                            int32_t push_size = compiler->GetSymbolTypeSize(param_decl->type);
+                            if (push_size < default_size) {
+                                push_size = default_size;
+                            }
 
-                            uint8_t* a = AllocateBufferForInstruction(2 + 4);
-                            a[0] = 0x66;    // Operand size prefix
-                            a[1] = 0x68;    // push imm32
-                            *(uint32_t*)(a + 2) = imm32;
+                            int32_t value = (push_size == 2 ? (int16_t)imm : (int32_t)imm);
+                            if (value == (int8_t)value) {
+                                uint8_t* a = AllocateBufferWithPrefix(push_size, 1 + 1);
+                                a[0] = 0x6A;    // push imm8 (sign-extended)
+                                a[1] = (uint8_t)value;
+                            } else {
+                                uint8_t* a = AllocateBufferWithPrefix(push_size, 1 + push_size);
+                                a[0] = 0x68;    // push imm16/32
+                                if (push_size == 2) {
+                                    *(uint16_t*)(a + 1) = (uint16_t)imm;
+                                } else {
+                                    *(uint32_t*)(a + 1) = imm;
+                                }
+                            }
                             break;
                         }
 
                         case BaseSymbolType::String: {
                             strings.insert(push->push_statement.symbol->name);
 
-                            uint8_t* a = AllocateBufferForInstruction(1 + 2);
-                            a[0] = 0x68;    // push imm16
+                            uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+                            a[0] = 0x68;    // push imm16/32
 
                             // Create backpatch info for string
                             BackpatchString(a + 1, push->push_statement.symbol->name);
@@ -4098,43 +4294,86 @@ void DosExeEmitter::EmitCall(InstructionEntry* i, SymbolTableEntry* symbol_table
         }
     }
 
-    SaveAndUnloadAllRegisters(SaveReason::Inside);
+    for (CpuRegister reg : suppressed) {
+        suppressed_registers.erase(reg);
+    }
 
-    // Emit "call" instruction
-    {
-        uint8_t* call = AllocateBufferForInstruction(1 + 2);
-        call[0] = 0xE8; // call rel16
+    if (i->call_statement.target->type.base != BaseSymbolType::SharedFunction) {
+        // Load parameters passed in registers, if the second parameter
+        // is in the register of the first one, it must be loaded first
+        int32_t register_count = std::min(param_count, RegisterParameterCount);
+        int32_t order[] = { 1, 2 };
+
+        if (register_count == 2 && pushes[1]->push_statement.symbol->exp_type == ExpressionType::Variable) {
+            CpuRegister reg1 = GetParameterRegister(i->call_statement.target, 1);
+            CpuRegister reg2 = GetParameterRegister(i->call_statement.target, 2);
+
+            DosVariableDescriptor* var2 = FindVariableByName(pushes[1]->push_statement.symbol->name);
+            if (var2->reg == reg1) {
+                DosVariableDescriptor* var1 = nullptr;
+                if (pushes[0]->push_statement.symbol->exp_type == ExpressionType::Variable) {
+                    var1 = FindVariableByName(pushes[0]->push_statement.symbol->name);
+                }
 
-        std::list<DosLabel>::iterator it = functions.begin();
+                if (var1 && var1 != var2 && var1->reg == reg2) {
+                    // Parameters are in swapped registers
+                    uint8_t* a = AllocateBufferWithPrefix(4, 2);
+                    a[0] = 0x87;    // xchg r32, rm32
+                    a[1] = ToXrm(3, reg1, reg2);
 
-        while (it != functions.end()) {
-            if (strcmp(it->name, i->call_statement.target->name) == 0) {
-                *(uint16_t*)(call + 1) = (int16_t)(it->ip_dst - ip_dst);
-                goto AlreadyPatched;
+                    std::swap(var1->reg, var2->reg);
+                } else {
+                    std::swap(order[0], order[1]);
+                }
             }
+        }
 
-            ++it;
+        for (int32_t j = 0; j < register_count; j++) {
+            int32_t param = order[j];
+            LoadParameterToRegister(pushes[param - 1], param_decls[param - 1],
+                GetParameterRegister(i->call_statement.target, param));
         }
 
-        // Create backpatch info, if the function was not defined yet
-        {
-            DosBackpatchInstruction b { };
-            b.type = DosBackpatchType::ToRel16;
-            b.backpatch_offset = (call + 1) - buffer;
-            b.backpatch_ip = ip_dst;
-            b.target = DosBackpatchTarget::Function;
-            b.value = i->call_statement.target->name;
-            backpatch.push_back(b);
+        SaveAndUnloadCallerSavedRegisters(i->call_statement.target);
+    } else {
+        // Shared functions don't preserve any register
+        SaveAndUnloadAllRegisters(SaveReason::Inside);
+
+        parent_uses_bx = true;
+    }
+
+    if (instrument_profile) {
+        EmitProfileCounter(ProfileCounterType::Call, i->call_statement.target->name);
+    }
+
+    if (profile) {
+        // Compiler doesn't inline functions yet, so hot call sites are only reported
+        const ProfileCounter* counter = profile->FindCall(parent->name, ip_src);
+        if (counter && counter->count > 0 && counter->count >= profile->GetTotalCallCount() / HotCallDivisor) {
+            Log::Write(LogType::Verbose, "Call to \"%s\" was executed %u times, it's candidate for inlining",
+                i->call_statement.target->name, counter->count);
         }
+    }
+
+    // Emit "call" instruction
+    {
+        uint8_t* call = AllocateBufferForInstruction(1 + default_size);
+        call[0] = 0xE8; // call rel16/32
 
-    AlreadyPatched:
-        ;
+        // Target is resolved by link stage, so the function can be placed anywhere
+        DosBackpatchInstruction b { };
+        b.type = DosBackpatchType::ToRel;
+        b.backpatch_offset = (call + 1) - buffer;
+        b.backpatch_ip = ip_dst;
+        b.target = DosBackpatchTarget::Function;
+        b.value = i->call_statement.target->name;
+        backpatch.push_back(b);
     }
 
     if (i->call_statement.target->return_type.base != BaseSymbolType::Void || i->call_statement.target->return_type.pointer != 0) {
         // Set register of return variable to AX
         DosVariableDescriptor* ret = FindVariableByName(i->call_statement.return_symbol);
-        ret->reg = CpuRegister::AX;
+        SetVariableRegister(ret, CpuRegister::AX);
         ret->is_dirty = true;
         ret->last_used = ip_src;
     }
@@ -4168,7 +4407,7 @@ void DosExeEmitter::EmitReturn(InstructionEntry* i, SymbolTableEntry* symbol_tab
         // return value is passed to DOS and the program is terminated
         switch (i->return_statement.op.exp_type) {
             case ExpressionType::Constant: {
-                uint8_t imm8 = atoi(i->return_statement.op.value);
+                uint8_t imm8 = (uint8_t)i->return_statement.op.imm;
 
                 uint8_t* a = AllocateBufferForInstruction(2);
                 a[0] = 0xB0;    // mov al, imm8
@@ -4185,20 +4424,10 @@ void DosExeEmitter::EmitReturn(InstructionEntry* i, SymbolTableEntry* symbol_tab
                     uint8_t* a = AllocateBufferForInstruction(2);
                     a[0] = 0x8A;    // mov r8, rm8
                     a[1] = ToXrm(3, CpuRegister::AL, src->reg);
-                } else if (!src->symbol->parent) {
-                    // Static to register copy (16-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 2);
-                    a[0] = 0x8A;    // mov r8, rm8
-                    a[1] = ToXrm(0, CpuRegister::AL, 6);
-
-                    BackpatchStatic(a + 2, src);
                 } else {
-                    // Stack to register copy (8-bit range)
-                    uint8_t* a = AllocateBufferForInstruction(2 + 1);
-                    a[0] = 0x8A;    // mov r8, rm8
-                    a[1] = ToXrm(1, CpuRegister::AL, 6);
-
-                    BackpatchLocal(a + 2, src);
+                    // Static or stack to register copy
+                    //   mov r8, rm8
+                    EmitVariableAccess(1, { 0x8A }, CpuRegister::AL, src);
                 }
                 break;
             }
@@ -4206,16 +4435,34 @@ void DosExeEmitter::EmitReturn(InstructionEntry* i, SymbolTableEntry* symbol_tab
             default: ThrowOnUnreachableCode();
         }
 
-        AsmInt(0x21 /*DOS Function Dispatcher*/, 0x4C /*Terminate Process With Return Code*/);
+        if (instrument_profile) {
+            // Save profile counters, return code in AL register is preserved
+            uint8_t* a = AllocateBufferForInstruction(1 + default_size);
+            a[0] = 0xE8;    // call rel16/32
+
+            backpatch.push_back({
+                DosBackpatchType::ToRel, DosBackpatchTarget::Function,
+                (uint32_t)((a + 1) - buffer), (uint32_t)ip_dst, 0, ProfileDumpName
+            });
+        }
+
+        EmitExit();
     } else {
-        // Standard function with "stdcall" calling convention,
+        // Static variables must be written back, because the caller can read them
+        for (DosVariableDescriptor* var : register_owner) {
+            if (var && !var->symbol->parent && var->is_dirty) {
+                SaveVariable(var, SaveReason::Force);
+            }
+        }
+
+        // Standard function, the first parameters are passed in registers, the rest is released by callee,
         // return value (if any) is saved in AX register
         if (parent->return_type.base != BaseSymbolType::Void || parent->return_type.pointer != 0) {
             int32_t dst_size = compiler->GetSymbolTypeSize(parent->return_type);
 
             switch (i->return_statement.op.exp_type) {
                 case ExpressionType::Constant: {
-                    int32_t value = atoi(i->return_statement.op.value);
+                    int32_t value = (int32_t)i->return_statement.op.imm;
                     LoadConstantToRegister(value, CpuRegister::AX, dst_size);
                     break;
                 }
@@ -4229,61 +4476,823 @@ void DosExeEmitter::EmitReturn(InstructionEntry* i, SymbolTableEntry* symbol_tab
             }
         }
 
-        // Destroy current call frame
-        if (parent->parameter > 0) {
-            // Compute needed space in stack for parameters, 
-            // so stack region with parameters can be released
-            uint16_t stack_param_size = 0;
+        // Compute needed space in stack for parameters,
+        // so stack region with parameters can be released
+        uint16_t stack_param_size = 0;
 
-            SymbolTableEntry* param_decl = symbol_table;
-            while (param_decl) {
-                if (param_decl->parameter != 0 && param_decl->parent && strcmp(param_decl->parent, parent->name) == 0) {
-                    int32_t size = compiler->GetSymbolTypeSize(param_decl->type);
-                    if (size < 2) {
-                        size = 2;
-                    }
-                    stack_param_size += size;
-                }
+        SymbolTableEntry* param_decl = symbol_table;
+        while (param_decl) {
+            if (param_decl->parameter != 0 && param_decl->parent && strcmp(param_decl->parent, parent->name) == 0 &&
+                GetParameterRegister(parent, param_decl->parameter) == CpuRegister::None) {
 
-                param_decl = param_decl->next;
+                int32_t size = compiler->GetSymbolTypeSize(param_decl->type);
+                if (size < default_size) {
+                    size = default_size;
+                }
+                stack_param_size += size;
             }
 
-            AsmProcLeave(stack_param_size, true);
-        } else {
-            AsmProcLeave(0);
+            param_decl = param_decl->next;
         }
+
+        // Destroy current call frame and restore callee-saved registers,
+        // unused instructions are removed in epilogue
+        DosReturnSite site;
+        site.offset = buffer_offset;
+
+        AsmMov(CpuRegister::SP, CpuRegister::BP, 4);
+
+        uint8_t* pop_bp = AllocateBufferWithPrefix(4, 1);
+        pop_bp[0] = ToOpR(0x58, CpuRegister::BP);   // pop ebp
+
+        site.bx_offset = buffer_offset;
+
+        uint8_t* pop_bx = AllocateBufferWithPrefix(4, 1);
+        pop_bx[0] = ToOpR(0x58, CpuRegister::BX);   // pop ebx
+
+        site.ret_offset = buffer_offset;
+
+        AsmProcLeaveNoArgs(stack_param_size);
+
+        site.end_offset = buffer_offset;
+        parent_returns.push_back(site);
     }
 }
 
-CompareType DosExeEmitter::GetSwappedCompareType(CompareType type)
+void DosExeEmitter::EmitProfileCounter(ProfileCounterType type, const char* target)
 {
-    switch (type) {
-        case CompareType::Equal:          return CompareType::Equal;
-        case CompareType::NotEqual:       return CompareType::NotEqual;
-        case CompareType::Greater:        return CompareType::Less;
-        case CompareType::Less:           return CompareType::Greater;
-        case CompareType::GreaterOrEqual: return CompareType::LessOrEqual;
-        case CompareType::LessOrEqual:    return CompareType::GreaterOrEqual;
+    uint32_t index = compiler->GetProfileMap()->AddCounter(type, parent->name, target,
+        current_instruction->line, ip_src, (int32_t)(ip_dst - parent_ip_dst));
 
-        default: ThrowOnUnreachableCode();
+    if (index >= MaxProfileCounters) {
+        throw CompilerException(CompilerExceptionSource::Compilation,
+            "Program has too many basic blocks to be instrumented");
     }
+
+    //   inc dword ptr ds:[counters + index * 4]
+    //   inc rm32
+    uint8_t* a = AllocateBufferForMemoryAccess(4, { 0xFF }, 0, CpuMemory::Absolute);
+    StoreOffset(a, (int32_t)(index * sizeof(uint32_t)));
+
+    // Address of the table is added to the offset, when the table is allocated
+    backpatch.push_back({
+        DosBackpatchType::ToDsAbsAdd, DosBackpatchTarget::Static,
+        (uint32_t)(a - buffer), 0, 0, ProfileCountersName
+    });
 }
 
-bool DosExeEmitter::IfConstexpr(CompareType type, int32_t op1, int32_t op2)
+void DosExeEmitter::EmitExit()
 {
-    switch (type) {
-        case CompareType::LogOr:          return (op1 || op2);
-        case CompareType::LogAnd:         return (op1 && op2);
+    AsmInt(0x21 /*DOS Function Dispatcher*/, 0x4C /*Terminate Process With Return Code*/);
+}
 
-        case CompareType::Equal:          return (op1 == op2);
-        case CompareType::NotEqual:       return (op1 != op2);
-        case CompareType::Greater:        return (op1 > op2);
-        case CompareType::Less:           return (op1 < op2);
-        case CompareType::GreaterOrEqual: return (op1 >= op2);
-        case CompareType::LessOrEqual:    return (op1 <= op2);
+void DosExeEmitter::EmitProfileDump()
+{
+    ProfileMap* profile_map = compiler->GetProfileMap();
+    uint32_t counter_count = profile_map->GetCounterCount();
 
-        default: ThrowOnUnreachableCode();
+    Log::Write(LogType::Verbose, "Program is instrumented with %d profile counters", counter_count);
+
+    BackpatchLabels({ ProfileDumpName, ip_dst }, DosBackpatchTarget::Function);
+
+    // Return code of the program is in AL register
+    //   push ax
+    uint8_t* l1 = AllocateBufferForInstruction(1);
+    l1[0] = ToOpR(0x50, CpuRegister::AX);   // push r16
+
+    // Create new file (or truncate existing one) with normal attributes
+    ZeroRegister(CpuRegister::CX, 2);
+
+    //   mov dx, [filename]
+    uint8_t* l3 = AllocateBufferForInstruction(1 + 2);
+    l3[0] = ToOpR(0xB8, CpuRegister::DX);   // mov r16, imm16
+
+    uint32_t l3_offset = (l3 + 1) - buffer;
+
+    AsmInt(0x21 /*DOS Function Dispatcher*/, 0x3C /*Create File*/);
+
+    // File cannot be created, counters are lost, but the program can still exit
+    //   jc [done]
+    uint8_t* l5 = AllocateBufferForInstruction(2);
+    l5[0] = 0x72;   // jc rel8
+
+    uint32_t l5_ip = ip_dst;
+    uint32_t l5_offset = (l5 + 1) - buffer;
+
+    AsmMov(CpuRegister::BX, CpuRegister::AX, 2);
+
+    //   mov cx, sizeof(header)
+    //   mov dx, [header]
+    uint8_t* l7 = AllocateBufferForInstruction(1 + 2 + 1 + 2);
+    l7[0] = ToOpR(0xB8, CpuRegister::CX);   // mov r16, imm16
+    *(uint16_t*)(l7 + 1) = sizeof(ProfileDataHeader);
+    l7[3] = ToOpR(0xB8, CpuRegister::DX);   // mov r16, imm16
+
+    uint32_t l7_offset = (l7 + 4) - buffer;
+
+    AsmInt(0x21 /*DOS Function Dispatcher*/, 0x40 /*Write File*/);
+
+    //   mov cx, counter_count * 4
+    //   mov dx, [counters]
+    uint8_t* l9 = AllocateBufferForInstruction(1 + 2 + 1 + 2);
+    l9[0] = ToOpR(0xB8, CpuRegister::CX);   // mov r16, imm16
+    *(uint16_t*)(l9 + 1) = (uint16_t)(counter_count * sizeof(uint32_t));
+    l9[3] = ToOpR(0xB8, CpuRegister::DX);   // mov r16, imm16
+
+    backpatch.push_back({
+        DosBackpatchType::ToDsAbs, DosBackpatchTarget::Static,
+        (uint32_t)((l9 + 4) - buffer), 0, 0, ProfileCountersName
+    });
+
+    AsmInt(0x21 /*DOS Function Dispatcher*/, 0x40 /*Write File*/);
+
+    AsmInt(0x21 /*DOS Function Dispatcher*/, 0x3E /*Close File*/);
+
+// done:
+    *(buffer + l5_offset) = (int8_t)(ip_dst - l5_ip);
+
+    //   pop ax
+    //   ret
+    uint8_t* l13 = AllocateBufferForInstruction(1 + 1);
+    l13[0] = ToOpR(0x58, CpuRegister::AX);  // pop r16
+    l13[1] = 0xC3;  // ret
+
+    // Header and filename are constant, so they are stored directly after the function
+    *(uint16_t*)(buffer + l7_offset) = (uint16_t)(ip_dst + code_base);
+
+    ProfileDataHeader* header = (ProfileDataHeader*)AllocateBufferForInstruction(sizeof(ProfileDataHeader));
+    memcpy(header->signature, "PRF1", sizeof(header->signature));
+    header->hash = profile_map->GetHash();
+    header->counter_count = counter_count;
+
+    *(uint16_t*)(buffer + l3_offset) = (uint16_t)(ip_dst + code_base);
+
+    const char* filename = compiler->GetProfileDataName();
+    size_t filename_length = strlen(filename);
+    uint8_t* name = AllocateBufferForInstruction(filename_length + 1);
+    memcpy(name, filename, filename_length);
+    name[filename_length] = '\0';
+}
+
+void DosExeEmitter::ComputeVariableWeights()
+{
+    for (DosVariableDescriptor& var : variables) {
+        var.weight = 0;
     }
+
+    // Every reference is weighted by execution count of its basic block
+    InstructionEntry* current = current_instruction;
+    int32_t ip = ip_src;
+    uint32_t count = 0;
+
+    while (current && ip <= parent_end_ip) {
+        const ProfileCounter* block = profile->FindBlock(parent->name, ip);
+        if (block) {
+            count = block->count;
+        }
+
+        switch (current->type) {
+            case InstructionType::Assign: {
+                AddVariableWeight(current->assignment.dst_value, count);
+                if (current->assignment.dst_index.exp_type == ExpressionType::Variable) {
+                    AddVariableWeight(current->assignment.dst_index.value, count);
+                }
+                if (current->assignment.op1.exp_type == ExpressionType::Variable) {
+                    AddVariableWeight(current->assignment.op1.value, count);
+                }
+                if (current->assignment.op2.exp_type == ExpressionType::Variable) {
+                    AddVariableWeight(current->assignment.op2.value, count);
+                }
+                break;
+            }
+            case InstructionType::If: {
+                if (current->if_statement.op1.exp_type == ExpressionType::Variable) {
+                    AddVariableWeight(current->if_statement.op1.value, count);
+                }
+                if (current->if_statement.op2.exp_type == ExpressionType::Variable) {
+                    AddVariableWeight(current->if_statement.op2.value, count);
+                }
+                break;
+            }
+            case InstructionType::Push: {
+                if (current->push_statement.symbol->exp_type == ExpressionType::Variable) {
+                    AddVariableWeight(current->push_statement.symbol->name, count);
+                }
+                break;
+            }
+            case InstructionType::Return: {
+                if (current->return_statement.op.exp_type == ExpressionType::Variable) {
+                    AddVariableWeight(current->return_statement.op.value, count);
+                }
+                break;
+            }
+        }
+
+        current = current->next;
+        ip++;
+    }
+}
+
+void DosExeEmitter::AddVariableWeight(const char* name, uint32_t count)
+{
+    if (!name) {
+        return;
+    }
+
+    // Function-local variables take precedence over static variables
+    DosVariableDescriptor* var = TryFindVariableByName(name);
+    if (var) {
+        var->weight = (var->weight > UINT32_MAX - count ? UINT32_MAX : var->weight + count);
+    }
+}
+
+void DosExeEmitter::PromoteStaticVariable()
+{
+    // Backward jumps enclose loops, instructions between target and jump are executed repeatedly
+    std::vector<bool> in_loop(parent_end_ip - ip_src + 1);
+
+    {
+        InstructionEntry* current = current_instruction;
+        int32_t ip = ip_src;
+
+        while (current && ip <= parent_end_ip) {
+            int32_t target = -1;
+            if (current->type == InstructionType::Goto) {
+                target = current->goto_statement.ip;
+            } else if (current->type == InstructionType::If) {
+                target = current->if_statement.ip;
+            }
+
+            if (target >= ip_src && target <= ip) {
+                for (int32_t j = target; j <= ip; j++) {
+                    in_loop[j - ip_src] = true;
+                }
+            }
+
+            current = current->next;
+            ip++;
+        }
+    }
+
+    if (parent->type.base == BaseSymbolType::EntryPoint && in_loop[0]) {
+        // Jumps to the first instruction of entry point execute its prologue again, the variable would be reloaded there
+        return;
+    }
+
+    std::unordered_map<DosVariableDescriptor*, uint32_t> uses;
+    std::unordered_set<DosVariableDescriptor*> written;
+
+    auto add_use = [&](const char* name) -> DosVariableDescriptor* {
+        if (!name) {
+            return nullptr;
+        }
+
+        // Function-local variables take precedence over static variables
+        DosVariableDescriptor* var = TryFindVariableByName(name);
+        if (!var || var->symbol->parent) {
+            return nullptr;
+        }
+
+        uses[var]++;
+        return var;
+    };
+
+    InstructionEntry* current = current_instruction;
+    int32_t ip = ip_src;
+
+    while (current && ip <= parent_end_ip) {
+        if (!in_loop[ip - ip_src]) {
+            // Writes outside of loops must be known too, the value has to be written back on return
+            const char* dst = nullptr;
+            if (current->type == InstructionType::Assign && !current->assignment.dst_index.value) {
+                dst = current->assignment.dst_value;
+            } else if (current->type == InstructionType::Call) {
+                dst = current->call_statement.return_symbol;
+            }
+
+            DosVariableDescriptor* var = (dst ? TryFindVariableByName(dst) : nullptr);
+            if (var && !var->symbol->parent) {
+                written.insert(var);
+            }
+
+            current = current->next;
+            ip++;
+            continue;
+        }
+
+        switch (current->type) {
+            case InstructionType::Assign: {
+                DosVariableDescriptor* dst = add_use(current->assignment.dst_value);
+                if (dst && !current->assignment.dst_index.value) {
+                    written.insert(dst);
+                }
+                if (current->assignment.dst_index.exp_type == ExpressionType::Variable) {
+                    add_use(current->assignment.dst_index.value);
+                }
+                if (current->assignment.op1.exp_type == ExpressionType::Variable) {
+                    add_use(current->assignment.op1.value);
+                    if (current->assignment.op1.index.exp_type == ExpressionType::Variable) {
+                        add_use(current->assignment.op1.index.value);
+                    }
+                }
+                if (current->assignment.op2.exp_type == ExpressionType::Variable) {
+                    add_use(current->assignment.op2.value);
+                    if (current->assignment.op2.index.exp_type == ExpressionType::Variable) {
+                        add_use(current->assignment.op2.index.value);
+                    }
+                }
+                break;
+            }
+            case InstructionType::If: {
+                if (current->if_statement.op1.exp_type == ExpressionType::Variable) {
+                    add_use(current->if_statement.op1.value);
+                }
+                if (current->if_statement.op2.exp_type == ExpressionType::Variable) {
+                    add_use(current->if_statement.op2.value);
+                }
+                break;
+            }
+            case InstructionType::Push: {
+                if (current->push_statement.symbol->exp_type == ExpressionType::Variable) {
+                    add_use(current->push_statement.symbol->name);
+                }
+                break;
+            }
+            case InstructionType::Call: {
+                DosVariableDescriptor* dst = add_use(current->call_statement.return_symbol);
+                if (dst) {
+                    written.insert(dst);
+                }
+                break;
+            }
+            case InstructionType::Return: {
+                if (current->return_statement.op.exp_type == ExpressionType::Variable) {
+                    add_use(current->return_statement.op.value);
+                }
+                break;
+            }
+        }
+
+        current = current->next;
+        ip++;
+    }
+
+    PointsToMap* points_to = compiler->GetPointsTo();
+
+    DosVariableDescriptor* best = nullptr;
+    uint32_t best_uses = MinPromotedStaticUses - 1;
+
+    for (const std::pair<DosVariableDescriptor* const, uint32_t>& use : uses) {
+        SymbolTableEntry* symbol = use.first->symbol;
+
+        // Only scalar variables that cannot be accessed through pointer can live in register
+        if (use.second <= best_uses || symbol->size != 0 || symbol->type.pointer != 0 ||
+            symbol->exp_type == ExpressionType::Constant || points_to->IsAddressTaken(parent_points_to, symbol)) {
+            continue;
+        }
+
+        if (symbol->type.base != BaseSymbolType::Bool && symbol->type.base != BaseSymbolType::Uint8 &&
+            symbol->type.base != BaseSymbolType::Uint16 && symbol->type.base != BaseSymbolType::Uint32) {
+            continue;
+        }
+
+        best = use.first;
+        best_uses = use.second;
+    }
+
+    if (!best) {
+        return;
+    }
+
+    promoted_static = best;
+    is_promoted_static_written = (written.find(best) != written.end());
+
+    // EBX is callee-saved, so the value survives calls of user functions that don't access the variable
+    parent_uses_bx = true;
+
+    RestorePromotedStatic();
+}
+
+void DosExeEmitter::RestorePromotedStatic()
+{
+    if (promoted_static->reg == CpuRegister::BX) {
+        return;
+    }
+
+    int32_t var_size = compiler->GetSymbolTypeSize(promoted_static->symbol->type);
+
+    CopyVariableToRegister(promoted_static, CpuRegister::BX, var_size);
+    SetVariableRegister(promoted_static, CpuRegister::BX);
+    promoted_static->last_used = ip_src;
+}
+
+void DosExeEmitter::ComputeValueRanges()
+{
+    // Only scalar local variables of current function are analyzed,
+    // parameters and static variables can hold any value of their type
+    std::unordered_set<DosVariableDescriptor*> tracked;
+
+    for (uint32_t i = 0; i < static_count; i++) {
+        variables[i].max_value = GetMaxValueOfSize(compiler->GetSymbolTypeSize(variables[i].symbol->type));
+    }
+
+    for (uint32_t i = parent_variables.begin; i < parent_variables.end; i++) {
+        DosVariableDescriptor* var = &variables[i];
+
+        var->max_value = GetMaxValueOfSize(compiler->GetSymbolTypeSize(var->symbol->type));
+
+        if (!var->symbol->parameter &&
+            var->symbol->size == 0 && var->symbol->type.pointer == 0 && var->symbol->exp_type != ExpressionType::Constant &&
+            (var->symbol->type.base == BaseSymbolType::Bool || var->symbol->type.base == BaseSymbolType::Uint8 ||
+             var->symbol->type.base == BaseSymbolType::Uint16 || var->symbol->type.base == BaseSymbolType::Uint32)) {
+
+            tracked.insert(var);
+        }
+    }
+
+    // Variables that are read before the first assignment or whose address is taken can't be narrowed
+    {
+        std::unordered_set<DosVariableDescriptor*> assigned;
+
+        auto check_read = [&](ExpressionType exp_type, char* name) {
+            if (exp_type == ExpressionType::Variable && name) {
+                DosVariableDescriptor* var = FindVariableByName(name);
+                if (assigned.find(var) == assigned.end()) {
+                    tracked.erase(var);
+                }
+            }
+        };
+
+        InstructionEntry* current = current_instruction;
+        int32_t ip = ip_src;
+
+        while (current && ip <= parent_end_ip) {
+            switch (current->type) {
+                case InstructionType::Assign: {
+                    check_read(current->assignment.op1.exp_type, current->assignment.op1.value);
+                    check_read(current->assignment.op1.index.exp_type, current->assignment.op1.index.value);
+                    check_read(current->assignment.op2.exp_type, current->assignment.op2.value);
+                    check_read(current->assignment.op2.index.exp_type, current->assignment.op2.index.value);
+                    check_read(current->assignment.dst_index.exp_type, current->assignment.dst_index.value);
+
+                    DosVariableDescriptor* dst = FindVariableByName(current->assignment.dst_value);
+                    if (current->assignment.type == AssignType::None && !current->assignment.dst_index.value &&
+                        current->assignment.op1.exp_type == ExpressionType::Variable &&
+                        dst->symbol->type.pointer > current->assignment.op1.type.pointer) {
+                        // Reference to variable
+                        tracked.erase(FindVariableByName(current->assignment.op1.value));
+                    }
+
+                    if (!current->assignment.dst_index.value) {
+                        assigned.insert(dst);
+                    }
+                    break;
+                }
+                case InstructionType::If: {
+                    check_read(current->if_statement.op1.exp_type, current->if_statement.op1.value);
+                    check_read(current->if_statement.op2.exp_type, current->if_statement.op2.value);
+                    break;
+                }
+                case InstructionType::Push: {
+                    check_read(current->push_statement.symbol->exp_type, current->push_statement.symbol->name);
+                    break;
+                }
+                case InstructionType::Call: {
+                    if (current->call_statement.return_symbol) {
+                        assigned.insert(FindVariableByName(current->call_statement.return_symbol));
+                    }
+                    break;
+                }
+                case InstructionType::Return: {
+                    check_read(current->return_statement.op.exp_type, current->return_statement.op.value);
+                    break;
+                }
+            }
+
+            current = current->next;
+            ip++;
+        }
+    }
+
+    // Upper bound of every analyzed variable is the highest value of all its assignments,
+    // assignments are evaluated repeatedly until all bounds are stable
+    {
+        std::unordered_set<DosVariableDescriptor*>::iterator it = tracked.begin();
+
+        while (it != tracked.end()) {
+            (*it)->max_value = 0;
+
+            ++it;
+        }
+    }
+
+    bool changed = true;
+    for (int32_t pass = 0; changed; pass++) {
+        changed = false;
+
+        InstructionEntry* current = current_instruction;
+        int32_t ip = ip_src;
+
+        while (current && ip <= parent_end_ip) {
+            DosVariableDescriptor* dst = nullptr;
+            uint64_t value = 0;
+
+            if (current->type == InstructionType::Assign && !current->assignment.dst_index.value) {
+                dst = FindVariableByName(current->assignment.dst_value);
+                if (tracked.find(dst) != tracked.end()) {
+                    value = GetAssignmentMaxValue(current);
+                }
+            } else if (current->type == InstructionType::Call && current->call_statement.return_symbol) {
+                dst = FindVariableByName(current->call_statement.return_symbol);
+                value = GetMaxValueOfSize(compiler->GetSymbolTypeSize(current->call_statement.target->return_type));
+            }
+
+            if (dst && tracked.find(dst) != tracked.end()) {
+                uint32_t type_max = GetMaxValueOfSize(compiler->GetSymbolTypeSize(dst->symbol->type));
+
+                // Value is truncated to the size of destination, loops are widened to the max. value
+                if (value > type_max || (value > dst->max_value && pass >= MaxRangeIterations)) {
+                    value = type_max;
+                }
+
+                if (value > dst->max_value) {
+                    dst->max_value = (uint32_t)value;
+                    changed = true;
+                }
+            }
+
+            current = current->next;
+            ip++;
+        }
+    }
+}
+
+uint64_t DosExeEmitter::GetAssignmentMaxValue(InstructionEntry* i)
+{
+    uint64_t op1 = GetOperandMaxValue(i->assignment.op1);
+
+    if (i->assignment.type == AssignType::None) {
+        return op1;
+    }
+
+    uint64_t op2 = GetOperandMaxValue(i->assignment.op2);
+
+    switch (i->assignment.type) {
+        case AssignType::Add:       return op1 + op2;
+        case AssignType::Multiply:  return op1 * op2;
+        case AssignType::Divide:    return op1;
+        case AssignType::Remainder: return (op2 > 0 && op2 - 1 < op1 ? op2 - 1 : op1);
+
+        case AssignType::ShiftLeft: {
+            if (i->assignment.op2.exp_type == ExpressionType::Constant && op2 < 32) {
+                return op1 << op2;
+            }
+            return UINT64_MAX;
+        }
+        case AssignType::ShiftRight: {
+            if (i->assignment.op2.exp_type == ExpressionType::Constant) {
+                return (op2 < 32 ? op1 >> op2 : 0);
+            }
+            return op1;
+        }
+
+        // Negation and subtraction can underflow
+        default: return UINT64_MAX;
+    }
+}
+
+uint32_t DosExeEmitter::GetOperandMaxValue(InstructionOperand& op)
+{
+    switch (op.exp_type) {
+        case ExpressionType::Constant: {
+            if (op.type.base == BaseSymbolType::String) {
+                return UINT32_MAX;
+            }
+
+            return (uint32_t)op.imm;
+        }
+        case ExpressionType::Variable: {
+            if (op.index.value) {
+                // Items of arrays are not analyzed
+                return UINT32_MAX;
+            }
+
+            return FindVariableByName(op.value)->max_value;
+        }
+
+        default: return UINT32_MAX;
+    }
+}
+
+uint32_t DosExeEmitter::GetMaxValueOfSize(int32_t size)
+{
+    switch (size) {
+        case 1: return UINT8_MAX;
+        case 2: return UINT16_MAX;
+        default: return UINT32_MAX;
+    }
+}
+
+int32_t DosExeEmitter::GetNarrowOperandSize(int32_t operand_size, uint64_t max_value)
+{
+    if (operand_size > default_size && max_value <= GetMaxValueOfSize(default_size)) {
+        return default_size;
+    }
+
+    return operand_size;
+}
+
+CompareType DosExeEmitter::GetSwappedCompareType(CompareType type)
+{
+    switch (type) {
+        case CompareType::Equal:          return CompareType::Equal;
+        case CompareType::NotEqual:       return CompareType::NotEqual;
+        case CompareType::Greater:        return CompareType::Less;
+        case CompareType::Less:           return CompareType::Greater;
+        case CompareType::GreaterOrEqual: return CompareType::LessOrEqual;
+        case CompareType::LessOrEqual:    return CompareType::GreaterOrEqual;
+
+        default: ThrowOnUnreachableCode();
+    }
+}
+
+bool DosExeEmitter::IfConstexpr(CompareType type, int32_t op1, int32_t op2)
+{
+    switch (type) {
+        case CompareType::LogOr:          return (op1 || op2);
+        case CompareType::LogAnd:         return (op1 && op2);
+
+        case CompareType::Equal:          return (op1 == op2);
+        case CompareType::NotEqual:       return (op1 != op2);
+        case CompareType::Greater:        return (op1 > op2);
+        case CompareType::Less:           return (op1 < op2);
+        case CompareType::GreaterOrEqual: return (op1 >= op2);
+        case CompareType::LessOrEqual:    return (op1 <= op2);
+
+        default: ThrowOnUnreachableCode();
+    }
+}
+
+void DosExeEmitter::EmitCommonSharedFunctions()
+{
+    EmitSharedFunction("GetCommandLine", [&]() {
+        // Command line is stored in Program Segment Prefix (or at the same place before the code)
+        //   mov si, (0x81 - 1)
+        LoadConstantToRegister(code_base - 0x0100 + 0x81 - 1, CpuRegister::SI, default_size);
+
+        uint32_t loop1 = ip_dst;
+
+        // Go forward and find first non-whitespace character
+        //   inc si
+        uint8_t* l3 = AllocateBufferForInstruction(1);
+        l3[0] = ToOpR(0x40, CpuRegister::SI);   // inc r16/32
+
+        //   cmp [si], ' '
+        uint8_t* l4 = AllocateBufferForMemoryAccess(1, { 0x80 }, 7, CpuMemory::Si, 1);
+        l4[0] = ' ';    // cmp rm8, imm8
+
+        //   jz [loop1]
+        uint8_t* l5 = AllocateBufferForInstruction(1 + 1);
+        l5[0] = 0x74;   // jz rel8
+        l5[1] = (int8_t)(loop1 - ip_dst);
+
+        // Save starting address to AX
+        AsmMov(CpuRegister::AX, CpuRegister::SI, default_size);
+
+        AsmDec(CpuRegister::SI, default_size);
+
+        uint32_t loop2 = ip_dst;
+
+        // Go forward and find CR
+        AsmInc(CpuRegister::SI, default_size);
+
+        //   cmp [si], '\r'
+        uint8_t* l9 = AllocateBufferForMemoryAccess(1, { 0x80 }, 7, CpuMemory::Si, 1);
+        l9[0] = '\r';   // cmp rm8, imm8
+
+        //   jnz [loop2]
+        uint8_t* l10 = AllocateBufferForInstruction(1 + 1);
+        l10[0] = 0x75;   // jnz rel8
+        l10[1] = (int8_t)(loop2 - ip_dst);
+
+        uint32_t loop3 = ip_dst;
+
+        // Go backward and find first non-whitespace character
+        AsmDec(CpuRegister::SI, default_size);
+
+        //   cmp [si], ' '
+        uint8_t* l12 = AllocateBufferForMemoryAccess(1, { 0x80 }, 7, CpuMemory::Si, 1);
+        l12[0] = ' ';    // cmp rm8, imm8
+
+        //   jz [loop3]
+        uint8_t* l13 = AllocateBufferForInstruction(1 + 1);
+        l13[0] = 0x74;   // jz rel8
+        l13[1] = (int8_t)(loop3 - ip_dst);
+
+        AsmInc(CpuRegister::SI, default_size);
+
+        //   mov [si], '\0'
+        uint8_t* l15 = AllocateBufferForMemoryAccess(1, { 0xC6 }, 0, CpuMemory::Si, 1);
+        l15[0] = 0x00;   // mov rm8, imm8 ('\0')
+
+        AsmProcLeaveNoArgs(0);
+    });
+
+    EmitSharedFunction("#StringsEqual", [&]() {
+        AsmProcEnter();
+
+        //   mov si, ss:[bp + 6]
+        uint8_t* l2 = AllocateBufferForMemoryAccess(default_size, { 0x8B }, CpuRegister::SI, CpuMemory::Stack);
+        l2[0] = (int8_t)GetProcFrameSize();     // mov r16/32, rm16/32
+
+        //   mov di, ss:[bp + 8]
+        uint8_t* l3 = AllocateBufferForMemoryAccess(default_size, { 0x8B }, CpuRegister::DI, CpuMemory::Stack);
+        l3[0] = (int8_t)(GetProcFrameSize() + default_size); // mov r16/32, rm16/32
+
+        //   cmp si, di
+        uint8_t* l4 = AllocateBufferWithPrefix(default_size, 2);
+        l4[0] = 0x39;   // cmp rm16/32, r16/32
+        l4[1] = ToXrm(3, CpuRegister::DI, CpuRegister::SI);
+
+        //   jz [equal]
+        uint8_t* l5 = AllocateBufferForInstruction(1 + 1);
+        l5[0] = 0x74;   // jz rel8
+
+        uint32_t l5_ip = ip_dst;
+        uint32_t l5_offset = (l5 + 1) - buffer;
+
+        AsmDec(CpuRegister::DI, default_size);
+
+        uint8_t loop = ip_dst;
+
+        AsmInc(CpuRegister::DI, default_size);
+
+        //   lodsb
+        uint8_t* l8 = AllocateBufferForInstruction(1);
+        l8[0] = 0xAC;
+
+        //   cmp [di], al
+        AllocateBufferForMemoryAccess(1, { 0x38 }, CpuRegister::AL, CpuMemory::Di);    // cmp rm8, r8
+
+        //   jnz [not_equal]
+        uint8_t* l10 = AllocateBufferForInstruction(1 + 1);
+        l10[0] = 0x75;  // jnz rel8
+        
+        uint32_t l10_ip = ip_dst;
+        uint32_t l10_offset = (l10 + 1) - buffer;
+
+        //   cmp al, 0
+        uint8_t* l11 = AllocateBufferForInstruction(2 + 1);
+        l11[0] = 0x80;  // cmp rm8, imm8
+        l11[1] = ToXrm(3, 7, CpuRegister::AL);
+        l11[2] = 0;
+
+        //   jnz [loop]
+        uint8_t* l12 = AllocateBufferForInstruction(1 + 1);
+        l12[0] = 0x75;  // jnz rel8
+        l12[1] = (int8_t)(loop - ip_dst);
+
+        // They are equal
+        uint32_t equal = ip_dst;
+        *(buffer + l5_offset) = (int8_t)(equal - l5_ip);
+
+        LoadConstantToRegister(1, CpuRegister::AL, 1);
+
+        //   jmp [end]
+        uint8_t* l14 = AllocateBufferForInstruction(1 + 1);
+        l14[0] = 0xEB;  // jmp rel8
+
+        uint32_t l14_ip = ip_dst;
+        uint32_t l14_offset = (l14 + 1) - buffer;
+
+        // They are not equal
+        // Backpatch "not_equal" jump, offset is known now
+        uint32_t not_equal = ip_dst;
+        *(buffer + l10_offset) = (int8_t)(not_equal - l10_ip);
+
+        ZeroRegister(CpuRegister::AL, 1);
+
+        // Backpatch "end" jump, offset is known now
+        uint32_t end = ip_dst;
+        *(buffer + l14_offset) = (int8_t)(end - l14_ip);
+
+        AsmProcLeave(2 * default_size);
+    });
+}
+
+bool DosExeEmitter::IsSharedFunctionReferenced(const char* name)
+{
+    SymbolTableEntry* symbol = compiler->GetSymbols();
+
+    while (symbol) {
+        if (symbol->type.base == BaseSymbolType::SharedFunction && strcmp(symbol->name, name) == 0) {
+            return (symbol->ref_count > 0);
+        }
+
+        symbol = symbol->next;
+    }
+
+    return false;
 }
 
 void DosExeEmitter::EmitSharedFunction(char* name, std::function<void()> emitter)
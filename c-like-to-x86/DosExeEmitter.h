@@ -5,9 +5,11 @@
 #include <malloc.h>
 #include <string>
 #include <list>
+#include <vector>
 #include <map>
 #include <stack>
 #include <unordered_set>
+#include <unordered_map>
 #include <functional>
 
 #include "Compiler.h"
@@ -15,12 +17,15 @@
 #include "SymbolTableEntry.h"
 #include "i386Emitter.h"
 
+struct ObjectUnit;
+
 enum struct DosBackpatchType {
     Unknown,
 
     ToRel8,     // Relative address (signed 8-bit)
-    ToRel16,    // Relative address (16-bit)
-    ToDsAbs16,  // Absolute address to DS segment (16-bit)
+    ToRel,      // Relative address (default address size)
+    ToDsAbs,    // Absolute address to DS segment (default address size)
+    ToDsAbsAdd, // Absolute address to DS segment (default address size), added to already stored offset
     ToStack8    // Relative address (signed 8-bit)
 };
 
@@ -58,6 +63,14 @@ struct DosVariableDescriptor {
 
     bool is_dirty;
     bool force_save;
+
+    uint32_t weight;            // Executed references in current function, only if profile is used
+    uint32_t max_value;         // Known upper bound of the value in current function
+};
+
+struct DosVariableRange {
+    uint32_t begin;
+    uint32_t end;
 };
 
 struct DosLabel {
@@ -65,6 +78,32 @@ struct DosLabel {
     int32_t ip_dst;
 };
 
+struct DosDeferredFunction {
+    InstructionEntry* instruction;
+    int32_t ip_src;
+    int32_t ip_end;
+};
+
+struct DosFunctionRange {
+    char* name;
+    int32_t begin;          // First byte of the function
+    int32_t end;
+    int32_t entry_ip;       // Removed instructions of prologue can precede the entry
+    bool is_entry_point;
+};
+
+struct DosLinkedStatic {
+    char* name;
+    int32_t size;
+};
+
+struct DosReturnSite {
+    uint32_t offset;        // "mov esp, ebp" and "pop ebp"
+    uint32_t bx_offset;     // "pop ebx"
+    uint32_t ret_offset;    // "retn"
+    uint32_t end_offset;
+};
+
 enum struct SaveReason {
     Before,     // Variable will be saved if it's referenced in current or one of the following instructions
     Inside,     // Variable will be saved if it's referenced in one of the following instructions
@@ -114,7 +153,7 @@ struct MzRelocEntry {
 
 #define BackpatchStatic(ptr, var)                                   \
     backpatch.push_back({                                           \
-        DosBackpatchType::ToDsAbs16, DosBackpatchTarget::Static,    \
+        DosBackpatchType::ToDsAbs, DosBackpatchTarget::Static,      \
         (uint32_t)((ptr) - buffer), 0, 0, (var)->symbol->name       \
     });
 
@@ -122,37 +161,95 @@ struct MzRelocEntry {
     {                                                               \
         strings.insert(str);                                        \
         backpatch.push_back({                                       \
-            DosBackpatchType::ToDsAbs16, DosBackpatchTarget::String,\
+            DosBackpatchType::ToDsAbs, DosBackpatchTarget::String,  \
             (uint32_t)((ptr) - buffer), 0, 0, str                   \
         });                                                         \
     }
 
 /// <summary>
-/// Class that emits 16-bit EXE executable for DOS (i386)
+/// Class that emits 16-bit EXE executable for DOS (i386),
+/// other executable formats reuse its code generation (with different default operand size)
 /// </summary>
-class DosExeEmitter : i386::Emitter
+class DosExeEmitter : protected i386::Emitter
 {
     friend class SuppressRegister;
 
 public:
     DosExeEmitter(Compiler* compiler);
-    ~DosExeEmitter();
+    virtual ~DosExeEmitter();
 
-    void EmitMzHeader();
+    virtual void EmitHeader();
     void EmitInstructions(InstructionEntry* instruction_stream);
-    void EmitSharedFunctions();
+    virtual void EmitSharedFunctions();
     void EmitStaticData();
-    void FixMzHeader(InstructionEntry* instruction_stream, uint32_t stack_size);
+
+    /// <summary>
+    /// Resolve all references to functions, strings and static variables at once,
+    /// so no function has to know placement of the others while it's emitted
+    /// </summary>
+    void ResolveRelocations();
+
+    virtual void FixHeader(InstructionEntry* instruction_stream, uint32_t stack_size);
+
+    /// <summary>
+    /// Copy emitted instructions to object unit instead of finalizing the executable,
+    /// references to functions, strings and static variables are kept as relocations
+    /// </summary>
+    /// <param name="unit">Object unit</param>
+    void CreateObject(ObjectUnit& unit);
+
+    /// <summary>
+    /// Place functions of object units instead of emitting instructions, only functions
+    /// reachable from the entry point are placed, then the executable is finalized as usual
+    /// </summary>
+    /// <param name="units">Object units, they must live until the executable is saved</param>
+    void LinkObjects(std::vector<ObjectUnit>& units);
 
     void Save(FILE* stream);
+    void Save(std::vector<uint8_t>& output);
 
-private:
     /// <summary>
-    /// Add all variables from symbol table to internal list
+    /// Pre-allocate output buffer, size of previously emitted executable can be used as hint
+    /// </summary>
+    /// <param name="size">Expected size in bytes</param>
+    void ReserveOutput(uint32_t size);
+
+protected:
+    /// <summary>
+    /// Emit abstract instructions starting at current instruction
+    /// </summary>
+    /// <param name="symbol_table">Symbol table</param>
+    /// <param name="ip_end">Instruction pointer, where the emitting stops</param>
+    void EmitInstructionRange(SymbolTableEntry* symbol_table, int32_t ip_end);
+
+    /// <summary>
+    /// Get address of the entry point
+    /// </summary>
+    /// <param name="instruction_stream">Instruction stream; or nullptr if object units were linked</param>
+    /// <returns>Instruction pointer</returns>
+    uint32_t GetEntryIp(InstructionEntry* instruction_stream);
+
+    /// <summary>
+    /// Add all variables from symbol table to internal list, static variables are stored first,
+    /// then local variables of each function are stored in one contiguous range
     /// </summary>
     /// <param name="symbol_table">Symbol table</param>
     void CreateVariableList(SymbolTableEntry* symbol_table);
 
+    /// <summary>
+    /// Select local variables of function as current scope and release all registers,
+    /// values of static variables were already written back by the previous function
+    /// </summary>
+    /// <param name="function">Function</param>
+    void BindParentVariables(SymbolTableEntry* function);
+
+    /// <summary>
+    /// Change register of variable and update owner of the register
+    /// </summary>
+    /// <param name="var">Variable descriptor</param>
+    /// <param name="reg">New register; or None</param>
+    void SetVariableRegister(DosVariableDescriptor* var, i386::CpuRegister reg);
+
     /// <summary>
     /// Return unused/free register, if all registers are referenced,
     /// save and unreference least used register
@@ -174,6 +271,13 @@ private:
     /// <returns>Variable descriptor</returns>
     DosVariableDescriptor* FindVariableByName(char* name);
 
+    /// <summary>
+    /// Find variable specified by name in current function or in static variables
+    /// </summary>
+    /// <param name="name">Name of variable</param>
+    /// <returns>Variable descriptor; or nullptr if it doesn't exist</returns>
+    DosVariableDescriptor* TryFindVariableByName(const char* name);
+
     /// <summary>
     /// Find next reference to variable
     /// </summary>
@@ -204,6 +308,18 @@ private:
     /// <param name="reg_dst">Register with value</param>
     void SaveIndexedVariable(DosVariableDescriptor* var, InstructionOperandIndex& index, i386::CpuRegister reg_dst);
 
+    /// <summary>
+    /// Save variables that can be accessed through the pointer, so the memory holds their current values
+    /// </summary>
+    /// <param name="pointer">Dereferenced pointer</param>
+    void SaveAliasedVariables(DosVariableDescriptor* pointer);
+
+    /// <summary>
+    /// Unreference registers of variables that could be changed through the pointer
+    /// </summary>
+    /// <param name="pointer">Dereferenced pointer</param>
+    void UnloadAliasedVariables(DosVariableDescriptor* pointer);
+
     /// <summary>
     /// Save variable which uses specified register and unreference it
     /// </summary>
@@ -231,6 +347,29 @@ private:
     /// <param name="param_size">Size of parameter</param>
     void PushVariableToStack(DosVariableDescriptor* var, int32_t param_size);
 
+    /// <summary>
+    /// Load value of parameter to register, it's used for parameters passed in registers
+    /// </summary>
+    /// <param name="push">Push instruction with the value</param>
+    /// <param name="param_decl">Declaration of parameter</param>
+    /// <param name="reg">Target register</param>
+    void LoadParameterToRegister(InstructionEntry* push, SymbolTableEntry* param_decl, i386::CpuRegister reg);
+
+    /// <summary>
+    /// Get register that is used to pass parameter of user function
+    /// </summary>
+    /// <param name="function">Called function</param>
+    /// <param name="parameter">Index of parameter (1-based)</param>
+    /// <returns>Register; or None if the parameter is passed in stack</returns>
+    i386::CpuRegister GetParameterRegister(SymbolTableEntry* function, int32_t parameter);
+
+    /// <summary>
+    /// Save and unload all variables that don't survive a call of user function,
+    /// variables in callee-saved register are saved only if the callee can read or change them
+    /// </summary>
+    /// <param name="function">Called function</param>
+    void SaveAndUnloadCallerSavedRegisters(SymbolTableEntry* function);
+
     /// <summary>
     /// Force load value of variable to any register,
     /// if it is already in register, ownership will be removed
@@ -280,6 +419,33 @@ private:
     /// <param name="desired_size">Specified size</param>
     void LoadConstantToRegister(int32_t value, i386::CpuRegister reg, int32_t desired_size);
 
+    /// <summary>
+    /// Emit instruction with variable stored in memory (static or stack) as operand
+    /// </summary>
+    /// <param name="operand_size">Operand size in bytes (1, 2 or 4)</param>
+    /// <param name="opcode">Opcode bytes</param>
+    /// <param name="r">Register or opcode extension</param>
+    /// <param name="var">Variable descriptor</param>
+    /// <param name="imm_size">Size of immediate value</param>
+    /// <returns>Pointer to immediate value</returns>
+    uint8_t* EmitVariableAccess(int32_t operand_size, std::initializer_list<uint8_t> opcode, uint8_t r, DosVariableDescriptor* var, uint32_t imm_size = 0);
+
+    uint8_t* EmitVariableAccess(int32_t operand_size, std::initializer_list<uint8_t> opcode, i386::CpuRegister r, DosVariableDescriptor* var, uint32_t imm_size = 0)
+    {
+        return EmitVariableAccess(operand_size, opcode, (uint8_t)r, var, imm_size);
+    }
+
+    /// <summary>
+    /// Emit instruction with item of array or pointer as operand, offset of the item must be already loaded in index register
+    /// (if the variable is pointer, the pointer must be already added to it)
+    /// </summary>
+    /// <param name="operand_size">Operand size in bytes (1, 2 or 4)</param>
+    /// <param name="opcode">Opcode bytes</param>
+    /// <param name="r">Register</param>
+    /// <param name="var">Variable descriptor</param>
+    /// <param name="index">Index register (SI or DI)</param>
+    void EmitIndexedVariableAccess(int32_t operand_size, std::initializer_list<uint8_t> opcode, i386::CpuRegister r, DosVariableDescriptor* var, i386::CpuRegister index);
+
     /// <summary>
     /// Fill specified register with zeros
     /// </summary>
@@ -287,6 +453,16 @@ private:
     /// <param name="desired_size">Size of register</param>
     void ZeroRegister(i386::CpuRegister reg, int32_t desired_size);
 
+    /// <summary>
+    /// Emit arithmetic instruction with register and immediate value as operands,
+    /// sign-extended 8-bit immediate is used if possible
+    /// </summary>
+    /// <param name="operand_size">Operand size in bytes (1, 2 or 4)</param>
+    /// <param name="r">Opcode extension (0 = add, 5 = sub, 7 = cmp, ...)</param>
+    /// <param name="reg">Register</param>
+    /// <param name="value">Immediate value</param>
+    void EmitImmediateOperation(int32_t operand_size, uint8_t r, i386::CpuRegister reg, int32_t value);
+
     // Backpatching
     /// <summary>
     /// Backpatch all entries in list with address of current line
@@ -306,6 +482,25 @@ private:
     /// <param name="target">Type of entries</param>
     void CheckBackpatchListIsEmpty(DosBackpatchTarget target);
 
+    /// <summary>
+    /// Write resolved address to the place described by backpatch entry
+    /// </summary>
+    /// <param name="b">Backpatch entry</param>
+    /// <param name="ip_dst">Resolved address</param>
+    void ApplyBackpatch(const DosBackpatchInstruction& b, int32_t ip_dst);
+
+    /// <summary>
+    /// Move entries that can be resolved only by link stage from backpatch list to relocation list
+    /// </summary>
+    void MoveRelocations();
+
+    /// <summary>
+    /// Find symbols that are resolved by link stage
+    /// </summary>
+    /// <param name="target">Type of entries</param>
+    /// <returns>Symbols; or nullptr if the entries are resolved immediately</returns>
+    std::unordered_map<std::string, int32_t>* FindLinkSymbols(DosBackpatchTarget target);
+
     /// <summary>
     /// Check if the last statement of function is return,
     /// so the function is terminated properly.
@@ -319,6 +514,27 @@ private:
     /// <param name="symbol_table">Symbol table</param>
     void ProcessSymbolLinkage(SymbolTableEntry* symbol_table);
 
+    /// <summary>
+    /// Skip all instructions until the beginning of the next function
+    /// </summary>
+    /// <param name="symbol_table">Symbol table</param>
+    void SkipToNextFunction(SymbolTableEntry* symbol_table);
+
+    /// <summary>
+    /// Copy the function from cache, if it was emitted by previous compilation with the same key
+    /// </summary>
+    /// <param name="function">Function or entry point</param>
+    /// <param name="symbol_table">Symbol table</param>
+    /// <returns>True if the function was copied and its instructions were skipped</returns>
+    bool TryEmitCachedFunction(SymbolTableEntry* function, SymbolTableEntry* symbol_table);
+
+    /// <summary>
+    /// Add current function to cache, it's called from epilogue
+    /// </summary>
+    /// <param name="entry_ip">Entry of the function</param>
+    /// <param name="first_relocation">Index of the first relocation of the function</param>
+    void AddFunctionToCache(int32_t entry_ip, size_t first_relocation);
+
     // Instruction emitters
     void EmitEntryPointPrologue(SymbolTableEntry* function);
 
@@ -326,6 +542,15 @@ private:
 
     void EmitFunctionEpilogue();
 
+    /// <summary>
+    /// Remove parts of prologue and all epilogues of current function that are not needed,
+    /// call frame is omitted if no variable is accessed in stack, removed instructions are skipped
+    /// </summary>
+    /// <param name="uses_frame">Call frame is needed to access variables in stack</param>
+    /// <param name="stack_var_size">Size of local variables in stack</param>
+    /// <returns>Offset of the first instruction in buffer</returns>
+    uint32_t RemoveUnusedFrame(bool uses_frame, int32_t stack_var_size);
+
     void EmitAssign(InstructionEntry* i);
     inline void EmitAssignNone(InstructionEntry* i);
     inline void EmitAssignNegation(InstructionEntry* i);
@@ -346,6 +571,83 @@ private:
     void EmitCall(InstructionEntry* i, SymbolTableEntry* symbol_table, std::stack<InstructionEntry*>& call_parameters);
     void EmitReturn(InstructionEntry* i, SymbolTableEntry* symbol_table);
 
+    /// <summary>
+    /// Terminate the program, return code is in AL register
+    /// </summary>
+    virtual void EmitExit();
+
+    /// <summary>
+    /// Emit increment of new profile counter, it's used only in instrumented programs
+    /// </summary>
+    /// <param name="type">Type of counter</param>
+    /// <param name="target">Called function, only for call edges</param>
+    void EmitProfileCounter(ProfileCounterType type, const char* target);
+
+    /// <summary>
+    /// Emit function that saves all profile counters to file, it's called before the program exits
+    /// </summary>
+    virtual void EmitProfileDump();
+
+    /// <summary>
+    /// Compute weights of all variables referenced in current function from execution profile,
+    /// register allocator keeps variables with higher weight in registers
+    /// </summary>
+    void ComputeVariableWeights();
+
+    /// <summary>
+    /// Increase weight of variable specified by name
+    /// </summary>
+    /// <param name="name">Name of variable</param>
+    /// <param name="count">Execution count of the reference</param>
+    void AddVariableWeight(const char* name, uint32_t count);
+
+    /// <summary>
+    /// Compute upper bounds of values of all local variables in current function,
+    /// operations on values that fit into default operand size don't need the prefix
+    /// </summary>
+    void ComputeValueRanges();
+
+    /// <summary>
+    /// Select the static variable that is referenced the most inside loops of current function,
+    /// it's kept in EBX register for the whole function and it's written back only when needed
+    /// </summary>
+    void PromoteStaticVariable();
+
+    /// <summary>
+    /// Load promoted static variable to EBX register, if it's not there already
+    /// </summary>
+    void RestorePromotedStatic();
+
+    /// <summary>
+    /// Get upper bound of the result of assignment
+    /// </summary>
+    /// <param name="i">Assignment instruction</param>
+    /// <returns>Upper bound, it can exceed the size of destination</returns>
+    uint64_t GetAssignmentMaxValue(InstructionEntry* i);
+
+    /// <summary>
+    /// Get upper bound of the value of operand
+    /// </summary>
+    /// <param name="op">Operand</param>
+    /// <returns>Upper bound</returns>
+    uint32_t GetOperandMaxValue(InstructionOperand& op);
+
+    /// <summary>
+    /// Get max. value that can be stored in specified size
+    /// </summary>
+    /// <param name="size">Size in bytes</param>
+    /// <returns>Max. value</returns>
+    uint32_t GetMaxValueOfSize(int32_t size);
+
+    /// <summary>
+    /// Get the narrowest operand size that produces the same result,
+    /// only default operand size is preferred, because it doesn't need the prefix
+    /// </summary>
+    /// <param name="operand_size">Operand size in bytes</param>
+    /// <param name="max_value">Upper bound of operands and result</param>
+    /// <returns>Operand size in bytes</returns>
+    int32_t GetNarrowOperandSize(int32_t operand_size, uint64_t max_value);
+
     /// <summary>
     /// Get opposite compare type, so operands can be swapped
     /// </summary>
@@ -369,12 +671,55 @@ private:
     /// <param name="emitter">Callback to emit instructions</param>
     void EmitSharedFunction(char* name, std::function<void()> emitter);
 
+    /// <summary>
+    /// Check if shared function is referenced in source code
+    /// </summary>
+    /// <param name="name">Name of function</param>
+    /// <returns>True if it's referenced</returns>
+    bool IsSharedFunctionReferenced(const char* name);
+
+    /// <summary>
+    /// Emit shared functions that don't depend on operating system
+    /// </summary>
+    void EmitCommonSharedFunctions();
+
+    // Internal symbols of instrumented programs, names cannot collide with user symbols
+    static char ProfileCountersName[];
+    static char ProfileDumpName[];
+
 
     /// <summary>
     /// Max. number of abstract instructions that can fit into "rel8" address
     /// </summary>
     const int32_t NearJumpThreshold = 10;
 
+    /// <summary>
+    /// Call site is hot, if it has at least this fraction of all executed calls
+    /// </summary>
+    const uint32_t HotCallDivisor = 10;
+
+    /// <summary>
+    /// User functions receive the first parameters in ECX and EDX registers and return value in EAX register,
+    /// EAX, ECX and EDX are caller-saved, EBX and EBP are callee-saved;
+    /// shared functions use only stack to pass parameters
+    /// </summary>
+    const int32_t RegisterParameterCount = 2;
+
+    /// <summary>
+    /// Size of callee-saved registers (EBX) that are pushed before the call frame of user function
+    /// </summary>
+    const int32_t CalleeSavedSize = 4;
+
+    /// <summary>
+    /// Upper bounds that are still growing after this number of passes are widened to the max. value of the type
+    /// </summary>
+    const int32_t MaxRangeIterations = 4;
+
+    /// <summary>
+    /// Static variable is promoted to register only if it has at least this number of references inside loops
+    /// </summary>
+    const uint32_t MinPromotedStaticUses = 2;
+
 
     Compiler* compiler;
 
@@ -384,16 +729,51 @@ private:
 
     std::map<uint32_t, uint32_t> ip_src_to_dst;
     std::list<DosBackpatchInstruction> backpatch;
-    std::list<DosVariableDescriptor> variables;
-    std::list<DosLabel> functions;
+    std::vector<DosVariableDescriptor> variables;
+    uint32_t static_count = 0;
+    std::unordered_map<std::string, uint32_t> static_index;
+    std::unordered_map<std::string, DosVariableRange> function_variables;
+    std::list<DosBackpatchInstruction> relocations;                 // Unresolved references to other functions and data
+    std::unordered_map<std::string, int32_t> function_symbols;
+    std::unordered_map<std::string, int32_t> string_symbols;
+    std::unordered_map<std::string, int32_t> static_symbols;
     std::list<DosLabel> labels;
     std::unordered_set<char*> strings;
+    std::unordered_set<uint32_t> discontinuous_ips;
+    std::list<DosDeferredFunction> cold_functions;
+    std::vector<DosFunctionRange> function_ranges;
+    std::vector<DosLinkedStatic> linked_statics;
+    std::list<std::string> linked_names;            // Names of static variables qualified by object unit
+    int32_t linked_entry_ip = -1;
 
     std::unordered_set<i386::CpuRegister> suppressed_registers;
     
     SymbolTableEntry* parent = nullptr;
+    DosVariableRange parent_variables = { };
+    std::unordered_map<std::string, uint32_t> parent_index;
+    const FunctionPointsTo* parent_points_to = nullptr;
+    DosVariableDescriptor* register_owner[8] = { };     // Variables in general-purpose registers of current scope
     int32_t parent_end_ip = 0;
     uint32_t parent_stack_offset = 0;
+    uint32_t parent_ip_dst = 0;
+    uint32_t parent_frame_offset = 0;
+    bool parent_uses_bx = false;
+    DosVariableDescriptor* promoted_static = nullptr;   // Static variable held in EBX register in current function
+    bool is_promoted_static_written = false;
+    std::vector<DosReturnSite> parent_returns;
+    uint64_t parent_cache_key = 0;                      // Current function will be added to cache; or zero
     InstructionEntry* current_instruction = nullptr;
     bool was_return = false;
+
+    bool instrument_profile = false;
+    bool is_block_entry = false;
+    uint32_t profile_clear_offset = 0;
+
+    /// <summary>
+    /// Address of the first emitted instruction, DOS loads the program directly after Program Segment Prefix
+    /// </summary>
+    uint32_t code_base = 0x0100;
+
+    ProfileMap* profile = nullptr;
+    bool emitting_cold_functions = false;
 };
\ No newline at end of file
@@ -0,0 +1,716 @@
+#include "ElfEmitter.h"
+
+#include "Log.h"
+#include "Compiler.h"
+#include "CompilerException.h"
+
+// This emitter is using i386 architecture
+using namespace i386;
+
+ElfEmitter::ElfEmitter(Compiler* compiler)
+    : DosExeEmitter(compiler)
+{
+    // Linux starts the program in flat 32-bit segments
+    default_size = 4;
+    code_base = ImageBase + HeaderSize;
+}
+
+ElfEmitter::~ElfEmitter()
+{
+}
+
+void ElfEmitter::EmitHeader()
+{
+    // Headers are followed by space for command line, so the whole block has the same size as PSP
+    uint8_t* block = AllocateBuffer(HeaderSize);
+    memset(block, 0, HeaderSize);
+
+    Elf32Header* header = (Elf32Header*)block;
+    header->ident[0] = 0x7F;
+    header->ident[1] = 'E';
+    header->ident[2] = 'L';
+    header->ident[3] = 'F';
+    header->ident[4] = 1;           // 32-bit
+    header->ident[5] = 1;           // Little-endian
+    header->ident[6] = 1;           // Current version
+    header->type = 2;               // Executable file
+    header->machine = 3;            // i386
+    header->version = 1;
+    header->phoff = sizeof(Elf32Header);
+    header->ehsize = sizeof(Elf32Header);
+    header->phentsize = sizeof(Elf32ProgramHeader);
+    header->phnum = 1;
+
+    // The whole file is mapped as one segment, so the program can modify itself
+    // and static variables are located directly after the code
+    Elf32ProgramHeader* segment = (Elf32ProgramHeader*)(block + sizeof(Elf32Header));
+    segment->type = 1;              // Loadable
+    segment->offset = 0;
+    segment->vaddr = ImageBase;
+    segment->paddr = ImageBase;
+    segment->flags = 7;             // Read, write, execute
+    segment->align = 0x1000;
+}
+
+void ElfEmitter::EmitSharedFunctions()
+{
+    Log::Write(LogType::Info, "Emitting shared functions...");
+    Log::PushIndent();
+
+    // This buffer is used for (almost) all I/O operations
+    const int32_t io_buffer_size = 0x20; // 32 bytes
+
+    uint32_t io_buffer_address = 0;
+
+    // Check, if I/O buffer for read/print operations is needed
+    bool io_buffer_needed = (IsSharedFunctionReferenced("PrintUint32")  ||
+                             IsSharedFunctionReferenced("PrintNewLine") ||
+                             IsSharedFunctionReferenced("ReadUint32"));
+
+    // Buffer is needed, allocate space for it
+    if (io_buffer_needed) {
+        io_buffer_address = ip_dst + code_base;
+
+        uint8_t* buffer = AllocateBufferForInstruction(io_buffer_size);
+        memset(buffer, 0, io_buffer_size);
+    }
+
+    // Emit only referenced functions
+    EmitSharedFunction("PrintUint32", [&]() {
+        AsmProcEnter();
+
+        //   mov eax, ss:[ebp + 8]
+        uint8_t* l2 = AllocateBufferForMemoryAccess(4, { 0x8B }, CpuRegister::AX, CpuMemory::Stack);
+        l2[0] = (int8_t)GetProcFrameSize();     // mov r32, rm32
+
+        LoadConstantToRegister(10, CpuRegister::CX, 4);
+        LoadConstantToRegister(io_buffer_size, CpuRegister::DI, 4);
+
+        uint32_t loop = ip_dst;
+
+        AsmDec(CpuRegister::DI, 4);
+
+        ZeroRegister(CpuRegister::DX, 4);
+
+        //   div ecx
+        uint8_t* l6 = AllocateBufferWithPrefix(4, 2);
+        l6[0] = 0xF7;   // div eax, rm32
+        l6[1] = ToXrm(3, 6, CpuRegister::CX);
+
+        //   add dl, '0'
+        uint8_t* l7 = AllocateBufferForInstruction(2 + 1);
+        l7[0] = 0x80;   // add rm8, imm8
+        l7[1] = ToXrm(3, 0, CpuRegister::DL);
+        l7[2] = '0';
+
+        //   mov [buffer + edi], dl
+        uint8_t* l8 = AllocateBufferForMemoryAccess(1, { 0x88 }, CpuRegister::DL, CpuMemory::DiDisp);
+        StoreOffset(l8, io_buffer_address);     // mov rm8, r8
+
+        //   cmp eax, 0
+        uint8_t* l9 = AllocateBufferWithPrefix(4, 3);
+        l9[0] = 0x83;   // cmp rm32, imm8
+        l9[1] = ToXrm(3, 7, CpuRegister::AX);
+        l9[2] = 0;
+
+        //   jnz [loop]
+        uint8_t* l10 = AllocateBufferForInstruction(1 + 1);
+        l10[0] = 0x75;   // jnz rel8
+        *(int8_t*)(l10 + 1) = (int8_t)(loop - ip_dst);
+
+        // Write digits from EDI to the end of the buffer
+        LoadConstantToRegister(io_buffer_size, CpuRegister::DX, 4);
+        AsmSub(CpuRegister::DX, CpuRegister::DI, 4);
+
+        LoadConstantToRegister(io_buffer_address, CpuRegister::CX, 4);
+        AsmAdd(CpuRegister::CX, CpuRegister::DI, 4);
+
+        LoadConstantToRegister(1 /*stdout*/, CpuRegister::BX, 4);
+
+        EmitSyscall(SysWrite);
+
+        AsmProcLeave(4);
+    });
+
+    EmitSharedFunction("PrintString", [&]() {
+        AsmProcEnter();
+
+        //   mov esi, ss:[ebp + 8]
+        uint8_t* l2 = AllocateBufferForMemoryAccess(4, { 0x8B }, CpuRegister::SI, CpuMemory::Stack);
+        l2[0] = (int8_t)GetProcFrameSize();     // mov r32, rm32
+
+        AsmMov(CpuRegister::DI, CpuRegister::SI, 4);
+
+        uint32_t loop = ip_dst;
+
+        //   cmp [edi], 0
+        uint8_t* l4 = AllocateBufferForMemoryAccess(1, { 0x80 }, 7, CpuMemory::Di, 1);
+        l4[0] = 0;      // cmp rm8, imm8
+
+        //   jz [end]
+        uint8_t* l5 = AllocateBufferForInstruction(1 + 1);
+        l5[0] = 0x74;   // jz rel8
+
+        uint32_t l5_ip = ip_dst;
+        uint32_t l5_offset = (l5 + 1) - buffer;
+
+        AsmInc(CpuRegister::DI, 4);
+
+        //   jmp [loop]
+        uint8_t* l7 = AllocateBufferForInstruction(1 + 1);
+        l7[0] = 0xEB;   // jmp rel8
+        l7[1] = (int8_t)(loop - ip_dst);
+
+    // end:
+        *(buffer + l5_offset) = (int8_t)(ip_dst - l5_ip);
+
+        AsmSub(CpuRegister::DI, CpuRegister::SI, 4);
+
+        AsmMov(CpuRegister::DX, CpuRegister::DI, 4);
+        AsmMov(CpuRegister::CX, CpuRegister::SI, 4);
+
+        LoadConstantToRegister(1 /*stdout*/, CpuRegister::BX, 4);
+
+        EmitSyscall(SysWrite);
+
+        AsmProcLeave(4);
+    });
+
+    EmitSharedFunction("PrintNewLine", [&]() {
+        //   mov [buffer], '\n'
+        uint8_t* l1 = AllocateBufferForMemoryAccess(1, { 0xC6 }, 0, CpuMemory::Absolute, 1);
+        StoreOffset(l1, io_buffer_address);     // mov rm8, imm8
+        l1[4] = '\n';
+
+        LoadConstantToRegister(io_buffer_address, CpuRegister::CX, 4);
+        LoadConstantToRegister(1, CpuRegister::DX, 4);
+        LoadConstantToRegister(1 /*stdout*/, CpuRegister::BX, 4);
+
+        EmitSyscall(SysWrite);
+
+        AsmProcLeaveNoArgs(0);
+    });
+
+    EmitSharedFunction("ReadUint32", [&]() {
+        // Number is accumulated in ESI, EDI is set after the first non-digit character
+        ZeroRegister(CpuRegister::SI, 4);
+        ZeroRegister(CpuRegister::DI, 4);
+
+        uint32_t loop = ip_dst;
+
+        // Read one character from stdin
+        ZeroRegister(CpuRegister::BX, 4);
+        LoadConstantToRegister(io_buffer_address, CpuRegister::CX, 4);
+        LoadConstantToRegister(1, CpuRegister::DX, 4);
+
+        EmitSyscall(SysRead);
+
+        // End of file or error
+        //   cmp eax, 1
+        uint8_t* l7 = AllocateBufferWithPrefix(4, 3);
+        l7[0] = 0x83;   // cmp rm32, imm8
+        l7[1] = ToXrm(3, 7, CpuRegister::AX);
+        l7[2] = 1;
+
+        //   jnz [end]
+        uint8_t* l8 = AllocateBufferForInstruction(1 + 1);
+        l8[0] = 0x75;   // jnz rel8
+
+        uint32_t l8_ip = ip_dst;
+        uint32_t l8_offset = (l8 + 1) - buffer;
+
+        //   mov al, [buffer]
+        //   cmp al, '\n'
+        uint8_t* l9 = AllocateBufferForInstruction(1 + 4 + 2);
+        l9[0] = 0xA0;   // mov al, moffs8
+        *(uint32_t*)(l9 + 1) = io_buffer_address;
+        l9[5] = 0x3C;   // cmp al, imm8
+        l9[6] = '\n';
+
+        //   jz [end]
+        uint8_t* l10 = AllocateBufferForInstruction(1 + 1);
+        l10[0] = 0x74;   // jz rel8
+
+        uint32_t l10_ip = ip_dst;
+        uint32_t l10_offset = (l10 + 1) - buffer;
+
+        // The rest of the line is skipped after the first non-digit character
+        AsmOr(CpuRegister::DI, CpuRegister::DI, 4);
+
+        //   jnz [loop]
+        uint8_t* l12 = AllocateBufferForInstruction(1 + 1);
+        l12[0] = 0x75;   // jnz rel8
+        l12[1] = (int8_t)(loop - ip_dst);
+
+        //   cmp al, '9'
+        //   ja [stop]
+        uint8_t* l13 = AllocateBufferForInstruction(2 + 2);
+        l13[0] = 0x3C;  // cmp al, imm8
+        l13[1] = '9';
+        l13[2] = 0x77;  // ja rel8
+
+        uint32_t l13_ip = ip_dst;
+        uint32_t l13_offset = (l13 + 3) - buffer;
+
+        //   sub al, '0'
+        //   jb [stop]
+        uint8_t* l14 = AllocateBufferForInstruction(2 + 2);
+        l14[0] = 0x2C;  // sub al, imm8
+        l14[1] = '0';
+        l14[2] = 0x72;  // jb rel8
+
+        uint32_t l14_ip = ip_dst;
+        uint32_t l14_offset = (l14 + 3) - buffer;
+
+        //   movzx eax, al
+        //   imul esi, esi, 10
+        uint8_t* l15 = AllocateBufferForInstruction(3 + 3);
+        l15[0] = 0x0F;  // movzx r32, rm8
+        l15[1] = 0xB6;
+        l15[2] = ToXrm(3, CpuRegister::AX, CpuRegister::AL);
+        l15[3] = 0x6B;  // imul r32, rm32, imm8
+        l15[4] = ToXrm(3, CpuRegister::SI, CpuRegister::SI);
+        l15[5] = 10;
+
+        AsmAdd(CpuRegister::SI, CpuRegister::AX, 4);
+
+        //   jmp [loop]
+        uint8_t* l17 = AllocateBufferForInstruction(1 + 1);
+        l17[0] = 0xEB;  // jmp rel8
+        l17[1] = (int8_t)(loop - ip_dst);
+
+    // stop:
+        *(buffer + l13_offset) = (int8_t)(ip_dst - l13_ip);
+        *(buffer + l14_offset) = (int8_t)(ip_dst - l14_ip);
+
+        AsmInc(CpuRegister::DI, 4);
+
+        //   jmp [loop]
+        uint8_t* l19 = AllocateBufferForInstruction(1 + 1);
+        l19[0] = 0xEB;  // jmp rel8
+        l19[1] = (int8_t)(loop - ip_dst);
+
+    // end:
+        *(buffer + l8_offset) = (int8_t)(ip_dst - l8_ip);
+        *(buffer + l10_offset) = (int8_t)(ip_dst - l10_ip);
+
+        AsmMov(CpuRegister::AX, CpuRegister::SI, 4);
+
+        AsmProcLeaveNoArgs(0);
+    });
+
+    EmitCommonSharedFunctions();
+
+    // There is no memory manager, so blocks are allocated from the space reserved after static variables,
+    // each block is prefixed by its size, so the last allocated block can be released
+    EmitSharedFunction("#Alloc", [&]() {
+        AsmProcEnter();
+
+        //   mov ebx, ss:[ebp + 8]
+        uint8_t* l2 = AllocateBufferForMemoryAccess(4, { 0x8B }, CpuRegister::BX, CpuMemory::Stack);
+        l2[0] = (int8_t)GetProcFrameSize();     // mov r32, rm32
+
+        AsmOr(CpuRegister::BX, CpuRegister::BX, 4);
+
+        //   jz [ret_null]
+        uint8_t* l4 = AllocateBufferForInstruction(2);
+        l4[0] = 0x74;   // jz rel8
+
+        uint32_t l4_ip = ip_dst;
+        uint32_t l4_offset = (l4 + 1) - buffer;
+
+        // Add size of the prefix
+        //   add ebx, 4
+        uint8_t* l5 = AllocateBufferForInstruction(2 + 1);
+        l5[0] = 0x83;   // add rm32, imm8
+        l5[1] = ToXrm(3, 0, CpuRegister::BX);
+        l5[2] = 4;
+
+        //   jc [ret_null]
+        //   mov eax, [heap_top]
+        uint8_t* l6 = AllocateBufferForInstruction(2 + 1 + 4);
+        l6[0] = 0x72;   // jc rel8
+        l6[2] = 0xA1;   // mov eax, moffs32
+
+        uint32_t l6_ip = ip_dst - 5;
+        uint32_t l6_offset = (l6 + 1) - buffer;
+        uint32_t l6_heap_top_offset = (l6 + 3) - buffer;
+
+        AsmMov(CpuRegister::DX, CpuRegister::AX, 4);
+        AsmAdd(CpuRegister::DX, CpuRegister::BX, 4);
+
+        //   jc [ret_null]
+        uint8_t* l9 = AllocateBufferForInstruction(2);
+        l9[0] = 0x72;   // jc rel8
+
+        uint32_t l9_ip = ip_dst;
+        uint32_t l9_offset = (l9 + 1) - buffer;
+
+        //   cmp edx, [heap_end]
+        uint8_t* l10 = AllocateBufferForInstruction(2 + 4);
+        l10[0] = 0x81;  // cmp rm32, imm32
+        l10[1] = ToXrm(3, 7, CpuRegister::DX);
+
+        // End of the heap is known after static variables are allocated
+        heap_end_offset = (l10 + 2) - buffer;
+
+        //   ja [ret_null]
+        uint8_t* l11 = AllocateBufferForInstruction(2);
+        l11[0] = 0x77;  // ja rel8
+
+        uint32_t l11_ip = ip_dst;
+        uint32_t l11_offset = (l11 + 1) - buffer;
+
+        //   mov [heap_top], edx
+        uint8_t* l12 = AllocateBufferForMemoryAccess(4, { 0x89 }, CpuRegister::DX, CpuMemory::Absolute);
+
+        uint32_t l12_heap_top_offset = l12 - buffer;
+
+        //   mov [eax], ebx
+        //   add eax, 4
+        uint8_t* l13 = AllocateBufferForInstruction(2 + 3);
+        l13[0] = 0x89;  // mov rm32, r32
+        l13[1] = ToXrm(0, CpuRegister::BX, CpuRegister::AX);
+        l13[2] = 0x83;  // add rm32, imm8
+        l13[3] = ToXrm(3, 0, CpuRegister::AX);
+        l13[4] = 4;
+
+        //   jmp [ret_ptr]
+        uint8_t* l14 = AllocateBufferForInstruction(2);
+        l14[0] = 0xEB;  // jmp rel8
+
+        uint32_t l14_ip = ip_dst;
+        uint32_t l14_offset = (l14 + 1) - buffer;
+
+    // ret_null:
+        uint32_t ret_null = ip_dst;
+        *(buffer + l4_offset) = (int8_t)(ret_null - l4_ip);
+        *(buffer + l6_offset) = (int8_t)(ret_null - l6_ip);
+        *(buffer + l9_offset) = (int8_t)(ret_null - l9_ip);
+        *(buffer + l11_offset) = (int8_t)(ret_null - l11_ip);
+
+        ZeroRegister(CpuRegister::AX, 4);
+
+    // ret_ptr:
+        uint32_t ret_ptr = ip_dst;
+        *(buffer + l14_offset) = (int8_t)(ret_ptr - l14_ip);
+
+        AsmProcLeave(4);
+
+        // Top of the heap is stored directly after the function, it's initialized in FixHeader
+        uint32_t heap_top_address = ip_dst + code_base;
+        *(uint32_t*)(buffer + l6_heap_top_offset) = heap_top_address;
+        *(uint32_t*)(buffer + l12_heap_top_offset) = heap_top_address;
+
+        heap_top_offset = buffer_offset;
+
+        uint8_t* heap_top = AllocateBufferForInstruction(4);
+        *(uint32_t*)heap_top = 0;
+    });
+
+    EmitSharedFunction("release", [&]() {
+        AsmProcEnter();
+
+        // Only the last allocated block can be released, otherwise the call is ignored
+        if (heap_top_offset) {
+            // The whole file is mapped, so offset in the file is also relative address of the variable
+            uint32_t heap_top_address = ImageBase + heap_top_offset;
+
+            //   mov esi, ss:[ebp + 8]
+            uint8_t* l2 = AllocateBufferForMemoryAccess(4, { 0x8B }, CpuRegister::SI, CpuMemory::Stack);
+            l2[0] = (int8_t)GetProcFrameSize();     // mov r32, rm32
+
+            AsmOr(CpuRegister::SI, CpuRegister::SI, 4);
+
+            //   jz [done]
+            uint8_t* l4 = AllocateBufferForInstruction(2);
+            l4[0] = 0x74;   // jz rel8
+
+            uint32_t l4_ip = ip_dst;
+            uint32_t l4_offset = (l4 + 1) - buffer;
+
+            //   sub esi, 4
+            uint8_t* l5 = AllocateBufferForInstruction(2 + 1);
+            l5[0] = 0x83;   // sub rm32, imm8
+            l5[1] = ToXrm(3, 5, CpuRegister::SI);
+            l5[2] = 4;
+
+            AsmMov(CpuRegister::AX, CpuRegister::SI, 4);
+
+            //   add eax, [esi]
+            AllocateBufferForMemoryAccess(4, { 0x03 }, CpuRegister::AX, CpuMemory::Si);    // add r32, rm32
+
+            //   cmp eax, [heap_top]
+            uint8_t* l7 = AllocateBufferForMemoryAccess(4, { 0x3B }, CpuRegister::AX, CpuMemory::Absolute);
+            StoreOffset(l7, heap_top_address);      // cmp r32, rm32
+
+            //   jnz [done]
+            uint8_t* l8 = AllocateBufferForInstruction(2);
+            l8[0] = 0x75;   // jnz rel8
+
+            uint32_t l8_ip = ip_dst;
+            uint32_t l8_offset = (l8 + 1) - buffer;
+
+            //   mov [heap_top], esi
+            uint8_t* l9 = AllocateBufferForMemoryAccess(4, { 0x89 }, CpuRegister::SI, CpuMemory::Absolute);
+            StoreOffset(l9, heap_top_address);      // mov rm32, r32
+
+        // done:
+            *(buffer + l4_offset) = (int8_t)(ip_dst - l4_ip);
+            *(buffer + l8_offset) = (int8_t)(ip_dst - l8_ip);
+        }
+
+        AsmProcLeave(4);
+    });
+
+    if (instrument_profile) {
+        EmitProfileDump();
+    }
+
+    EmitStartup();
+
+    Log::PopIndent();
+}
+
+void ElfEmitter::FixHeader(InstructionEntry* instruction_stream, uint32_t stack_size)
+{
+    Elf32Header* header = (Elf32Header*)buffer;
+    Elf32ProgramHeader* segment = (Elf32ProgramHeader*)(buffer + sizeof(Elf32Header));
+
+    Log::Write(LogType::Info, "Finalizing executable file...");
+    Log::PushIndent();
+
+    Log::Write(LogType::Verbose, "Program size: %d bytes", ip_dst);
+    Log::Write(LogType::Verbose, "Static size: %d bytes", static_size);
+
+    compiler->GetStats()->SetEmittedSize(ip_dst, static_size);
+
+    // Stack is provided by the kernel, so the requested size is not used
+    Log::Write(LogType::Verbose, "Stack is allocated by the system");
+
+    // Heap is placed directly after static variables
+    uint32_t heap_start = (HeaderSize + ip_dst + static_size + 16 - 1) & ~(16 - 1);
+
+    Log::Write(LogType::Verbose, "Heap size: %d bytes", HeapSize);
+
+    segment->filesz = buffer_offset;
+    segment->memsz = heap_start + HeapSize;
+
+    if (heap_top_offset) {
+        *(uint32_t*)(buffer + heap_top_offset) = ImageBase + heap_start;
+        *(uint32_t*)(buffer + heap_end_offset) = ImageBase + heap_start + HeapSize;
+    }
+
+    // Adjust start IP
+    uint32_t entry_ip = GetEntryIp(instruction_stream);
+
+    StoreOffset(buffer + startup_entry_offset, (int32_t)(entry_ip - startup_entry_ip));
+
+    header->entry = ImageBase + startup_offset;
+
+    Log::Write(LogType::Verbose, "Entry point: 0x%08x", code_base + entry_ip);
+
+    Log::PopIndent();
+}
+
+void ElfEmitter::EmitExit()
+{
+    //   movzx ebx, al
+    uint8_t* a = AllocateBufferWithPrefix(4, 3);
+    a[0] = 0x0F;    // movzx r32, rm8
+    a[1] = 0xB6;
+    a[2] = ToXrm(3, CpuRegister::BX, CpuRegister::AL);
+
+    EmitSyscall(SysExit);
+}
+
+void ElfEmitter::EmitProfileDump()
+{
+    ProfileMap* profile_map = compiler->GetProfileMap();
+    uint32_t counter_count = profile_map->GetCounterCount();
+
+    Log::Write(LogType::Verbose, "Program is instrumented with %d profile counters", counter_count);
+
+    BackpatchLabels({ ProfileDumpName, ip_dst }, DosBackpatchTarget::Function);
+
+    // Return code of the program is in AL register
+    //   push eax
+    uint8_t* l1 = AllocateBufferForInstruction(1);
+    l1[0] = ToOpR(0x50, CpuRegister::AX);   // push r32
+
+    // Create new file (or truncate existing one)
+    //   mov ebx, [filename]
+    uint8_t* l2 = AllocateBufferForInstruction(1 + 4);
+    l2[0] = ToOpR(0xB8, CpuRegister::BX);   // mov r32, imm32
+
+    uint32_t l2_offset = (l2 + 1) - buffer;
+
+    LoadConstantToRegister(0x241 /*O_WRONLY | O_CREAT | O_TRUNC*/, CpuRegister::CX, 4);
+    LoadConstantToRegister(0644 /*rw-r--r--*/, CpuRegister::DX, 4);
+
+    EmitSyscall(SysOpen);
+
+    // File cannot be created, counters are lost, but the program can still exit
+    AsmOr(CpuRegister::AX, CpuRegister::AX, 4);
+
+    //   js [done]
+    uint8_t* l7 = AllocateBufferForInstruction(2);
+    l7[0] = 0x78;   // js rel8
+
+    uint32_t l7_ip = ip_dst;
+    uint32_t l7_offset = (l7 + 1) - buffer;
+
+    AsmMov(CpuRegister::BX, CpuRegister::AX, 4);
+
+    //   mov ecx, [header]
+    uint8_t* l9 = AllocateBufferForInstruction(1 + 4);
+    l9[0] = ToOpR(0xB8, CpuRegister::CX);   // mov r32, imm32
+
+    uint32_t l9_offset = (l9 + 1) - buffer;
+
+    LoadConstantToRegister(sizeof(ProfileDataHeader), CpuRegister::DX, 4);
+
+    EmitSyscall(SysWrite);
+
+    //   mov ecx, [counters]
+    uint8_t* l12 = AllocateBufferForInstruction(1 + 4);
+    l12[0] = ToOpR(0xB8, CpuRegister::CX);  // mov r32, imm32
+
+    backpatch.push_back({
+        DosBackpatchType::ToDsAbs, DosBackpatchTarget::Static,
+        (uint32_t)((l12 + 1) - buffer), 0, 0, ProfileCountersName
+    });
+
+    LoadConstantToRegister(counter_count * sizeof(uint32_t), CpuRegister::DX, 4);
+
+    EmitSyscall(SysWrite);
+
+    EmitSyscall(SysClose);
+
+// done:
+    *(buffer + l7_offset) = (int8_t)(ip_dst - l7_ip);
+
+    //   pop eax
+    //   ret
+    uint8_t* l18 = AllocateBufferForInstruction(1 + 1);
+    l18[0] = ToOpR(0x58, CpuRegister::AX);  // pop r32
+    l18[1] = 0xC3;  // ret
+
+    // Header and filename are constant, so they are stored directly after the function
+    *(uint32_t*)(buffer + l9_offset) = ip_dst + code_base;
+
+    ProfileDataHeader* header = (ProfileDataHeader*)AllocateBufferForInstruction(sizeof(ProfileDataHeader));
+    memcpy(header->signature, "PRF1", sizeof(header->signature));
+    header->hash = profile_map->GetHash();
+    header->counter_count = counter_count;
+
+    *(uint32_t*)(buffer + l2_offset) = ip_dst + code_base;
+
+    const char* filename = compiler->GetProfileDataName();
+    size_t filename_length = strlen(filename);
+    uint8_t* name = AllocateBufferForInstruction(filename_length + 1);
+    memcpy(name, filename, filename_length);
+    name[filename_length] = '\0';
+}
+
+void ElfEmitter::EmitStartup()
+{
+    startup_offset = buffer_offset;
+
+    // Copy arguments to command line in Program Segment Prefix, each of them is prefixed by space
+    //   mov edi, ImageBase + 0x81
+    //   lea esi, [esp + 8]
+    uint8_t* l1 = AllocateBufferForInstruction(1 + 4 + 4);
+    l1[0] = ToOpR(0xB8, CpuRegister::DI);   // mov r32, imm32
+    *(uint32_t*)(l1 + 1) = ImageBase + 0x81;
+    l1[5] = 0x8D;   // lea r32, m
+    l1[6] = ToXrm(1, CpuRegister::SI, 4);
+    l1[7] = 0x24;   // SIB (esp)
+    l1[8] = 8;
+
+    uint32_t next_arg = ip_dst;
+
+    //   lodsd
+    //   test eax, eax
+    //   jz [done]
+    uint8_t* l2 = AllocateBufferForInstruction(1 + 2 + 2);
+    l2[0] = 0xAD;   // lodsd
+    l2[1] = 0x85;   // test rm32, r32
+    l2[2] = ToXrm(3, CpuRegister::AX, CpuRegister::AX);
+    l2[3] = 0x74;   // jz rel8
+
+    uint32_t l2_ip = ip_dst;
+    uint32_t l2_offset = (l2 + 4) - buffer;
+
+    //   mov ebx, eax
+    //   mov al, ' '
+    uint8_t* l3 = AllocateBufferForInstruction(2 + 2);
+    l3[0] = 0x8B;   // mov r32, rm32
+    l3[1] = ToXrm(3, CpuRegister::BX, CpuRegister::AX);
+    l3[2] = ToOpR(0xB0, CpuRegister::AL);   // mov r8, imm8
+    l3[3] = ' ';
+
+    uint32_t copy = ip_dst;
+
+    // Command line is truncated, if it's too long
+    //   cmp edi, ImageBase + 0xFF
+    //   jae [done]
+    uint8_t* l4 = AllocateBufferForInstruction(2 + 4 + 2);
+    l4[0] = 0x81;   // cmp rm32, imm32
+    l4[1] = ToXrm(3, 7, CpuRegister::DI);
+    *(uint32_t*)(l4 + 2) = ImageBase + 0xFF;
+    l4[6] = 0x73;   // jae rel8
+
+    uint32_t l4_ip = ip_dst;
+    uint32_t l4_offset = (l4 + 7) - buffer;
+
+    //   stosb
+    //   mov al, [ebx]
+    //   inc ebx
+    //   test al, al
+    //   jnz [copy]
+    //   jmp [next_arg]
+    uint8_t* l5 = AllocateBufferForInstruction(1 + 2 + 1 + 2 + 2 + 2);
+    l5[0] = 0xAA;   // stosb
+    l5[1] = 0x8A;   // mov r8, rm8
+    l5[2] = ToXrm(0, CpuRegister::AL, CpuRegister::BX);
+    l5[3] = ToOpR(0x40, CpuRegister::BX);   // inc r32
+    l5[4] = 0x84;   // test rm8, r8
+    l5[5] = ToXrm(3, CpuRegister::AL, CpuRegister::AL);
+    l5[6] = 0x75;   // jnz rel8
+    l5[7] = (int8_t)(copy - (ip_dst - 2));
+    l5[8] = 0xEB;   // jmp rel8
+    l5[9] = (int8_t)(next_arg - ip_dst);
+
+// done:
+    *(buffer + l2_offset) = (int8_t)(ip_dst - l2_ip);
+    *(buffer + l4_offset) = (int8_t)(ip_dst - l4_ip);
+
+    //   mov [edi], '\r'
+    //   lea eax, [edi - (ImageBase + 0x81)]
+    //   mov [ImageBase + 0x80], al
+    uint8_t* l6 = AllocateBufferForInstruction(3 + 2 + 4 + 1 + 4);
+    l6[0] = 0xC6;   // mov rm8, imm8
+    l6[1] = ToXrm(0, 0, CpuRegister::DI);
+    l6[2] = '\r';
+    l6[3] = 0x8D;   // lea r32, m
+    l6[4] = ToXrm(2, CpuRegister::AX, CpuRegister::DI);
+    *(uint32_t*)(l6 + 5) = (uint32_t)0 - (ImageBase + 0x81);
+    l6[9] = 0xA2;   // mov moffs8, al
+    *(uint32_t*)(l6 + 10) = ImageBase + 0x80;
+
+    //   jmp [entry_ip]
+    uint8_t* l7 = AllocateBufferForInstruction(1 + 4);
+    l7[0] = 0xE9;   // jmp rel32
+
+    // Entry point is known after all instructions are emitted
+    startup_entry_offset = (l7 + 1) - buffer;
+    startup_entry_ip = ip_dst;
+}
+
+void ElfEmitter::EmitSyscall(uint32_t number)
+{
+    LoadConstantToRegister(number, CpuRegister::AX, 4);
+
+    AsmInt(0x80 /*Linux System Call*/);
+}
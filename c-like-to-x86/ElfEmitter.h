@@ -0,0 +1,95 @@
+#pragma once
+
+#include "DosExeEmitter.h"
+
+#pragma pack(push, 1)
+
+struct Elf32Header {
+    uint8_t ident[16];      // 0x7F, ELF, class, data, version
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct Elf32ProgramHeader {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+};
+
+#pragma pack(pop)
+
+/// <summary>
+/// Class that emits ELF32 executable for Linux (i386),
+/// generated code is shared with DOS, but it runs in flat 32-bit segments
+/// </summary>
+class ElfEmitter : public DosExeEmitter
+{
+public:
+    ElfEmitter(Compiler* compiler);
+    virtual ~ElfEmitter();
+
+    virtual void EmitHeader();
+    virtual void EmitSharedFunctions();
+    virtual void FixHeader(InstructionEntry* instruction_stream, uint32_t stack_size);
+
+protected:
+    virtual void EmitExit();
+    virtual void EmitProfileDump();
+
+    /// <summary>
+    /// Emit entry point that prepares command line and jumps to the entry point of the program
+    /// </summary>
+    void EmitStartup();
+
+    /// <summary>
+    /// Emit system call, parameters must be already loaded in EBX, ECX and EDX registers
+    /// </summary>
+    /// <param name="number">Number of system call</param>
+    void EmitSyscall(uint32_t number);
+
+    /// <summary>
+    /// Image is loaded at this address
+    /// </summary>
+    const uint32_t ImageBase = 0x08048000;
+
+    /// <summary>
+    /// ELF headers are padded to the size of DOS Program Segment Prefix,
+    /// so command line is stored at the same place relative to the code as in DOS executable
+    /// </summary>
+    const uint32_t HeaderSize = 0x0100;
+
+    /// <summary>
+    /// Heap is reserved directly after static variables
+    /// </summary>
+    const uint32_t HeapSize = 0x100000;
+
+    // Linux system calls (i386)
+    const uint32_t SysExit = 1;
+    const uint32_t SysRead = 3;
+    const uint32_t SysWrite = 4;
+    const uint32_t SysOpen = 5;
+    const uint32_t SysClose = 6;
+
+
+    uint32_t startup_offset = 0;
+    uint32_t startup_entry_offset = 0;
+    uint32_t startup_entry_ip = 0;
+    uint32_t heap_top_offset = 0;
+    uint32_t heap_end_offset = 0;
+};
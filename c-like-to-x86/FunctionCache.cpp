@@ -0,0 +1,444 @@
+#include "FunctionCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "IncludeCache.h"
+#include "Log.h"
+
+#pragma pack(push, 1)
+
+struct FunctionCacheHeader {
+    uint8_t signature[4]; // CLTF
+    uint32_t version;
+    uint64_t key;
+    uint32_t code_size;
+    uint32_t entry;
+    uint32_t relocation_count;
+};
+
+struct FunctionCacheRecord {
+    uint8_t type;
+    uint8_t target;
+    uint32_t offset;
+    int32_t ip;
+    uint32_t name_length;
+};
+
+#pragma pack(pop)
+
+FunctionCache::FunctionCache()
+{
+}
+
+FunctionCache::~FunctionCache()
+{
+    for (auto& it : entries) {
+        delete it.second;
+    }
+}
+
+void FunctionCache::SetDirectory(const wchar_t* directory)
+{
+    if (directory) {
+        this->directory = directory;
+    } else {
+        this->directory.clear();
+    }
+}
+
+bool FunctionCache::IsEnabled()
+{
+    return !directory.empty();
+}
+
+void FunctionCache::BeginCompilation(uint8_t target, SymbolTableEntry* symbol_table, SideEffectMap* side_effects)
+{
+    this->side_effects = side_effects;
+
+    seed = 0xcbf29ce484222325ull;
+    AddValue(seed, (uint32_t)FunctionCacheVersion);
+    AddValue(seed, IncludeCache::ComputeCompilerHash());
+    AddValue(seed, target);
+
+    function_ips.clear();
+    signatures.clear();
+    statics.clear();
+    locals.clear();
+    labels.clear();
+
+    SymbolTableEntry* symbol = symbol_table;
+    while (symbol) {
+        switch (symbol->type.base) {
+            case BaseSymbolType::Function:
+            case BaseSymbolType::EntryPoint: {
+                function_ips.push_back(symbol->ip);
+                break;
+            }
+            case BaseSymbolType::Label: {
+                labels.push_back(symbol);
+                break;
+            }
+            case BaseSymbolType::FunctionPrototype:
+            case BaseSymbolType::SharedFunction: {
+                break;
+            }
+
+            default: {
+                if (symbol->parent) {
+                    locals[symbol->parent].push_back(symbol);
+                } else {
+                    statics[symbol->name] = symbol;
+                }
+                break;
+            }
+        }
+
+        symbol = symbol->next;
+    }
+
+    std::sort(function_ips.begin(), function_ips.end());
+
+    // Callers depend on calling convention, parameters and side effects of called functions
+    symbol = symbol_table;
+    while (symbol) {
+        if (symbol->type.base == BaseSymbolType::Function || symbol->type.base == BaseSymbolType::EntryPoint ||
+            symbol->type.base == BaseSymbolType::FunctionPrototype || symbol->type.base == BaseSymbolType::SharedFunction) {
+
+            uint64_t hash = seed;
+            AddValue(hash, (uint8_t)symbol->type.base);
+            AddSymbolType(hash, symbol->return_type);
+
+            std::unordered_map<std::string, std::vector<SymbolTableEntry*>>::iterator it = locals.find(symbol->name);
+            if (it != locals.end()) {
+                for (SymbolTableEntry* param : it->second) {
+                    if (param->parameter) {
+                        AddValue(hash, param->parameter);
+                        AddSymbolType(hash, param->type);
+                        AddValue(hash, param->size);
+                    }
+                }
+            }
+
+            const FunctionSideEffects* effects = side_effects->Find(symbol->name);
+            if (effects) {
+                // Sets are unordered, so only sums of hashes of their items are used
+                uint64_t reads = 0, writes = 0;
+                for (const std::string& name : effects->reads) {
+                    uint64_t item = seed;
+                    AddData(item, name.c_str(), name.size());
+                    reads += item;
+                }
+                for (const std::string& name : effects->writes) {
+                    uint64_t item = seed;
+                    AddData(item, name.c_str(), name.size());
+                    writes += item;
+                }
+
+                AddValue(hash, reads);
+                AddValue(hash, writes);
+                AddValue(hash, (uint8_t)((effects->reads_memory ? 1 : 0) | (effects->writes_memory ? 2 : 0) |
+                                         (effects->calls_shared ? 4 : 0)));
+            } else {
+                AddValue(hash, (uint8_t)0xFF);
+            }
+
+            signatures[symbol->name] = hash;
+        }
+
+        symbol = symbol->next;
+    }
+}
+
+uint64_t FunctionCache::ComputeKey(SymbolTableEntry* function, InstructionEntry* instruction, int32_t ip,
+    const std::unordered_set<uint32_t>& discontinuous_ips)
+{
+    uint64_t hash = seed;
+    AddData(hash, function->name, strlen(function->name) + 1);
+    AddValue(hash, (uint8_t)function->type.base);
+    AddSymbolType(hash, function->return_type);
+
+    // Variables are identified by their index, so renumbered temporary variables don't change the key
+    current_locals.clear();
+
+    std::unordered_map<std::string, std::vector<SymbolTableEntry*>>::iterator it = locals.find(function->name);
+    if (it != locals.end()) {
+        for (SymbolTableEntry* symbol : it->second) {
+            current_locals.emplace(symbol->name, (uint32_t)current_locals.size());
+
+            AddSymbolType(hash, symbol->type);
+            AddValue(hash, (uint8_t)symbol->exp_type);
+            AddValue(hash, symbol->size);
+            AddValue(hash, symbol->parameter);
+            AddValue(hash, (uint8_t)(symbol->ref_count != 0 ? 1 : 0));
+        }
+    }
+
+    std::vector<int32_t>::iterator next = std::upper_bound(function_ips.begin(), function_ips.end(), ip);
+    int32_t ip_end = (next != function_ips.end() ? *next : INT32_MAX);
+
+    for (SymbolTableEntry* label : labels) {
+        if (label->ip >= ip && label->ip < ip_end) {
+            AddData(hash, label->name, strlen(label->name) + 1);
+            AddValue(hash, label->ip - ip);
+        }
+    }
+
+    auto add_operand = [&](char* value, SymbolType type, ExpressionType exp_type) {
+        AddValue(hash, (uint8_t)exp_type);
+        AddSymbolType(hash, type);
+        if (exp_type == ExpressionType::Variable) {
+            AddName(hash, value);
+        } else if (value) {
+            AddData(hash, value, strlen(value) + 1);
+        }
+    };
+
+    int32_t current_ip = ip;
+    while (instruction && current_ip < ip_end) {
+        AddValue(hash, (uint8_t)instruction->type);
+        AddValue(hash, (uint8_t)(discontinuous_ips.find(current_ip) != discontinuous_ips.end() ? 1 : 0));
+
+        switch (instruction->type) {
+            case InstructionType::Assign: {
+                AddValue(hash, (uint8_t)instruction->assignment.type);
+                AddName(hash, instruction->assignment.dst_value);
+
+                InstructionOperandIndex& dst_index = instruction->assignment.dst_index;
+                add_operand(dst_index.value, dst_index.type, dst_index.exp_type);
+
+                for (InstructionOperand* op : { &instruction->assignment.op1, &instruction->assignment.op2 }) {
+                    add_operand(op->value, op->type, op->exp_type);
+                    add_operand(op->index.value, op->index.type, op->index.exp_type);
+                }
+                break;
+            }
+            case InstructionType::Goto: {
+                AddValue(hash, instruction->goto_statement.ip - ip);
+                break;
+            }
+            case InstructionType::GotoLabel: {
+                AddData(hash, instruction->goto_label_statement.label, strlen(instruction->goto_label_statement.label) + 1);
+                break;
+            }
+            case InstructionType::If: {
+                AddValue(hash, instruction->if_statement.ip - ip);
+                AddValue(hash, (uint8_t)instruction->if_statement.type);
+
+                for (InstructionOperand* op : { &instruction->if_statement.op1, &instruction->if_statement.op2 }) {
+                    add_operand(op->value, op->type, op->exp_type);
+                    add_operand(op->index.value, op->index.type, op->index.exp_type);
+                }
+                break;
+            }
+            case InstructionType::Push: {
+                SymbolTableEntry* symbol = instruction->push_statement.symbol;
+                add_operand(symbol->name, symbol->type, symbol->exp_type);
+                AddValue(hash, instruction->push_statement.imm);
+                break;
+            }
+            case InstructionType::Call: {
+                SymbolTableEntry* target = instruction->call_statement.target;
+                AddData(hash, target->name, strlen(target->name) + 1);
+
+                std::unordered_map<std::string, uint64_t>::iterator signature = signatures.find(target->name);
+                AddValue(hash, (signature != signatures.end() ? signature->second : 0));
+
+                AddName(hash, instruction->call_statement.return_symbol);
+                break;
+            }
+            case InstructionType::Return: {
+                InstructionOperand& op = instruction->return_statement.op;
+                add_operand(op.value, op.type, op.exp_type);
+                break;
+            }
+        }
+
+        instruction = instruction->next;
+        current_ip++;
+    }
+
+    // Registers are unloaded at the end of the function, if the next instruction is target of jump
+    AddValue(hash, (uint8_t)(discontinuous_ips.find(current_ip) != discontinuous_ips.end() ? 1 : 0));
+
+    return hash;
+}
+
+const FunctionCacheEntry* FunctionCache::Find(uint64_t key)
+{
+    std::unordered_map<uint64_t, FunctionCacheEntry*>::iterator it = entries.find(key);
+    if (it != entries.end()) {
+        return it->second;
+    }
+
+    FunctionCacheEntry* entry = LoadEntry(key);
+    if (entry) {
+        entries[key] = entry;
+    }
+
+    return entry;
+}
+
+void FunctionCache::Add(FunctionCacheEntry& entry)
+{
+    FunctionCacheEntry*& cached = entries[entry.key];
+    if (cached) {
+        return;
+    }
+
+    cached = new FunctionCacheEntry(std::move(entry));
+
+    SaveEntry(cached);
+}
+
+FunctionCacheEntry* FunctionCache::LoadEntry(uint64_t key)
+{
+    if (directory.empty()) {
+        return nullptr;
+    }
+
+    wchar_t filename[32];
+    swprintf_s(filename, L"\\%016llx.fnc", key);
+
+    FILE* file;
+    if (_wfopen_s(&file, (directory + filename).c_str(), L"rb")) {
+        return nullptr;
+    }
+
+    FunctionCacheHeader header;
+    if (!fread(&header, sizeof(header), 1, file) ||
+        memcmp(header.signature, "CLTF", 4) != 0 ||
+        header.version != FunctionCacheVersion ||
+        header.key != key || header.entry > header.code_size) {
+
+        fclose(file);
+        return nullptr;
+    }
+
+    FunctionCacheEntry* entry = new FunctionCacheEntry();
+    entry->key = key;
+    entry->entry = header.entry;
+    entry->code.resize(header.code_size);
+
+    bool success = (header.code_size == 0 || fread(entry->code.data(), header.code_size, 1, file) == 1);
+
+    entry->relocations.resize(success ? header.relocation_count : 0);
+    for (auto& relocation : entry->relocations) {
+        FunctionCacheRecord record;
+        if (!fread(&record, sizeof(record), 1, file) ||
+            record.offset >= header.code_size || record.name_length > 0xFFFF) {
+            success = false;
+            break;
+        }
+
+        relocation.type = record.type;
+        relocation.target = record.target;
+        relocation.offset = record.offset;
+        relocation.ip = record.ip;
+
+        relocation.name.resize(record.name_length);
+        if (record.name_length > 0 && !fread(&relocation.name[0], record.name_length, 1, file)) {
+            success = false;
+            break;
+        }
+    }
+
+    fclose(file);
+
+    if (!success) {
+        // Cache file is corrupted
+        delete entry;
+        return nullptr;
+    }
+
+    Log::Write(LogType::Verbose, "Function %016llx loaded from cache", key);
+
+    return entry;
+}
+
+void FunctionCache::SaveEntry(FunctionCacheEntry* entry)
+{
+    if (directory.empty()) {
+        return;
+    }
+
+    wchar_t filename[32];
+    swprintf_s(filename, L"\\%016llx.fnc", entry->key);
+
+    FILE* file;
+    if (_wfopen_s(&file, (directory + filename).c_str(), L"wb")) {
+        Log::Write(LogType::Warning, "Function %016llx cannot be saved to cache", entry->key);
+        return;
+    }
+
+    FunctionCacheHeader header;
+    memcpy(header.signature, "CLTF", 4);
+    header.version = FunctionCacheVersion;
+    header.key = entry->key;
+    header.code_size = (uint32_t)entry->code.size();
+    header.entry = entry->entry;
+    header.relocation_count = (uint32_t)entry->relocations.size();
+    fwrite(&header, sizeof(header), 1, file);
+
+    if (!entry->code.empty()) {
+        fwrite(entry->code.data(), 1, entry->code.size(), file);
+    }
+
+    for (auto& relocation : entry->relocations) {
+        FunctionCacheRecord record;
+        record.type = relocation.type;
+        record.target = relocation.target;
+        record.offset = relocation.offset;
+        record.ip = relocation.ip;
+        record.name_length = (uint32_t)relocation.name.size();
+        fwrite(&record, sizeof(record), 1, file);
+
+        fwrite(relocation.name.data(), 1, relocation.name.size(), file);
+    }
+
+    fclose(file);
+}
+
+void FunctionCache::AddName(uint64_t& hash, const char* name)
+{
+    if (!name) {
+        AddValue(hash, (uint8_t)0);
+        return;
+    }
+
+    std::unordered_map<std::string, uint32_t>::iterator local = current_locals.find(name);
+    if (local != current_locals.end()) {
+        AddValue(hash, (uint8_t)1);
+        AddValue(hash, local->second);
+        return;
+    }
+
+    AddValue(hash, (uint8_t)2);
+    AddData(hash, name, strlen(name) + 1);
+
+    std::unordered_map<std::string, SymbolTableEntry*>::iterator it = statics.find(name);
+    if (it != statics.end()) {
+        SymbolTableEntry* symbol = it->second;
+        AddSymbolType(hash, symbol->type);
+        AddValue(hash, (uint8_t)symbol->exp_type);
+        AddValue(hash, symbol->size);
+        AddValue(hash, (uint8_t)(side_effects->IsAddressTaken(name) ? 1 : 0));
+    }
+}
+
+void FunctionCache::AddSymbolType(uint64_t& hash, SymbolType type)
+{
+    AddValue(hash, (uint8_t)type.base);
+    AddValue(hash, type.pointer);
+}
+
+void FunctionCache::AddData(uint64_t& hash, const void* data, size_t size)
+{
+    // FNV-1a
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
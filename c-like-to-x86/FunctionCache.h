@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "InstructionEntry.h"
+#include "SymbolTableEntry.h"
+#include "SideEffectMap.h"
+
+/// <summary>
+/// Version of on-disk cache files, it must be increased when their layout is changed,
+/// changes of the emitted machine code are covered by build of the compiler in the key
+/// </summary>
+#define FunctionCacheVersion 3
+
+struct FunctionCacheRelocation {
+    uint8_t type;               // Type and target of backpatch
+    uint8_t target;
+
+    uint32_t offset;            // Offset of patched value relative to the first byte of the function
+    int32_t ip;                 // Offset of the next instruction relative to the first byte of the function
+
+    std::string name;           // Referenced symbol; or content of string
+};
+
+struct FunctionCacheEntry {
+    uint64_t key;
+
+    std::vector<uint8_t> code;
+    uint32_t entry;                                 // Offset of the entry, removed instructions of prologue can precede it
+
+    std::vector<FunctionCacheRelocation> relocations;
+};
+
+/// <summary>
+/// Cache of emitted functions, each function is keyed by hash of its abstract instructions,
+/// its variables and everything it knows about called functions and referenced static variables.
+/// Unchanged functions are copied from the cache instead of being compiled again.
+/// </summary>
+class FunctionCache
+{
+public:
+    FunctionCache();
+    ~FunctionCache();
+
+    /// <summary>
+    /// Set directory where the functions are persisted across compilations
+    /// </summary>
+    /// <param name="directory">Cache directory; or nullptr to disable the cache</param>
+    void SetDirectory(const wchar_t* directory);
+
+    /// <summary>
+    /// Check if the cache directory was specified
+    /// </summary>
+    /// <returns>True if the cache is enabled</returns>
+    bool IsEnabled();
+
+    /// <summary>
+    /// Collect information about all functions of the current compilation, cached functions are kept
+    /// </summary>
+    /// <param name="target">Target platform</param>
+    /// <param name="symbol_table">Symbol table</param>
+    /// <param name="side_effects">Side effects of all user functions</param>
+    void BeginCompilation(uint8_t target, SymbolTableEntry* symbol_table, SideEffectMap* side_effects);
+
+    /// <summary>
+    /// Compute key of the function, it changes if anything that affects the emitted code is changed
+    /// </summary>
+    /// <param name="function">Function or entry point</param>
+    /// <param name="instruction">The first instruction of the function</param>
+    /// <param name="ip">Abstract instruction pointer of the first instruction</param>
+    /// <param name="discontinuous_ips">Targets of jumps</param>
+    /// <returns>Key</returns>
+    uint64_t ComputeKey(SymbolTableEntry* function, InstructionEntry* instruction, int32_t ip,
+        const std::unordered_set<uint32_t>& discontinuous_ips);
+
+    /// <summary>
+    /// Find emitted function by its key
+    /// </summary>
+    /// <param name="key">Key of the function</param>
+    /// <returns>Cached function; or nullptr if it's not cached</returns>
+    const FunctionCacheEntry* Find(uint64_t key);
+
+    /// <summary>
+    /// Add emitted function to the cache, content of the entry is moved
+    /// </summary>
+    /// <param name="entry">Emitted function</param>
+    void Add(FunctionCacheEntry& entry);
+
+private:
+    FunctionCacheEntry* LoadEntry(uint64_t key);
+    void SaveEntry(FunctionCacheEntry* entry);
+
+    void AddName(uint64_t& hash, const char* name);
+
+    static void AddSymbolType(uint64_t& hash, SymbolType type);
+    static void AddData(uint64_t& hash, const void* data, size_t size);
+
+    template<typename T>
+    static void AddValue(uint64_t& hash, T value)
+    {
+        AddData(hash, &value, sizeof(value));
+    }
+
+    std::unordered_map<uint64_t, FunctionCacheEntry*> entries;
+
+    // Information about the current compilation
+    uint64_t seed = 0;
+    std::vector<int32_t> function_ips;                                      // Sorted
+    std::unordered_map<std::string, uint64_t> signatures;                   // Called functions
+    std::unordered_map<std::string, SymbolTableEntry*> statics;
+    std::unordered_map<std::string, std::vector<SymbolTableEntry*>> locals;
+    std::vector<SymbolTableEntry*> labels;
+    SideEffectMap* side_effects = nullptr;
+
+    std::unordered_map<std::string, uint32_t> current_locals;               // Index of variable in current function
+
+    std::wstring directory;
+};
@@ -1,5 +1,15 @@
 #include "GenericEmitter.h"
 
+void GenericEmitter::ReserveBuffer(uint32_t size)
+{
+    if (buffer_size >= size) {
+        return;
+    }
+
+    buffer_size = size;
+    buffer = (uint8_t*)realloc(buffer, buffer_size);
+}
+
 uint8_t* GenericEmitter::AllocateBuffer(uint32_t size)
 {
     if (!buffer) {
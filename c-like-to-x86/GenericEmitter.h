@@ -13,6 +13,12 @@ class GenericEmitter
 {
 
 protected:
+    /// <summary>
+    /// Pre-allocate buffer, so it doesn't have to be reallocated during emitting
+    /// </summary>
+    /// <param name="size">Expected size in bytes</param>
+    void ReserveBuffer(uint32_t size);
+
     uint8_t* AllocateBuffer(uint32_t size);
     uint8_t* AllocateBufferForInstruction(uint32_t size);
 
@@ -0,0 +1,381 @@
+#include "IncludeCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Windows-specific includes
+#include "targetver.h"
+#include <windows.h>
+
+#include "Log.h"
+#include "CompilerException.h"
+#include "SourceFile.h"
+
+#pragma pack(push, 1)
+
+struct IncludeCacheHeader {
+    uint8_t signature[4]; // CLTI
+    uint32_t version;
+    uint64_t compiler;
+    uint64_t hash;
+    uint32_t token_count;
+    uint8_t allow_unary;
+};
+
+struct IncludeCacheToken {
+    int32_t token;
+    int32_t first_line;
+    int32_t first_column;
+    int32_t last_line;
+    int32_t last_column;
+    uint8_t base;
+    uint8_t pointer;
+    uint8_t exp_type;
+    uint32_t value_length; // 0xFFFFFFFF for no value
+};
+
+#pragma pack(pop)
+
+IncludeCache::IncludeCache()
+{
+}
+
+IncludeCache::~IncludeCache()
+{
+    for (auto& it : units) {
+        ReleaseTokens(it.second);
+        delete it.second;
+    }
+
+    for (IncludeUnit* unit : detached_units) {
+        ReleaseTokens(unit);
+        delete unit;
+    }
+}
+
+void IncludeCache::SetDirectory(const wchar_t* directory)
+{
+    if (directory) {
+        this->directory = directory;
+    } else {
+        this->directory.clear();
+    }
+}
+
+bool IncludeCache::IsPersistent()
+{
+    return !directory.empty();
+}
+
+void IncludeCache::BeginCompilation()
+{
+    frames.clear();
+    included.clear();
+    included_files.clear();
+
+    for (IncludeUnit* unit : detached_units) {
+        ReleaseTokens(unit);
+        delete unit;
+    }
+    detached_units.clear();
+}
+
+IncludeAction IncludeCache::Include(const char* path, int32_t line)
+{
+    char full_path[MAX_PATH];
+    if (!GetFullPathNameA(path, MAX_PATH, full_path, nullptr)) {
+        throw CompilerException(CompilerExceptionSource::Unknown, "Cannot open include file");
+    }
+
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(full_path, GetFileExInfoStandard, &attributes)) {
+        throw CompilerException(CompilerExceptionSource::Unknown, "Cannot open include file");
+    }
+
+    uint64_t last_write = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) |
+        attributes.ftLastWriteTime.dwLowDateTime;
+
+    // Try to find the file by its path first, so it doesn't have to be read
+    uint64_t hash;
+    auto path_entry = paths.find(full_path);
+    if (path_entry != paths.end() && path_entry->second.last_write == last_write) {
+        hash = path_entry->second.hash;
+    } else {
+        SourceFile file;
+        if (!file.Open(full_path)) {
+            throw CompilerException(CompilerExceptionSource::Unknown, "Cannot open include file");
+        }
+
+        hash = ComputeHash((const uint8_t*)file.GetData(), file.GetSize());
+        paths[full_path] = { last_write, hash };
+    }
+
+    included_files.push_back({ path, hash });
+
+    // Every file is included only once per compilation, different files with the same content are not skipped,
+    // paths are not case-sensitive
+    std::string key = full_path;
+    for (char& c : key) {
+        c = (char)tolower((uint8_t)c);
+    }
+
+    if (!included.insert(key).second) {
+        Log::Write(LogType::Verbose, "Skipping already included file \"%s\"", full_path);
+        return IncludeAction::Skip;
+    }
+
+    IncludeUnit* unit;
+    auto unit_entry = units.find(hash);
+    if (unit_entry != units.end()) {
+        unit = unit_entry->second;
+    } else {
+        unit = LoadUnit(hash);
+        if (!unit) {
+            unit = new IncludeUnit();
+            unit->hash = hash;
+        }
+
+        units[hash] = unit;
+    }
+
+    if (unit->is_complete) {
+        frames.push_back({ unit, 0, line, true });
+        return IncludeAction::Replay;
+    }
+
+    for (const IncludeFrame& frame : frames) {
+        if (frame.unit == unit) {
+            // File with the same content is still lexed, its tokens cannot be shared yet
+            unit = new IncludeUnit();
+            unit->hash = hash;
+            detached_units.push_back(unit);
+            break;
+        }
+    }
+
+    // Unit is not complete (e.g. previous compilation failed), lex it again
+    ReleaseTokens(unit);
+
+    frames.push_back({ unit, 0, line, false });
+    return IncludeAction::Lex;
+}
+
+int32_t IncludeCache::EndLex(bool allow_unary)
+{
+    if (frames.empty() || frames.back().is_replay) {
+        ThrowOnUnreachableCode();
+    }
+
+    IncludeFrame& frame = frames.back();
+    frame.unit->allow_unary = allow_unary;
+    frame.unit->is_complete = true;
+
+    SaveUnit(frame.unit);
+
+    int32_t line = frame.line;
+    frames.pop_back();
+    return line;
+}
+
+IncludeFrame* IncludeCache::GetCurrentFrame()
+{
+    if (frames.empty()) {
+        return nullptr;
+    }
+
+    return &frames.back();
+}
+
+void IncludeCache::PopFrame()
+{
+    if (frames.empty() || !frames.back().is_replay) {
+        ThrowOnUnreachableCode();
+    }
+
+    frames.pop_back();
+}
+
+void IncludeCache::RecordToken(const IncludeToken& token)
+{
+    if (frames.empty() || frames.back().is_replay) {
+        // Only tokens of included files are recorded
+        return;
+    }
+
+    IncludeToken copy = token;
+    copy.value = (token.value ? _strdup(token.value) : nullptr);
+    frames.back().unit->tokens.push_back(copy);
+}
+
+const std::vector<IncludedFile>& IncludeCache::GetIncludedFiles()
+{
+    return included_files;
+}
+
+IncludeUnit* IncludeCache::LoadUnit(uint64_t hash)
+{
+    if (directory.empty()) {
+        return nullptr;
+    }
+
+    wchar_t filename[32];
+    swprintf_s(filename, L"\\%016llx.tok", hash);
+
+    FILE* file;
+    if (_wfopen_s(&file, (directory + filename).c_str(), L"rb")) {
+        return nullptr;
+    }
+
+    IncludeCacheHeader header;
+    if (!fread(&header, sizeof(header), 1, file) ||
+        memcmp(header.signature, "CLTI", 4) != 0 ||
+        header.version != IncludeCacheVersion ||
+        header.compiler != ComputeCompilerHash() ||
+        header.hash != hash) {
+
+        fclose(file);
+        return nullptr;
+    }
+
+    IncludeUnit* unit = new IncludeUnit();
+    unit->hash = hash;
+    unit->allow_unary = (header.allow_unary != 0);
+    unit->tokens.reserve(header.token_count);
+
+    for (uint32_t i = 0; i < header.token_count; i++) {
+        IncludeCacheToken entry;
+        if (!fread(&entry, sizeof(entry), 1, file)) {
+            break;
+        }
+
+        IncludeToken token;
+        token.token = entry.token;
+        token.first_line = entry.first_line;
+        token.first_column = entry.first_column;
+        token.last_line = entry.last_line;
+        token.last_column = entry.last_column;
+        token.type = { (BaseSymbolType)entry.base, entry.pointer };
+        token.exp_type = (ExpressionType)entry.exp_type;
+
+        if (entry.value_length != 0xFFFFFFFF) {
+            token.value = (char*)malloc(entry.value_length + 1);
+            if (entry.value_length > 0 && !fread(token.value, entry.value_length, 1, file)) {
+                free(token.value);
+                break;
+            }
+            token.value[entry.value_length] = '\0';
+        } else {
+            token.value = nullptr;
+        }
+
+        unit->tokens.push_back(token);
+    }
+
+    fclose(file);
+
+    if (unit->tokens.size() != header.token_count) {
+        // Cache file is corrupted
+        ReleaseTokens(unit);
+        delete unit;
+        return nullptr;
+    }
+
+    unit->is_complete = true;
+
+    Log::Write(LogType::Verbose, "Include unit %016llx loaded from cache", hash);
+
+    return unit;
+}
+
+void IncludeCache::SaveUnit(IncludeUnit* unit)
+{
+    if (directory.empty()) {
+        return;
+    }
+
+    wchar_t filename[32];
+    swprintf_s(filename, L"\\%016llx.tok", unit->hash);
+
+    FILE* file;
+    if (_wfopen_s(&file, (directory + filename).c_str(), L"wb")) {
+        Log::Write(LogType::Warning, "Include unit %016llx cannot be saved to cache", unit->hash);
+        return;
+    }
+
+    IncludeCacheHeader header;
+    memcpy(header.signature, "CLTI", 4);
+    header.version = IncludeCacheVersion;
+    header.compiler = ComputeCompilerHash();
+    header.hash = unit->hash;
+    header.token_count = (uint32_t)unit->tokens.size();
+    header.allow_unary = (unit->allow_unary ? 1 : 0);
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (auto& token : unit->tokens) {
+        IncludeCacheToken entry;
+        entry.token = token.token;
+        entry.first_line = token.first_line;
+        entry.first_column = token.first_column;
+        entry.last_line = token.last_line;
+        entry.last_column = token.last_column;
+        entry.base = (uint8_t)token.type.base;
+        entry.pointer = token.type.pointer;
+        entry.exp_type = (uint8_t)token.exp_type;
+        entry.value_length = (token.value ? (uint32_t)strlen(token.value) : 0xFFFFFFFF);
+        fwrite(&entry, sizeof(entry), 1, file);
+
+        if (token.value) {
+            fwrite(token.value, 1, entry.value_length, file);
+        }
+    }
+
+    fclose(file);
+}
+
+void IncludeCache::ReleaseTokens(IncludeUnit* unit)
+{
+    for (auto& token : unit->tokens) {
+        free(token.value);
+    }
+
+    unit->tokens.clear();
+    unit->is_complete = false;
+}
+
+uint64_t IncludeCache::ComputeHash(const uint8_t* data, size_t size)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t IncludeCache::ComputeCompilerHash()
+{
+    static uint64_t compiler_hash = 0;
+    if (compiler_hash) {
+        return compiler_hash;
+    }
+
+    struct {
+        uint64_t size;
+        uint64_t last_write;
+    } compiler_data { };
+
+    wchar_t compiler_path[MAX_PATH];
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (GetModuleFileNameW(nullptr, compiler_path, MAX_PATH) &&
+        GetFileAttributesExW(compiler_path, GetFileExInfoStandard, &attributes)) {
+
+        compiler_data.size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+        compiler_data.last_write = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) |
+            attributes.ftLastWriteTime.dwLowDateTime;
+    }
+
+    compiler_hash = ComputeHash((const uint8_t*)&compiler_data, sizeof(compiler_data));
+    return compiler_hash;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "SymbolTableEntry.h"
+
+/// <summary>
+/// Pseudo-token returned by lexer when the include stack was changed,
+/// it's never passed to the parser
+/// </summary>
+#define IncludeResumeToken -1
+
+/// <summary>
+/// Pseudo-token that holds compiler directive found in included file
+/// </summary>
+#define IncludeDirectiveToken -2
+
+/// <summary>
+/// Version of on-disk cache files, it must be increased when their format is changed,
+/// files are also bound to the build of the compiler that produced them
+/// </summary>
+#define IncludeCacheVersion 2
+
+enum struct IncludeAction {
+    Skip,       // File was already included in this compilation
+    Replay,     // Cached tokens will be replayed
+    Lex         // File must be opened and lexed, tokens will be recorded
+};
+
+struct IncludeToken {
+    int32_t token;
+
+    int32_t first_line;
+    int32_t first_column;
+    int32_t last_line;
+    int32_t last_column;
+
+    char* value;            // Identifier, constant or compiler directive
+    SymbolType type;
+    ExpressionType exp_type;
+};
+
+struct IncludeUnit {
+    uint64_t hash;
+    std::vector<IncludeToken> tokens;
+
+    bool allow_unary;       // State of the lexer after the last token
+    bool is_complete;
+};
+
+struct IncludedFile {
+    std::string path;       // Path as specified in directive, it's relative to working directory
+    uint64_t hash;
+};
+
+struct IncludeFrame {
+    IncludeUnit* unit;
+    size_t position;
+    int32_t line;           // Line in parent file
+
+    bool is_replay;
+};
+
+/// <summary>
+/// Cache of included files, each file is lexed only once and its tokens are replayed
+/// if it's included again. Units are keyed by full path and last write time,
+/// and by hash of their content. Every path is included only once per compilation.
+/// </summary>
+class IncludeCache
+{
+public:
+    IncludeCache();
+    ~IncludeCache();
+
+    /// <summary>
+    /// Set directory where the units are persisted across compilations
+    /// </summary>
+    /// <param name="directory">Cache directory; or nullptr to disable on-disk cache</param>
+    void SetDirectory(const wchar_t* directory);
+
+    /// <summary>
+    /// Check if the units are also persisted to cache directory
+    /// </summary>
+    /// <returns>True if the directory was specified</returns>
+    bool IsPersistent();
+
+    /// <summary>
+    /// Reset state of the current compilation, cached units are kept
+    /// </summary>
+    void BeginCompilation();
+
+    /// <summary>
+    /// Resolve include directive, new frame is pushed if the file should be processed
+    /// </summary>
+    /// <param name="path">Path to included file</param>
+    /// <param name="line">Current line in parent file</param>
+    /// <returns>How to process the file</returns>
+    IncludeAction Include(const char* path, int32_t line);
+
+    /// <summary>
+    /// Lexer reached the end of included file, the unit is complete now
+    /// </summary>
+    /// <param name="allow_unary">State of the lexer</param>
+    /// <returns>Line in parent file</returns>
+    int32_t EndLex(bool allow_unary);
+
+    /// <summary>
+    /// Get frame on the top of include stack
+    /// </summary>
+    /// <returns>Current frame; or nullptr if the main file is processed</returns>
+    IncludeFrame* GetCurrentFrame();
+
+    /// <summary>
+    /// Remove replayed frame from the top of include stack
+    /// </summary>
+    void PopFrame();
+
+    /// <summary>
+    /// Record token if the current file is lexed, value is copied
+    /// </summary>
+    /// <param name="token">Token</param>
+    void RecordToken(const IncludeToken& token);
+
+    /// <summary>
+    /// Get all files that were included in the current compilation, including skipped ones
+    /// </summary>
+    /// <returns>Included files</returns>
+    const std::vector<IncludedFile>& GetIncludedFiles();
+
+    /// <summary>
+    /// Compute hash of file content
+    /// </summary>
+    /// <param name="data">Content</param>
+    /// <param name="size">Size of content</param>
+    /// <returns>Hash</returns>
+    static uint64_t ComputeHash(const uint8_t* data, size_t size);
+
+    /// <summary>
+    /// Compute hash of size and last write time of the compiler executable,
+    /// any rebuild of the compiler (e.g. changed lexer or grammar) changes it
+    /// </summary>
+    /// <returns>Hash</returns>
+    static uint64_t ComputeCompilerHash();
+
+private:
+    IncludeUnit* LoadUnit(uint64_t hash);
+    void SaveUnit(IncludeUnit* unit);
+    void ReleaseTokens(IncludeUnit* unit);
+
+    struct PathEntry {
+        uint64_t last_write;
+        uint64_t hash;
+    };
+
+    std::unordered_map<std::string, PathEntry> paths;
+    std::unordered_map<uint64_t, IncludeUnit*> units;
+    std::unordered_set<std::string> included;                // Full paths of files included in the current compilation
+    std::vector<IncludeUnit*> detached_units;               // Units with the same content as a file that is still lexed
+    std::vector<IncludedFile> included_files;
+    std::vector<IncludeFrame> frames;
+
+    std::wstring directory;
+};
@@ -50,6 +50,7 @@ struct InstructionOperandIndex {
     char* value;
     SymbolType type;
     ExpressionType exp_type;
+    int64_t imm;                // Value of constant, it's resolved once after parsing
 };
 
 struct InstructionOperand {
@@ -57,11 +58,12 @@ struct InstructionOperand {
     SymbolType type;
     ExpressionType exp_type;
     InstructionOperandIndex index;
+    int64_t imm;                // Value of constant, it's resolved once after parsing
 };
 
 struct InstructionEntry {
-    char* content;
     int32_t goto_ip;
+    uint32_t line;              // Source line, where the instruction was created
 
     InstructionType type;
 
@@ -95,6 +97,7 @@ struct InstructionEntry {
         
         struct {
             SymbolTableEntry* symbol;
+            int64_t imm;
         } push_statement;
 
         struct {
@@ -114,6 +117,7 @@ struct BackpatchList {
     InstructionEntry* entry;
 
     BackpatchList* next;
+    BackpatchList* tail;        // Last item of the list, it's valid only in the first item
 };
 
 struct SwitchBackpatchList {
@@ -123,6 +127,8 @@ struct SwitchBackpatchList {
     SymbolType type;
 
     uint32_t line;
+    uint32_t column;
 
     SwitchBackpatchList* next;
+    SwitchBackpatchList* tail;  // Last item of the list, it's valid only in the first item
 };
\ No newline at end of file
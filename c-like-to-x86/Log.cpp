@@ -2,6 +2,9 @@
 
 #include <stdint.h>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // Windows-specific includes
 #include "targetver.h"
@@ -12,15 +15,39 @@
 
 namespace Log {
     static const int32_t max_lines = 3;
+    static const size_t max_pending = 64 * 1024;
+
+    LogType min_type = LogType::Verbose;
 
     static HANDLE console_handle = GetStdHandle(STD_OUTPUT_HANDLE);
-    static bool is_output_redirected;
+    static std::ostream* output_stream = &std::cout;
     static bool supports_unicode;
 
+    static LogSink DetectSink()
+    {
+        // Colors are useless if the output is redirected to file or pipe
+        DWORD mode;
+        return (GetConsoleMode(console_handle, &mode) ? LogSink::Console : LogSink::Text);
+    }
+
+    static LogSink output_sink = DetectSink();
+
+    // Buffered sinks append formatted lines to pending, it's written by the background thread
+    // if it's running, otherwise when it's full or on flush
+    static std::string pending;
+    static std::mutex pending_mutex;
+    static std::mutex output_mutex;
+    static std::condition_variable pending_changed;
+    static std::thread writer;
+    static bool stop_writer;
+
     static int8_t indent;
     static std::string last_lines[max_lines];
     static int8_t last_line_index;
 
+    static std::string* redirect_output;
+    static std::string* diagnostic_output;
+
     static bool EndsWith(std::string const &a, std::string const &b) {
         auto len = b.length();
         auto pos = a.length() - len;
@@ -109,6 +136,107 @@ namespace Log {
         SetConsoleTextAttribute(console_handle, (default_attrib & 0xFFF0) | foreground);
     }
 
+    static const char* GetTypeName(LogType type)
+    {
+        switch (type) {
+            case LogType::Verbose: return "verbose";
+            case LogType::Info: return "info";
+            case LogType::Warning: return "warning";
+            case LogType::Error: return "error";
+
+            default: return "unknown";
+        }
+    }
+
+    static void AppendJsonString(std::string& output, const std::string& value)
+    {
+        output += '"';
+        for (char c : value) {
+            switch (c) {
+                case '"': output += "\\\""; break;
+                case '\\': output += "\\\\"; break;
+                case '\n': output += "\\n"; break;
+                case '\r': output += "\\r"; break;
+                case '\t': output += "\\t"; break;
+
+                default:
+                    if ((uint8_t)c < 0x20) {
+                        output += tinyformat::format("\\u%04x", (int32_t)c);
+                    } else {
+                        output += c;
+                    }
+                    break;
+            }
+        }
+        output += '"';
+    }
+
+    static void WritePending()
+    {
+        // Output lock keeps chunks in order if both threads are writing
+        std::lock_guard<std::mutex> output_lock(output_mutex);
+
+        std::string chunk;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            chunk.swap(pending);
+        }
+
+        if (!chunk.empty()) {
+            output_stream->write(chunk.data(), chunk.size());
+        }
+    }
+
+    static void WriterThread()
+    {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(pending_mutex);
+                pending_changed.wait(lock, [] { return !pending.empty() || stop_writer; });
+                if (pending.empty()) {
+                    break;
+                }
+            }
+
+            WritePending();
+        }
+    }
+
+    static void WriteBuffered(LogType type, const std::string& line)
+    {
+        bool is_full;
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            was_empty = pending.empty();
+
+            if (output_sink == LogSink::Json) {
+                pending += "{\"type\":\"";
+                pending += GetTypeName(type);
+                pending += "\",\"indent\":";
+                pending += std::to_string(indent);
+                pending += ",\"message\":";
+                AppendJsonString(pending, line);
+                pending += "}\n";
+            } else {
+                pending.append(indent * 2, ' ');
+                pending += line;
+                pending += "\r\n";
+            }
+
+            is_full = (pending.size() >= max_pending);
+        }
+
+        if (writer.joinable()) {
+            // Thread waits only if there is nothing to write
+            if (was_empty) {
+                pending_changed.notify_one();
+            }
+        } else if (is_full) {
+            WritePending();
+        }
+    }
+
     void PushIndent()
     {
         indent++;
@@ -123,8 +251,32 @@ namespace Log {
 
     void Write(LogType type, std::string line)
     {
+        if (!IsEnabled(type)) {
+            return;
+        }
+
+        if (diagnostic_output && type == LogType::Warning) {
+            diagnostic_output->append(line);
+            diagnostic_output->append("\n");
+        }
+
+        if (redirect_output) {
+            // Redirected output is not colored
+            for (int8_t i = 0; i < indent; i++) {
+                redirect_output->append("  ");
+            }
+            redirect_output->append(line);
+            redirect_output->append("\r\n");
+            return;
+        }
+
+        if (output_sink != LogSink::Console) {
+            WriteBuffered(type, line);
+            return;
+        }
+
         if (line.empty()) {
-            std::cout << "\r\n";
+            *output_stream << "\r\n";
             return;
         }
 
@@ -155,27 +307,27 @@ namespace Log {
         SetBrightConsoleColor(type, highlight, default_attrib);
 
         for (int8_t i = 0; i < indent; i++) {
-            std::cout << "  ";
+            *output_stream << "  ";
         }
 
         // Dark beginning
         if (begin_grey_length != 0) {
             SetDarkConsoleColor(type, default_attrib);
-            std::cout << line.substr(0, begin_grey_length);
+            *output_stream << line.substr(0, begin_grey_length);
         }
 
         // Bright main part
         SetBrightConsoleColor(type, highlight, default_attrib);
-        std::cout << line.substr(begin_grey_length, line.length() - begin_grey_length - end_grey_length);
+        *output_stream << line.substr(begin_grey_length, line.length() - begin_grey_length - end_grey_length);
 
         // Dark ending
         if (end_grey_length != 0) {
             SetDarkConsoleColor(type, default_attrib);
-            std::cout << line.substr(line.length() - end_grey_length, end_grey_length);
+            *output_stream << line.substr(line.length() - end_grey_length, end_grey_length);
         }
 
         // End the current line
-        std::cout << "\r\n";
+        *output_stream << "\r\n";
 
         last_lines[last_line_index] = line;
         last_line_index = (last_line_index + 1) % max_lines;
@@ -185,21 +337,36 @@ namespace Log {
 
     void WriteSeparator()
     {
+        if (redirect_output || output_sink != LogSink::Console) {
+            return;
+        }
+
         CONSOLE_SCREEN_BUFFER_INFO info;
         GetConsoleScreenBufferInfo(console_handle, &info);
 
         SetConsoleTextAttribute(console_handle, FOREGROUND_INTENSITY);
 
         for (uint16_t i = 0; i < info.dwSize.X; i += 1) {
-            std::cout << "_";
+            *output_stream << "_";
         }
-        std::cout << "\r\n";
+        *output_stream << "\r\n";
 
         SetConsoleTextAttribute(console_handle, info.wAttributes);
     }
 
     void SetHighlight(bool highlight)
     {
+        if (redirect_output) {
+            return;
+        }
+
+        if (output_sink != LogSink::Console) {
+            // Everything must be visible before user starts typing
+            WritePending();
+            output_stream->flush();
+            return;
+        }
+
         WORD attrib;
         if (highlight) {
             attrib = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
@@ -209,4 +376,71 @@ namespace Log {
 
         SetConsoleTextAttribute(console_handle, attrib);
     }
+
+    void SetOutput(std::string* output)
+    {
+        redirect_output = output;
+        indent = 0;
+    }
+
+    void SetDiagnosticOutput(std::string* output)
+    {
+        diagnostic_output = output;
+    }
+
+    void SetErrorOutput()
+    {
+        // Pending lines are not written yet, so nothing from them can end up in standard output
+        std::lock_guard<std::mutex> output_lock(output_mutex);
+
+        output_stream = &std::cerr;
+        console_handle = GetStdHandle(STD_ERROR_HANDLE);
+    }
+
+    void SetMinType(LogType type)
+    {
+        min_type = type;
+    }
+
+    void SetSink(LogSink sink)
+    {
+        if (output_sink == sink) {
+            return;
+        }
+
+        bool async = writer.joinable();
+        Flush();
+        output_sink = sink;
+        SetAsync(async);
+    }
+
+    void SetAsync(bool async)
+    {
+        if (async) {
+            if (output_sink == LogSink::Console || writer.joinable()) {
+                return;
+            }
+
+            stop_writer = false;
+            writer = std::thread(WriterThread);
+        } else {
+            if (!writer.joinable()) {
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(pending_mutex);
+                stop_writer = true;
+            }
+            pending_changed.notify_one();
+            writer.join();
+        }
+    }
+
+    void Flush()
+    {
+        SetAsync(false);
+        WritePending();
+        output_stream->flush();
+    }
 }
\ No newline at end of file
@@ -14,7 +14,30 @@ enum struct LogType {
     Error
 };
 
+/// <summary>
+/// Messages of lower type are removed at compile time, e.g. /DLogMinType=LogType::Info
+/// </summary>
+#if !defined(LogMinType)
+#   define LogMinType LogType::Verbose
+#endif
+
+enum struct LogSink {
+    Console,    // Colored output, similar parts of consecutive lines are dimmed
+    Text,       // Buffered plain text, it's used by default if output is redirected
+    Json        // Buffered JSON object per line
+};
+
 namespace Log {
+    // Messages of lower type are skipped at runtime, use SetMinType to change it
+    extern LogType min_type;
+
+    /// <summary>
+    /// Check if messages of specified type are written, so they can be skipped before formatting
+    /// </summary>
+    inline bool IsEnabled(LogType type) {
+        return type >= LogMinType && type >= min_type;
+    }
+
     void PushIndent();
     void PopIndent();
     void Write(LogType type, std::string line);
@@ -26,10 +49,52 @@ namespace Log {
 
     template<typename... Args>
     void Write(LogType type, const char* fmt, const Args&... args) {
-        Write(type, tinyformat::format(fmt, args...));
+        if (IsEnabled(type)) {
+            Write(type, tinyformat::format(fmt, args...));
+        }
     }
 
     void WriteSeparator();
 
     void SetHighlight(bool highlight);
+
+    /// <summary>
+    /// Redirect all subsequent lines to string instead of console, indentation is reset
+    /// </summary>
+    /// <param name="output">Target string; or nullptr to write to console again</param>
+    void SetOutput(std::string* output);
+
+    /// <summary>
+    /// Copy all subsequent warnings also to string, one per line, so they can be replayed later
+    /// </summary>
+    /// <param name="output">Target string; or nullptr to stop copying</param>
+    void SetDiagnosticOutput(std::string* output);
+
+    /// <summary>
+    /// Write all subsequent and pending lines to standard error instead of standard output
+    /// </summary>
+    void SetErrorOutput();
+
+    /// <summary>
+    /// Set the lowest type of messages that are written
+    /// </summary>
+    /// <param name="type">Lowest written type; it cannot be lower than LogMinType</param>
+    void SetMinType(LogType type);
+
+    /// <summary>
+    /// Set format of standard output, pending lines are written first
+    /// </summary>
+    /// <param name="sink">Output format</param>
+    void SetSink(LogSink sink);
+
+    /// <summary>
+    /// Write buffered lines on background thread, it has no effect for console sink
+    /// </summary>
+    /// <param name="async">True to start the thread; false to stop it</param>
+    void SetAsync(bool async);
+
+    /// <summary>
+    /// Write all pending lines to standard output, it must be called before exit
+    /// </summary>
+    void Flush();
 }
\ No newline at end of file
@@ -1,8 +1,14 @@
 #include "Compiler.h"
+#include "Log.h"
 
 Compiler c;
 
 int __cdecl wmain(int argc, wchar_t* argv[], wchar_t* envp[])
 {
-    return c.OnRun(argc, argv);
+    int result = c.OnRun(argc, argv);
+
+    // Buffered lines must be written before exit
+    Log::Flush();
+
+    return result;
 }
\ No newline at end of file
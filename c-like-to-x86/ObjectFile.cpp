@@ -0,0 +1,175 @@
+#include "ObjectFile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#pragma pack(push, 1)
+
+struct ObjectFileHeader {
+    uint8_t signature[4]; // CLTO
+    uint32_t version;
+    uint8_t target;
+    uint32_t stack_size;
+    uint32_t code_size;
+    uint32_t function_count;
+    uint32_t relocation_count;
+    uint32_t static_count;
+};
+
+struct ObjectFileFunction {
+    uint32_t begin;
+    uint32_t end;
+    uint32_t entry;
+    uint8_t is_entry_point;
+};
+
+struct ObjectFileRelocation {
+    uint8_t type;
+    uint8_t target;
+    uint32_t offset;
+    int32_t ip;
+};
+
+struct ObjectFileStatic {
+    uint32_t size;
+};
+
+#pragma pack(pop)
+
+bool ObjectFile::Save(FILE* stream, const ObjectUnit& unit)
+{
+    ObjectFileHeader header;
+    memcpy(header.signature, "CLTO", 4);
+    header.version = ObjectFileVersion;
+    header.target = (uint8_t)unit.target;
+    header.stack_size = unit.stack_size;
+    header.code_size = (uint32_t)unit.code.size();
+    header.function_count = (uint32_t)unit.functions.size();
+    header.relocation_count = (uint32_t)unit.relocations.size();
+    header.static_count = (uint32_t)unit.statics.size();
+    fwrite(&header, sizeof(header), 1, stream);
+
+    if (!unit.code.empty()) {
+        fwrite(unit.code.data(), 1, unit.code.size(), stream);
+    }
+
+    // Each record is followed by name of the symbol
+    for (auto& function : unit.functions) {
+        ObjectFileFunction entry;
+        entry.begin = function.begin;
+        entry.end = function.end;
+        entry.entry = function.entry;
+        entry.is_entry_point = (function.is_entry_point ? 1 : 0);
+        fwrite(&entry, sizeof(entry), 1, stream);
+
+        WriteName(stream, function.name);
+    }
+
+    for (auto& relocation : unit.relocations) {
+        ObjectFileRelocation entry;
+        entry.type = (uint8_t)relocation.type;
+        entry.target = (uint8_t)relocation.target;
+        entry.offset = relocation.offset;
+        entry.ip = relocation.ip;
+        fwrite(&entry, sizeof(entry), 1, stream);
+
+        WriteName(stream, relocation.name);
+    }
+
+    for (auto& variable : unit.statics) {
+        ObjectFileStatic entry;
+        entry.size = variable.size;
+        fwrite(&entry, sizeof(entry), 1, stream);
+
+        WriteName(stream, variable.name);
+    }
+
+    // Buffered data are written now, so failed writes are detected here
+    return (fflush(stream) == 0 && !ferror(stream));
+}
+
+bool ObjectFile::Load(const wchar_t* filename, ObjectUnit& unit)
+{
+    FILE* file;
+    if (_wfopen_s(&file, filename, L"rb")) {
+        return false;
+    }
+
+    ObjectFileHeader header;
+    if (!fread(&header, sizeof(header), 1, file) ||
+        memcmp(header.signature, "CLTO", 4) != 0 ||
+        header.version != ObjectFileVersion) {
+
+        fclose(file);
+        return false;
+    }
+
+    unit.target = (TargetPlatform)header.target;
+    unit.stack_size = header.stack_size;
+
+    unit.code.resize(header.code_size);
+    bool success = (header.code_size == 0 || fread(unit.code.data(), header.code_size, 1, file) == 1);
+
+    unit.functions.resize(success ? header.function_count : 0);
+    for (auto& function : unit.functions) {
+        ObjectFileFunction entry;
+        if (!fread(&entry, sizeof(entry), 1, file) || !ReadName(file, function.name) ||
+            entry.begin > entry.end || entry.end > header.code_size || entry.entry < entry.begin || entry.entry > entry.end) {
+            success = false;
+            break;
+        }
+
+        function.begin = entry.begin;
+        function.end = entry.end;
+        function.entry = entry.entry;
+        function.is_entry_point = (entry.is_entry_point != 0);
+    }
+
+    unit.relocations.resize(success ? header.relocation_count : 0);
+    for (auto& relocation : unit.relocations) {
+        ObjectFileRelocation entry;
+        if (!fread(&entry, sizeof(entry), 1, file) || !ReadName(file, relocation.name) ||
+            entry.offset >= header.code_size) {
+            success = false;
+            break;
+        }
+
+        relocation.type = (DosBackpatchType)entry.type;
+        relocation.target = (DosBackpatchTarget)entry.target;
+        relocation.offset = entry.offset;
+        relocation.ip = entry.ip;
+    }
+
+    unit.statics.resize(success ? header.static_count : 0);
+    for (auto& variable : unit.statics) {
+        ObjectFileStatic entry;
+        if (!fread(&entry, sizeof(entry), 1, file) || !ReadName(file, variable.name)) {
+            success = false;
+            break;
+        }
+
+        variable.size = entry.size;
+    }
+
+    fclose(file);
+
+    return success;
+}
+
+void ObjectFile::WriteName(FILE* stream, const std::string& name)
+{
+    uint32_t length = (uint32_t)name.size();
+    fwrite(&length, sizeof(length), 1, stream);
+    fwrite(name.data(), 1, length, stream);
+}
+
+bool ObjectFile::ReadName(FILE* stream, std::string& name)
+{
+    uint32_t length;
+    if (!fread(&length, sizeof(length), 1, stream) || length > 0xFFFF) {
+        return false;
+    }
+
+    name.resize(length);
+    return (length == 0 || fread(&name[0], length, 1, stream) == 1);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "Compiler.h"
+#include "DosExeEmitter.h"
+
+/// <summary>
+/// Version of object files, it must be increased when the format or calling convention is changed
+/// </summary>
+#define ObjectFileVersion 1
+
+struct ObjectFunction {
+    std::string name;
+
+    uint32_t begin;             // Offset of the first byte in code section
+    uint32_t end;
+    uint32_t entry;             // Entry of the function, removed instructions of prologue can precede it
+
+    bool is_entry_point;
+};
+
+struct ObjectRelocation {
+    DosBackpatchType type;
+    DosBackpatchTarget target;  // Only functions, strings and static variables
+
+    uint32_t offset;            // Offset of patched value in code section
+    int32_t ip;                 // Offset of the next instruction in code section, used by relative addresses
+
+    std::string name;           // Referenced symbol; or content of string
+};
+
+struct ObjectStatic {
+    std::string name;
+    uint32_t size;
+};
+
+/// <summary>
+/// Compiled unit of the program, code is not bound to any address yet,
+/// so all references to other functions and data are described by relocations
+/// </summary>
+struct ObjectUnit {
+    TargetPlatform target;
+    uint32_t stack_size;        // Requested by directive in the unit; or zero
+
+    std::vector<uint8_t> code;
+    std::vector<ObjectFunction> functions;      // Sorted by offset
+    std::vector<ObjectRelocation> relocations;  // Sorted by offset
+    std::vector<ObjectStatic> statics;          // Static variables are private to the unit
+};
+
+/// <summary>
+/// Reads and writes object files created by separate compilation
+/// </summary>
+class ObjectFile
+{
+public:
+    /// <summary>
+    /// Write object unit to stream
+    /// </summary>
+    /// <param name="stream">Output stream</param>
+    /// <param name="unit">Object unit</param>
+    /// <returns>True if the unit was written successfully</returns>
+    static bool Save(FILE* stream, const ObjectUnit& unit);
+
+    /// <summary>
+    /// Read object unit from file
+    /// </summary>
+    /// <param name="filename">Path to file</param>
+    /// <param name="unit">Loaded object unit</param>
+    /// <returns>True if the file is valid object file</returns>
+    static bool Load(const wchar_t* filename, ObjectUnit& unit);
+
+private:
+    static void WriteName(FILE* stream, const std::string& name);
+    static bool ReadName(FILE* stream, std::string& name);
+};
@@ -0,0 +1,353 @@
+#include "OutputCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Windows-specific includes
+#include "targetver.h"
+#include <windows.h>
+
+#include "Log.h"
+#include "SourceFile.h"
+
+#pragma pack(push, 1)
+
+struct OutputCacheHeader {
+    uint8_t signature[4]; // CLTR
+    uint32_t version;
+    uint64_t key;
+    uint32_t include_count;
+    uint32_t output_size;
+    uint32_t diagnostics_size;
+};
+
+struct OutputCacheInclude {
+    uint64_t hash;
+    uint32_t path_length;
+};
+
+struct OutputCacheIndexHeader {
+    uint8_t signature[4]; // CLTX
+    uint32_t version;
+    uint64_t clock;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t entry_count;
+};
+
+#pragma pack(pop)
+
+OutputCache::OutputCache()
+{
+}
+
+OutputCache::~OutputCache()
+{
+}
+
+void OutputCache::SetDirectory(const wchar_t* directory)
+{
+    if (directory) {
+        this->directory = directory;
+    } else {
+        this->directory.clear();
+    }
+}
+
+void OutputCache::SetMaxSize(uint64_t max_size)
+{
+    this->max_size = max_size;
+}
+
+bool OutputCache::IsEnabled()
+{
+    return !directory.empty();
+}
+
+uint64_t OutputCache::ComputeKey(const char* source, uint32_t size, const std::string& options)
+{
+    struct {
+        uint32_t version;
+        uint64_t compiler_size;
+        uint64_t compiler_last_write;
+        uint64_t source_hash;
+    } key_data { };
+
+    key_data.version = OutputCacheVersion;
+
+    // Any rebuild of the compiler invalidates all entries
+    wchar_t compiler_path[MAX_PATH];
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (GetModuleFileNameW(nullptr, compiler_path, MAX_PATH) &&
+        GetFileAttributesExW(compiler_path, GetFileExInfoStandard, &attributes)) {
+
+        key_data.compiler_size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+        key_data.compiler_last_write = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) |
+            attributes.ftLastWriteTime.dwLowDateTime;
+    }
+
+    key_data.source_hash = IncludeCache::ComputeHash((const uint8_t*)source, size);
+
+    std::string data((const char*)&key_data, sizeof(key_data));
+    data += options;
+
+    return IncludeCache::ComputeHash((const uint8_t*)data.data(), data.size());
+}
+
+bool OutputCache::Find(uint64_t key, std::vector<uint8_t>& output, std::string& diagnostics)
+{
+    LoadIndex();
+
+    bool found = false;
+
+    OutputCacheIndexEntry* entry = FindIndexEntry(key);
+    SourceFile file;
+    if (entry && file.Open(GetEntryFilename(key).c_str())) {
+        const uint8_t* data = (const uint8_t*)file.GetData();
+        const uint8_t* end = data + file.GetSize();
+
+        const OutputCacheHeader* header = (const OutputCacheHeader*)data;
+        found = (end - data >= sizeof(OutputCacheHeader) &&
+                 memcmp(header->signature, "CLTR", 4) == 0 &&
+                 header->version == OutputCacheVersion &&
+                 header->key == key);
+
+        if (found) {
+            data += sizeof(OutputCacheHeader);
+
+            // Entry is valid only if all included files are unchanged
+            for (uint32_t i = 0; i < header->include_count; i++) {
+                const OutputCacheInclude* include = (const OutputCacheInclude*)data;
+                if (end - data < sizeof(OutputCacheInclude) ||
+                    end - data - sizeof(OutputCacheInclude) < include->path_length) {
+                    found = false;
+                    break;
+                }
+
+                data += sizeof(OutputCacheInclude);
+                std::string path((const char*)data, include->path_length);
+                data += include->path_length;
+
+                SourceFile included;
+                if (!included.Open(path.c_str()) ||
+                    IncludeCache::ComputeHash((const uint8_t*)included.GetData(), included.GetSize()) != include->hash) {
+                    Log::Write(LogType::Verbose, "Included file \"%s\" was changed", path.c_str());
+                    found = false;
+                    break;
+                }
+            }
+        }
+
+        if (found && (uint64_t)(end - data) == (uint64_t)header->output_size + header->diagnostics_size) {
+            output.assign(data, data + header->output_size);
+            diagnostics.assign((const char*)data + header->output_size, header->diagnostics_size);
+        } else {
+            found = false;
+        }
+    }
+
+    if (found) {
+        entry->last_used = ++clock;
+        hits++;
+    } else {
+        misses++;
+    }
+
+    SaveIndex();
+
+    return found;
+}
+
+void OutputCache::Add(uint64_t key, const std::vector<IncludedFile>& includes, const wchar_t* output_filename, const std::string& diagnostics)
+{
+    SourceFile output;
+    if (!output.Open(output_filename)) {
+        return;
+    }
+
+    FILE* file;
+    if (_wfopen_s(&file, GetEntryFilename(key).c_str(), L"wb")) {
+        Log::Write(LogType::Warning, "Output %016llx cannot be saved to cache", key);
+        return;
+    }
+
+    OutputCacheHeader header;
+    memcpy(header.signature, "CLTR", 4);
+    header.version = OutputCacheVersion;
+    header.key = key;
+    header.include_count = (uint32_t)includes.size();
+    header.output_size = output.GetSize();
+    header.diagnostics_size = (uint32_t)diagnostics.size();
+    fwrite(&header, sizeof(header), 1, file);
+
+    uint32_t size = sizeof(header);
+
+    for (const IncludedFile& included : includes) {
+        OutputCacheInclude include;
+        include.hash = included.hash;
+        include.path_length = (uint32_t)included.path.size();
+        fwrite(&include, sizeof(include), 1, file);
+        fwrite(included.path.data(), 1, included.path.size(), file);
+
+        size += sizeof(include) + include.path_length;
+    }
+
+    if (header.output_size > 0) {
+        fwrite(output.GetData(), 1, header.output_size, file);
+    }
+    fwrite(diagnostics.data(), 1, diagnostics.size(), file);
+
+    size += header.output_size + header.diagnostics_size;
+
+    bool success = !ferror(file);
+    fclose(file);
+
+    if (!success) {
+        _wremove(GetEntryFilename(key).c_str());
+        return;
+    }
+
+    LoadIndex();
+
+    RemoveIndexEntry(key);
+    index.push_back({ key, size, ++clock });
+
+    Evict();
+
+    SaveIndex();
+}
+
+void OutputCache::WriteReport()
+{
+    LoadIndex();
+
+    uint64_t size = 0;
+    for (const OutputCacheIndexEntry& entry : index) {
+        size += entry.size;
+    }
+
+    uint32_t total = hits + misses;
+
+    // Counters are written only with --stats, so --quiet or --log-level must not hide them
+    LogType min_type = Log::min_type;
+    Log::SetMinType(LogType::Info);
+
+    Log::Write(LogType::Info, "Output cache:");
+    Log::PushIndent();
+    Log::Write(LogType::Info, "Hits: %d, misses: %d (%.1f%% hit rate)", hits, misses, total ? hits * 100.0 / total : 0.0);
+    Log::Write(LogType::Info, "Entries: %d, size: %d of %d KB, evicted: %d",
+        (int32_t)index.size(), (int32_t)(size / 1024), (int32_t)(max_size / 1024), evictions);
+    Log::PopIndent();
+
+    Log::SetMinType(min_type);
+}
+
+void OutputCache::LoadIndex()
+{
+    index.clear();
+    clock = 0;
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+
+    FILE* file;
+    if (_wfopen_s(&file, (directory + L"\\index.dat").c_str(), L"rb")) {
+        return;
+    }
+
+    OutputCacheIndexHeader header;
+    if (fread(&header, sizeof(header), 1, file) &&
+        memcmp(header.signature, "CLTX", 4) == 0 &&
+        header.version == OutputCacheVersion) {
+
+        index.resize(header.entry_count);
+        if (header.entry_count > 0 && fread(index.data(), sizeof(OutputCacheIndexEntry), header.entry_count, file) != header.entry_count) {
+            // Index is corrupted, entries that are not referenced are overwritten later
+            index.clear();
+        } else {
+            clock = header.clock;
+            hits = header.hits;
+            misses = header.misses;
+            evictions = header.evictions;
+        }
+    }
+
+    fclose(file);
+}
+
+void OutputCache::SaveIndex()
+{
+    FILE* file;
+    if (_wfopen_s(&file, (directory + L"\\index.dat").c_str(), L"wb")) {
+        Log::Write(LogType::Warning, "Index of output cache cannot be saved");
+        return;
+    }
+
+    OutputCacheIndexHeader header;
+    memcpy(header.signature, "CLTX", 4);
+    header.version = OutputCacheVersion;
+    header.clock = clock;
+    header.hits = hits;
+    header.misses = misses;
+    header.evictions = evictions;
+    header.entry_count = (uint32_t)index.size();
+    fwrite(&header, sizeof(header), 1, file);
+
+    if (!index.empty()) {
+        fwrite(index.data(), sizeof(OutputCacheIndexEntry), index.size(), file);
+    }
+
+    fclose(file);
+}
+
+OutputCacheIndexEntry* OutputCache::FindIndexEntry(uint64_t key)
+{
+    for (OutputCacheIndexEntry& entry : index) {
+        if (entry.key == key) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+void OutputCache::RemoveIndexEntry(uint64_t key)
+{
+    index.erase(std::remove_if(index.begin(), index.end(), [key](const OutputCacheIndexEntry& entry) {
+        return entry.key == key;
+    }), index.end());
+}
+
+void OutputCache::Evict()
+{
+    uint64_t size = 0;
+    for (const OutputCacheIndexEntry& entry : index) {
+        size += entry.size;
+    }
+
+    // The most recent entry is always kept, even if it's larger than the cache
+    while (size > max_size && index.size() > 1) {
+        std::vector<OutputCacheIndexEntry>::iterator oldest = std::min_element(index.begin(), index.end(),
+            [](const OutputCacheIndexEntry& a, const OutputCacheIndexEntry& b) {
+                return a.last_used < b.last_used;
+            });
+
+        Log::Write(LogType::Verbose, "Output %016llx was evicted from cache", oldest->key);
+
+        _wremove(GetEntryFilename(oldest->key).c_str());
+
+        size -= oldest->size;
+        evictions++;
+        index.erase(oldest);
+    }
+}
+
+std::wstring OutputCache::GetEntryFilename(uint64_t key)
+{
+    wchar_t filename[32];
+    swprintf_s(filename, L"\\%016llx.out", key);
+
+    return directory + filename;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "IncludeCache.h"
+
+/// <summary>
+/// Version of on-disk cache files, it must be increased when their format is changed
+/// </summary>
+#define OutputCacheVersion 1
+
+/// <summary>
+/// Default upper bound of the cache size
+/// </summary>
+#define OutputCacheDefaultSize (64 * 1024 * 1024)
+
+struct OutputCacheIndexEntry {
+    uint64_t key;
+    uint32_t size;          // Size of the file in bytes
+    uint64_t last_used;     // Value of the clock when the entry was used
+};
+
+/// <summary>
+/// Cache of whole compilations, output file and diagnostics are stored under the key
+/// derived from the source code, options and build of the compiler. Each entry also holds
+/// hashes of all included files, so it's valid only if none of them was changed.
+/// Size of the cache is bounded, the least recently used entries are evicted.
+/// </summary>
+class OutputCache
+{
+public:
+    OutputCache();
+    ~OutputCache();
+
+    /// <summary>
+    /// Set directory where the outputs are stored
+    /// </summary>
+    /// <param name="directory">Cache directory; or nullptr to disable the cache</param>
+    void SetDirectory(const wchar_t* directory);
+
+    /// <summary>
+    /// Set upper bound of the cache size
+    /// </summary>
+    /// <param name="max_size">Size in bytes</param>
+    void SetMaxSize(uint64_t max_size);
+
+    /// <summary>
+    /// Check if the cache directory was specified
+    /// </summary>
+    /// <returns>True if the cache is enabled</returns>
+    bool IsEnabled();
+
+    /// <summary>
+    /// Compute key of the compilation
+    /// </summary>
+    /// <param name="source">Source code</param>
+    /// <param name="size">Size of source code</param>
+    /// <param name="options">Options that affect the output</param>
+    /// <returns>Key</returns>
+    uint64_t ComputeKey(const char* source, uint32_t size, const std::string& options);
+
+    /// <summary>
+    /// Find output of the compilation, included files are resolved relative to working directory
+    /// </summary>
+    /// <param name="key">Key of the compilation</param>
+    /// <param name="output">Content of output file</param>
+    /// <param name="diagnostics">Warnings reported by the compilation</param>
+    /// <returns>True if the output was found and all included files are unchanged</returns>
+    bool Find(uint64_t key, std::vector<uint8_t>& output, std::string& diagnostics);
+
+    /// <summary>
+    /// Add output of successful compilation to the cache, old entries are evicted if needed
+    /// </summary>
+    /// <param name="key">Key of the compilation</param>
+    /// <param name="includes">Files included by the compilation</param>
+    /// <param name="output_filename">Full path to output file</param>
+    /// <param name="diagnostics">Warnings reported by the compilation</param>
+    void Add(uint64_t key, const std::vector<IncludedFile>& includes, const wchar_t* output_filename, const std::string& diagnostics);
+
+    /// <summary>
+    /// Write hit and miss counters and size of the cache to log
+    /// </summary>
+    void WriteReport();
+
+private:
+    void LoadIndex();
+    void SaveIndex();
+
+    OutputCacheIndexEntry* FindIndexEntry(uint64_t key);
+    void RemoveIndexEntry(uint64_t key);
+
+    /// <summary>
+    /// Remove the least recently used entries until the cache fits to its size
+    /// </summary>
+    void Evict();
+
+    std::wstring GetEntryFilename(uint64_t key);
+
+    std::wstring directory;
+    uint64_t max_size = OutputCacheDefaultSize;
+
+    // Content of index file, it's shared by all compilations that use the same directory
+    std::vector<OutputCacheIndexEntry> index;
+    uint64_t clock = 0;
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t evictions = 0;
+};
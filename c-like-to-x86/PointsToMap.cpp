@@ -0,0 +1,307 @@
+#include "PointsToMap.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "Log.h"
+
+PointsToMap::PointsToMap()
+{
+}
+
+PointsToMap::~PointsToMap()
+{
+}
+
+void PointsToMap::Clear()
+{
+    functions.clear();
+    function_index.clear();
+    statics.clear();
+    side_effects = nullptr;
+}
+
+void PointsToMap::Compute(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table, SideEffectMap* side_effects)
+{
+    Clear();
+
+    this->side_effects = side_effects;
+
+    std::map<std::string, Variables> locals;
+
+    SymbolTableEntry* symbol = symbol_table;
+    while (symbol) {
+        if (symbol->type.base == BaseSymbolType::Function || symbol->type.base == BaseSymbolType::EntryPoint) {
+            FunctionPointsTo function;
+            function.name = symbol->name;
+            function.ip = symbol->ip;
+            functions.push_back(function);
+        } else if (symbol->parent) {
+            locals[symbol->parent][symbol->name] = symbol;
+        } else if (symbol->exp_type == ExpressionType::Variable && symbol->type.base != BaseSymbolType::Label &&
+                   symbol->type.base != BaseSymbolType::SharedFunction && symbol->type.base != BaseSymbolType::FunctionPrototype) {
+            statics[symbol->name] = symbol;
+        }
+
+        symbol = symbol->next;
+    }
+
+    std::sort(functions.begin(), functions.end(), [](const FunctionPointsTo& a, const FunctionPointsTo& b) {
+        return a.ip < b.ip;
+    });
+
+    for (uint32_t i = 0; i < functions.size(); i++) {
+        function_index[functions[i].name] = i;
+    }
+
+    // Instructions belong to the nearest preceding function
+    static const Variables no_locals;
+
+    size_t next = 0;
+    FunctionPointsTo* function = nullptr;
+    const Variables* function_locals = &no_locals;
+
+    InstructionEntry* current = instruction_stream;
+    int32_t ip = 0;
+    while (current) {
+        while (next < functions.size() && functions[next].ip <= ip) {
+            function = &functions[next];
+            next++;
+
+            std::map<std::string, Variables>::iterator it = locals.find(function->name);
+            function_locals = (it != locals.end() ? &it->second : &no_locals);
+
+            for (const Variables::value_type& variable : *function_locals) {
+                SymbolTableEntry* local = variable.second;
+                if (local->parameter > 0 && local->type.pointer > 0 && local->size == 0) {
+                    // Parameter points to memory of the caller, it cannot reach variables of this call
+                    function->pointers[local->name].any_static = true;
+                }
+            }
+        }
+
+        if (function) {
+            AddInstruction(*function, current, *function_locals);
+        }
+
+        current = current->next;
+        ip++;
+    }
+
+    for (FunctionPointsTo& function : functions) {
+        Propagate(function);
+
+        if (!function.address_taken.empty()) {
+            Log::Write(LogType::Verbose, "Function \"%s\" has %d variables with address taken",
+                function.name.c_str(), (int32_t)function.address_taken.size());
+        }
+
+        // Copies are needed only to compute the sets
+        function.copies.clear();
+        function.copies.shrink_to_fit();
+    }
+}
+
+const FunctionPointsTo* PointsToMap::Find(const char* function)
+{
+    std::map<std::string, uint32_t>::iterator it = function_index.find(function);
+    if (it == function_index.end()) {
+        return nullptr;
+    }
+
+    return &functions[it->second];
+}
+
+bool PointsToMap::IsAddressTaken(const FunctionPointsTo* function, SymbolTableEntry* variable)
+{
+    if (!variable->parent) {
+        return (!side_effects || side_effects->IsAddressTaken(variable->name));
+    }
+
+    return (!function || function->address_taken.find(variable->name) != function->address_taken.end());
+}
+
+bool PointsToMap::MayAlias(const FunctionPointsTo* function, SymbolTableEntry* pointer, SymbolTableEntry* variable)
+{
+    if (!IsAddressTaken(function, variable)) {
+        return false;
+    }
+
+    if (!function || !pointer->parent) {
+        // Static pointers can be changed anywhere, so they can point to anything
+        return true;
+    }
+
+    std::unordered_map<std::string, PointerTargets>::const_iterator it = function->pointers.find(pointer->name);
+    if (it == function->pointers.end()) {
+        // Pointer was never assigned
+        return false;
+    }
+
+    const PointerTargets& targets = it->second;
+    if (targets.variables.find(variable->name) != targets.variables.end()) {
+        return true;
+    }
+
+    return (variable->parent ? targets.any_local : targets.any_static);
+}
+
+void PointsToMap::AddInstruction(FunctionPointsTo& function, InstructionEntry* i, const Variables& locals)
+{
+    switch (i->type) {
+        case InstructionType::Assign: {
+            if (i->assignment.dst_index.value) {
+                // Indexed store changes only memory, stored pointers can be loaded back only as unknown
+                break;
+            }
+
+            InstructionOperand& op1 = i->assignment.op1;
+            InstructionOperand& op2 = i->assignment.op2;
+
+            SymbolTableEntry* dst = FindVariable(i->assignment.dst_value, locals);
+            if (!dst) {
+                break;
+            }
+
+            if (i->assignment.type == AssignType::None && op1.exp_type == ExpressionType::Variable && !op1.index.value) {
+                SymbolTableEntry* src = FindVariable(op1.value, locals);
+                if (src && dst->type.pointer > src->type.pointer) {
+                    // Reference to variable
+                    if (src->parent) {
+                        function.address_taken.insert(src->name);
+                    }
+                    if (dst->parent) {
+                        function.pointers[dst->name].variables.insert(src->name);
+                    }
+                    break;
+                }
+            }
+
+            if (!dst->parent || dst->type.pointer == 0 || dst->size > 0) {
+                // Only local pointers are tracked
+                break;
+            }
+
+            bool has_pointer = AddSource(function, dst->name, op1, locals);
+            if (i->assignment.type != AssignType::None && i->assignment.type != AssignType::Negation) {
+                has_pointer |= AddSource(function, dst->name, op2, locals);
+            }
+
+            if (!has_pointer && (op1.exp_type == ExpressionType::Variable || op2.exp_type == ExpressionType::Variable)) {
+                // Pointer was computed from integers, it can point anywhere
+                SetUnknown(function.pointers[dst->name]);
+            }
+            break;
+        }
+
+        case InstructionType::Call: {
+            if (!i->call_statement.return_symbol) {
+                break;
+            }
+
+            SymbolTableEntry* dst = FindVariable(i->call_statement.return_symbol, locals);
+            if (!dst || !dst->parent || dst->type.pointer == 0) {
+                break;
+            }
+
+            PointerTargets& targets = function.pointers[dst->name];
+            if (strcmp(i->call_statement.target->name, "#Alloc") != 0) {
+                // User function can return any pointer it got
+                SetUnknown(targets);
+            }
+            break;
+        }
+    }
+}
+
+bool PointsToMap::AddSource(FunctionPointsTo& function, const std::string& pointer, const InstructionOperand& operand, const Variables& locals)
+{
+    if (operand.exp_type != ExpressionType::Variable || !operand.value) {
+        return false;
+    }
+
+    SymbolTableEntry* src = FindVariable(operand.value, locals);
+    if (!src) {
+        return false;
+    }
+
+    if (operand.index.value) {
+        // Pointer loaded from memory can be anything that was stored there
+        if (src->type.pointer > 1) {
+            SetUnknown(function.pointers[pointer]);
+            return true;
+        }
+        return false;
+    }
+
+    if (src->type.pointer == 0) {
+        return false;
+    }
+
+    if (src->size > 0) {
+        // Arrays are never held in registers
+        return true;
+    }
+
+    if (src->parent) {
+        function.copies.emplace_back(pointer, src->name);
+    } else {
+        // Static pointer can be changed by any function
+        SetUnknown(function.pointers[pointer]);
+    }
+    return true;
+}
+
+SymbolTableEntry* PointsToMap::FindVariable(const char* name, const Variables& locals)
+{
+    if (!name) {
+        return nullptr;
+    }
+
+    Variables::const_iterator it = locals.find(name);
+    if (it != locals.end()) {
+        return it->second;
+    }
+
+    it = statics.find(name);
+    if (it != statics.end()) {
+        return it->second;
+    }
+
+    return nullptr;
+}
+
+void PointsToMap::Propagate(FunctionPointsTo& function)
+{
+    bool changed;
+    do {
+        changed = false;
+
+        for (const std::pair<std::string, std::string>& copy : function.copies) {
+            std::unordered_map<std::string, PointerTargets>::iterator src = function.pointers.find(copy.second);
+            if (src == function.pointers.end()) {
+                continue;
+            }
+
+            // Reference to source could be invalidated by insertion
+            PointerTargets source = src->second;
+            PointerTargets& dst = function.pointers[copy.first];
+
+            size_t size = dst.variables.size();
+            dst.variables.insert(source.variables.begin(), source.variables.end());
+
+            changed |= (dst.variables.size() != size ||
+                        (source.any_static && !dst.any_static) ||
+                        (source.any_local && !dst.any_local));
+
+            dst.any_static |= source.any_static;
+            dst.any_local |= source.any_local;
+        }
+    } while (changed);
+}
+
+void PointsToMap::SetUnknown(PointerTargets& targets)
+{
+    targets.any_static = true;
+    targets.any_local = true;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+
+#include "InstructionEntry.h"
+#include "SymbolTableEntry.h"
+#include "SideEffectMap.h"
+
+/// <summary>
+/// Variables that can be accessed through pointer, memory allocated by shared functions
+/// and arrays are never held in registers, so they are not tracked
+/// </summary>
+struct PointerTargets {
+    std::unordered_set<std::string> variables;  // Variables whose address was assigned to the pointer
+
+    bool any_static;            // Pointer can point to any static variable with address taken
+    bool any_local;             // Pointer can point to any local variable with address taken
+};
+
+/// <summary>
+/// Points-to sets of all local pointers of user function
+/// </summary>
+struct FunctionPointsTo {
+    std::string name;
+
+    int32_t ip;                                                 // Abstract instruction pointer of the first instruction
+
+    std::unordered_map<std::string, PointerTargets> pointers;   // Local pointer variables
+    std::unordered_set<std::string> address_taken;              // Local variables that can be accessed through pointer
+
+    std::vector<std::pair<std::string, std::string>> copies;    // Pointer is assigned from another pointer (destination, source)
+};
+
+/// <summary>
+/// Side table with flow-insensitive points-to sets of local pointers, so the emitter can keep
+/// variables in registers across indirect loads and stores if the pointer cannot reach them
+/// </summary>
+class PointsToMap
+{
+public:
+    typedef std::unordered_map<std::string, SymbolTableEntry*> Variables;
+
+    PointsToMap();
+    ~PointsToMap();
+
+    void Clear();
+
+    /// <summary>
+    /// Compute points-to sets of all functions of the current compilation
+    /// </summary>
+    /// <param name="instruction_stream">Instruction stream</param>
+    /// <param name="symbol_table">Symbol table</param>
+    /// <param name="side_effects">Side effects of all user functions, it knows static variables with address taken</param>
+    void Compute(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table, SideEffectMap* side_effects);
+
+    /// <summary>
+    /// Find points-to sets of user function
+    /// </summary>
+    /// <param name="function">Name of function</param>
+    /// <returns>Points-to sets; or nullptr if the function is unknown</returns>
+    const FunctionPointsTo* Find(const char* function);
+
+    /// <summary>
+    /// Check if variable can be accessed through pointer
+    /// </summary>
+    /// <param name="function">Points-to sets of current function; or nullptr if they are unknown</param>
+    /// <param name="variable">Local or static variable</param>
+    /// <returns>True if address of the variable is taken</returns>
+    bool IsAddressTaken(const FunctionPointsTo* function, SymbolTableEntry* variable);
+
+    /// <summary>
+    /// Check if load or store through pointer can access the variable
+    /// </summary>
+    /// <param name="function">Points-to sets of current function; or nullptr if they are unknown</param>
+    /// <param name="pointer">Pointer that is dereferenced</param>
+    /// <param name="variable">Local or static variable</param>
+    /// <returns>True if the pointer can point to the variable</returns>
+    bool MayAlias(const FunctionPointsTo* function, SymbolTableEntry* pointer, SymbolTableEntry* variable);
+
+private:
+    /// <summary>
+    /// Record pointer assignments of one instruction
+    /// </summary>
+    /// <param name="function">Points-to sets of function that contains the instruction</param>
+    /// <param name="i">Instruction</param>
+    /// <param name="locals">Variables declared in the function</param>
+    void AddInstruction(FunctionPointsTo& function, InstructionEntry* i, const Variables& locals);
+
+    /// <summary>
+    /// Record that the pointer can get its value from the operand
+    /// </summary>
+    /// <param name="function">Points-to sets of function that contains the instruction</param>
+    /// <param name="pointer">Local pointer variable</param>
+    /// <param name="operand">Operand of assignment</param>
+    /// <param name="locals">Variables declared in the function</param>
+    /// <returns>True if the operand is pointer</returns>
+    bool AddSource(FunctionPointsTo& function, const std::string& pointer, const InstructionOperand& operand, const Variables& locals);
+
+    /// <summary>
+    /// Find variable, local variables hide static variables with the same name
+    /// </summary>
+    /// <param name="name">Name of variable</param>
+    /// <param name="locals">Variables declared in the function</param>
+    /// <returns>Variable; or nullptr if the variable is unknown</returns>
+    SymbolTableEntry* FindVariable(const char* name, const Variables& locals);
+
+    /// <summary>
+    /// Merge points-to sets along pointer copies until nothing changes
+    /// </summary>
+    /// <param name="function">Points-to sets of function</param>
+    static void Propagate(FunctionPointsTo& function);
+
+    static void SetUnknown(PointerTargets& targets);
+
+    std::vector<FunctionPointsTo> functions;
+    std::map<std::string, uint32_t> function_index;
+
+    Variables statics;
+    SideEffectMap* side_effects = nullptr;
+};
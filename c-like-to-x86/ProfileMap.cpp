@@ -0,0 +1,440 @@
+#include "ProfileMap.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "Log.h"
+
+ProfileMap::ProfileMap()
+{
+}
+
+ProfileMap::~ProfileMap()
+{
+}
+
+void ProfileMap::Clear()
+{
+    counters.clear();
+    functions.clear();
+    function_index.clear();
+    hash = 0;
+    total_call_count = 0;
+}
+
+uint32_t ProfileMap::AddCounter(ProfileCounterType type, const char* function, const char* target, uint32_t line, int32_t ip_src, int32_t offset)
+{
+    counters.push_back({ type, function ? function : "", target ? target : "", line, ip_src, offset, 0 });
+
+    return (uint32_t)(counters.size() - 1);
+}
+
+void ProfileMap::AddFunctions(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table)
+{
+    CollectFunctions(instruction_stream, symbol_table, functions);
+}
+
+uint32_t ProfileMap::GetCounterCount()
+{
+    return (uint32_t)counters.size();
+}
+
+const std::vector<ProfileCounter>& ProfileMap::GetCounters()
+{
+    return counters;
+}
+
+void ProfileMap::SetHash(uint32_t hash)
+{
+    this->hash = hash;
+}
+
+uint32_t ProfileMap::GetHash()
+{
+    return hash;
+}
+
+bool ProfileMap::Save(const wchar_t* filename)
+{
+    FILE* file;
+    if (_wfopen_s(&file, filename, L"wb")) {
+        Log::Write(LogType::Warning, "Profile map cannot be saved to file");
+        return false;
+    }
+
+    // Names are identifiers, so they can be separated by spaces
+    fprintf(file, "PROFILE-MAP 1\n");
+    fprintf(file, "hash %08x\n", hash);
+    fprintf(file, "functions %u\n", (uint32_t)functions.size());
+
+    for (size_t i = 0; i < functions.size(); i++) {
+        const ProfileFunction& function = functions[i];
+
+        fprintf(file, "%s %d %u %08x\n", function.name.c_str(), function.ip,
+            function.instruction_count, function.hash);
+    }
+
+    fprintf(file, "counters %u\n", (uint32_t)counters.size());
+
+    for (size_t i = 0; i < counters.size(); i++) {
+        const ProfileCounter& counter = counters[i];
+
+        fprintf(file, "%u %s %s %u %d %d", (uint32_t)i, CounterTypeToString(counter.type),
+            counter.function.c_str(), counter.line, counter.ip_src, counter.offset);
+
+        if (counter.type == ProfileCounterType::Call) {
+            fprintf(file, " %s", counter.target.c_str());
+        }
+
+        fprintf(file, "\n");
+    }
+
+    bool success = !ferror(file);
+
+    fclose(file);
+
+    return success;
+}
+
+bool ProfileMap::Load(const wchar_t* map_filename, const wchar_t* data_filename)
+{
+    Clear();
+
+    FILE* file;
+    if (_wfopen_s(&file, map_filename, L"rb")) {
+        Log::Write(LogType::Warning, "Profile map cannot be opened, it must be next to the profile data");
+        return false;
+    }
+
+    char name[256];
+    char type[16];
+    uint32_t version, function_count, counter_count;
+
+    bool success = (fscanf_s(file, "PROFILE-MAP %u hash %x functions %u", &version, &hash, &function_count) == 3 && version == 1);
+
+    for (uint32_t i = 0; success && i < function_count; i++) {
+        ProfileFunction function { };
+        if (fscanf_s(file, "%255s %d %u %x", name, (uint32_t)sizeof(name), &function.ip,
+                &function.instruction_count, &function.hash) != 4) {
+            success = false;
+            break;
+        }
+
+        function.name = name;
+
+        function_index[function.name] = (uint32_t)functions.size();
+        functions.push_back(function);
+    }
+
+    success = success && (fscanf_s(file, " counters %u", &counter_count) == 1);
+
+    for (uint32_t i = 0; success && i < counter_count; i++) {
+        ProfileCounter counter { };
+        uint32_t index;
+        if (fscanf_s(file, "%u %15s %255s %u %d %d", &index, type, (uint32_t)sizeof(type), name, (uint32_t)sizeof(name),
+                &counter.line, &counter.ip_src, &counter.offset) != 6 || index != i) {
+            success = false;
+            break;
+        }
+
+        counter.function = name;
+
+        if (strcmp(type, "call") == 0) {
+            if (fscanf_s(file, "%255s", name, (uint32_t)sizeof(name)) != 1) {
+                success = false;
+                break;
+            }
+
+            counter.type = ProfileCounterType::Call;
+            counter.target = name;
+        } else {
+            counter.type = ProfileCounterType::Block;
+        }
+
+        counters.push_back(counter);
+    }
+
+    fclose(file);
+
+    if (!success) {
+        Log::Write(LogType::Warning, "Profile map is corrupted");
+        Clear();
+        return false;
+    }
+
+    // Read counters recorded by instrumented program
+    if (_wfopen_s(&file, data_filename, L"rb")) {
+        Log::Write(LogType::Warning, "Profile data cannot be opened");
+        Clear();
+        return false;
+    }
+
+    ProfileDataHeader header;
+    success = (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.signature, "PRF1", 4) == 0);
+    if (success && (header.hash != hash || header.counter_count != counters.size())) {
+        Log::Write(LogType::Warning, "Profile data were recorded by different program than the profile map describes");
+        success = false;
+    }
+
+    for (uint32_t i = 0; success && i < counters.size(); i++) {
+        success = (fread(&counters[i].count, sizeof(uint32_t), 1, file) == 1);
+    }
+
+    fclose(file);
+
+    if (!success) {
+        Log::Write(LogType::Warning, "Profile data are corrupted or stale");
+        Clear();
+        return false;
+    }
+
+    // Counters are indexed by instruction pointer relative to the function,
+    // so changes in other functions don't affect them
+    for (uint32_t i = 0; i < counters.size(); i++) {
+        const ProfileCounter& counter = counters[i];
+
+        std::map<std::string, uint32_t>::iterator it = function_index.find(counter.function);
+        if (it == function_index.end()) {
+            continue;
+        }
+
+        ProfileFunction& function = functions[it->second];
+        if (counter.type == ProfileCounterType::Call) {
+            function.calls[counter.ip_src - function.ip] = i;
+            total_call_count += counter.count;
+        } else {
+            function.blocks[counter.ip_src - function.ip] = i;
+        }
+    }
+
+    return true;
+}
+
+uint32_t ProfileMap::Validate(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table)
+{
+    std::vector<ProfileFunction> current_functions;
+    CollectFunctions(instruction_stream, symbol_table, current_functions);
+
+    uint32_t valid_count = 0;
+
+    for (size_t i = 0; i < current_functions.size(); i++) {
+        const ProfileFunction& current = current_functions[i];
+
+        std::map<std::string, uint32_t>::iterator it = function_index.find(current.name);
+        if (it == function_index.end()) {
+            // Function was added after the profile was recorded
+            continue;
+        }
+
+        ProfileFunction& function = functions[it->second];
+        if (function.hash != current.hash || function.instruction_count != current.instruction_count) {
+            Log::Write(LogType::Warning, "Profile of function \"%s\" is stale, it will be ignored", current.name.c_str());
+            continue;
+        }
+
+        function.is_valid = true;
+        function.current_ip = current.ip;
+        valid_count++;
+    }
+
+    return valid_count;
+}
+
+const ProfileCounter* ProfileMap::FindBlock(const char* function, int32_t ip_src)
+{
+    ProfileFunction* f = FindValidFunction(function);
+    if (!f) {
+        return nullptr;
+    }
+
+    std::map<int32_t, uint32_t>::iterator it = f->blocks.find(ip_src - f->current_ip);
+    if (it == f->blocks.end()) {
+        return nullptr;
+    }
+
+    return &counters[it->second];
+}
+
+const ProfileCounter* ProfileMap::FindCall(const char* function, int32_t ip_src)
+{
+    ProfileFunction* f = FindValidFunction(function);
+    if (!f) {
+        return nullptr;
+    }
+
+    std::map<int32_t, uint32_t>::iterator it = f->calls.find(ip_src - f->current_ip);
+    if (it == f->calls.end()) {
+        return nullptr;
+    }
+
+    return &counters[it->second];
+}
+
+bool ProfileMap::IsColdFunction(const char* function)
+{
+    ProfileFunction* f = FindValidFunction(function);
+    if (!f) {
+        return false;
+    }
+
+    // The first block of function is counted on every entry
+    std::map<int32_t, uint32_t>::iterator it = f->blocks.find(0);
+
+    return (it != f->blocks.end() && counters[it->second].count == 0);
+}
+
+uint32_t ProfileMap::GetTotalCallCount()
+{
+    return total_call_count;
+}
+
+uint32_t ProfileMap::ComputeHash(InstructionEntry* instruction_stream)
+{
+    // FNV-1a of all instructions
+    uint32_t hash = 2166136261u;
+
+    InstructionEntry* current = instruction_stream;
+    while (current) {
+        HashInstruction(hash, current);
+
+        current = current->next;
+    }
+
+    return hash;
+}
+
+void ProfileMap::HashInstruction(uint32_t& hash, InstructionEntry* i)
+{
+    hash ^= (uint32_t)i->type;
+    hash *= 16777619u;
+
+    switch (i->type) {
+        case InstructionType::Assign: {
+            hash ^= (uint32_t)i->assignment.type;
+            hash *= 16777619u;
+
+            HashString(hash, i->assignment.dst_value);
+            HashString(hash, i->assignment.dst_index.value);
+            HashString(hash, i->assignment.op1.value);
+            HashString(hash, i->assignment.op1.index.value);
+            HashString(hash, i->assignment.op2.value);
+            HashString(hash, i->assignment.op2.index.value);
+            break;
+        }
+        case InstructionType::If: {
+            hash ^= (uint32_t)i->if_statement.type;
+            hash *= 16777619u;
+
+            HashString(hash, i->if_statement.op1.value);
+            HashString(hash, i->if_statement.op2.value);
+            break;
+        }
+        case InstructionType::GotoLabel: {
+            HashString(hash, i->goto_label_statement.label);
+            break;
+        }
+        case InstructionType::Push: {
+            HashString(hash, i->push_statement.symbol->name);
+            break;
+        }
+        case InstructionType::Call: {
+            HashString(hash, i->call_statement.target->name);
+            HashString(hash, i->call_statement.return_symbol);
+            break;
+        }
+        case InstructionType::Return: {
+            HashString(hash, i->return_statement.op.value);
+            break;
+        }
+    }
+}
+
+void ProfileMap::HashString(uint32_t& hash, const char* value)
+{
+    if (value) {
+        for (const char* ptr = value; *ptr; ptr++) {
+            hash ^= (uint8_t)*ptr;
+            hash *= 16777619u;
+        }
+    }
+
+    // Hash also the terminator, so adjacent operands are separated
+    hash *= 16777619u;
+}
+
+void ProfileMap::CollectFunctions(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table, std::vector<ProfileFunction>& functions)
+{
+    size_t first = functions.size();
+
+    SymbolTableEntry* symbol = symbol_table;
+    while (symbol) {
+        if (symbol->type.base == BaseSymbolType::Function || symbol->type.base == BaseSymbolType::EntryPoint) {
+            ProfileFunction function { };
+            function.name = symbol->name;
+            function.ip = symbol->ip;
+            function.hash = 2166136261u;
+            functions.push_back(function);
+        }
+
+        symbol = symbol->next;
+    }
+
+    std::sort(functions.begin() + first, functions.end(), [](const ProfileFunction& a, const ProfileFunction& b) {
+        return a.ip < b.ip;
+    });
+
+    // Instructions belong to the nearest preceding function
+    size_t next = first;
+    ProfileFunction* function = nullptr;
+
+    InstructionEntry* current = instruction_stream;
+    int32_t ip = 0;
+    while (current) {
+        while (next < functions.size() && functions[next].ip <= ip) {
+            function = &functions[next];
+            next++;
+        }
+
+        if (function) {
+            uint32_t& hash = function->hash;
+
+            HashInstruction(hash, current);
+
+            int32_t target = 0;
+            if (current->type == InstructionType::Goto) {
+                target = current->goto_statement.ip - function->ip;
+            } else if (current->type == InstructionType::If) {
+                target = current->if_statement.ip - function->ip;
+            }
+
+            hash ^= (uint32_t)target;
+            hash *= 16777619u;
+
+            function->instruction_count++;
+        }
+
+        current = current->next;
+        ip++;
+    }
+}
+
+ProfileFunction* ProfileMap::FindValidFunction(const char* function)
+{
+    std::map<std::string, uint32_t>::iterator it = function_index.find(function);
+    if (it == function_index.end() || !functions[it->second].is_valid) {
+        return nullptr;
+    }
+
+    return &functions[it->second];
+}
+
+const char* ProfileMap::CounterTypeToString(ProfileCounterType type)
+{
+    switch (type) {
+        case ProfileCounterType::Block: return "block";
+        case ProfileCounterType::Call: return "call";
+
+        default: return "-";
+    }
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "InstructionEntry.h"
+#include "SymbolTableEntry.h"
+
+enum struct ProfileCounterType : uint32_t {
+    Block,      // Entry of basic block
+    Call        // Call edge
+};
+
+struct ProfileCounter {
+    ProfileCounterType type;
+
+    std::string function;       // Function that contains the counter
+    std::string target;         // Called function, only for call edges
+
+    uint32_t line;              // Source line
+    int32_t ip_src;             // Abstract instruction pointer
+    int32_t offset;             // Offset of the counter from start of the function in instrumented program
+
+    uint32_t count;             // Number of executions, only if the profile was loaded
+};
+
+struct ProfileFunction {
+    std::string name;
+
+    int32_t ip;                 // Abstract instruction pointer of the first instruction
+    uint32_t instruction_count;
+    uint32_t hash;              // Hash of instructions of the function
+
+    bool is_valid;              // Profile matches the current compilation
+    int32_t current_ip;         // Abstract instruction pointer in the current compilation
+
+    std::map<int32_t, uint32_t> blocks; // Relative instruction pointer to counter index
+    std::map<int32_t, uint32_t> calls;  // Relative instruction pointer to counter index
+};
+
+#pragma pack(push, 1)
+
+/// <summary>
+/// Header of file written by instrumented program at exit, it's followed by 32-bit counters
+/// </summary>
+struct ProfileDataHeader {
+    uint8_t signature[4];       // PRF1
+    uint32_t hash;              // Hash of instruction stream
+    uint32_t counter_count;
+};
+
+#pragma pack(pop)
+
+/// <summary>
+/// Side table that maps counters of instrumented program back to functions and source lines,
+/// the index of counter in the table is the same as the index in the counter table of the program
+/// </summary>
+class ProfileMap
+{
+public:
+    ProfileMap();
+    ~ProfileMap();
+
+    void Clear();
+
+    /// <summary>
+    /// Add new counter to the table
+    /// </summary>
+    /// <param name="type">Type of counter</param>
+    /// <param name="function">Function that contains the counter</param>
+    /// <param name="target">Called function, only for call edges</param>
+    /// <param name="line">Source line</param>
+    /// <param name="ip_src">Abstract instruction pointer</param>
+    /// <param name="offset">Offset of the counter from start of the function</param>
+    /// <returns>Index of the counter</returns>
+    uint32_t AddCounter(ProfileCounterType type, const char* function, const char* target, uint32_t line, int32_t ip_src, int32_t offset);
+
+    /// <summary>
+    /// Add all functions of the current compilation with their hashes to the table
+    /// </summary>
+    /// <param name="instruction_stream">Instruction stream</param>
+    /// <param name="symbol_table">Symbol table</param>
+    void AddFunctions(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table);
+
+    uint32_t GetCounterCount();
+    const std::vector<ProfileCounter>& GetCounters();
+
+    void SetHash(uint32_t hash);
+    uint32_t GetHash();
+
+    /// <summary>
+    /// Write the table to text file
+    /// </summary>
+    /// <param name="filename">Path to file</param>
+    /// <returns>True if the file was written successfully</returns>
+    bool Save(const wchar_t* filename);
+
+    /// <summary>
+    /// Read the table and counters recorded by instrumented program
+    /// </summary>
+    /// <param name="map_filename">Path to file with the table</param>
+    /// <param name="data_filename">Path to file with counters</param>
+    /// <returns>True if both files were loaded and they belong together</returns>
+    bool Load(const wchar_t* map_filename, const wchar_t* data_filename);
+
+    /// <summary>
+    /// Compare loaded profile with the current compilation, profiles of changed functions are ignored
+    /// </summary>
+    /// <param name="instruction_stream">Instruction stream</param>
+    /// <param name="symbol_table">Symbol table</param>
+    /// <returns>Number of functions with valid profile</returns>
+    uint32_t Validate(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table);
+
+    /// <summary>
+    /// Find counter of basic block that starts at specified instruction
+    /// </summary>
+    /// <param name="function">Function that contains the block</param>
+    /// <param name="ip_src">Abstract instruction pointer in the current compilation</param>
+    /// <returns>Counter; or nullptr if the block has no valid profile</returns>
+    const ProfileCounter* FindBlock(const char* function, int32_t ip_src);
+
+    /// <summary>
+    /// Find counter of call edge at specified instruction
+    /// </summary>
+    /// <param name="function">Function that contains the call</param>
+    /// <param name="ip_src">Abstract instruction pointer in the current compilation</param>
+    /// <returns>Counter; or nullptr if the call has no valid profile</returns>
+    const ProfileCounter* FindCall(const char* function, int32_t ip_src);
+
+    /// <summary>
+    /// Check if the function has valid profile and it was never executed
+    /// </summary>
+    /// <param name="function">Name of function</param>
+    /// <returns>True if the function is cold</returns>
+    bool IsColdFunction(const char* function);
+
+    uint32_t GetTotalCallCount();
+
+    /// <summary>
+    /// Compute hash of instruction stream, so stale profiles can be detected
+    /// </summary>
+    /// <param name="instruction_stream">Instruction stream</param>
+    /// <returns>Hash</returns>
+    static uint32_t ComputeHash(InstructionEntry* instruction_stream);
+
+private:
+    static const char* CounterTypeToString(ProfileCounterType type);
+
+    /// <summary>
+    /// Add operation and operands of instruction to hash, jump targets are not included
+    /// </summary>
+    /// <param name="hash">Hash to update</param>
+    /// <param name="i">Instruction</param>
+    static void HashInstruction(uint32_t& hash, InstructionEntry* i);
+
+    static void HashString(uint32_t& hash, const char* value);
+
+    /// <summary>
+    /// Find all functions in instruction stream and compute hash of their instructions,
+    /// jump targets are hashed relative to the function, so unrelated changes don't affect it
+    /// </summary>
+    /// <param name="instruction_stream">Instruction stream</param>
+    /// <param name="symbol_table">Symbol table</param>
+    /// <param name="functions">Found functions</param>
+    static void CollectFunctions(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table, std::vector<ProfileFunction>& functions);
+
+    ProfileFunction* FindValidFunction(const char* function);
+
+    std::vector<ProfileCounter> counters;
+    std::vector<ProfileFunction> functions;
+    std::map<std::string, uint32_t> function_index;
+    uint32_t hash = 0;
+    uint32_t total_call_count = 0;
+};
@@ -0,0 +1,295 @@
+#include "SideEffectMap.h"
+
+#include <string.h>
+#include <algorithm>
+
+SideEffectMap::SideEffectMap()
+{
+}
+
+SideEffectMap::~SideEffectMap()
+{
+}
+
+void SideEffectMap::Clear()
+{
+    functions.clear();
+    function_index.clear();
+    statics.clear();
+    address_taken.clear();
+}
+
+void SideEffectMap::Compute(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table)
+{
+    Clear();
+
+    std::map<std::string, VariableTypes> locals;
+
+    SymbolTableEntry* symbol = symbol_table;
+    while (symbol) {
+        if (symbol->type.base == BaseSymbolType::Function || symbol->type.base == BaseSymbolType::EntryPoint) {
+            FunctionSideEffects function { };
+            function.name = symbol->name;
+            function.ip = symbol->ip;
+            functions.push_back(function);
+        } else if (symbol->parent) {
+            locals[symbol->parent][symbol->name] = symbol->type;
+        } else if (symbol->exp_type == ExpressionType::Variable && symbol->type.base != BaseSymbolType::Label &&
+                   symbol->type.base != BaseSymbolType::SharedFunction && symbol->type.base != BaseSymbolType::FunctionPrototype) {
+            statics[symbol->name] = symbol->type;
+        }
+
+        symbol = symbol->next;
+    }
+
+    std::sort(functions.begin(), functions.end(), [](const FunctionSideEffects& a, const FunctionSideEffects& b) {
+        return a.ip < b.ip;
+    });
+
+    for (uint32_t i = 0; i < functions.size(); i++) {
+        function_index[functions[i].name] = i;
+    }
+
+    // Instructions belong to the nearest preceding function
+    static const VariableTypes no_locals;
+
+    size_t next = 0;
+    FunctionSideEffects* function = nullptr;
+    const VariableTypes* function_locals = &no_locals;
+
+    InstructionEntry* current = instruction_stream;
+    int32_t ip = 0;
+    while (current) {
+        while (next < functions.size() && functions[next].ip <= ip) {
+            function = &functions[next];
+            next++;
+
+            std::map<std::string, VariableTypes>::iterator it = locals.find(function->name);
+            function_locals = (it != locals.end() ? &it->second : &no_locals);
+        }
+
+        if (function) {
+            AddInstruction(*function, current, *function_locals);
+        }
+
+        current = current->next;
+        ip++;
+    }
+
+    Propagate();
+}
+
+const FunctionSideEffects* SideEffectMap::Find(const char* function)
+{
+    std::map<std::string, uint32_t>::iterator it = function_index.find(function);
+    if (it == function_index.end()) {
+        return nullptr;
+    }
+
+    return &functions[it->second];
+}
+
+bool SideEffectMap::CanRead(const FunctionSideEffects* effects, const char* name)
+{
+    if (!effects) {
+        return true;
+    }
+
+    if (effects->reads.find(name) != effects->reads.end()) {
+        return true;
+    }
+
+    return (effects->reads_memory && address_taken.find(name) != address_taken.end());
+}
+
+bool SideEffectMap::CanWrite(const FunctionSideEffects* effects, const char* name)
+{
+    if (!effects) {
+        return true;
+    }
+
+    if (effects->writes.find(name) != effects->writes.end()) {
+        return true;
+    }
+
+    return (effects->writes_memory && address_taken.find(name) != address_taken.end());
+}
+
+bool SideEffectMap::IsAddressTaken(const char* name)
+{
+    return (address_taken.find(name) != address_taken.end());
+}
+
+void SideEffectMap::AddInstruction(FunctionSideEffects& effects, InstructionEntry* i, const VariableTypes& locals)
+{
+    switch (i->type) {
+        case InstructionType::Assign: {
+            InstructionOperand& op1 = i->assignment.op1;
+            InstructionOperand& op2 = i->assignment.op2;
+
+            AddRead(effects, op1.value, op1.exp_type, locals);
+            AddRead(effects, op1.index.value, op1.index.exp_type, locals);
+            if (op1.exp_type == ExpressionType::Variable && op1.index.value) {
+                effects.reads_memory = true;
+            }
+
+            if (i->assignment.type != AssignType::None && i->assignment.type != AssignType::Negation) {
+                AddRead(effects, op2.value, op2.exp_type, locals);
+                AddRead(effects, op2.index.value, op2.index.exp_type, locals);
+                if (op2.exp_type == ExpressionType::Variable && op2.index.value) {
+                    effects.reads_memory = true;
+                }
+            }
+
+            if (i->assignment.dst_index.value) {
+                // Indexed store always goes to memory, base variable holds only the pointer
+                AddRead(effects, i->assignment.dst_value, ExpressionType::Variable, locals);
+                AddRead(effects, i->assignment.dst_index.value, i->assignment.dst_index.exp_type, locals);
+                effects.writes_memory = true;
+            } else {
+                AddWrite(effects, i->assignment.dst_value, locals);
+
+                if (i->assignment.type == AssignType::None && op1.exp_type == ExpressionType::Variable && !op1.index.value &&
+                    locals.find(op1.value) == locals.end()) {
+
+                    VariableTypes::const_iterator op1_type = statics.find(op1.value);
+                    const SymbolType* dst_type = FindType(i->assignment.dst_value, locals);
+
+                    if (op1_type != statics.end() && dst_type && dst_type->pointer > op1_type->second.pointer) {
+                        // Reference to static variable, it can be changed through the pointer from now on
+                        address_taken.insert(op1.value);
+                    }
+                }
+            }
+            break;
+        }
+
+        case InstructionType::If: {
+            InstructionOperand& op1 = i->if_statement.op1;
+            InstructionOperand& op2 = i->if_statement.op2;
+
+            AddRead(effects, op1.value, op1.exp_type, locals);
+            AddRead(effects, op2.value, op2.exp_type, locals);
+
+            if (op1.type.base == BaseSymbolType::String && op1.type.pointer == 0) {
+                // Strings are compared in memory by shared function
+                effects.reads_memory = true;
+                effects.calls_shared = true;
+            }
+            break;
+        }
+
+        case InstructionType::Push: {
+            SymbolTableEntry* symbol = i->push_statement.symbol;
+            AddRead(effects, symbol->name, symbol->exp_type, locals);
+            break;
+        }
+
+        case InstructionType::Call: {
+            SymbolTableEntry* target = i->call_statement.target;
+            if (target->type.base == BaseSymbolType::SharedFunction) {
+                // Shared functions can access memory through parameters
+                effects.reads_memory = true;
+                effects.writes_memory = true;
+                effects.calls_shared = true;
+            } else {
+                effects.calls.insert(target->name);
+            }
+
+            if (i->call_statement.return_symbol) {
+                AddWrite(effects, i->call_statement.return_symbol, locals);
+            }
+            break;
+        }
+
+        case InstructionType::Return: {
+            InstructionOperand& op = i->return_statement.op;
+            AddRead(effects, op.value, op.exp_type, locals);
+            break;
+        }
+    }
+}
+
+const SymbolType* SideEffectMap::FindType(const char* name, const VariableTypes& locals)
+{
+    VariableTypes::const_iterator it = locals.find(name);
+    if (it != locals.end()) {
+        return &it->second;
+    }
+
+    it = statics.find(name);
+    if (it != statics.end()) {
+        return &it->second;
+    }
+
+    return nullptr;
+}
+
+void SideEffectMap::AddRead(FunctionSideEffects& effects, const char* name, ExpressionType exp_type, const VariableTypes& locals)
+{
+    if (!name || exp_type != ExpressionType::Variable) {
+        return;
+    }
+
+    if (statics.find(name) != statics.end() && locals.find(name) == locals.end()) {
+        effects.reads.insert(name);
+    }
+}
+
+void SideEffectMap::AddWrite(FunctionSideEffects& effects, const char* name, const VariableTypes& locals)
+{
+    if (!name) {
+        return;
+    }
+
+    if (statics.find(name) != statics.end() && locals.find(name) == locals.end()) {
+        effects.writes.insert(name);
+    }
+}
+
+void SideEffectMap::Propagate()
+{
+    bool changed;
+    do {
+        changed = false;
+
+        for (FunctionSideEffects& caller : functions) {
+            for (const std::string& name : caller.calls) {
+                std::map<std::string, uint32_t>::iterator it = function_index.find(name);
+                if (it == function_index.end()) {
+                    // Function has only prototype, nothing is known about it
+                    changed |= !caller.reads_memory || !caller.writes_memory || !caller.calls_shared;
+                    caller.reads_memory = caller.writes_memory = caller.calls_shared = true;
+                    for (const VariableTypes::value_type& variable : statics) {
+                        caller.reads.insert(variable.first);
+                        caller.writes.insert(variable.first);
+                    }
+                    continue;
+                }
+
+                const FunctionSideEffects& callee = functions[it->second];
+                if (&callee == &caller) {
+                    continue;
+                }
+
+                size_t reads_size = caller.reads.size();
+                size_t writes_size = caller.writes.size();
+
+                caller.reads.insert(callee.reads.begin(), callee.reads.end());
+                caller.writes.insert(callee.writes.begin(), callee.writes.end());
+
+                changed |= (caller.reads.size() != reads_size || caller.writes.size() != writes_size);
+
+                if ((callee.reads_memory && !caller.reads_memory) ||
+                    (callee.writes_memory && !caller.writes_memory) ||
+                    (callee.calls_shared && !caller.calls_shared)) {
+
+                    caller.reads_memory |= callee.reads_memory;
+                    caller.writes_memory |= callee.writes_memory;
+                    caller.calls_shared |= callee.calls_shared;
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+
+#include "InstructionEntry.h"
+#include "SymbolTableEntry.h"
+
+/// <summary>
+/// Summary of side effects of user function, it includes all functions called from it
+/// </summary>
+struct FunctionSideEffects {
+    std::string name;
+
+    int32_t ip;                                 // Abstract instruction pointer of the first instruction
+
+    std::unordered_set<std::string> reads;      // Static variables that are read
+    std::unordered_set<std::string> writes;     // Static variables that are written
+    std::unordered_set<std::string> calls;      // Called user functions
+
+    bool reads_memory;          // Memory is read through pointer or array
+    bool writes_memory;         // Memory is written through pointer or array
+    bool calls_shared;          // Shared function (I/O, memory allocation) is called
+};
+
+/// <summary>
+/// Side table with mod/ref summaries of all user functions, they are computed from the call graph,
+/// so the call sites can keep values in registers if the callee can't observe or change them
+/// </summary>
+class SideEffectMap
+{
+public:
+    typedef std::unordered_map<std::string, SymbolType> VariableTypes;
+
+    SideEffectMap();
+    ~SideEffectMap();
+
+    void Clear();
+
+    /// <summary>
+    /// Compute summaries of all functions of the current compilation
+    /// </summary>
+    /// <param name="instruction_stream">Instruction stream</param>
+    /// <param name="symbol_table">Symbol table</param>
+    void Compute(InstructionEntry* instruction_stream, SymbolTableEntry* symbol_table);
+
+    /// <summary>
+    /// Find summary of user function
+    /// </summary>
+    /// <param name="function">Name of function</param>
+    /// <returns>Summary; or nullptr if the function is unknown</returns>
+    const FunctionSideEffects* Find(const char* function);
+
+    /// <summary>
+    /// Check if the function can read value of static variable
+    /// </summary>
+    /// <param name="effects">Summary of called function; or nullptr if it's unknown</param>
+    /// <param name="name">Name of static variable</param>
+    /// <returns>True if the value can be read</returns>
+    bool CanRead(const FunctionSideEffects* effects, const char* name);
+
+    /// <summary>
+    /// Check if the function can change value of static variable
+    /// </summary>
+    /// <param name="effects">Summary of called function; or nullptr if it's unknown</param>
+    /// <param name="name">Name of static variable</param>
+    /// <returns>True if the value can be changed</returns>
+    bool CanWrite(const FunctionSideEffects* effects, const char* name);
+
+    /// <summary>
+    /// Check if static variable can be accessed through pointer
+    /// </summary>
+    /// <param name="name">Name of static variable</param>
+    /// <returns>True if address of the variable is taken</returns>
+    bool IsAddressTaken(const char* name);
+
+private:
+    /// <summary>
+    /// Record direct side effects of one instruction
+    /// </summary>
+    /// <param name="effects">Summary of function that contains the instruction</param>
+    /// <param name="i">Instruction</param>
+    /// <param name="locals">Variables declared in the function</param>
+    void AddInstruction(FunctionSideEffects& effects, InstructionEntry* i, const VariableTypes& locals);
+
+    /// <summary>
+    /// Find type of variable, local variables hide static variables with the same name
+    /// </summary>
+    /// <param name="name">Name of variable</param>
+    /// <param name="locals">Variables declared in the function</param>
+    /// <returns>Type; or nullptr if the variable is unknown</returns>
+    const SymbolType* FindType(const char* name, const VariableTypes& locals);
+
+    void AddRead(FunctionSideEffects& effects, const char* name, ExpressionType exp_type, const VariableTypes& locals);
+    void AddWrite(FunctionSideEffects& effects, const char* name, const VariableTypes& locals);
+
+    /// <summary>
+    /// Merge summaries of called functions to callers until nothing changes
+    /// </summary>
+    void Propagate();
+
+    std::vector<FunctionSideEffects> functions;
+    std::map<std::string, uint32_t> function_index;
+
+    VariableTypes statics;
+    std::unordered_set<std::string> address_taken;     // Static variables that can be accessed through pointer
+};
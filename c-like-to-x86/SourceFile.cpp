@@ -0,0 +1,121 @@
+#include "SourceFile.h"
+
+#include <stdlib.h>
+
+// Windows-specific includes
+#include "targetver.h"
+#include <windows.h>
+
+SourceFile::SourceFile()
+{
+}
+
+SourceFile::~SourceFile()
+{
+    Close();
+}
+
+bool SourceFile::Open(const wchar_t* filename)
+{
+    return OpenHandle(CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+}
+
+bool SourceFile::Open(const char* filename)
+{
+    return OpenHandle(CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+}
+
+void SourceFile::Close()
+{
+    if (data) {
+        if (is_mapped) {
+            UnmapViewOfFile(data);
+        } else {
+            free(data);
+        }
+
+        data = nullptr;
+    }
+
+    if (mapping) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+
+    if (file) {
+        CloseHandle(file);
+        file = nullptr;
+    }
+
+    size = 0;
+    is_mapped = false;
+}
+
+char* SourceFile::GetData()
+{
+    return data;
+}
+
+uint32_t SourceFile::GetSize()
+{
+    return size;
+}
+
+bool SourceFile::OpenHandle(void* handle)
+{
+    Close();
+
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    file = handle;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart > 0x7FFFFFFF) {
+        Close();
+        return false;
+    }
+
+    size = (uint32_t)file_size.QuadPart;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    // Remaining bytes of the last page are filled with zeros, so the mapping can be used
+    // only if there is space for two terminators; copy-on-write allows in-place changes
+    uint32_t last_page = (size % info.dwPageSize);
+    if (last_page != 0 && last_page <= info.dwPageSize - 2) {
+        mapping = CreateFileMapping(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if (mapping) {
+            data = (char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            if (data) {
+                is_mapped = true;
+                return true;
+            }
+
+            CloseHandle(mapping);
+            mapping = nullptr;
+        }
+    }
+
+    // File can't be mapped, read it to memory
+    data = (char*)malloc(size + 2);
+
+    uint32_t offset = 0;
+    while (offset < size) {
+        DWORD read;
+        if (!ReadFile(file, data + offset, size - offset, &read, nullptr) || read == 0) {
+            Close();
+            return false;
+        }
+
+        offset += read;
+    }
+
+    data[size] = '\0';
+    data[size + 1] = '\0';
+    return true;
+}
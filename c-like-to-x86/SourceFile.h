@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>
+/// Source file mapped to memory, so the lexer can scan it directly without copying.
+/// Content is always followed by two zero bytes and it can be modified in place,
+/// changes are never written back to the file.
+/// </summary>
+class SourceFile
+{
+public:
+    SourceFile();
+    ~SourceFile();
+
+    /// <summary>
+    /// Map specified file to memory, if it's not possible, it's read to allocated buffer
+    /// </summary>
+    /// <param name="filename">Path to file</param>
+    /// <returns>True if the file was opened successfully</returns>
+    bool Open(const wchar_t* filename);
+    bool Open(const char* filename);
+
+    void Close();
+
+    char* GetData();
+    uint32_t GetSize();
+
+private:
+    bool OpenHandle(void* handle);
+
+    void* file = nullptr;
+    void* mapping = nullptr;
+
+    char* data = nullptr;
+    uint32_t size = 0;
+    bool is_mapped = false;
+};
@@ -14,6 +14,10 @@
 
 #include "Log.h"
 #include "DosExeEmitter.h"
+#include "ElfEmitter.h"
+#include "ObjectFile.h"
+#include "CompileServer.h"
+#include "SourceFile.h"
 
 // Internal Bison functions and variables
 extern int yylex();
@@ -21,6 +25,9 @@ extern int yyparse();
 extern FILE* yyin;
 extern int yylineno;
 
+// Internal Flex functions
+extern void LexerScanInPlace(char* source, uint32_t size);
+
 
 Compiler::Compiler()
 {
@@ -32,24 +39,163 @@ Compiler::~Compiler()
 
 int Compiler::OnRun(int argc, wchar_t* argv[])
 {
+    // Process options, remaining arguments are input and output filenames
+    std::vector<wchar_t*> args;
+    for (int i = 0; i < argc; i++) {
+        if (wcscmp(argv[i], L"--include-cache") == 0 && i + 1 < argc) {
+            include_cache.SetDirectory(argv[++i]);
+            continue;
+        }
+        if (wcscmp(argv[i], L"--function-cache") == 0 && i + 1 < argc) {
+            function_cache.SetDirectory(argv[++i]);
+            continue;
+        }
+        if (wcscmp(argv[i], L"--output-cache") == 0 && i + 1 < argc) {
+            output_cache.SetDirectory(argv[++i]);
+            continue;
+        }
+        if (wcscmp(argv[i], L"--output-cache-size") == 0 && i + 1 < argc) {
+            output_cache.SetMaxSize((uint64_t)_wtoi(argv[++i]) * 1024 * 1024);
+            continue;
+        }
+        if (wcscmp(argv[i], L"--quiet") == 0) {
+            Log::SetMinType(LogType::Warning);
+            continue;
+        }
+        if (wcscmp(argv[i], L"--log-level") == 0 && i + 1 < argc) {
+            i++;
+            if (wcscmp(argv[i], L"verbose") == 0) {
+                Log::SetMinType(LogType::Verbose);
+            } else if (wcscmp(argv[i], L"info") == 0) {
+                Log::SetMinType(LogType::Info);
+            } else if (wcscmp(argv[i], L"warning") == 0) {
+                Log::SetMinType(LogType::Warning);
+            } else if (wcscmp(argv[i], L"error") == 0) {
+                Log::SetMinType(LogType::Error);
+            } else {
+                Log::Write(LogType::Error, "Unknown log level, only \"verbose\", \"info\", \"warning\" and \"error\" are supported!");
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+        if (wcscmp(argv[i], L"--log-json") == 0) {
+            Log::SetSink(LogSink::Json);
+            continue;
+        }
+        if (wcscmp(argv[i], L"--log-async") == 0) {
+            Log::SetAsync(true);
+            continue;
+        }
+        if (wcscmp(argv[i], L"--stats") == 0) {
+            show_stats = true;
+            continue;
+        }
+        if (wcscmp(argv[i], L"--stats-json") == 0 && i + 1 < argc) {
+            stats_filename = argv[++i];
+            continue;
+        }
+        if (wcscmp(argv[i], L"--compile-only") == 0) {
+            compile_only = true;
+            continue;
+        }
+        if (wcscmp(argv[i], L"--profile-generate") == 0) {
+            profile_generate = true;
+            continue;
+        }
+        if (wcscmp(argv[i], L"--profile-use") == 0 && i + 1 < argc) {
+            profile_data_filename = argv[++i];
+            profile_use = true;
+            continue;
+        }
+        if (wcscmp(argv[i], L"--target") == 0 && i + 1 < argc) {
+            i++;
+            if (wcscmp(argv[i], L"dos") == 0) {
+                target = TargetPlatform::Dos;
+            } else if (wcscmp(argv[i], L"linux") == 0) {
+                target = TargetPlatform::Linux;
+            } else {
+                Log::Write(LogType::Error, "Unknown target platform, only \"dos\" and \"linux\" are supported!");
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        args.push_back(argv[i]);
+    }
+
+    argc = (int)args.size();
+    argv = args.data();
+
+    if (profile_generate && profile_use) {
+        Log::Write(LogType::Error, "Program cannot be instrumented and optimized by profile at the same time!");
+        return EXIT_FAILURE;
+    }
+
+    if (compile_only && (profile_generate || profile_use)) {
+        Log::Write(LogType::Error, "Profile cannot be used with separate compilation yet!");
+        return EXIT_FAILURE;
+    }
+
     if (argc < 2) {
         Log::Write(LogType::Error, "You must specify at least output filename!");
         return EXIT_FAILURE;
     }
 
+    // Linker of separately compiled object files
+    if (wcscmp(argv[1], L"--link") == 0) {
+        if (argc < 4) {
+            Log::Write(LogType::Error, "You must specify output filename and at least one object file!");
+            return EXIT_FAILURE;
+        }
+        return LinkObjectFiles(argv[2], argv + 3, argc - 3);
+    }
+
+    // Compile server and its client
+    if (wcscmp(argv[1], L"--server") == 0) {
+        CompileServer server(this);
+        if (argc >= 3 && wcscmp(argv[2], L"-") == 0) {
+            // Requests are read from stdin, responses are written to stdout
+            return server.Run(nullptr);
+        }
+        return server.Run(argc >= 3 ? argv[2] : CompileServerPipeName);
+    }
+
+    if (wcscmp(argv[1], L"--client") == 0) {
+        // Server cannot write object files, profiles or statistics and it uses its own caches
+        if (compile_only || profile_generate || profile_use || stats_filename ||
+            include_cache.IsPersistent() || function_cache.IsEnabled() || output_cache.IsEnabled()) {
+            Log::Write(LogType::Error, "Only \"--target\", \"--stats\", \"--log-level\" and \"--quiet\" options can be sent to compile server!");
+            return EXIT_FAILURE;
+        }
+
+        const wchar_t* pipe_name = CompileServerPipeName;
+        if (argc >= 4 && wcscmp(argv[2], L"--pipe") == 0) {
+            pipe_name = argv[3];
+            argc -= 2;
+            argv += 2;
+        }
+
+        CompileServerOptions options { };
+        options.target = (uint8_t)target;
+        options.log_level = (uint8_t)Log::min_type;
+        options.show_stats = (show_stats ? 1 : 0);
+
+        return CompileServer::RunClient(pipe_name, options, argc - 1, argv + 1);
+    }
+
     wchar_t* input_filename;
     wchar_t* output_filename;
 
-    // Open input file
+    // Open input file, it's mapped to memory and scanned in place
+    SourceFile input;
     if (argc >= 3) {
-        errno_t err = _wfopen_s(&yyin, argv[1], L"rb");
-        if (err) {
-            char error[200];
-            strerror_s(error, err);
-            Log::Write(LogType::Error, "Error while opening input file: %s", error);
+        if (!input.Open(argv[1])) {
+            Log::Write(LogType::Error, "Error while opening input file: 0x%08x", GetLastError());
             return EXIT_FAILURE;
         }
 
+        yyin = nullptr;
+
         input_filename = argv[1];
         output_filename = argv[2];
     } else {
@@ -69,6 +215,56 @@ int Compiler::OnRun(int argc, wchar_t* argv[])
         return EXIT_FAILURE;
     }
 
+    // Profile map is saved next to the executable, so the path must be resolved
+    // before working directory is changed, counters are saved by the program itself
+    if (profile_generate) {
+        wchar_t path[MAX_PATH];
+        if (_wfullpath(path, output_filename, MAX_PATH)) {
+            profile_map_filename = path;
+
+            wchar_t* extension = PathFindExtension(path);
+            profile_map_filename.resize(extension - path);
+            profile_map_filename += L".pmap";
+
+            // Name of counter file must be valid DOS filename
+            char* name = profile_data_name;
+            for (wchar_t* ptr = PathFindFileName(path); ptr < extension && name < profile_data_name + 8; ptr++) {
+                if (iswalnum(*ptr) && *ptr < 0x80) {
+                    *name++ = (char)towupper(*ptr);
+                }
+            }
+            if (name != profile_data_name) {
+                strcpy_s(name, sizeof(profile_data_name) - (name - profile_data_name), ".PRF");
+            }
+        }
+    }
+
+    // Profile map is expected next to the recorded counters
+    if (profile_use) {
+        wchar_t path[MAX_PATH];
+        if (_wfullpath(path, profile_data_filename.c_str(), MAX_PATH)) {
+            profile_data_filename = path;
+            profile_map_filename = path;
+
+            wchar_t* extension = PathFindExtension(path);
+            profile_map_filename.resize(extension - path);
+            profile_map_filename += L".pmap";
+        }
+    }
+
+    // Output file is copied to cache after the compilation, so the path must be resolved
+    // before working directory is changed, profile depends on files that are not tracked
+    std::wstring output_path;
+    bool use_output_cache = (output_cache.IsEnabled() && input_filename && !profile_generate && !profile_use);
+    if (use_output_cache) {
+        wchar_t path[MAX_PATH];
+        if (_wfullpath(path, output_filename, MAX_PATH)) {
+            output_path = path;
+        } else {
+            use_output_cache = false;
+        }
+    }
+
     // Set working directory
     if (input_filename && PathRemoveFileSpec(input_filename)) {
         SetCurrentDirectory(input_filename);
@@ -77,9 +273,56 @@ int Compiler::OnRun(int argc, wchar_t* argv[])
         GetCurrentDirectory(MAX_PATH, path);
     }
 
+    // Identical compilation is served from cache without parsing,
+    // included files are resolved relative to the new working directory
+    uint64_t output_key = 0;
+    std::string diagnostics;
+    if (use_output_cache) {
+        std::string options = tinyformat::format("--target %d", (int32_t)target);
+        if (compile_only) {
+            options += " --compile-only";
+        }
+
+        output_key = output_cache.ComputeKey(input.GetData(), input.GetSize(), options);
+
+        std::vector<uint8_t> output;
+        if (output_cache.Find(output_key, output, diagnostics)) {
+            Log::Write(LogType::Info, "Output was found in cache");
+
+            size_t begin = 0, end;
+            while ((end = diagnostics.find('\n', begin)) != std::string::npos) {
+                Log::Write(LogType::Warning, diagnostics.substr(begin, end - begin));
+                begin = end + 1;
+            }
+
+            bool success = (output.empty() || fwrite(output.data(), output.size(), 1, outputExe) == 1);
+            fclose(outputExe);
+
+            if (!success) {
+                Log::Write(LogType::Error, "Output file cannot be written.");
+                return EXIT_FAILURE;
+            }
+
+            Log::Write(LogType::Info, "Build was successful!");
+
+            if (show_stats) {
+                output_cache.WriteReport();
+            }
+
+            return EXIT_SUCCESS;
+        }
+
+        Log::Write(LogType::Verbose, "Output was not found in cache");
+
+        Log::SetDiagnosticOutput(&diagnostics);
+    }
+
     // Declare all shared functions
     DeclareSharedFunctions();
 
+    include_cache.BeginCompilation();
+    stats.Reset();
+
     bool input_done = false;
 
     // Parse input file
@@ -97,9 +340,18 @@ int Compiler::OnRun(int argc, wchar_t* argv[])
             Log::SetHighlight(true);
         }
 
-        do {
+        stats.BeginPhase(CompilePhase::Parse);
+
+        if (input_filename) {
+            LexerScanInPlace(input.GetData(), input.GetSize());
             yyparse();
-        } while (!feof(yyin));
+        } else {
+            do {
+                yyparse();
+            } while (!feof(yyin));
+        }
+
+        stats.EndPhase();
 
         if (!input_filename) {
             Log::SetHighlight(false);
@@ -112,7 +364,7 @@ int Compiler::OnRun(int argc, wchar_t* argv[])
 
         PostprocessSymbolTable();
 
-        Log::Write(LogType::Info, "Creating executable file...");
+        Log::Write(LogType::Info, compile_only ? "Creating object file..." : "Creating executable file...");
         Log::PushIndent();
 
 #if defined(DEBUG_OUTPUT)
@@ -120,20 +372,35 @@ int Compiler::OnRun(int argc, wchar_t* argv[])
 #endif
 
         // Parsing was successful, generate output files
-        {
-            DosExeEmitter emitter(this);
-            emitter.EmitMzHeader();
-            emitter.EmitInstructions(instruction_stream_head);
-            emitter.EmitSharedFunctions();
-            emitter.EmitStaticData();
-            emitter.FixMzHeader(instruction_stream_head, stack_size);
-            emitter.Save(outputExe);
+        if (compile_only) {
+            ObjectUnit unit { };
+            std::unique_ptr<DosExeEmitter> emitter = CreateEmitter();
+            EmitObject(*emitter, unit);
+
+            if (!ObjectFile::Save(outputExe, unit)) {
+                throw CompilerException(CompilerExceptionSource::Compilation, "Object file could not be written");
+            }
+        } else {
+            std::unique_ptr<DosExeEmitter> emitter = CreateEmitter();
+            EmitExecutable(*emitter);
+            emitter->Save(outputExe);
         }
 
         Log::PopIndent();
+        Log::SetDiagnosticOutput(nullptr);
         Log::Write(LogType::Info, "Build was successful!");
+
+        ReportStats();
+
+        if (profile_generate && !profile_map_filename.empty()) {
+            if (profile_map.Save(profile_map_filename.c_str())) {
+                Log::Write(LogType::Verbose, "Program is instrumented with %d counters, they will be saved to \"%s\"",
+                    profile_map.GetCounterCount(), profile_data_name);
+            }
+        }
     } catch (CompilerException& ex) {
         // Input file can't be parsed/compiled
+        Log::SetDiagnosticOutput(nullptr);
 
         // Cleanup
         if (!input_done && !input_filename) {
@@ -147,44 +414,288 @@ int Compiler::OnRun(int argc, wchar_t* argv[])
 
         fclose(outputExe);
 
-        // Show error message
-        const char* source;
-        switch (ex.GetSource()) {
-            case CompilerExceptionSource::Syntax:      source = "Syntax: ";      break;
-            case CompilerExceptionSource::Declaration: source = "Declaration: "; break;
-            case CompilerExceptionSource::Statement:   source = "Statement: ";   break;
+        ReportCompilerException(ex);
 
-            default: source = ""; break;
-        }
+        return EXIT_FAILURE;
+    }
 
-        int32_t line = ex.GetLine();
-        if (line >= 0) {
-            int32_t column = ex.GetColumn();
-            if (column >= 0) {
-                Log::Write(LogType::Error, "[%d:%d] %s%s", line, column, source, ex.what());
-            } else {
-                Log::Write(LogType::Error, "[%d:-] %s%s", line, source, ex.what());
-            }
-        } else {
-            Log::Write(LogType::Error, "%s%s", source, ex.what());
+    if (yyin && yyin != stdin) {
+        fclose(yyin);
+    }
+
+    fclose(outputExe);
+
+    if (use_output_cache) {
+        output_cache.Add(output_key, include_cache.GetIncludedFiles(), output_path.c_str(), diagnostics);
+
+        if (show_stats) {
+            output_cache.WriteReport();
         }
+    }
+
+    ReleaseAll();
+
+    return EXIT_SUCCESS;
+}
+
+int Compiler::CompileBuffer(char* source, uint32_t source_size, TargetPlatform target, bool show_stats, std::vector<uint8_t>& output)
+{
+    // Options of the previous request are replaced
+    this->target = target;
+    this->show_stats = show_stats;
+
+    // Keep capacity of the output buffer, it's used as size hint for the emitter
+    size_t size_hint = output.capacity();
+    output.clear();
+
+    // Shared functions are declared only for the first compilation
+    if (!shared_functions_tail) {
+        DeclareSharedFunctions();
+    }
+
+    include_cache.BeginCompilation();
+    stats.Reset();
+
+    LexerScanInPlace(source, source_size);
+
+    int result;
+
+    try {
+        Log::Write(LogType::Info, "Parsing source code...");
+        Log::PushIndent();
+
+        stats.BeginPhase(CompilePhase::Parse);
+        yyparse();
+        stats.EndPhase();
 
         Log::PopIndent();
+
+        PostprocessSymbolTable();
+
+        Log::Write(LogType::Info, "Creating executable file...");
+        Log::PushIndent();
+
+#if defined(DEBUG_OUTPUT)
+        CreateDebugOutput();
+#endif
+
+        {
+            std::unique_ptr<DosExeEmitter> emitter = CreateEmitter();
+            emitter->ReserveOutput((uint32_t)size_hint);
+            EmitExecutable(*emitter);
+            emitter->Save(output);
+        }
+
         Log::PopIndent();
-        Log::Write(LogType::Error, "Build failed!");
+        Log::Write(LogType::Info, "Build was successful!");
+
+        ReportStats();
+
+        result = EXIT_SUCCESS;
+    } catch (CompilerException& ex) {
+        output.clear();
+
+        ReportCompilerException(ex);
+
+        result = EXIT_FAILURE;
+    }
+
+    ReleaseCompilation();
+
+    return result;
+}
+
+void Compiler::EmitExecutable(DosExeEmitter& emitter)
+{
+    profile_map.Clear();
+    profile_loaded = false;
+
+    if (profile_generate) {
+        profile_map.SetHash(ProfileMap::ComputeHash(instruction_stream_head));
+        profile_map.AddFunctions(instruction_stream_head, symbol_table);
+    } else if (profile_use && !profile_map_filename.empty()) {
+        if (profile_map.Load(profile_map_filename.c_str(), profile_data_filename.c_str())) {
+            uint32_t valid_count = profile_map.Validate(instruction_stream_head, symbol_table);
+            Log::Write(LogType::Verbose, "Profile is used for %d functions", valid_count);
+
+            profile_loaded = (valid_count > 0);
+        }
+    }
+
+    if (GetFunctionCache()) {
+        function_cache.BeginCompilation((uint8_t)target, symbol_table, &side_effects);
+    }
+
+    stats.BeginPhase(CompilePhase::EmitInstructions);
+    emitter.EmitHeader();
+    emitter.EmitInstructions(instruction_stream_head);
+
+    stats.BeginPhase(CompilePhase::EmitSharedFunctions);
+    emitter.EmitSharedFunctions();
+
+    stats.BeginPhase(CompilePhase::EmitStaticData);
+    emitter.EmitStaticData();
+
+    stats.BeginPhase(CompilePhase::Link);
+    emitter.ResolveRelocations();
+
+    stats.BeginPhase(CompilePhase::FixMzHeader);
+    emitter.FixHeader(instruction_stream_head, stack_size);
+
+    stats.EndPhase();
+}
+
+void Compiler::EmitObject(DosExeEmitter& emitter, ObjectUnit& unit)
+{
+    profile_map.Clear();
+    profile_loaded = false;
+
+    if (GetFunctionCache()) {
+        function_cache.BeginCompilation((uint8_t)target, symbol_table, &side_effects);
+    }
+
+    stats.BeginPhase(CompilePhase::EmitInstructions);
+    emitter.EmitHeader();
+    emitter.EmitInstructions(instruction_stream_head);
+    emitter.CreateObject(unit);
+
+    unit.target = target;
+    unit.stack_size = stack_size;
 
+    stats.EndPhase();
+}
+
+int Compiler::LinkObjectFiles(const wchar_t* output_filename, wchar_t** input_filenames, int input_count)
+{
+    std::vector<ObjectUnit> units(input_count);
+    for (int i = 0; i < input_count; i++) {
+        if (!ObjectFile::Load(input_filenames[i], units[i])) {
+            Log::Write(LogType::Error, "Object file #%d cannot be loaded, it must be compiled by the same version!", i + 1);
+            return EXIT_FAILURE;
+        }
+        if (units[i].target != target) {
+            Log::Write(LogType::Error, "Object file #%d was compiled for different target platform!", i + 1);
+            return EXIT_FAILURE;
+        }
+
+        // Stack size is requested by the unit with entry point
+        for (const ObjectFunction& function : units[i].functions) {
+            if (function.is_entry_point) {
+                stack_size = units[i].stack_size;
+            }
+        }
+    }
+
+    FILE* outputExe;
+    errno_t err = _wfopen_s(&outputExe, output_filename, L"wb");
+    if (err) {
+        char error[200];
+        strerror_s(error, err);
+        Log::Write(LogType::Error, "Error while creating output file: %s", error);
         return EXIT_FAILURE;
     }
 
-    if (yyin != stdin) {
-        fclose(yyin);
+    // Shared functions are emitted only if any object unit references them
+    DeclareSharedFunctions();
+
+    stats.Reset();
+
+    int result;
+
+    try {
+        Log::Write(LogType::Info, "Creating executable file...");
+        Log::PushIndent();
+
+        {
+            std::unique_ptr<DosExeEmitter> emitter = CreateEmitter();
+
+            stats.BeginPhase(CompilePhase::EmitInstructions);
+            emitter->EmitHeader();
+            emitter->LinkObjects(units);
+
+            stats.BeginPhase(CompilePhase::EmitSharedFunctions);
+            emitter->EmitSharedFunctions();
+
+            stats.BeginPhase(CompilePhase::EmitStaticData);
+            emitter->EmitStaticData();
+
+            stats.BeginPhase(CompilePhase::Link);
+            emitter->ResolveRelocations();
+
+            stats.BeginPhase(CompilePhase::FixMzHeader);
+            emitter->FixHeader(nullptr, stack_size);
+
+            stats.EndPhase();
+
+            emitter->Save(outputExe);
+        }
+
+        Log::PopIndent();
+        Log::Write(LogType::Info, "Build was successful!");
+
+        ReportStats();
+
+        result = EXIT_SUCCESS;
+    } catch (CompilerException& ex) {
+        ReportCompilerException(ex);
+
+        result = EXIT_FAILURE;
     }
 
     fclose(outputExe);
 
     ReleaseAll();
 
-    return EXIT_SUCCESS;
+    return result;
+}
+
+std::unique_ptr<DosExeEmitter> Compiler::CreateEmitter()
+{
+    switch (target) {
+        case TargetPlatform::Dos: return std::make_unique<DosExeEmitter>(this);
+        case TargetPlatform::Linux: return std::make_unique<ElfEmitter>(this);
+
+        default: ThrowOnUnreachableCode();
+    }
+}
+
+void Compiler::ReportStats()
+{
+    if (show_stats) {
+        stats.WriteReport();
+    }
+
+    if (stats_filename) {
+        stats.SaveJson(stats_filename);
+    }
+}
+
+void Compiler::ReportCompilerException(CompilerException& ex)
+{
+    const char* source;
+    switch (ex.GetSource()) {
+        case CompilerExceptionSource::Syntax:      source = "Syntax: ";      break;
+        case CompilerExceptionSource::Declaration: source = "Declaration: "; break;
+        case CompilerExceptionSource::Statement:   source = "Statement: ";   break;
+
+        default: source = ""; break;
+    }
+
+    int32_t line = ex.GetLine();
+    if (line >= 0) {
+        int32_t column = ex.GetColumn();
+        if (column >= 0) {
+            Log::Write(LogType::Error, "[%d:%d] %s%s", line, column, source, ex.what());
+        } else {
+            Log::Write(LogType::Error, "[%d:-] %s%s", line, source, ex.what());
+        }
+    } else {
+        Log::Write(LogType::Error, "%s%s", source, ex.what());
+    }
+
+    Log::PopIndent();
+    Log::PopIndent();
+    Log::Write(LogType::Error, "Build failed!");
 }
 
 #if defined(DEBUG_OUTPUT)
@@ -254,10 +765,11 @@ void Compiler::CreateDebugOutput()
                 symbol = symbol->next;
             }
 
+            std::string content = FormatInstruction(current);
             if (current->goto_ip == -1) {
-                fprintf(output_debug, "    %-5llu %s\r\n", ip, current->content);
+                fprintf(output_debug, "    %-5llu %s\r\n", ip, content.c_str());
             } else {
-                fprintf(output_debug, "    %-5llu %s %d\r\n", ip, current->content, current->goto_ip);
+                fprintf(output_debug, "    %-5llu %s %d\r\n", ip, content.c_str(), current->goto_ip);
             }
 
             current = current->next;
@@ -269,6 +781,127 @@ void Compiler::CreateDebugOutput()
 }
 #endif
 
+std::string Compiler::FormatInstruction(InstructionEntry* i)
+{
+    auto format_operand = [](const char* value, const char* index) {
+        std::string result = (value ? value : "");
+        if (index) {
+            result += "[";
+            result += index;
+            result += "]";
+        }
+        return result;
+    };
+
+    std::string result;
+
+    switch (i->type) {
+        case InstructionType::Assign: {
+            InstructionOperand& op1 = i->assignment.op1;
+            InstructionOperand& op2 = i->assignment.op2;
+
+            result = format_operand(i->assignment.dst_value, i->assignment.dst_index.value);
+            result += " = ";
+
+            if (i->assignment.type == AssignType::None) {
+                result += format_operand(op1.value, op1.index.value);
+                break;
+            }
+            if (i->assignment.type == AssignType::Negation) {
+                result += "-";
+                result += format_operand(op1.value, op1.index.value);
+                break;
+            }
+
+            const char* op;
+            switch (i->assignment.type) {
+                case AssignType::Add: op = " + "; break;
+                case AssignType::Subtract: op = " - "; break;
+                case AssignType::Multiply: op = " * "; break;
+                case AssignType::Divide: op = " / "; break;
+                case AssignType::Remainder: op = " % "; break;
+                case AssignType::ShiftLeft: op = " << "; break;
+                case AssignType::ShiftRight: op = " >> "; break;
+
+                default: ThrowOnUnreachableCode();
+            }
+
+            result += format_operand(op1.value, op1.index.value);
+            result += op;
+            result += format_operand(op2.value, op2.index.value);
+            break;
+        }
+
+        case InstructionType::Goto: {
+            result = "goto";
+            break;
+        }
+
+        case InstructionType::GotoLabel: {
+            result = "goto \"";
+            result += i->goto_label_statement.label;
+            result += "\"";
+            break;
+        }
+
+        case InstructionType::If: {
+            const char* op;
+            switch (i->if_statement.type) {
+                case CompareType::LogOr: op = " || "; break;
+                case CompareType::LogAnd: op = " && "; break;
+                case CompareType::Equal: op = " == "; break;
+                case CompareType::NotEqual: op = " != "; break;
+                case CompareType::Greater: op = " > "; break;
+                case CompareType::Less: op = " < "; break;
+                case CompareType::GreaterOrEqual: op = " >= "; break;
+                case CompareType::LessOrEqual: op = " <= "; break;
+
+                default: ThrowOnUnreachableCode();
+            }
+
+            result = "if (";
+            result += format_operand(i->if_statement.op1.value, i->if_statement.op1.index.value);
+            result += op;
+            result += format_operand(i->if_statement.op2.value, i->if_statement.op2.index.value);
+            result += ") goto";
+            break;
+        }
+
+        case InstructionType::Push: {
+            result = "push ";
+            result += i->push_statement.symbol->name;
+            break;
+        }
+
+        case InstructionType::Call: {
+            if (i->call_statement.return_symbol) {
+                result = i->call_statement.return_symbol;
+                result += " = ";
+            }
+
+            result += "call ";
+            result += i->call_statement.target->name;
+            result += " (";
+            result += std::to_string(i->call_statement.target->parameter);
+            result += ")";
+            break;
+        }
+
+        case InstructionType::Return: {
+            result = "return";
+            if (i->return_statement.op.value) {
+                result += " ";
+                result += i->return_statement.op.value;
+            }
+            break;
+        }
+
+        default: ThrowOnUnreachableCode();
+    }
+
+    return result;
+}
+
 void Compiler::ParseCompilerDirective(char* directive, std::function<bool(char* directive, char* param)> callback)
 {
     char* param = directive;
@@ -323,11 +956,11 @@ void Compiler::ParseCompilerDirective(char* directive, std::function<bool(char*
     Log::Write(LogType::Warning, "Compiler directive \"%s\" cannot be resolved", directive);
 }
 
-InstructionEntry* Compiler::AddToStream(InstructionType type, char* code)
+InstructionEntry* Compiler::AddToStream(InstructionType type)
 {
     InstructionEntry* entry = new InstructionEntry();
-    entry->content = _strdup(code);
     entry->goto_ip = -1;
+    entry->line = yylineno;
     entry->type = type;
 
     if (instruction_stream_head) {
@@ -344,12 +977,13 @@ InstructionEntry* Compiler::AddToStream(InstructionType type, char* code)
     return entry;
 }
 
-BackpatchList* Compiler::AddToStreamWithBackpatch(InstructionType type, char* code)
+BackpatchList* Compiler::AddToStreamWithBackpatch(InstructionType type)
 {
-    InstructionEntry* entry = AddToStream(type, code);
+    InstructionEntry* entry = AddToStream(type);
 
     BackpatchList* backpatch = new BackpatchList();
     backpatch->entry = entry;
+    backpatch->tail = backpatch;
     return backpatch;
 }
 
@@ -385,6 +1019,56 @@ SymbolTableEntry* Compiler::GetSymbols()
     return symbol_table;
 }
 
+IncludeCache* Compiler::GetIncludeCache()
+{
+    return &include_cache;
+}
+
+CompileStats* Compiler::GetStats()
+{
+    return &stats;
+}
+
+ProfileMap* Compiler::GetProfileMap()
+{
+    return &profile_map;
+}
+
+FunctionCache* Compiler::GetFunctionCache()
+{
+    // Instrumented code and code optimized by profile depend on the whole program
+    if (!function_cache.IsEnabled() || profile_generate || profile_loaded) {
+        return nullptr;
+    }
+
+    return &function_cache;
+}
+
+SideEffectMap* Compiler::GetSideEffects()
+{
+    return &side_effects;
+}
+
+PointsToMap* Compiler::GetPointsTo()
+{
+    return &points_to;
+}
+
+const char* Compiler::GetProfileDataName()
+{
+    return (profile_generate ? profile_data_name : nullptr);
+}
+
+bool Compiler::IsCompileOnly()
+{
+    return compile_only;
+}
+
+ProfileMap* Compiler::GetProfile()
+{
+    return (profile_loaded ? &profile_map : nullptr);
+}
+
 SymbolTableEntry* Compiler::ToDeclarationList(SymbolType type, int32_t size, const char* name, ExpressionType exp_type)
 {
     SymbolTableEntry* symbol = new SymbolTableEntry();
@@ -750,9 +1434,7 @@ void Compiler::PrepareForCall(const char* name, SymbolTableEntry* call_parameter
         }
 
         // Add required parameter to stream
-        char buffer[500];
-        sprintf_s(buffer, "push %s", call_parameters->name);
-        InstructionEntry* i = AddToStream(InstructionType::Push, buffer);
+        InstructionEntry* i = AddToStream(InstructionType::Push);
         i->push_statement.symbol = call_parameters;
 
         current = current->next;
@@ -1029,7 +1711,7 @@ const char* Compiler::ExpressionTypeToString(ExpressionType type)
 int32_t Compiler::GetSymbolTypeSize(SymbolType type)
 {
     if (type.pointer > 0) {
-        return 2; // 16-bit pointer
+        return GetPointerSize();
     }
 
     switch (type.base) {
@@ -1038,7 +1720,17 @@ int32_t Compiler::GetSymbolTypeSize(SymbolType type)
         case BaseSymbolType::Uint16: return 2;
         case BaseSymbolType::Uint32: return 4;
 
-        case BaseSymbolType::String: return 2; // 16-bit pointer
+        case BaseSymbolType::String: return GetPointerSize();
+
+        default: ThrowOnUnreachableCode();
+    }
+}
+
+int32_t Compiler::GetPointerSize()
+{
+    switch (target) {
+        case TargetPlatform::Dos: return 2; // 16-bit pointer (near)
+        case TargetPlatform::Linux: return 4; // 32-bit pointer (flat)
 
         default: ThrowOnUnreachableCode();
     }
@@ -1177,25 +1869,84 @@ void Compiler::ReleaseDeclarationQueue()
 }
 
 void Compiler::ReleaseAll()
+{
+    ReleaseCompilation();
+
+    while (symbol_table) {
+        SymbolTableEntry* current = symbol_table;
+        symbol_table = symbol_table->next;
+        free(current->name);
+        free(current->parent);
+        delete current;
+    }
+
+    shared_functions_tail = nullptr;
+}
+
+void Compiler::ReleaseCompilation()
 {
     ReleaseDeclarationQueue();
 
     while (instruction_stream_head) {
         InstructionEntry* current = instruction_stream_head;
         instruction_stream_head = instruction_stream_head->next;
-        free(current->content);
         delete current;
     }
 
     instruction_stream_tail = nullptr;
 
-    while (symbol_table) {
-        SymbolTableEntry* current = symbol_table;
-        symbol_table = symbol_table->next;
+    // Release all symbols declared after shared functions
+    SymbolTableEntry* symbol;
+    if (shared_functions_tail) {
+        symbol = shared_functions_tail->next;
+        shared_functions_tail->next = nullptr;
+    } else {
+        symbol = symbol_table;
+        symbol_table = nullptr;
+    }
+
+    while (symbol) {
+        SymbolTableEntry* current = symbol;
+        symbol = symbol->next;
         free(current->name);
         free(current->parent);
         delete current;
     }
+
+    // Shared functions are referenced again by the next compilation
+    symbol = symbol_table;
+    while (symbol) {
+        symbol->ref_count = 0;
+        symbol = symbol->next;
+    }
+
+    current_ip = -1;
+    function_ip = 0;
+
+    var_count_bool = 0;
+    var_count_uint8 = 0;
+    var_count_uint16 = 0;
+    var_count_uint32 = 0;
+    var_count_string = 0;
+
+    break_list.clear();
+    continue_list.clear();
+    assign_scope = 0;
+    break_scope = -1;
+    continue_scope = -1;
+
+    stack_size = 0;
+
+    side_effects.Clear();
+    points_to.Clear();
+
+    // Nothing can reference interned strings of the last compilation now
+    interned_strings.clear();
+}
+
+char* Compiler::InternString(const char* value)
+{
+    return (char*)interned_strings.insert(value).first->c_str();
 }
 
 void Compiler::PostprocessSymbolTable()
@@ -1204,6 +1955,26 @@ void Compiler::PostprocessSymbolTable()
         return;
     }
 
+    stats.BeginPhase(CompilePhase::Postprocess);
+
+    {
+        uint32_t instruction_count = 0;
+        InstructionEntry* current = instruction_stream_head;
+        while (current) {
+            instruction_count++;
+            current = current->next;
+        }
+
+        uint32_t symbol_count = 0;
+        SymbolTableEntry* symbol = symbol_table;
+        while (symbol) {
+            symbol_count++;
+            symbol = symbol->next;
+        }
+
+        stats.SetProgramSize(instruction_count, symbol_count);
+    }
+
     Log::Write(LogType::Info, "Post-processing the symbol table...");
 
     // Fix IP of first function
@@ -1234,12 +2005,31 @@ void Compiler::PostprocessSymbolTable()
         symbol = symbol->next;
     }
 
-    if (!entry_point) {
-        ThrowOnUnreachableCode();
-    }
-
     std::stack<SymbolTableEntry*> dependency_stack { };
-    dependency_stack.push(entry_point);
+
+    if (compile_only) {
+        // Any function can be called from other object units, linker removes unused functions
+        symbol = symbol_table;
+        while (symbol) {
+            if (!symbol->parent &&
+                (symbol->type.base == BaseSymbolType::Function ||
+                 symbol->type.base == BaseSymbolType::EntryPoint)) {
+                dependency_stack.push(symbol);
+            }
+
+            symbol = symbol->next;
+        }
+
+        if (dependency_stack.empty()) {
+            throw CompilerException(CompilerExceptionSource::Declaration, "Object unit must contain at least one function");
+        }
+    } else {
+        if (!entry_point) {
+            ThrowOnUnreachableCode();
+        }
+
+        dependency_stack.push(entry_point);
+    }
 
     do {
         symbol = dependency_stack.top();
@@ -1271,7 +2061,7 @@ void Compiler::PostprocessSymbolTable()
                 SymbolTableEntry* target = current->call_statement.target;
                 if (target->type.base == BaseSymbolType::SharedFunction) {
                     target->ref_count++;
-                } else {
+                } else if (target->type.base != BaseSymbolType::FunctionPrototype) {
                     dependency_stack.push(target);
                 }
             }
@@ -1282,6 +2072,60 @@ void Compiler::PostprocessSymbolTable()
     FunctionEnd:
         ;
     } while (!dependency_stack.empty());
+
+    ResolveImmediates();
+
+    side_effects.Compute(instruction_stream_head, symbol_table);
+    points_to.Compute(instruction_stream_head, symbol_table, &side_effects);
+
+    stats.EndPhase();
+}
+
+void Compiler::ResolveImmediates()
+{
+    auto resolve = [](const char* value, SymbolType type, ExpressionType exp_type, int64_t& imm) {
+        if (value && exp_type == ExpressionType::Constant && type.base != BaseSymbolType::String) {
+            imm = strtoll(value, nullptr, 10);
+        }
+    };
+
+    InstructionEntry* current = instruction_stream_head;
+    while (current) {
+        switch (current->type) {
+            case InstructionType::Assign: {
+                InstructionOperandIndex& dst_index = current->assignment.dst_index;
+                resolve(dst_index.value, dst_index.type, dst_index.exp_type, dst_index.imm);
+
+                for (InstructionOperand* op : { &current->assignment.op1, &current->assignment.op2 }) {
+                    resolve(op->value, op->type, op->exp_type, op->imm);
+                    resolve(op->index.value, op->index.type, op->index.exp_type, op->index.imm);
+                }
+                break;
+            }
+
+            case InstructionType::If: {
+                InstructionOperand& op1 = current->if_statement.op1;
+                InstructionOperand& op2 = current->if_statement.op2;
+                resolve(op1.value, op1.type, op1.exp_type, op1.imm);
+                resolve(op2.value, op2.type, op2.exp_type, op2.imm);
+                break;
+            }
+
+            case InstructionType::Push: {
+                SymbolTableEntry* symbol = current->push_statement.symbol;
+                resolve(symbol->name, symbol->type, symbol->exp_type, current->push_statement.imm);
+                break;
+            }
+
+            case InstructionType::Return: {
+                InstructionOperand& op = current->return_statement.op;
+                resolve(op.value, op.type, op.exp_type, op.imm);
+                break;
+            }
+        }
+
+        current = current->next;
+    }
 }
 
 void Compiler::DeclareSharedFunctions()
@@ -1333,6 +2177,6 @@ void Compiler::DeclareSharedFunctions()
     AddSymbol("release", { BaseSymbolType::SharedFunction, 0 }, 0, { BaseSymbolType::Void, 0 },
         ExpressionType::None, 0, 1, nullptr, false);
 
-    AddSymbol("ptr", { BaseSymbolType::Void, 1 }, 0, { BaseSymbolType::Unknown, 0 },
+    shared_functions_tail = AddSymbol("ptr", { BaseSymbolType::Void, 1 }, 0, { BaseSymbolType::Unknown, 0 },
         ExpressionType::None, 0, 1, "release", false);
 }
@@ -6,11 +6,24 @@
 #include <iostream>
 #include <vector>
 #include <functional>
+#include <string>
+#include <memory>
+#include <unordered_set>
 
 #include "CompilerException.h"
 #include "InstructionEntry.h"
 #include "SymbolTableEntry.h"
 #include "ScopeType.h"
+#include "IncludeCache.h"
+#include "FunctionCache.h"
+#include "OutputCache.h"
+#include "CompileStats.h"
+#include "ProfileMap.h"
+#include "SideEffectMap.h"
+#include "PointsToMap.h"
+
+class DosExeEmitter;
+struct ObjectUnit;
 
 // Debug output is created when it is compiled in Debug configuration
 #if _DEBUG
@@ -18,6 +31,14 @@
 #endif
 
 
+/// <summary>
+/// Operating system of emitted executable
+/// </summary>
+enum struct TargetPlatform {
+    Dos,        // MZ executable
+    Linux       // ELF32 executable (i386)
+};
+
 /// <summary>
 /// Name of the function that represents application entry point
 /// </summary>
@@ -109,7 +130,7 @@
 
 #define CreateIfWithBackpatch(backpatch, compare_type, op1_, op2_)          \
     {                                                                       \
-        backpatch = c.AddToStreamWithBackpatch(InstructionType::If, output_buffer); \
+        backpatch = c.AddToStreamWithBackpatch(InstructionType::If);        \
         backpatch->entry->if_statement.type = compare_type;                 \
         CopyOperand(backpatch->entry->if_statement.op1, op1_);              \
         CopyOperand(backpatch->entry->if_statement.op2, op2_);              \
@@ -117,7 +138,7 @@
 
 #define CreateIfConstWithBackpatch(backpatch, compare_type, op1_, constant)     \
     {                                                                           \
-        backpatch = c.AddToStreamWithBackpatch(InstructionType::If, output_buffer); \
+        backpatch = c.AddToStreamWithBackpatch(InstructionType::If);            \
         backpatch->entry->if_statement.type = compare_type;                     \
         CopyOperand(backpatch->entry->if_statement.op1, op1_);                  \
         backpatch->entry->if_statement.op2.value = constant;                    \
@@ -129,8 +150,7 @@
     if (var.exp_type == ExpressionType::Variable && var.index.value) {          \
         SymbolTableEntry* _decl_index = c.GetUnusedVariable(var.type);          \
                                                                                 \
-        sprintf_s(output_buffer, "%s = %s[%s]", _decl_index->name, var.value, var.index.value); \
-        InstructionEntry* _i = c.AddToStream(InstructionType::Assign, output_buffer);           \
+        InstructionEntry* _i = c.AddToStream(InstructionType::Assign);          \
         _i->assignment.dst_value = _decl_index->name;                           \
         CopyOperand(_i->assignment.op1, var);                                   \
                                                                                 \
@@ -143,8 +163,7 @@
     if (var.exp_type == ExpressionType::Variable && var.index.value) {          \
         SymbolTableEntry* _decl_index = c.GetUnusedVariable(var.type);          \
                                                                                 \
-        sprintf_s(output_buffer, "%s = %s[%s]", _decl_index->name, var.value, var.index.value); \
-        InstructionEntry* _i = c.AddToStream(InstructionType::Assign, output_buffer);           \
+        InstructionEntry* _i = c.AddToStream(InstructionType::Assign);          \
         _i->assignment.dst_value = _decl_index->name;                           \
         CopyOperand(_i->assignment.op1, var);                                   \
                                                                                 \
@@ -158,18 +177,14 @@
 #define PrepareExpressionsForLogical(exp1, marker, exp2)                        \
     {                                                                           \
         if (exp1.type.base != BaseSymbolType::Bool) {                           \
-            sprintf_s(output_buffer, "if (%s != 0) goto", exp1.value);          \
             CreateIfConstWithBackpatch(exp1.true_list, CompareType::NotEqual, exp1, "0");       \
-            sprintf_s(output_buffer, "goto");                                   \
-            exp1.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer); \
+            exp1.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto);                \
                                                                                 \
             marker.ip += 2;                                                     \
         }                                                                       \
         if (exp2.type.base != BaseSymbolType::Bool) {                           \
-            sprintf_s(output_buffer, "if (%s != 0) goto", exp2.value);          \
             CreateIfConstWithBackpatch(exp2.true_list, CompareType::NotEqual, exp2, "0");       \
-            sprintf_s(output_buffer, "goto");                                   \
-            exp2.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer); \
+            exp2.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto);                \
         }                                                                       \
     }
 
@@ -178,11 +193,10 @@
     {                                                                           \
         _true_ip = c.NextIp();                                                  \
         if (exp.true_list || exp.false_list) {                                  \
-            sprintf_s(output_buffer, "%s = 1", exp.value);                      \
-            InstructionEntry* _i = c.AddToStream(InstructionType::Assign, output_buffer);   \
+            InstructionEntry* _i = c.AddToStream(InstructionType::Assign);      \
             _i->assignment.type = AssignType::None;                             \
             _i->assignment.dst_value = exp.value;                               \
-            _i->assignment.op1.value = _strdup("1");                            \
+            _i->assignment.op1.value = c.InternString("1");                     \
             _i->assignment.op1.type = { BaseSymbolType::Bool, 0 };              \
             _i->assignment.op1.exp_type = ExpressionType::Constant;             \
         }                                                                       \
@@ -208,11 +222,10 @@
     {                                                                           \
         _true_ip = c.NextIp();                                                  \
         if (exp.true_list || exp.false_list) {                                  \
-            sprintf_s(output_buffer, "%s = 1", exp.value);                      \
-            InstructionEntry* _i = c.AddToStream(InstructionType::Assign, output_buffer);   \
+            InstructionEntry* _i = c.AddToStream(InstructionType::Assign);      \
             _i->assignment.type = AssignType::None;                             \
             _i->assignment.dst_value = exp.value;                               \
-            _i->assignment.op1.value = _strdup("1");                            \
+            _i->assignment.op1.value = c.InternString("1");                     \
             _i->assignment.op1.type = { BaseSymbolType::Bool, 0 };              \
             _i->assignment.op1.exp_type = ExpressionType::Constant;             \
         }                                                                       \
@@ -237,11 +250,10 @@
         if (c.IsScopeActive(ScopeType::Assign)) {                               \
             _decl_if = c.GetUnusedVariable({ BaseSymbolType::Bool, 0 });        \
                                                                                 \
-            sprintf_s(output_buffer, "%s = 0", _decl_if->name);                 \
-            InstructionEntry* _i = c.AddToStream(InstructionType::Assign, output_buffer);   \
+            InstructionEntry* _i = c.AddToStream(InstructionType::Assign);      \
             _i->assignment.type = AssignType::None;                             \
             _i->assignment.dst_value = _decl_if->name;                          \
-            _i->assignment.op1.value = _strdup("0");                            \
+            _i->assignment.op1.value = c.InternString("0");                     \
             _i->assignment.op1.type = { BaseSymbolType::Bool, 0 };              \
             _i->assignment.op1.exp_type = ExpressionType::Constant;             \
         }                                                                       \
@@ -253,11 +265,10 @@
         if (c.IsScopeActive(ScopeType::Assign)) {                               \
             _decl_if = c.GetUnusedVariable({ BaseSymbolType::Bool, 0 });        \
                                                                                 \
-            sprintf_s(output_buffer, "%s = 0", _decl_if->name);                 \
-            InstructionEntry* _i = c.AddToStream(InstructionType::Assign, output_buffer);   \
+            InstructionEntry* _i = c.AddToStream(InstructionType::Assign);      \
             _i->assignment.type = AssignType::None;                             \
             _i->assignment.dst_value = _decl_if->name;                          \
-            _i->assignment.op1.value = _strdup("0");                            \
+            _i->assignment.op1.value = c.InternString("0");                     \
             _i->assignment.op1.type = { BaseSymbolType::Bool, 0 };              \
             _i->assignment.op1.exp_type = ExpressionType::Constant;             \
                                                                                 \
@@ -288,18 +299,100 @@ public:
 
     int OnRun(int argc, wchar_t* argv[]);
 
+    /// <summary>
+    /// Compile source code from memory buffer, the executable is written to output buffer.
+    /// Shared functions are declared only once and kept between compilations.
+    /// </summary>
+    /// <param name="source">Source code followed by two zero bytes, it's modified during compilation</param>
+    /// <param name="source_size">Size of source code in bytes</param>
+    /// <param name="target">Target platform of this compilation</param>
+    /// <param name="show_stats">Write statistics report after successful compilation</param>
+    /// <param name="output">Output buffer, its capacity is reused</param>
+    /// <returns>Exit code</returns>
+    int CompileBuffer(char* source, uint32_t source_size, TargetPlatform target, bool show_stats, std::vector<uint8_t>& output);
+
 #if defined(DEBUG_OUTPUT)
     void CreateDebugOutput();
 #endif
 
+    /// <summary>
+    /// Create text representation of instruction, it's rendered only when it's needed
+    /// </summary>
+    /// <param name="i">Instruction</param>
+    /// <returns>Text representation</returns>
+    std::string FormatInstruction(InstructionEntry* i);
+
     void ParseCompilerDirective(char* directive, std::function<bool(char* directive, char* param)> callback);
 
-    InstructionEntry* AddToStream(InstructionType type, char* code);
-    BackpatchList* AddToStreamWithBackpatch(InstructionType type, char* code);
+    InstructionEntry* AddToStream(InstructionType type);
+    BackpatchList* AddToStreamWithBackpatch(InstructionType type);
     void BackpatchStream(BackpatchList* list, int32_t new_ip);
 
     SymbolTableEntry* GetSymbols();
 
+    /// <summary>
+    /// Get cache of included files, it's kept between compilations
+    /// </summary>
+    /// <returns>Include cache</returns>
+    IncludeCache* GetIncludeCache();
+
+    /// <summary>
+    /// Get cache of emitted functions, it's kept between compilations
+    /// </summary>
+    /// <returns>Function cache; or nullptr if it's disabled for the current compilation</returns>
+    FunctionCache* GetFunctionCache();
+
+    /// <summary>
+    /// Get statistics of the current compilation
+    /// </summary>
+    /// <returns>Statistics</returns>
+    CompileStats* GetStats();
+
+    /// <summary>
+    /// Get map of profile counters, it's filled only if the program is instrumented
+    /// </summary>
+    /// <returns>Profile map</returns>
+    ProfileMap* GetProfileMap();
+
+    /// <summary>
+    /// Get DOS filename, that instrumented program writes its counters to at exit
+    /// </summary>
+    /// <returns>Filename; or nullptr if the program should not be instrumented</returns>
+    const char* GetProfileDataName();
+
+    /// <summary>
+    /// Check if the unit is compiled to object file, so the entry point is optional
+    /// and calls to functions declared only by prototype are resolved by linker
+    /// </summary>
+    /// <returns>True if executable is not created</returns>
+    bool IsCompileOnly();
+
+    /// <summary>
+    /// Get execution profile that should guide optimizations
+    /// </summary>
+    /// <returns>Loaded profile; or nullptr if no valid profile was specified</returns>
+    ProfileMap* GetProfile();
+
+    /// <summary>
+    /// Get side effects of all user functions, they are computed during post-processing
+    /// </summary>
+    /// <returns>Side effect map</returns>
+    SideEffectMap* GetSideEffects();
+
+    /// <summary>
+    /// Get points-to sets of local pointers of all user functions, they are computed during post-processing
+    /// </summary>
+    /// <returns>Points-to map</returns>
+    PointsToMap* GetPointsTo();
+
+    /// <summary>
+    /// Get copy of the string that lives until the end of the current compilation,
+    /// equal strings share the same copy
+    /// </summary>
+    /// <param name="value">String</param>
+    /// <returns>Interned string</returns>
+    char* InternString(const char* value);
+
     SymbolTableEntry* ToDeclarationList(SymbolType type, int32_t size, const char* name, ExpressionType exp_type);
     void ToParameterList(SymbolType type, const char* name);
     SymbolTableEntry* ToCallParameterList(SymbolTableEntry* queue, SymbolType type, const char* name, ExpressionType exp_type);
@@ -352,6 +445,12 @@ public:
     /// <returns>Size in bytes</returns>
     int32_t GetSymbolTypeSize(SymbolType type);
 
+    /// <summary>
+    /// Get size of pointer in bytes, it depends on target platform
+    /// </summary>
+    /// <returns>Size in bytes</returns>
+    int32_t GetPointerSize();
+
     /// <summary>
     /// Convert size (1, 2, 4, ...) to shift operand
     /// </summary>
@@ -376,11 +475,61 @@ private:
     void ReleaseDeclarationQueue();
     void ReleaseAll();
 
+    /// <summary>
+    /// Release all structures of the last compilation, but keep shared functions declared
+    /// </summary>
+    void ReleaseCompilation();
+
+    /// <summary>
+    /// Emit executable file from parsed instruction stream and symbol table
+    /// </summary>
+    /// <param name="emitter">Emitter</param>
+    void EmitExecutable(DosExeEmitter& emitter);
+
+    /// <summary>
+    /// Emit object unit from parsed instruction stream and symbol table
+    /// </summary>
+    /// <param name="emitter">Emitter</param>
+    /// <param name="unit">Object unit</param>
+    void EmitObject(DosExeEmitter& emitter, ObjectUnit& unit);
+
+    /// <summary>
+    /// Link object files to executable file
+    /// </summary>
+    /// <param name="output_filename">Path to executable file</param>
+    /// <param name="input_filenames">Paths to object files</param>
+    /// <param name="input_count">Number of object files</param>
+    /// <returns>Exit code</returns>
+    int LinkObjectFiles(const wchar_t* output_filename, wchar_t** input_filenames, int input_count);
+
+    /// <summary>
+    /// Create emitter for selected target platform
+    /// </summary>
+    /// <returns>Emitter</returns>
+    std::unique_ptr<DosExeEmitter> CreateEmitter();
+
+    /// <summary>
+    /// Write statistics of successful compilation, if they were requested
+    /// </summary>
+    void ReportStats();
+
+    /// <summary>
+    /// Show error message for exception thrown during compilation
+    /// </summary>
+    /// <param name="ex">Exception</param>
+    void ReportCompilerException(CompilerException& ex);
+
     /// <summary>
     /// Perform specific actions when the parsing is completed
     /// </summary>
     void PostprocessSymbolTable();
 
+    /// <summary>
+    /// Parse values of all constant operands in the instruction stream,
+    /// so emitters don't need to parse them again in every instruction
+    /// </summary>
+    void ResolveImmediates();
+
     /// <summary>
     /// Declare all shared functions, so they can be eventually called
     /// </summary>
@@ -390,6 +539,7 @@ private:
     InstructionEntry* instruction_stream_tail = nullptr;
     SymbolTableEntry* symbol_table = nullptr;
     SymbolTableEntry* declaration_queue = nullptr;
+    SymbolTableEntry* shared_functions_tail = nullptr;
 
     int32_t current_ip = -1;
     int32_t function_ip = 0;
@@ -409,6 +559,29 @@ private:
     int32_t continue_scope = -1;
 
     uint32_t stack_size = 0;
+
+    TargetPlatform target = TargetPlatform::Dos;
+    bool compile_only = false;
+
+    IncludeCache include_cache;
+    FunctionCache function_cache;
+    OutputCache output_cache;
+
+    CompileStats stats;
+    bool show_stats = false;
+    const wchar_t* stats_filename = nullptr;
+
+    ProfileMap profile_map;
+    bool profile_generate = false;
+    char profile_data_name[8 + 1 + 3 + 1] = "PROFILE.PRF";
+    std::wstring profile_map_filename;
+    bool profile_use = false;
+    bool profile_loaded = false;
+    std::wstring profile_data_filename;
+
+    SideEffectMap side_effects;
+    PointsToMap points_to;
+    std::unordered_set<std::string> interned_strings;
     
 };
 
@@ -419,12 +592,9 @@ template<typename T>
 T* MergeLists(T* a, T* b)
 {
     if (a && b) {
-        T* head = a;
-        while (a->next) {
-            a = a->next;
-        }
-        a->next = b;
-        return head;
+        a->tail->next = b;
+        a->tail = b->tail;
+        return a;
     }
 
     if (a && !b) {
@@ -4,6 +4,106 @@
 
 namespace i386
 {
+    uint8_t* Emitter::AllocateBufferWithPrefix(int32_t operand_size, uint32_t size)
+    {
+        if (operand_size == 1 || operand_size == default_size) {
+            return AllocateBufferForInstruction(size);
+        }
+
+        uint8_t* a = AllocateBufferForInstruction(1 + size);
+        a[0] = 0x66;    // Operand size prefix
+        return a + 1;
+    }
+
+    uint8_t* Emitter::AllocateBufferForMemoryAccess(int32_t operand_size, std::initializer_list<uint8_t> opcode, uint8_t r, CpuMemory m, uint32_t imm_size)
+    {
+        // 32-bit addressing needs SIB byte to use two registers
+        bool needs_sib = (default_size == 4 && (m == CpuMemory::StackSi || m == CpuMemory::StackDi));
+
+        uint32_t size = (uint32_t)opcode.size() + 1 + (needs_sib ? 1 : 0) + GetDisplacementSize(m) + imm_size;
+        uint8_t* a = AllocateBufferWithPrefix(operand_size, size);
+
+        for (uint8_t op : opcode) {
+            *a = op;
+            a++;
+        }
+
+        if (default_size == 2) {
+            switch (m) {
+                case CpuMemory::Stack:    *a = ToXrm(1, r, 6); break;
+                case CpuMemory::Absolute: *a = ToXrm(0, r, 6); break;
+                case CpuMemory::Si:       *a = ToXrm(0, r, 4); break;
+                case CpuMemory::Di:       *a = ToXrm(0, r, 5); break;
+                case CpuMemory::SiDisp:   *a = ToXrm(2, r, 4); break;
+                case CpuMemory::DiDisp:   *a = ToXrm(2, r, 5); break;
+                case CpuMemory::StackSi:  *a = ToXrm(1, r, 2); break;
+                case CpuMemory::StackDi:  *a = ToXrm(1, r, 3); break;
+
+                default: ThrowOnUnreachableCode();
+            }
+        } else {
+            switch (m) {
+                case CpuMemory::Stack:    *a = ToXrm(1, r, CpuRegister::BP); break;
+                case CpuMemory::Absolute: *a = ToXrm(0, r, 5); break;
+                case CpuMemory::Si:       *a = ToXrm(0, r, CpuRegister::SI); break;
+                case CpuMemory::Di:       *a = ToXrm(0, r, CpuRegister::DI); break;
+                case CpuMemory::SiDisp:   *a = ToXrm(2, r, CpuRegister::SI); break;
+                case CpuMemory::DiDisp:   *a = ToXrm(2, r, CpuRegister::DI); break;
+                case CpuMemory::StackSi:
+                case CpuMemory::StackDi: {
+                    a[0] = ToXrm(1, r, 4);
+                    a++;
+                    // SIB (ebp + esi/edi)
+                    a[0] = ToXrm(0, (m == CpuMemory::StackSi ? CpuRegister::SI : CpuRegister::DI), CpuRegister::BP);
+                    break;
+                }
+
+                default: ThrowOnUnreachableCode();
+            }
+        }
+
+        return a + 1;
+    }
+
+    int32_t Emitter::GetDisplacementSize(CpuMemory m)
+    {
+        switch (m) {
+            case CpuMemory::Stack:
+            case CpuMemory::StackSi:
+            case CpuMemory::StackDi:
+                return 1;
+
+            case CpuMemory::Absolute:
+            case CpuMemory::SiDisp:
+            case CpuMemory::DiDisp:
+                return default_size;
+
+            case CpuMemory::Si:
+            case CpuMemory::Di:
+                return 0;
+
+            default: ThrowOnUnreachableCode();
+        }
+    }
+
+    void Emitter::StoreOffset(uint8_t* ptr, int32_t value)
+    {
+        if (default_size == 2) {
+            *(int16_t*)ptr = (int16_t)value;
+        } else {
+            *(int32_t*)ptr = value;
+        }
+    }
+
+    int32_t Emitter::LoadOffset(uint8_t* ptr)
+    {
+        if (default_size == 2) {
+            return *(int16_t*)ptr;
+        } else {
+            return *(int32_t*)ptr;
+        }
+    }
+
     void Emitter::AsmMov(CpuRegister to, CpuRegister from, int32_t size)
     {
         switch (size) {
@@ -13,17 +113,11 @@ namespace i386
                 a[1] = ToXrm(3, to, from);
                 break;
             }
-            case 2: {
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x8B;    // mov r16, rm16
-                a[1] = ToXrm(3, to, from);
-                break;
-            }
+            case 2:
             case 4: {
-                uint8_t* a = AllocateBufferForInstruction(3);
-                a[0] = 0x66;    // Operand size prefix
-                a[1] = 0x8B;    // mov r32, rm32
-                a[2] = ToXrm(3, to, from);
+                uint8_t* a = AllocateBufferWithPrefix(size, 2);
+                a[0] = 0x8B;    // mov r16/32, rm16/32
+                a[1] = ToXrm(3, to, from);
                 break;
             }
 
@@ -54,17 +148,11 @@ namespace i386
                 a[1] = ToXrm(3, from, to);
                 break;
             }
-            case 2: {
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x01;    // add rm16, r16
-                a[1] = ToXrm(3, from, to);
-                break;
-            }
+            case 2:
             case 4: {
-                uint8_t* a = AllocateBufferForInstruction(3);
-                a[0] = 0x66;    // Operand size prefix
-                a[1] = 0x01;    // add rm32, r32
-                a[2] = ToXrm(3, from, to);
+                uint8_t* a = AllocateBufferWithPrefix(size, 2);
+                a[0] = 0x01;    // add rm16/32, r16/32
+                a[1] = ToXrm(3, from, to);
                 break;
             }
 
@@ -81,17 +169,11 @@ namespace i386
                 a[1] = ToXrm(3, from, to);
                 break;
             }
-            case 2: {
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x29;    // sub rm16, r16
-                a[1] = ToXrm(3, from, to);
-                break;
-            }
+            case 2:
             case 4: {
-                uint8_t* a = AllocateBufferForInstruction(3);
-                a[0] = 0x66;    // Operand size prefix
-                a[1] = 0x29;    // sub rm32, r32
-                a[2] = ToXrm(3, from, to);
+                uint8_t* a = AllocateBufferWithPrefix(size, 2);
+                a[0] = 0x29;    // sub rm16/32, r16/32
+                a[1] = ToXrm(3, from, to);
                 break;
             }
 
@@ -108,15 +190,10 @@ namespace i386
                 a[1] = ToXrm(3, 0, r);
                 break;
             }
-            case 2: {
-                uint8_t* a = AllocateBufferForInstruction(1);
-                a[0] = ToOpR(0x40, r);  // inc r16
-                break;
-            }
+            case 2:
             case 4: {
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x66;            // Operand size prefix
-                a[1] = ToOpR(0x40, r);  // inc r32
+                uint8_t* a = AllocateBufferWithPrefix(size, 1);
+                a[0] = ToOpR(0x40, r);  // inc r16/32
                 break;
             }
 
@@ -133,15 +210,10 @@ namespace i386
                 a[1] = ToXrm(3, 1, r);
                 break;
             }
-            case 2: {
-                uint8_t* a = AllocateBufferForInstruction(1);
-                a[0] = ToOpR(0x48, r);  // dec r16
-                break;
-            }
+            case 2:
             case 4: {
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x66;            // Operand size prefix
-                a[1] = ToOpR(0x48, r);  // dec r32
+                uint8_t* a = AllocateBufferWithPrefix(size, 1);
+                a[0] = ToOpR(0x48, r);  // dec r16/32
                 break;
             }
 
@@ -158,17 +230,11 @@ namespace i386
                 a[1] = ToXrm(3, from, to);
                 break;
             }
-            case 2: {
-                uint8_t* a = AllocateBufferForInstruction(2);
-                a[0] = 0x09;    // or rm16, r16
-                a[1] = ToXrm(3, from, to);
-                break;
-            }
+            case 2:
             case 4: {
-                uint8_t* a = AllocateBufferForInstruction(3);
-                a[0] = 0x66;    // Operand size prefix
-                a[1] = 0x09;    // or rm32, r32
-                a[2] = ToXrm(3, from, to);
+                uint8_t* a = AllocateBufferWithPrefix(size, 2);
+                a[0] = 0x09;    // or rm16/32, r16/32
+                a[1] = ToXrm(3, from, to);
                 break;
             }
 
@@ -178,26 +244,24 @@ namespace i386
 
     void Emitter::AsmProcEnter()
     {
-        uint8_t* a = AllocateBufferForInstruction(2 + 3);
-        a[0] = 0x66;                            // Operand size prefix
-        a[1] = ToOpR(0x50, CpuRegister::BP);    // push ebp
-        a[2] = 0x66;                            // Operand size prefix
-        a[3] = 0x8B;                            // mov r32 (ebp), rm32 (esp)
-        a[4] = ToXrm(3, CpuRegister::BP, CpuRegister::SP);
+        uint8_t* a1 = AllocateBufferWithPrefix(4, 1);
+        a1[0] = ToOpR(0x50, CpuRegister::BP);   // push ebp
+
+        uint8_t* a2 = AllocateBufferWithPrefix(4, 2);
+        a2[0] = 0x8B;                           // mov r32 (ebp), rm32 (esp)
+        a2[1] = ToXrm(3, CpuRegister::BP, CpuRegister::SP);
     }
 
     void Emitter::AsmProcLeave(uint16_t retn_imm16, bool restore_sp)
     {
         if (restore_sp) {
-            uint8_t* a1 = AllocateBufferForInstruction(3);
-            a1[0] = 0x66;                       // Operand size prefix
-            a1[1] = 0x8B;                       // mov r32 (esp), rm32 (ebp)
-            a1[2] = ToXrm(3, CpuRegister::SP, CpuRegister::BP);
+            uint8_t* a1 = AllocateBufferWithPrefix(4, 2);
+            a1[0] = 0x8B;                       // mov r32 (esp), rm32 (ebp)
+            a1[1] = ToXrm(3, CpuRegister::SP, CpuRegister::BP);
         }
 
-        uint8_t* a2 = AllocateBufferForInstruction(2);
-        a2[0] = 0x66;                           // Operand size prefix
-        a2[1] = ToOpR(0x58, CpuRegister::BP);   // pop ebp
+        uint8_t* a2 = AllocateBufferWithPrefix(4, 1);
+        a2[0] = ToOpR(0x58, CpuRegister::BP);   // pop ebp
 
         AsmProcLeaveNoArgs(retn_imm16);
     }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <initializer_list>
+
 #include "GenericEmitter.h"
 
 namespace i386
@@ -41,6 +43,20 @@ namespace i386
         GS = 5
     };
 
+    /// <summary>
+    /// Memory operands used by generated code, their encoding depends on default address size
+    /// </summary>
+    enum struct CpuMemory {
+        Stack,      // [bp + disp8]
+        Absolute,   // [disp16/32]
+        Si,         // [si]
+        Di,         // [di]
+        SiDisp,     // [si + disp16/32]
+        DiDisp,     // [di + disp16/32]
+        StackSi,    // [bp + si + disp8]
+        StackDi     // [bp + di + disp8]
+    };
+
     /// <summary>
     /// Class that emits machine code for i386 architecture
     /// </summary>
@@ -48,6 +64,54 @@ namespace i386
     {
 
     protected:
+        /// <summary>
+        /// Allocate buffer for instruction with specified operand size,
+        /// operand size prefix is emitted only if the size differs from default operand size
+        /// </summary>
+        /// <param name="operand_size">Operand size in bytes (1, 2 or 4)</param>
+        /// <param name="size">Size of the instruction without prefix</param>
+        /// <returns>Pointer to the instruction after prefix</returns>
+        uint8_t* AllocateBufferWithPrefix(int32_t operand_size, uint32_t size);
+
+        /// <summary>
+        /// Allocate buffer for instruction with memory operand, prefix, opcode, ModR/M and SIB bytes are emitted
+        /// </summary>
+        /// <param name="operand_size">Operand size in bytes (1, 2 or 4)</param>
+        /// <param name="opcode">Opcode bytes</param>
+        /// <param name="r">Register or opcode extension</param>
+        /// <param name="m">Memory operand</param>
+        /// <param name="imm_size">Size of immediate value that follows displacement</param>
+        /// <returns>Pointer to displacement</returns>
+        uint8_t* AllocateBufferForMemoryAccess(int32_t operand_size, std::initializer_list<uint8_t> opcode, uint8_t r, CpuMemory m, uint32_t imm_size = 0);
+
+        uint8_t* AllocateBufferForMemoryAccess(int32_t operand_size, std::initializer_list<uint8_t> opcode, CpuRegister r, CpuMemory m, uint32_t imm_size = 0)
+        {
+            return AllocateBufferForMemoryAccess(operand_size, opcode, (uint8_t)r, m, imm_size);
+        }
+
+        /// <summary>
+        /// Return size of displacement of specified memory operand
+        /// </summary>
+        int32_t GetDisplacementSize(CpuMemory m);
+
+        /// <summary>
+        /// Store address or relative offset with default address size
+        /// </summary>
+        void StoreOffset(uint8_t* ptr, int32_t value);
+
+        /// <summary>
+        /// Load address or relative offset with default address size
+        /// </summary>
+        int32_t LoadOffset(uint8_t* ptr);
+
+        /// <summary>
+        /// Size of saved EBP and return address, parameters start at this offset from (E)BP
+        /// </summary>
+        int32_t GetProcFrameSize()
+        {
+            return 4 + default_size;
+        }
+
         void AsmMov(CpuRegister to, CpuRegister from, int32_t size);
         void AsmMov(CpuRegister r16, CpuSegment sreg);
         void AsmMov(CpuSegment sreg, CpuRegister r16);
@@ -77,6 +141,13 @@ namespace i386
             return (uint8_t)((((uint8_t)(x) << 6) & 0xC0) | (((uint8_t)(r) << 3) & 0x38) | ((uint8_t)(m) & 0x07));
         }
 
+
+        /// <summary>
+        /// Default operand and address size of code segment in bytes,
+        /// it's 2 in 16-bit real mode and 4 in 32-bit flat protected mode
+        /// </summary>
+        int32_t default_size = 2;
+
     };
 
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <string>
+#include <unordered_map>
 
 #include "Log.h"
 #include "Compiler.h"
@@ -17,8 +18,6 @@ extern FILE* yyin;
 extern int yylineno;
 extern char* yytext;
 
-char output_buffer[500];
-
 extern Compiler c;
 
 %}
@@ -106,13 +105,14 @@ program_head
     : program
         {
             SymbolTableEntry* entry_point = c.FindSymbolByName(EntryPointName);
-            if (!entry_point) {
+            if (!entry_point && !c.IsCompileOnly()) {
                 throw CompilerException(CompilerExceptionSource::Declaration,
                     "Entry point not found");
             }
 
+            // Object unit doesn't need entry point, it's provided by another unit
             int32_t entry_ip;
-            if (entry_point->ip == 0) {
+            if (!entry_point || entry_point->ip == 0) {
                 entry_ip = 1;
             } else {
                 entry_ip = entry_point->ip;
@@ -311,8 +311,7 @@ matched_statement
             LogDebug("P: Processing void return");
 
             $$.next_list = nullptr;
-            sprintf_s(output_buffer, "return");
-            InstructionEntry* i = c.AddToStream(InstructionType::Return, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Return);
 			i->return_statement.op.type = { BaseSymbolType::None, 0 };
             i->return_statement.op.exp_type = ExpressionType::None;
         }
@@ -321,8 +320,7 @@ matched_statement
             LogDebug("P: Processing value return");
 
             $$.next_list = nullptr;
-            sprintf_s(output_buffer, "return %s", $2.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Return, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Return);
 			CopyOperand(i->return_statement.op, $2);
         }
     | WHILE continue_marker '(' assignment ')' marker break_marker matched_statement jump_marker marker
@@ -385,6 +383,7 @@ matched_statement
 
             SwitchBackpatchList* current = $8.next_list;
             SwitchBackpatchList* default_statement = nullptr;
+            std::unordered_map<std::string, uint32_t> case_lines;
 
             int32_t start_ip = c.NextIp();
 
@@ -399,8 +398,17 @@ matched_statement
 
                     default_statement = current;
                 } else {
-                    sprintf_s(output_buffer, "if (%s == %s) goto", $4.value, current->value);
-                    InstructionEntry* i = c.AddToStream(InstructionType::If, output_buffer);
+                    auto it = case_lines.emplace(current->value, current->line);
+                    if (!it.second) {
+                        std::string message = "Switch case \"";
+                        message += current->value;
+                        message += "\" was already defined at line ";
+                        message += std::to_string(it.first->second);
+                        throw CompilerException(CompilerExceptionSource::Statement,
+                            message, current->line, current->column);
+                    }
+
+                    InstructionEntry* i = c.AddToStream(InstructionType::If);
                     i->if_statement.ip = current->source_ip;
                     i->goto_ip = current->source_ip;
 
@@ -416,7 +424,7 @@ matched_statement
             }
 
             if (default_statement) {
-                InstructionEntry* i = c.AddToStream(InstructionType::Goto, "goto");
+                InstructionEntry* i = c.AddToStream(InstructionType::Goto);
                 i->goto_statement.ip = default_statement->source_ip;
                 i->goto_ip = default_statement->source_ip;
             }
@@ -432,7 +440,7 @@ matched_statement
         }
     | BREAK ';'
         {
-            BackpatchList* b = c.AddToStreamWithBackpatch(InstructionType::Goto, "goto");
+            BackpatchList* b = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             if (!c.AddToScopeList(ScopeType::Break, b)) {
                 throw CompilerException(CompilerExceptionSource::Statement,
@@ -443,7 +451,7 @@ matched_statement
         }
     | CONTINUE ';'
         {
-            BackpatchList* b = c.AddToStreamWithBackpatch(InstructionType::Goto, "goto");
+            BackpatchList* b = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             if (!c.AddToScopeList(ScopeType::Continue, b)) {
                 throw CompilerException(CompilerExceptionSource::Statement,
@@ -458,8 +466,7 @@ matched_statement
 
             $$.next_list = nullptr;
 
-            sprintf_s(output_buffer, "goto \"%s\"", $2);
-            InstructionEntry* i = c.AddToStream(InstructionType::GotoLabel, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::GotoLabel);
             i->goto_label_statement.label = $2;
         }
     | '{' statement_list '}'
@@ -568,6 +575,8 @@ default_statement
             b->source_ip = $3.ip;
             b->is_default = true;
             b->line = @1.first_line;
+            b->column = @1.first_column;
+            b->tail = b;
             $$.next_list = b;
         }
     ;
@@ -582,31 +591,22 @@ case_list
             b->value = $2.value;
             b->type = $2.type;
             b->line = @2.first_line;
+            b->column = @2.first_column;
+            b->tail = b;
             $$.next_list = b;
         }
     | case_list CASE CONSTANT ':' marker statement_list
         {
             CheckIsConstant($3, @3);
 
-            SwitchBackpatchList* prev = $1.next_list;
-            while (prev) {
-                if (strcmp($3.value, prev->value) == 0) {
-                    std::string message = "Switch case \"";
-                    message += $3.value;
-                    message += "\" was already defined at line ";
-                    message += std::to_string(prev->line);
-                    throw CompilerException(CompilerExceptionSource::Statement,
-                        message, @3.first_line, @3.first_column);
-                }
-
-                prev = prev->next;
-            }
-            
+            // Duplicate cases are checked when the whole "switch" statement is known
             SwitchBackpatchList* b = new SwitchBackpatchList();
             b->source_ip = $5.ip;
             b->value = $3.value;
             b->type = $3.type;
             b->line = @3.first_line;
+            b->column = @3.first_column;
+            b->tail = b;
             $$.next_list = MergeLists($1.next_list, b);
         }
     ;
@@ -740,12 +740,7 @@ assignment
 
 			PreAssign($4);
 
-			if ($4.index.value) {
-				sprintf_s(output_buffer, "%s = %s[%s]", $1, $4.value, $4.index.value);
-			} else {
-				sprintf_s(output_buffer, "%s = %s", $1, $4.value);
-			}
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             i->assignment.type = AssignType::None;
             i->assignment.dst_value = decl->name;
             CopyOperand(i->assignment.op1, $4);
@@ -805,12 +800,7 @@ assignment
 
 			PreAssign($7);
 
-			if ($7.index.value) {
-				sprintf_s(output_buffer, "%s[%s] = %s[%s]", $1, $3.value, $7.value, $7.index.value);
-			} else {
-				sprintf_s(output_buffer, "%s[%s] = %s", $1, $3.value, $7.value);
-			}
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             i->assignment.type = AssignType::None;
             i->assignment.dst_value = decl->name;
 			i->assignment.dst_index.value = $3.value;
@@ -861,8 +851,7 @@ assignment_with_declaration
 
             SymbolTableEntry* decl = c.ToDeclarationList($2, 0, $3, ExpressionType::Constant);
 
-            sprintf_s(output_buffer, "%s = %s", $3, $5.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             i->assignment.type = AssignType::None;
             i->assignment.dst_value = decl->name;
             CopyOperand(i->assignment.op1, $5);
@@ -890,12 +879,7 @@ assignment_with_declaration
 
             SymbolTableEntry* decl = c.ToDeclarationList($1, 0, $2, ExpressionType::None);
 
-			if ($5.index.value) {
-				sprintf_s(output_buffer, "%s = %s[%s]", $2, $5.value, $5.index.value);
-			} else {
-				sprintf_s(output_buffer, "%s = %s", $2, $5.value);
-			}
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             i->assignment.type = AssignType::None;
             i->assignment.dst_value = decl->name;
             CopyOperand(i->assignment.op1, $5);
@@ -923,8 +907,7 @@ expression
             if ($2.exp_type != ExpressionType::Variable) {
                 decl = c.GetUnusedVariable($2.type);
 
-                sprintf_s(output_buffer, "%s = %s", decl->name, $2.value);
-                InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+                InstructionEntry* i = c.AddToStream(InstructionType::Assign);
                 i->assignment.dst_value = decl->name;
                 CopyOperand(i->assignment.op1, $2);
 
@@ -935,8 +918,7 @@ expression
                 decl = nullptr;
             }
 
-            sprintf_s(output_buffer, "%s = %s + 1", $2.value, $2.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             i->assignment.type = AssignType::Add;
 			if (decl) {
 				i->assignment.dst_value = decl->name;
@@ -948,7 +930,7 @@ expression
 			}
 			CopyOperand(i->assignment.op1, $2);
 
-            i->assignment.op2.value = _strdup("1");
+            i->assignment.op2.value = c.InternString("1");
             i->assignment.op2.type = $2.type;
             i->assignment.op2.exp_type = ExpressionType::Constant;
 
@@ -967,8 +949,7 @@ expression
             if ($2.exp_type != ExpressionType::Variable) {
                 decl = c.GetUnusedVariable($2.type);
 
-                sprintf_s(output_buffer, "%s = %s", decl->name, $2.value);
-                InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+                InstructionEntry* i = c.AddToStream(InstructionType::Assign);
                 i->assignment.dst_value = decl->name;
                 CopyOperand(i->assignment.op1, $2);
 
@@ -979,8 +960,7 @@ expression
                 decl = nullptr;
             }
 
-            sprintf_s(output_buffer, "%s = %s - 1", $2.value, $2.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             i->assignment.type = AssignType::Subtract;
 			if (decl) {
 				i->assignment.dst_value = decl->name;
@@ -992,7 +972,7 @@ expression
 			}
 			CopyOperand(i->assignment.op1, $2);
 
-            i->assignment.op2.value = _strdup("1");
+            i->assignment.op2.value = c.InternString("1");
             i->assignment.op2.type = $2.type;
             i->assignment.op2.exp_type = ExpressionType::Constant;
 
@@ -1051,10 +1031,8 @@ expression
 
 			PreIf();
 
-            sprintf_s(output_buffer, "if (%s != %s) goto", $1.value, $3.value);
             CreateIfWithBackpatch($$.true_list, CompareType::NotEqual, $1, $3);
-            sprintf_s(output_buffer, "goto");
-            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             PostIf($$, $1);
         }
@@ -1073,10 +1051,8 @@ expression
 
 			PreIf();
 
-            sprintf_s(output_buffer, "if (%s == %s) goto", $1.value, $3.value);
             CreateIfWithBackpatch($$.true_list, CompareType::Equal, $1, $3);
-            sprintf_s(output_buffer, "goto");
-            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             if ($1.type.base == BaseSymbolType::Bool) {
                 $$.true_list = MergeLists($$.true_list, $1.true_list);
@@ -1102,10 +1078,8 @@ expression
 
 			PreIf();
 
-            sprintf_s(output_buffer, "if (%s >= %s) goto", $1.value, $3.value);
             CreateIfWithBackpatch($$.true_list, CompareType::GreaterOrEqual, $1, $3);
-            sprintf_s(output_buffer, "goto");
-            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             PostIf($$, $1);
         }
@@ -1122,10 +1096,8 @@ expression
 
 			PreIf();
 
-            sprintf_s(output_buffer, "if (%s <= %s) goto", $1.value, $3.value);
             CreateIfWithBackpatch($$.true_list, CompareType::LessOrEqual, $1, $3);
-            sprintf_s(output_buffer, "goto");
-            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             PostIf($$, $1);
         }
@@ -1142,10 +1114,8 @@ expression
 
 			PreIf();
 
-            sprintf_s(output_buffer, "if (%s > %s) goto", $1.value, $3.value);
             CreateIfWithBackpatch($$.true_list, CompareType::Greater, $1, $3);
-            sprintf_s(output_buffer, "goto");
-            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             PostIf($$, $1);
         }
@@ -1162,10 +1132,8 @@ expression
 
 			PreIf();
 
-            sprintf_s(output_buffer, "if (%s < %s) goto", $1.value, $3.value);
             CreateIfWithBackpatch($$.true_list, CompareType::Less, $1, $3);
-            sprintf_s(output_buffer, "goto");
-            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+            $$.false_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             PostIf($$, $1);
         }
@@ -1185,8 +1153,7 @@ expression
 
             SymbolTableEntry* decl = c.GetUnusedVariable($1.type);
 
-            sprintf_s(output_buffer, "%s = %s << %s", decl->name, $1.value, $3.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             FillInstructionForAssign(i, AssignType::ShiftLeft, decl, $1, $3);
 
             $$.value = decl->name;
@@ -1212,8 +1179,7 @@ expression
 
             SymbolTableEntry* decl = c.GetUnusedVariable($1.type);
 
-            sprintf_s(output_buffer, "%s = %s >> %s", decl->name, $1.value, $3.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             FillInstructionForAssign(i, AssignType::ShiftRight, decl, $1, $3);
 
             $$.value = decl->name;
@@ -1230,8 +1196,7 @@ expression
             
                 SymbolTableEntry* decl = c.GetUnusedVariable({ BaseSymbolType::String, 0 });
 
-                sprintf_s(output_buffer, "%s = %s + %s", decl->name, $1.value, $3.value);
-                InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+                InstructionEntry* i = c.AddToStream(InstructionType::Assign);
                 FillInstructionForAssign(i, AssignType::Add, decl, $1, $3);
 
                 $$.value = decl->name;
@@ -1271,8 +1236,7 @@ expression
 
                 SymbolTableEntry* decl = c.GetUnusedVariable(type);
 
-                sprintf_s(output_buffer, "%s = %s + %s", decl->name, $1.value, $3.value);
-                InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+                InstructionEntry* i = c.AddToStream(InstructionType::Assign);
                 FillInstructionForAssign(i, AssignType::Add, decl, $1, $3);
 
                 $$.value = decl->name;
@@ -1315,8 +1279,7 @@ expression
 
             SymbolTableEntry* decl = c.GetUnusedVariable(type);
 
-            sprintf_s(output_buffer, "%s = %s - %s", decl->name, $1.value, $3.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             FillInstructionForAssign(i, AssignType::Subtract, decl, $1, $3);
 
             $$.value = decl->name;
@@ -1345,8 +1308,7 @@ expression
 
             SymbolTableEntry* decl = c.GetUnusedVariable(type);
 
-            sprintf_s(output_buffer, "%s = %s * %s", decl->name, $1.value, $3.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             FillInstructionForAssign(i, AssignType::Multiply, decl, $1, $3);
 
             $$.value = decl->name;
@@ -1375,8 +1337,7 @@ expression
 
             SymbolTableEntry* decl = c.GetUnusedVariable(type);
 
-            sprintf_s(output_buffer, "%s = %s / %s", decl->name, $1.value, $3.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             FillInstructionForAssign(i, AssignType::Divide, decl, $1, $3);
 
             $$.value = decl->name;
@@ -1405,8 +1366,7 @@ expression
 
             SymbolTableEntry* decl = c.GetUnusedVariable(type);
 
-            sprintf_s(output_buffer, "%s = %s %% %s", decl->name, $1.value, $3.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             FillInstructionForAssign(i, AssignType::Remainder, decl, $1, $3);
 
             $$.value = decl->name;
@@ -1425,11 +1385,9 @@ expression
                 $$.true_list = $2.false_list;
                 $$.false_list = $2.true_list;
             } else if ($2.type.base == BaseSymbolType::Uint8 || $2.type.base == BaseSymbolType::Uint16 || $2.type.base == BaseSymbolType::Uint32) {
-                sprintf_s(output_buffer, "if (%s != 0) goto", $2.value);
                 CreateIfConstWithBackpatch($$.false_list, CompareType::NotEqual, $2, "0");
 
-                sprintf_s(output_buffer, "goto");
-                $$.true_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+                $$.true_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
             } else {
                 throw CompilerException(CompilerExceptionSource::Statement,
                     "Specified type is not allowed in logical operations", @1.first_line, @1.first_column);
@@ -1448,8 +1406,7 @@ expression
             SymbolTableEntry* decl = c.GetUnusedVariable($2.type);
             decl->exp_type = $2.exp_type;
 
-            sprintf_s(output_buffer, "%s = -%s", decl->name, $2.value);
-            InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+            InstructionEntry* i = c.AddToStream(InstructionType::Assign);
             i->assignment.type = AssignType::Negation;
             i->assignment.dst_value = decl->name;
 			CopyOperand(i->assignment.op1, $2);
@@ -1463,7 +1420,7 @@ expression
         {
             LogDebug("P: Processing constant");
 
-            $$.value = _strdup($1.value);
+            $$.value = $1.value;
             $$.type = $1.type;
             $$.exp_type = ExpressionType::Constant;
 			$$.index.value = nullptr;
@@ -1528,12 +1485,11 @@ expression
 			} else {
 				SymbolTableEntry* param = c.GetUnusedVariable({ BaseSymbolType::Uint32, 0 });
 
-				sprintf_s(output_buffer, "%s = %s << %u", param->name, $6.value, shift);
-				InstructionEntry* i1 = c.AddToStream(InstructionType::Assign, output_buffer);
+				InstructionEntry* i1 = c.AddToStream(InstructionType::Assign);
 				i1->assignment.type = AssignType::ShiftLeft;
 				i1->assignment.dst_value = param->name;
 				CopyOperand(i1->assignment.op1, $6);
-				i1->assignment.op2.value = _strdup(std::to_string(shift).c_str());
+				i1->assignment.op2.value = c.InternString(std::to_string(shift).c_str());
 				i1->assignment.op2.type = { BaseSymbolType::Uint8, 0 };
 				i1->assignment.op2.exp_type = ExpressionType::Constant;
 				i1->assignment.op2.index.value = nullptr;
@@ -1549,8 +1505,7 @@ expression
 			$$.index.value = nullptr;
             c.PrepareForCall(func->name, param_copy, 1);
 
-            sprintf_s(output_buffer, "%s = call %s (%d)", decl->name, func->name, 1);
-            InstructionEntry* i2 = c.AddToStream(InstructionType::Call, output_buffer);
+            InstructionEntry* i2 = c.AddToStream(InstructionType::Call);
             i2->call_statement.target = func;
             i2->call_statement.return_symbol = decl->name;
 		}
@@ -1575,8 +1530,7 @@ expression
 				$$.index.value = nullptr;
                 c.PrepareForCall(func->name, $3.list, $3.count);
 
-                sprintf_s(output_buffer, "call %s (%d)", func->name, $3.count);
-                InstructionEntry* i = c.AddToStream(InstructionType::Call, output_buffer);
+                InstructionEntry* i = c.AddToStream(InstructionType::Call);
                 i->call_statement.target = func;
             } else {
                 // Has return value
@@ -1589,8 +1543,7 @@ expression
 				$$.index.value = nullptr;
                 c.PrepareForCall(func->name, $3.list, $3.count);
 
-                sprintf_s(output_buffer, "%s = call %s (%d)", decl->name, func->name, $3.count);
-                InstructionEntry* i = c.AddToStream(InstructionType::Call, output_buffer);
+                InstructionEntry* i = c.AddToStream(InstructionType::Call);
                 i->call_statement.target = func;
                 i->call_statement.return_symbol = decl->name;
             }
@@ -1616,8 +1569,7 @@ expression
 				$$.index.value = nullptr;
                 c.PrepareForCall(func->name, nullptr, 0);
 
-                sprintf_s(output_buffer, "call %s (%d)", func->name, 0);
-                InstructionEntry* i = c.AddToStream(InstructionType::Call, output_buffer);
+                InstructionEntry* i = c.AddToStream(InstructionType::Call);
                 i->call_statement.target = func;
             } else {
                 // Has return value
@@ -1630,8 +1582,7 @@ expression
 				$$.index.value = nullptr;
                 c.PrepareForCall(func->name, nullptr, 0);
 
-                sprintf_s(output_buffer, "%s = call %s (%d)", decl->name, func->name, 0);
-                InstructionEntry* i = c.AddToStream(InstructionType::Call, output_buffer);
+                InstructionEntry* i = c.AddToStream(InstructionType::Call);
                 i->call_statement.target = func;
                 i->call_statement.return_symbol = decl->name;
             }
@@ -1653,8 +1604,7 @@ expression
 			reference_type.pointer++;
 			SymbolTableEntry* decl = c.GetUnusedVariable(reference_type);
 
-			sprintf_s(output_buffer, "%s = &(%s)", decl->name, param->name);
-			InstructionEntry* i = c.AddToStream(InstructionType::Assign, output_buffer);
+			InstructionEntry* i = c.AddToStream(InstructionType::Assign);
 			i->assignment.dst_value = decl->name;
 			i->assignment.op1.value = param->name;
 			i->assignment.op1.type = param->type;
@@ -1771,7 +1721,7 @@ id
         {
             LogDebug("P: Found identifier \"" << $1 << "\"");
 
-            $$ = _strdup(yytext);
+            $$ = _strdup($1);
         }
     ;
 
@@ -1788,8 +1738,7 @@ jump_marker
             LogDebug("P: Generating jump marker");
 
             $$.ip = c.NextIp();
-            sprintf_s(output_buffer, "goto");
-            $$.next_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+            $$.next_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
         }
     ;
 
@@ -1822,8 +1771,7 @@ switch_next
     :   {
             LogDebug("P: Generating switch next marker");
 
-            sprintf_s(output_buffer, "goto");
-            $$.next_list = c.AddToStreamWithBackpatch(InstructionType::Goto, output_buffer);
+            $$.next_list = c.AddToStreamWithBackpatch(InstructionType::Goto);
 
             $$.ip = c.NextIp();
         }